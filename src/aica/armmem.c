@@ -23,8 +23,8 @@
 #include "asic.h"
 #include "armcore.h"
 
-unsigned char aica_main_ram[2 MB];
-unsigned char aica_scratch_ram[8 KB];
+unsigned char aica_main_ram[2 MB] MEM_REGION_ALIGNED;
+unsigned char aica_scratch_ram[8 KB] MEM_REGION_ALIGNED;
 
 /*************** ARM memory access function blocks **************/
 
@@ -21,6 +21,7 @@
 #include "aica/audio.h"
 #include <glib.h>
 #include "dream.h"
+#include "gdrom/gdrom.h"
 #include <assert.h>
 #include <string.h>
 
@@ -410,6 +411,10 @@ void audio_mix_samples( int num_samples )
         }
     }
 
+    /* CD-DA comes in through the external input slots */
+    gdrom_cdda_mix( result_buf, num_samples, audio.output_rate,
+                    MMIO_READ( AICA2, CDDA_VOL_L ), MMIO_READ( AICA2, CDDA_VOL_R ) );
+
     /* Down-render to the final output format */
     audio_buffer_t buf = audio.output_buffers[audio.write_buffer];
     if( buf->status == BUFFER_FULL ) {
@@ -26,7 +26,10 @@
 #include "mem.h"
 #include "sh4/intc.h"
 #include "sh4/dmac.h"
+#include "dma.h"
 #include "sh4/sh4.h"
+#include "sh4/mmu.h"
+#include "config.h"
 #include "dreamcast.h"
 #include "maple/maple.h"
 #include "gdrom/ide.h"
@@ -60,6 +63,39 @@ struct dreamcast_module asic_module = { "ASIC", asic_init, asic_reset, NULL, asi
 #define G2_BIT0_ON_TICKS 120
 #define G2_BIT0_OFF_TICKS 420
 
+/* Approximate transfer rates used for timed DMA, in bytes per second */
+#define G2_DMA_BANDWIDTH   25000000  /* 16-bit G2 bus */
+#define PVR_DMA_BANDWIDTH  200000000 /* SH4 DMAC channel 2 to the TA/VRAM */
+#define SORT_DMA_BANDWIDTH 200000000
+#define IDE_DMA_BANDWIDTH  16000000
+
+static void g2_dma_complete( struct dma_channel *channel );
+static void pvr_dma2_complete( struct dma_channel *channel );
+static uint32_t pvr_dma_chunk( struct dma_channel *channel, uint32_t length );
+static void pvr_dma_complete( struct dma_channel *channel );
+static uint32_t sort_dma_chunk( struct dma_channel *channel, uint32_t length );
+static void sort_dma_complete( struct dma_channel *channel );
+static uint32_t ide_dma_chunk( struct dma_channel *channel, uint32_t length );
+static void ide_dma_complete( struct dma_channel *channel );
+
+static struct dma_channel g2_dma_channels[4] = {
+        { EVENT_G2_DMA0, G2_DMA_BANDWIDTH, NULL, g2_dma_complete },
+        { EVENT_G2_DMA1, G2_DMA_BANDWIDTH, NULL, g2_dma_complete },
+        { EVENT_G2_DMA2, G2_DMA_BANDWIDTH, NULL, g2_dma_complete },
+        { EVENT_G2_DMA3, G2_DMA_BANDWIDTH, NULL, g2_dma_complete } };
+static struct dma_channel pvr_dma2_channel = 
+        { EVENT_PVR_DMA2, G2_DMA_BANDWIDTH, NULL, pvr_dma2_complete };
+static struct dma_channel pvr_dma_channel = 
+        { EVENT_PVR_DMA, PVR_DMA_BANDWIDTH, pvr_dma_chunk, pvr_dma_complete };
+static struct dma_channel sort_dma_channel = 
+        { EVENT_SORT_DMA, SORT_DMA_BANDWIDTH, sort_dma_chunk, sort_dma_complete };
+static struct dma_channel ide_dma_channel = 
+        { EVENT_IDE_DMA, IDE_DMA_BANDWIDTH, ide_dma_chunk, ide_dma_complete };
+
+static struct dma_channel *asic_dma_channels[] = {
+        &g2_dma_channels[0], &g2_dma_channels[1], &g2_dma_channels[2], &g2_dma_channels[3],
+        &pvr_dma2_channel, &pvr_dma_channel, &sort_dma_channel, &ide_dma_channel, NULL };
+
 struct asic_g2_state {
     int bit5_off_timer;
     int bit4_on_timer;
@@ -106,27 +142,45 @@ static uint32_t asic_run_slice( uint32_t nanosecs )
 
 static void asic_init( void )
 {
+    int i;
     register_io_region( &mmio_region_ASIC );
     register_io_region( &mmio_region_EXTDMA );
+    for( i=0; asic_dma_channels[i] != NULL; i++ ) {
+        dma_channel_init( asic_dma_channels[i] );
+    }
+    dma_set_timed( lxdream_get_config_boolean_value( lxdream_get_config_group(CONFIG_GROUP_GLOBAL),
+                                                     CONFIG_TIMED_DMA ) );
     asic_reset();
 }
 
 static void asic_reset( void )
 {
+    int i;
     memset( &g2_state, 0xFF, sizeof(g2_state) );
+    for( i=0; asic_dma_channels[i] != NULL; i++ ) {
+        dma_channel_cancel( asic_dma_channels[i] );
+    }
 }    
 
 static void asic_save_state( FILE *f )
 {
+    int i;
     fwrite( &g2_state, sizeof(g2_state), 1, f );
+    for( i=0; asic_dma_channels[i] != NULL; i++ ) {
+        dma_channel_save_state( asic_dma_channels[i], f );
+    }
 }
 
 static int asic_load_state( FILE *f )
 {
+    int i;
     if( fread( &g2_state, sizeof(g2_state), 1, f ) != 1 )
         return 1;
-    else
-        return 0;
+    for( i=0; asic_dma_channels[i] != NULL; i++ ) {
+        if( dma_channel_load_state( asic_dma_channels[i], f ) != 0 )
+            return 1;
+    }
+    return 0;
 }
 
 
@@ -292,70 +346,121 @@ void g2_dma_transfer( int channel )
 
     if( MMIO_READ( EXTDMA, G2DMA0CTL1 + offset ) == 1 ) {
         if( MMIO_READ( EXTDMA, G2DMA0CTL2 + offset ) == 1 ) {
+            if( dma_channel_is_active( &g2_dma_channels[channel] ) ) {
+                return; /* Already running */
+            }
             uint32_t extaddr = MMIO_READ( EXTDMA, G2DMA0EXT + offset );
             uint32_t sh4addr = MMIO_READ( EXTDMA, G2DMA0SH4 + offset );
             uint32_t length = MMIO_READ( EXTDMA, G2DMA0SIZ + offset ) & 0x1FFFFFFF;
             uint32_t dir = MMIO_READ( EXTDMA, G2DMA0DIR + offset );
             // uint32_t mode = MMIO_READ( EXTDMA, G2DMA0MOD + offset );
-            unsigned char buf[length];
             if( dir == 0 ) { /* SH4 to device */
-                mem_copy_from_sh4( buf, sh4addr, length );
-                mem_copy_to_sh4( extaddr, buf, length );
+                dma_channel_start( &g2_dma_channels[channel], extaddr, sh4addr, length );
             } else { /* Device to SH4 */
-                mem_copy_from_sh4( buf, extaddr, length );
-                mem_copy_to_sh4( sh4addr, buf, length );
+                dma_channel_start( &g2_dma_channels[channel], sh4addr, extaddr, length );
             }
-            MMIO_WRITE( EXTDMA, G2DMA0CTL2 + offset, 0 );
-            asic_event( EVENT_G2_DMA0 + channel );
         } else {
+            dma_channel_cancel( &g2_dma_channels[channel] );
             MMIO_WRITE( EXTDMA, G2DMA0CTL2 + offset, 0 );
         }
     }
 }
 
+static void g2_dma_complete( struct dma_channel *dma )
+{
+    int channel = dma - g2_dma_channels;
+    MMIO_WRITE( EXTDMA, G2DMA0CTL2 + (channel << 5), 0 );
+    asic_event( EVENT_G2_DMA0 + channel );
+}
+
 void asic_ide_dma_transfer( )
 {	
     if( MMIO_READ( EXTDMA, IDEDMACTL2 ) == 1 ) {
         if( MMIO_READ( EXTDMA, IDEDMACTL1 ) == 1 ) {
+            if( dma_channel_is_active( &ide_dma_channel ) ) {
+                return;
+            }
             MMIO_WRITE( EXTDMA, IDEDMATXSIZ, 0 );
 
             uint32_t addr = MMIO_READ( EXTDMA, IDEDMASH4 );
             uint32_t length = MMIO_READ( EXTDMA, IDEDMASIZ );
             // int dir = MMIO_READ( EXTDMA, IDEDMADIR );
 
-            uint32_t xfer = ide_read_data_dma( addr, length );
-            MMIO_WRITE( EXTDMA, IDEDMATXSIZ, xfer );
-            MMIO_WRITE( EXTDMA, IDEDMACTL2, 0 );
-            asic_event( EVENT_IDE_DMA );            
+            dma_channel_start( &ide_dma_channel, addr, 0, length );
         } else { /* 0 */
+            dma_channel_cancel( &ide_dma_channel );
             MMIO_WRITE( EXTDMA, IDEDMACTL2, 0 );
         }
     }
 }
 
+static uint32_t ide_dma_chunk( struct dma_channel *channel, uint32_t length )
+{
+    uint32_t xfer = ide_read_data_dma( channel->destaddr, length );
+    channel->destaddr += xfer;
+    MMIO_WRITE( EXTDMA, IDEDMATXSIZ, MMIO_READ( EXTDMA, IDEDMATXSIZ ) + xfer );
+    return xfer;
+}
+
+static void ide_dma_complete( struct dma_channel *channel )
+{
+    MMIO_WRITE( EXTDMA, IDEDMACTL2, 0 );
+    asic_event( EVENT_IDE_DMA );            
+}
+
 void pvr_dma_transfer( )
 {
     sh4addr_t destaddr = MMIO_READ( ASIC, PVRDMADEST) &0x1FFFFFE0;
     uint32_t count = MMIO_READ( ASIC, PVRDMACNT );
+
+    if( !dma_channel_is_active( &pvr_dma_channel ) ) {
+        dma_channel_start( &pvr_dma_channel, destaddr, 0, count );
+    }
+}
+
+static uint32_t pvr_dma_chunk( struct dma_channel *channel, uint32_t length )
+{
     unsigned char data[8192];
+    uint32_t count = length;
     uint32_t rcount;
 
     while( count ) {
-        uint32_t chunksize = (count < 8192) ? count : 8192;
+        uint32_t chunksize;
+        sh4addr_t srcaddr;
+
+        /* Normally the whole chunk can be read straight from memory */
+        rcount = DMAC_get_source( 2, count, &srcaddr );
+        if( rcount != 0 ) {
+            dma_copy( channel->destaddr, srcaddr, rcount );
+            channel->destaddr += rcount;
+            if( rcount < count ) {
+                WARN( "PVR received %08X bytes from DMA, expected %08X", rcount, count );
+                count -= rcount;
+                break;
+            }
+            count -= rcount;
+            continue;
+        }
+
+        chunksize = (count < 8192) ? count : 8192;
         rcount = DMAC_get_buffer( 2, data, chunksize );
-        pvr2_dma_write( destaddr, data, rcount );
-        destaddr += rcount;
+        pvr2_dma_write( channel->destaddr, data, rcount );
+        channel->destaddr += rcount;
         count -= rcount;
         if( rcount != chunksize ) {
             WARN( "PVR received %08X bytes from DMA, expected %08X", rcount, chunksize );
             break;
         }
     }
+    return length - count;
+}
 
+static void pvr_dma_complete( struct dma_channel *channel )
+{
     MMIO_WRITE( ASIC, PVRDMACTL, 0 );
     MMIO_WRITE( ASIC, PVRDMACNT, 0 );
-    if( destaddr & 0x01000000 ) { /* Write to texture RAM */
-        MMIO_WRITE( ASIC, PVRDMADEST, destaddr );
+    if( channel->destaddr & 0x01000000 ) { /* Write to texture RAM */
+        MMIO_WRITE( ASIC, PVRDMADEST, channel->destaddr );
     }
     asic_event( EVENT_PVR_DMA );
 }
@@ -364,24 +469,30 @@ void pvr_dma2_transfer()
 {
     if( MMIO_READ( EXTDMA, PVRDMA2CTL2 ) == 1 ) {
         if( MMIO_READ( EXTDMA, PVRDMA2CTL1 ) == 1 ) {
+            if( dma_channel_is_active( &pvr_dma2_channel ) ) {
+                return;
+            }
             sh4addr_t extaddr = MMIO_READ( EXTDMA, PVRDMA2EXT );
             sh4addr_t sh4addr = MMIO_READ( EXTDMA, PVRDMA2SH4 );
             int dir = MMIO_READ( EXTDMA, PVRDMA2DIR );
             uint32_t length = MMIO_READ( EXTDMA, PVRDMA2SIZ );
-            unsigned char buf[length];
             if( dir == 0 ) { /* SH4 to PVR */
-                mem_copy_from_sh4( buf, sh4addr, length );
-                mem_copy_to_sh4( extaddr, buf, length );
+                dma_channel_start( &pvr_dma2_channel, extaddr, sh4addr, length );
             } else { /* PVR to SH4 */
-                mem_copy_from_sh4( buf, extaddr, length );
-                mem_copy_to_sh4( sh4addr, buf, length );
+                dma_channel_start( &pvr_dma2_channel, sh4addr, extaddr, length );
             }
-            MMIO_WRITE( EXTDMA, PVRDMA2CTL2, 0 );
-            asic_event( EVENT_PVR_DMA2 );
         }
+    } else {
+        dma_channel_cancel( &pvr_dma2_channel );
     }
 }
 
+static void pvr_dma2_complete( struct dma_channel *channel )
+{
+    MMIO_WRITE( EXTDMA, PVRDMA2CTL2, 0 );
+    asic_event( EVENT_PVR_DMA2 );
+}
+
 void sort_dma_transfer( )
 {
     sh4addr_t table_addr = MMIO_READ( ASIC, SORTDMATBL );
@@ -389,6 +500,11 @@ void sort_dma_transfer( )
     int table_size = MMIO_READ( ASIC, SORTDMATSIZ );
     int addr_shift = MMIO_READ( ASIC, SORTDMAASIZ ) ? 5 : 0;
     int count = 1;
+    uint32_t total = 0;
+
+    if( dma_channel_is_active( &sort_dma_channel ) ) {
+        return;
+    }
 
     uint32_t *table32 = (uint32_t *)mem_get_region( table_addr );
     uint16_t *table16 = (uint16_t *)table32;
@@ -400,8 +516,11 @@ void sort_dma_transfer( )
             count++;
             continue;
         } else if( next == 2 ) {
-            asic_event( EVENT_SORT_DMA );
-            break;
+            /* The data has already been sent to the TA, but in timed mode the
+             * completion is delayed by the time it would have taken to read */
+            MMIO_WRITE( ASIC, SORTDMACNT, count );
+            dma_channel_start( &sort_dma_channel, 0, 0, total );
+            return;
         } 
         uint32_t *data = (uint32_t *)mem_get_region(data_addr + (next<<addr_shift));
         if( data == NULL ) {
@@ -418,13 +537,25 @@ void sort_dma_transfer( )
             size = 0x100;
         }
         next = poly[7];
-        pvr2_ta_write( (unsigned char *)data, size<<5 );
+        pvr2_ta_write_bulk( (unsigned char *)data, size<<5 );
+        total += size<<5;
     }
 
     MMIO_WRITE( ASIC, SORTDMACNT, count );
     MMIO_WRITE( ASIC, SORTDMACTL, 0 );
 }
 
+static uint32_t sort_dma_chunk( struct dma_channel *channel, uint32_t length )
+{
+    return length;
+}
+
+static void sort_dma_complete( struct dma_channel *channel )
+{
+    MMIO_WRITE( ASIC, SORTDMACTL, 0 );
+    asic_event( EVENT_SORT_DMA );
+}
+
 void maple_set_dma_state( uint32_t val )
 {
     gboolean in_transfer = MMIO_READ( ASIC, MAPLE_STATE ) & 1;
@@ -451,6 +582,7 @@ gboolean asic_enable_ide_interface( gboolean enable )
 MMIO_REGION_READ_FN( ASIC, reg )
 {
     int32_t val;
+    ccn_storequeue_flush();
     reg &= 0xFFF;
     switch( reg ) {
     case PIRQ0:
@@ -481,6 +613,7 @@ MMIO_REGION_READ_DEFSUBFNS(ASIC)
 
 MMIO_REGION_WRITE_FN( ASIC, reg, val )
 {
+    ccn_storequeue_flush();
     reg &= 0xFFF;
     switch( reg ) {
     case PIRQ1:
@@ -24,7 +24,8 @@
 #include "bootstrap.h"
 #include "sh4/sh4.h"
 #include "drivers/cdrom/cdrom.h"
-#include "drivers/cdrom/isofs.h"
+#include "drivers/cdrom/isoindex.h"
+#include "dma.h"
 #include "gdrom/gdrom.h"
 
 gboolean bios_boot_gdrom_disc( void );
@@ -53,6 +54,9 @@ gboolean bios_boot_gdrom_disc( void );
 #define GD_CMD_STATUS_ABORT  3
 #define GD_CMD_STATUS_ERROR  4
 
+#define GD_SECTOR_SIZE 2048  /* readcd always reads mode 2 form 1 data */
+#define GD_MAX_READ_SIZE 0x01000000
+
 #define GD_ERROR_OK          0
 #define GD_ERROR_NO_DISC     2
 #define GD_ERROR_DISC_CHANGE 6
@@ -104,6 +108,35 @@ void bios_gdrom_init( void )
     memset( &gdrom_cmd_queue, 0, sizeof(gdrom_cmd_queue) );
 }
 
+/**
+ * Read sectors for a readcd command. The sectors are read (through the
+ * GD-Rom sector cache) straight into guest memory where the buffer is
+ * ordinary RAM, otherwise bounced through a temporary buffer.
+ */
+static cdrom_error_t bios_gdrom_read( cdrom_lba_t lba, cdrom_count_t count, sh4addr_t buffer )
+{
+    uint32_t length = count * GD_SECTOR_SIZE;
+    cdrom_error_t status;
+    unsigned char *tmp;
+    size_t len = 0;
+    sh4ptr_t dest;
+
+    if( count == 0 || count > GD_MAX_READ_SIZE / GD_SECTOR_SIZE ) {
+        return CDROM_ERROR_BADFIELD;
+    }
+    dest = dma_get_write_buffer( buffer, length );
+    if( dest != NULL ) {
+        return gdrom_read_cd( lba, count, 0x28, dest, NULL );
+    }
+    tmp = g_malloc( length );
+    status = gdrom_read_cd( lba, count, 0x28, tmp, &len );
+    if( status == CDROM_ERROR_OK ) {
+        dma_write( buffer, tmp, len );
+    }
+    g_free( tmp );
+    return status;
+}
+
 void bios_gdrom_run_command( gdrom_queue_entry_t cmd )
 {
     DEBUG( "BIOS GD command %d", cmd->cmd_code );
@@ -130,9 +163,8 @@ void bios_gdrom_run_command( gdrom_queue_entry_t cmd )
         break;
     case GD_CMD_PIOREAD:
     case GD_CMD_DMAREAD:
-        ptr = mem_get_region( cmd->params.readcd.buffer );
-        status = gdrom_read_cd( cmd->params.readcd.lba,
-                cmd->params.readcd.count, 0x28, ptr, NULL );
+        status = bios_gdrom_read( cmd->params.readcd.lba, cmd->params.readcd.count,
+                cmd->params.readcd.buffer );
         break;
     default:
         WARN( "Unknown BIOS GD command %d\n", cmd->cmd_code );
@@ -386,54 +418,50 @@ void bios_install( void )
 
 #define MIN_ISO_SECTORS 32
 
-static gboolean bios_load_ipl( cdrom_disc_t disc, cdrom_track_t track, const char *program_name,
-                               unsigned char *buffer, gboolean unscramble )
+static gboolean bios_load_ipl( cdrom_disc_t disc, const char *program_name,
+                               sh4addr_t load_addr, gboolean unscramble )
 {
-    gboolean rv = TRUE;
+    iso_path_index_t index = gdrom_get_boot_index();
+    cdrom_error_t status;
+    cdrom_count_t count;
+    cdrom_lba_t lba;
+    uint32_t size;
+    size_t len = 0;
+    sh4ptr_t dest;
 
-    IsoImageFilesystem *iso = iso_filesystem_new_from_track( disc, track, NULL );
-    if( iso == NULL ) {
+    if( index == NULL ) {
         ERROR( "Disc is not bootable (invalid ISO9660 filesystem)" );
         return FALSE;
     }
-    IsoFileSource *file = NULL;
-    int status = iso->get_by_path(iso, program_name, &file );
-    if( status != 1 ) {
+    if( !iso_path_index_lookup( index, program_name, &lba, &size ) ) {
         ERROR( "Disc is not bootable (initial program '%s' not found)", program_name );
-        iso_filesystem_unref(iso);
         return FALSE;
     }
 
-    struct stat st;
-    if( iso_file_source_stat(file, &st) == 1 ) {
-        if( st.st_size > (0x8D000000 - BINARY_LOAD_ADDR) ) {
-            ERROR( "Disc is not bootable (Initial program is too large to fit into memory)" );
-            rv = FALSE;
-        } else if( iso_file_source_open(file) == 1 ) {
-            size_t len;
-            if( unscramble ) {
-                unsigned char *tmp = g_malloc(st.st_size);
-                len = iso_file_source_read(file, tmp, st.st_size);
-                bootprogram_unscramble(buffer, tmp, st.st_size);
-                g_free(tmp);
-            } else {
-                len = iso_file_source_read(file, buffer, st.st_size);
-            }
+    /* Whole sectors are read, as the real BIOS does */
+    count = (size + GD_SECTOR_SIZE - 1) / GD_SECTOR_SIZE;
+    dest = dma_get_write_buffer( load_addr, count * GD_SECTOR_SIZE );
+    if( count * GD_SECTOR_SIZE > BINARY_MAX_SIZE || dest == NULL ) {
+        ERROR( "Disc is not bootable (Initial program is too large to fit into memory)" );
+        return FALSE;
+    }
 
-            if( len != st.st_size ) {
-                ERROR( "Disc is not bootable (Unable to read initial program '%s')", program_name );
-                rv = FALSE;
-            }
-            iso_file_source_close(file);
+    if( unscramble ) {
+        unsigned char *tmp = g_malloc( count * GD_SECTOR_SIZE );
+        status = gdrom_cache_read( disc, lba, count, CDROM_READ_MODE2_FORM1|CDROM_READ_DATA, tmp, &len );
+        if( status == CDROM_ERROR_OK && len >= size ) {
+            bootprogram_unscramble( dest, tmp, size );
         }
+        g_free( tmp );
     } else {
-        ERROR( "Disc is not bootable (Unable to get size of initial program '%s')", program_name );
-        rv = FALSE;
+        /* Straight into guest memory */
+        status = gdrom_cache_read( disc, lba, count, CDROM_READ_MODE2_FORM1|CDROM_READ_DATA, dest, &len );
     }
-
-    iso_file_source_unref(file);
-    iso_filesystem_unref(iso);
-    return rv;
+    if( status != CDROM_ERROR_OK || len < size ) {
+        ERROR( "Disc is not bootable (Unable to read initial program '%s')", program_name );
+        return FALSE;
+    }
+    return TRUE;
 }
 
 gboolean bios_boot_gdrom_disc( void )
@@ -459,8 +487,8 @@ gboolean bios_boot_gdrom_disc( void )
     }
     /* Load the initial bootstrap into DC ram at 8c008000 */
     size_t length = BOOTSTRAP_SIZE;
-    unsigned char *bootstrap = mem_get_region(BOOTSTRAP_LOAD_ADDR);
-    if( cdrom_disc_read_sectors( disc, track->lba, BOOTSTRAP_SIZE/2048,
+    unsigned char *bootstrap = dma_get_write_buffer(BOOTSTRAP_LOAD_ADDR, BOOTSTRAP_SIZE);
+    if( gdrom_cache_read( disc, track->lba, BOOTSTRAP_SIZE/GD_SECTOR_SIZE,
             CDROM_READ_DATA|CDROM_READ_MODE2_FORM1, bootstrap, &length ) !=
             CDROM_ERROR_OK ) {
         ERROR( "Disc is not bootable" );
@@ -483,9 +511,8 @@ gboolean bios_boot_gdrom_disc( void )
     }
 
     /* Bootstrap is good. Now find the program in the actual filesystem... */
-    unsigned char *program = mem_get_region(BINARY_LOAD_ADDR);
     gboolean isGDROM = (disc->disc_type == CDROM_DISC_GDROM );
-    if( !bios_load_ipl( disc, track, program_name, program, !isGDROM ) )
+    if( !bios_load_ipl( disc, program_name, BINARY_LOAD_ADDR, !isGDROM ) )
         return FALSE;
     asic_enable_ide_interface(isGDROM);
     dreamcast_program_loaded( "", BOOTSTRAP_ENTRY_ADDR );
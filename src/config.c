@@ -51,6 +51,11 @@ static struct lxdream_config_group global_group =
         { "recent", NULL, CONFIG_TYPE_FILELIST, NULL },
         { "vmu", NULL, CONFIG_TYPE_FILELIST, NULL },
         { "quick state", NULL, CONFIG_TYPE_INTEGER, "0" },
+        { "timed dma", N_("Timed DMA transfers"), CONFIG_TYPE_BOOLEAN, "false" },
+        { "fastmem", N_("Direct memory access from translated code"), CONFIG_TYPE_BOOLEAN, "false" },
+        { "render thread", N_("Render scenes on a separate thread"), CONFIG_TYPE_BOOLEAN, "false" },
+        { "raw sector cache", N_("Cache generated raw CD sectors"), CONFIG_TYPE_BOOLEAN, "false" },
+        { "gdrom timing", N_("GD-Rom drive timing (max, realistic or adaptive)"), CONFIG_TYPE_STRING, "max" },
         { NULL, CONFIG_TYPE_NONE }} };
 
 /**
@@ -153,17 +158,22 @@ const gchar *lxdream_get_config_value( lxdream_config_group_t group, int key )
     return group->params[key].value;
 }
 
-gboolean lxdream_get_config_boolean_value( lxdream_config_group_t group, int key )
+gboolean lxdream_parse_boolean_value( const gchar *value )
 {
-    const gchar *value = lxdream_get_config_value(group, key);
-    if( strcasecmp(value, "on") == 0 || strcasecmp(value, "true") == 0 ||
-        strcasecmp(value, "yes") == 0 || strcasecmp(value, "1") == 0 ) {
+    if( value != NULL && 
+        (strcasecmp(value, "on") == 0 || strcasecmp(value, "true") == 0 ||
+         strcasecmp(value, "yes") == 0 || strcasecmp(value, "1") == 0) ) {
         return TRUE;
     } else {
         return FALSE;
     }
 }
 
+gboolean lxdream_get_config_boolean_value( lxdream_config_group_t group, int key )
+{
+    return lxdream_parse_boolean_value( lxdream_get_config_value(group, key) );
+}
+
 gboolean lxdream_set_config_boolean_value( lxdream_config_group_t group, int key, gboolean value )
 {
     return lxdream_set_config_value(group, key, value ? "on" : "off");
@@ -36,6 +36,7 @@ extern "C" {
 #define CONFIG_TYPE_FILELIST 4
 #define CONFIG_TYPE_INTEGER 5
 #define CONFIG_TYPE_BOOLEAN 6
+#define CONFIG_TYPE_STRING 7
 
 #define DEFAULT_CONFIG_FILENAME "lxdreamrc"
 
@@ -80,7 +81,12 @@ typedef struct lxdream_config_group {
 #define CONFIG_RECENT 7
 #define CONFIG_VMU 8
 #define CONFIG_QUICK_STATE 9
-#define CONFIG_KEY_MAX CONFIG_QUICK_STATE
+#define CONFIG_TIMED_DMA 10
+#define CONFIG_FASTMEM 11
+#define CONFIG_RENDER_THREAD 12
+#define CONFIG_RAW_SECTOR_CACHE 13
+#define CONFIG_GDROM_TIMING 14
+#define CONFIG_KEY_MAX CONFIG_GDROM_TIMING
 
 #define CONFIG_GROUP_GLOBAL 0
 #define CONFIG_GROUP_HOTKEYS 2
@@ -98,6 +104,11 @@ void lxdream_copy_config_group( lxdream_config_group_t dest, lxdream_config_grou
 void lxdream_clone_config_group( lxdream_config_group_t dest, lxdream_config_group_t src );
 
 gboolean lxdream_get_config_boolean_value( lxdream_config_group_t group, int key );
+/**
+ * @return TRUE if the string is one of the recognized true values (on, true,
+ * yes, or 1), otherwise FALSE.
+ */
+gboolean lxdream_parse_boolean_value( const gchar *value );
 gboolean lxdream_set_config_boolean_value( lxdream_config_group_t group, int key, gboolean value );
 
 /**
@@ -36,6 +36,7 @@ display_driver_t display_driver_list[] = {
 #ifdef __ANDROID__
         &display_egl_driver,
 #endif
+        &display_sw_driver,
         &display_null_driver,
         NULL };
 
@@ -580,6 +581,7 @@ display_driver_t get_display_driver_by_name( const char *name )
 gboolean display_set_driver( display_driver_t driver )
 {
     gboolean rv = TRUE;
+    pvr2_render_thread_shutdown();
     if( display_driver != NULL && display_driver->shutdown_driver != NULL ) 
         display_driver->shutdown_driver();
 
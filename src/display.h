@@ -91,6 +91,9 @@ struct render_buffer {
                        * The render buffer does not own the texture */
     unsigned int buf_id; /* driver-specific buffer id, if applicable */
     gboolean flushed; /* True if the buffer has been flushed to vram */
+    unsigned int pbo_id; /* driver-specific async readback buffer, if applicable */
+    gboolean readback_pending; /* True if pbo_id holds a readback of the current contents */
+    uint32_t readback_format; /* Colour format of the pending readback */
 };
 
 /**
@@ -257,6 +260,21 @@ typedef struct display_driver {
     gboolean (*read_render_buffer)( unsigned char *target, render_buffer_t buffer,
             int rowstride, int format );
 
+    /**
+     * Start an asynchronous copy of the render buffer contents into driver
+     * memory, so that a following read_render_buffer() with the same rowstride
+     * and format can complete without stalling on the GPU. Rendering into the
+     * buffer again discards the copy. May be NULL if not supported.
+     */
+    void (*start_read_render_buffer)( render_buffer_t buffer, int rowstride, int format );
+
+    /**
+     * Make the driver's GL context current on the calling thread, or release
+     * it from the calling thread if current is FALSE, so that rendering can
+     * be handed over to another thread. May be NULL if not supported.
+     */
+    gboolean (*set_context_current)( gboolean current );
+
     /**
      * Create a new vertex buffer
      */
@@ -287,6 +305,7 @@ extern struct display_driver display_osx_driver;
 extern struct display_driver display_gl_driver;
 extern struct display_driver display_egl_driver;
 extern struct display_driver display_null_driver;
+extern struct display_driver display_sw_driver;
 
 /****************** Input methods **********************/
 
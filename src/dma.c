@@ -0,0 +1,301 @@
+/**
+ * $Id$
+ *
+ * Common block transfer engine for the G2, PVR and IDE DMA channels.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include "dream.h"
+#include "mem.h"
+#include "mmio.h"
+#include "dma.h"
+#include "eventq.h"
+#include "pvr2/pvr2.h"
+#include "xlat/xltcache.h"
+
+#define DMA_IS_TA(addr)     (((addr) & 0x1C000000) == 0x10000000)
+#define DMA_IS_VRAM64(addr) (((addr) & 0x1F000000) == 0x04000000)
+#define DMA_IS_VRAM32(addr) (((addr) & 0x1F800000) == 0x05000000)
+
+#define DMA_VRAM64_SIZE 0x00800000
+#define DMA_BOUNCE_SIZE 4096
+
+/* Length of each step of a timed transfer */
+#define DMA_STEP_NANOSECS 100000
+
+static gboolean dma_timed = FALSE;
+static struct dma_channel *dma_channels[MAX_EVENT_ID];
+
+/**
+ * Resolve addr to a span of contiguous host memory, of at most count bytes.
+ * @return the length of the span, or 0 if addr is not backed by memory.
+ */
+static uint32_t dma_get_span( sh4addr_t addr, uint32_t count, sh4ptr_t *span )
+{
+    sh4ptr_t start = mem_get_region( addr );
+    uint32_t len;
+
+    if( start == NULL ) {
+        return 0;
+    }
+    len = LXDREAM_PAGE_SIZE - (addr & (LXDREAM_PAGE_SIZE-1));
+    while( len < count && mem_get_region( addr + len ) == start + len ) {
+        len += LXDREAM_PAGE_SIZE;
+    }
+    *span = start;
+    return len < count ? len : count;
+}
+
+/**
+ * Invalidate anything that may be caching the contents of the destination
+ * range. Called once per transfer rather than once per span.
+ */
+static void dma_invalidate( sh4addr_t destaddr, uint32_t count )
+{
+    if( DMA_IS_TA(destaddr) || DMA_IS_VRAM64(destaddr) ) {
+        /* Texture cache invalidation is handled by the PVR2 write */
+        return;
+    }
+    if( DMA_IS_VRAM32(destaddr) ) {
+        pvr2_render_buffer_invalidate( destaddr, TRUE );
+    }
+    xlat_invalidate_block( destaddr, count );
+}
+
+/**
+ * Write as much of the host buffer to destaddr as will go in one operation.
+ * @return the number of bytes written, or 0 if destaddr is not writable.
+ */
+static uint32_t dma_write_span( sh4addr_t destaddr, unsigned char *src, uint32_t count )
+{
+    sh4ptr_t dest;
+    uint32_t len;
+
+    if( DMA_IS_TA(destaddr) ) {
+        pvr2_dma_write( destaddr, src, count );
+        return count;
+    } else if( DMA_IS_VRAM64(destaddr) ) {
+        pvr2_vram64_write( destaddr, src, count );
+        return count;
+    }
+
+    len = dma_get_span( destaddr, count, &dest );
+    if( len == 0 ) {
+        WARN( "Attempted DMA write to unknown address %08X", destaddr );
+    } else {
+        memcpy( dest, src, len );
+    }
+    return len;
+}
+
+/**
+ * Read from 64-bit VRAM into destaddr. This can go straight into ordinary
+ * memory, but has to bounce through a small buffer for anything else.
+ * @return the number of bytes transferred.
+ */
+static uint32_t dma_read_vram64( sh4addr_t destaddr, sh4addr_t srcaddr, uint32_t count )
+{
+    uint32_t remain = DMA_VRAM64_SIZE - (srcaddr & (DMA_VRAM64_SIZE-1));
+    sh4ptr_t dest;
+    uint32_t len;
+
+    if( count > remain ) {
+        count = remain;
+    }
+    if( !DMA_IS_TA(destaddr) && !DMA_IS_VRAM64(destaddr) ) {
+        len = dma_get_span( destaddr, count, &dest );
+        if( len == 0 ) {
+            WARN( "Attempted DMA write to unknown address %08X", destaddr );
+        } else {
+            pvr2_vram64_read( dest, srcaddr, len );
+        }
+        return len;
+    } else {
+        unsigned char tmp[DMA_BOUNCE_SIZE];
+        if( count > DMA_BOUNCE_SIZE ) {
+            count = DMA_BOUNCE_SIZE;
+        }
+        pvr2_vram64_read( tmp, srcaddr, count );
+        return dma_write_span( destaddr, tmp, count );
+    }
+}
+
+void dma_copy( sh4addr_t destaddr, sh4addr_t srcaddr, uint32_t length )
+{
+    dma_invalidate( destaddr, length );
+    while( length > 0 ) {
+        sh4ptr_t src;
+        uint32_t len;
+
+        if( DMA_IS_VRAM64(srcaddr) ) {
+            len = dma_read_vram64( destaddr, srcaddr, length );
+        } else {
+            len = dma_get_span( srcaddr, length, &src );
+            if( len == 0 ) {
+                WARN( "Attempted DMA read from unknown address %08X", srcaddr );
+                break;
+            }
+            len = dma_write_span( destaddr, src, len );
+        }
+        if( len == 0 ) {
+            break;
+        }
+        destaddr += len;
+        srcaddr += len;
+        length -= len;
+    }
+}
+
+void dma_write( sh4addr_t destaddr, unsigned char *src, uint32_t length )
+{
+    dma_invalidate( destaddr, length );
+    while( length > 0 ) {
+        uint32_t len = dma_write_span( destaddr, src, length );
+        if( len == 0 ) {
+            break;
+        }
+        destaddr += len;
+        src += len;
+        length -= len;
+    }
+}
+
+sh4ptr_t dma_get_write_buffer( sh4addr_t destaddr, uint32_t length )
+{
+    sh4ptr_t dest;
+
+    if( length == 0 || DMA_IS_TA(destaddr) || DMA_IS_VRAM64(destaddr) ||
+            dma_get_span( destaddr, length, &dest ) != length ) {
+        return NULL;
+    }
+    dma_invalidate( destaddr, length );
+    return dest;
+}
+
+/******************************* Channels ***********************************/
+
+void dma_set_timed( gboolean timed )
+{
+    dma_timed = timed;
+}
+
+gboolean dma_is_timed( void )
+{
+    return dma_timed;
+}
+
+/**
+ * @return the number of bytes to transfer in the next step
+ */
+static uint32_t dma_step_length( struct dma_channel *channel )
+{
+    uint32_t step = (uint32_t)(((uint64_t)channel->bandwidth * DMA_STEP_NANOSECS) / 1000000000);
+    return channel->remaining < step ? channel->remaining : step;
+}
+
+static void dma_schedule_step( struct dma_channel *channel )
+{
+    uint64_t nanosecs = ((uint64_t)dma_step_length(channel) * 1000000000) / channel->bandwidth;
+    event_schedule( channel->eventid, (uint32_t)nanosecs );
+}
+
+/**
+ * Move the next length bytes of the transfer, and complete it if that was
+ * the last of the data (or the channel stopped early).
+ * @return TRUE if the transfer is still in progress.
+ */
+static gboolean dma_channel_step( struct dma_channel *channel, uint32_t length )
+{
+    uint32_t moved;
+    if( channel->chunk == NULL ) {
+        dma_copy( channel->destaddr, channel->srcaddr, length );
+        channel->destaddr += length;
+        channel->srcaddr += length;
+        moved = length;
+    } else {
+        moved = channel->chunk( channel, length );
+    }
+
+    if( moved < length ) {
+        channel->remaining = 0;
+    } else {
+        channel->remaining -= length;
+    }
+    if( channel->remaining == 0 ) {
+        channel->complete( channel );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void dma_event_callback( int eventid )
+{
+    struct dma_channel *channel = dma_channels[eventid];
+    if( channel->remaining != 0 && dma_channel_step( channel, dma_step_length(channel) ) ) {
+        dma_schedule_step( channel );
+    }
+}
+
+void dma_channel_init( struct dma_channel *channel )
+{
+    channel->remaining = 0;
+    dma_channels[channel->eventid] = channel;
+    register_event_callback( channel->eventid, dma_event_callback );
+}
+
+void dma_channel_start( struct dma_channel *channel, sh4addr_t destaddr, 
+                        sh4addr_t srcaddr, uint32_t length )
+{
+    channel->destaddr = destaddr;
+    channel->srcaddr = srcaddr;
+    channel->remaining = length;
+    if( length == 0 ) {
+        channel->complete( channel );
+    } else if( !dma_timed ) {
+        dma_channel_step( channel, length );
+    } else {
+        dma_schedule_step( channel );
+    }
+}
+
+void dma_channel_cancel( struct dma_channel *channel )
+{
+    if( channel->remaining != 0 ) {
+        event_cancel( channel->eventid );
+        channel->remaining = 0;
+    }
+}
+
+gboolean dma_channel_is_active( struct dma_channel *channel )
+{
+    return channel->remaining != 0;
+}
+
+void dma_channel_save_state( struct dma_channel *channel, FILE *f )
+{
+    fwrite( &channel->destaddr, sizeof(channel->destaddr), 1, f );
+    fwrite( &channel->srcaddr, sizeof(channel->srcaddr), 1, f );
+    fwrite( &channel->remaining, sizeof(channel->remaining), 1, f );
+}
+
+int dma_channel_load_state( struct dma_channel *channel, FILE *f )
+{
+    if( fread( &channel->destaddr, sizeof(channel->destaddr), 1, f ) != 1 ||
+        fread( &channel->srcaddr, sizeof(channel->srcaddr), 1, f ) != 1 ||
+        fread( &channel->remaining, sizeof(channel->remaining), 1, f ) != 1 ) {
+        return 1;
+    }
+    return 0;
+}
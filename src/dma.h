@@ -0,0 +1,121 @@
+/**
+ * $Id$
+ *
+ * Common block transfer engine for the G2, PVR and IDE DMA channels. Source
+ * and destination addresses are resolved to spans of host memory and copied
+ * directly, without staging the data through an intermediate buffer.
+ * Channels either transfer instantly or, in timed mode, at an approximation
+ * of the real bus bandwidth.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_dma_H
+#define lxdream_dma_H 1
+
+#include <stdio.h>
+#include "lxdream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct dma_channel;
+
+/**
+ * Transfer the next chunk of an active DMA of at most length bytes.
+ * @return the number of bytes actually transferred. Returning less than
+ * length ends the transfer early.
+ */
+typedef uint32_t (*dma_chunk_fn_t)( struct dma_channel *channel, uint32_t length );
+
+/**
+ * Complete a DMA transfer (update the device registers and raise the
+ * completion event).
+ */
+typedef void (*dma_complete_fn_t)( struct dma_channel *channel );
+
+/**
+ * A DMA channel that can either complete instantly, or in timed mode move
+ * its data in bandwidth-sized chunks over a series of events, completing
+ * when the last chunk has been moved.
+ */
+struct dma_channel {
+    int eventid;                  /* Event used to schedule the transfer */
+    uint32_t bandwidth;           /* Transfer rate in bytes per second */
+    dma_chunk_fn_t chunk;         /* Chunk transfer, or NULL for dma_copy() */
+    dma_complete_fn_t complete;   /* Completion handler */
+    /* Current transfer state */
+    sh4addr_t destaddr;
+    sh4addr_t srcaddr;
+    uint32_t remaining;           /* Bytes left to transfer, 0 when idle */
+};
+
+/**
+ * Copy a block of data between two physical addresses. Either side may be
+ * ordinary memory or one of the PVR2 areas (TA, 64-bit VRAM), and the
+ * transfer may cross region boundaries. Translation cache and render buffer
+ * invalidation is done once for the whole destination range.
+ */
+void dma_copy( sh4addr_t destaddr, sh4addr_t srcaddr, uint32_t length );
+
+/**
+ * Copy a block of data from a host buffer to a physical address, as per
+ * dma_copy().
+ */
+void dma_write( sh4addr_t destaddr, unsigned char *src, uint32_t length );
+
+/**
+ * Prepare to write length bytes directly into memory at destaddr, so that
+ * the caller can produce the data in place rather than through dma_write().
+ * Anything caching the destination range is invalidated.
+ * @return a host pointer to the whole range, or NULL if it isn't a single
+ * contiguous block of ordinary memory (in which case use dma_write).
+ */
+sh4ptr_t dma_get_write_buffer( sh4addr_t destaddr, uint32_t length );
+
+/**
+ * Select between instant (FALSE) and timed (TRUE) DMA transfers. Instant is
+ * the default. Transfers already in progress are unaffected.
+ */
+void dma_set_timed( gboolean timed );
+
+gboolean dma_is_timed( void );
+
+/**
+ * Register the channel's event callback. Must be called once at init time.
+ */
+void dma_channel_init( struct dma_channel *channel );
+
+/**
+ * Start a transfer of length bytes on the channel. In instant mode the
+ * transfer (and completion handler) runs before this returns.
+ */
+void dma_channel_start( struct dma_channel *channel, sh4addr_t destaddr, 
+                        sh4addr_t srcaddr, uint32_t length );
+
+/**
+ * Abort any transfer in progress on the channel, without completing it.
+ */
+void dma_channel_cancel( struct dma_channel *channel );
+
+gboolean dma_channel_is_active( struct dma_channel *channel );
+
+void dma_channel_save_state( struct dma_channel *channel, FILE *f );
+int dma_channel_load_state( struct dma_channel *channel, FILE *f );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_dma_H */
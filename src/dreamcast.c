@@ -27,10 +27,13 @@
 #include "mem.h"
 #include "dreamcast.h"
 #include "asic.h"
+#include "dma.h"
 #include "syscall.h"
 #include "gui.h"
 #include "aica/aica.h"
+#include "drivers/cdrom/sector.h"
 #include "gdrom/ide.h"
+#include "gdrom/gdrom.h"
 #include "maple/maple.h"
 #include "pvr2/pvr2.h"
 #include "sh4/sh4.h"
@@ -55,6 +58,7 @@ static gchar *dreamcast_program_name = NULL;
 static sh4addr_t dreamcast_entry_point = 0xA0000000;
 static uint32_t timeslice_length = DEFAULT_TIMESLICE_LENGTH;
 static uint64_t run_time_nanosecs = 0;
+static uint64_t emulated_time_nanosecs = 0; /* Total of all completed timeslices */
 static unsigned int quick_save_state = -1;
 
 #define MAX_MODULES 32
@@ -80,9 +84,9 @@ extern struct mem_region_fn mem_region_pvr2yuv;
 extern struct mem_region_fn mem_region_pvr2vdma1;
 extern struct mem_region_fn mem_region_pvr2vdma2;
 
-unsigned char dc_main_ram[16 MB];
-unsigned char dc_boot_rom[2 MB];
-unsigned char dc_flash_ram[128 KB];
+unsigned char dc_main_ram[16 MB] MEM_REGION_ALIGNED;
+unsigned char dc_boot_rom[2 MB] MEM_REGION_ALIGNED;
+unsigned char dc_flash_ram[128 KB] MEM_REGION_ALIGNED;
 
 /**
  * This function is responsible for defining how all the pieces of the
@@ -114,6 +118,17 @@ void dreamcast_configure( gboolean use_bootrom )
     mem_map_region( NULL,            0x10800000, 8 MB,   MEM_REGION_PVR2YUV,      &mem_region_pvr2yuv, 0, 0x02000000, 0x12800000 );
     mem_map_region( NULL,            0x11000000, 16 MB,  MEM_REGION_PVR2VDMA1,    &mem_region_pvr2vdma1, 0, 16 MB, 0 );
     mem_map_region( NULL,            0x13000000, 16 MB,  MEM_REGION_PVR2VDMA2,    &mem_region_pvr2vdma2, 0, 16 MB, 0 );
+
+    /* Let translated code read the plain memory regions directly if requested.
+     * (VRAM is left out, as reads have to check for pending render buffers) */
+    if( lxdream_get_config_boolean_value( lxdream_get_config_group(CONFIG_GROUP_GLOBAL), CONFIG_FASTMEM ) &&
+            mem_fastmem_init() ) {
+        mem_fastmem_map_region( MEM_REGION_BIOS );
+        mem_fastmem_map_region( MEM_REGION_FLASH );
+        mem_fastmem_map_region( MEM_REGION_AUDIO );
+        mem_fastmem_map_region( MEM_REGION_AUDIO_SCRATCH );
+        mem_fastmem_map_region( MEM_REGION_MAIN );
+    }
     
     dreamcast_use_bios = use_bootrom;
     dreamcast_has_bios = dreamcast_load_bios( bios_path );
@@ -187,6 +202,18 @@ gboolean dreamcast_config_changed(void *data, struct lxdream_config_group *group
         dreamcast_load_flash(tmp);
         g_free(tmp);
         break;
+    case CONFIG_TIMED_DMA:
+        dma_set_timed( lxdream_parse_boolean_value(newval) );
+        break;
+    case CONFIG_RENDER_THREAD:
+        pvr2_render_thread_set_enabled( lxdream_parse_boolean_value(newval) );
+        break;
+    case CONFIG_RAW_SECTOR_CACHE:
+        sector_source_set_raw_cache_enabled( lxdream_parse_boolean_value(newval) );
+        break;
+    case CONFIG_GDROM_TIMING:
+        gdrom_timing_set_mode( gdrom_timing_parse_mode(newval) );
+        break;
     }
     reset_gui_paths();
     return TRUE;
@@ -282,6 +309,7 @@ void dreamcast_run( void )
                 if( modules[i]->run_time_slice != NULL )
                     time_to_run = modules[i]->run_time_slice( time_to_run );
             }
+            emulated_time_nanosecs += time_to_run;
 
             if( run_time_nanosecs > time_to_run ) {
                 run_time_nanosecs -= time_to_run;
@@ -297,6 +325,7 @@ void dreamcast_run( void )
                 if( modules[i]->run_time_slice != NULL )
                     time_to_run = modules[i]->run_time_slice( time_to_run );
             }
+            emulated_time_nanosecs += time_to_run;
 
         }
     }
@@ -309,6 +338,7 @@ void dreamcast_run( void )
     }
     
     vmulist_save_all();
+    gdrom_trace_flush();
     dreamcast_state = STATE_STOPPED;
 
     if( dreamcast_exit_on_stop ) {
@@ -317,6 +347,11 @@ void dreamcast_run( void )
     }
 }
 
+uint64_t dreamcast_get_emulated_time( void )
+{
+    return emulated_time_nanosecs + sh4r.slice_cycle;
+}
+
 void dreamcast_stop( void )
 {
     sh4_core_exit(CORE_EXIT_HALT); // returns only if not inside SH4 core
@@ -332,6 +367,7 @@ void dreamcast_shutdown()
         dreamcast_state = STATE_STOPPING;
     dreamcast_save_flash();
     vmulist_save_all();
+    gdrom_trace_stop();
 #ifdef ENABLE_SH4STATS
     sh4_stats_print(stdout);
 #endif
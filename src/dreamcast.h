@@ -44,6 +44,10 @@ void dreamcast_reset(void);
 void dreamcast_run(void);
 void dreamcast_set_run_time( unsigned int seconds, unsigned int nanosecs );
 void dreamcast_set_exit_on_stop( gboolean flag );
+/**
+ * Return the total emulated time since startup, in nanoseconds.
+ */
+uint64_t dreamcast_get_emulated_time(void);
 void dreamcast_stop(void);
 void dreamcast_shutdown(void);
 gboolean dreamcast_is_running(void);
@@ -63,7 +67,7 @@ gboolean dreamcast_can_run(void);
 void dreamcast_program_loaded( const gchar *name, sh4addr_t entry_point );
 
 #define DREAMCAST_SAVE_MAGIC "%!-lxDream!Save\0"
-#define DREAMCAST_SAVE_VERSION 0x00010006
+#define DREAMCAST_SAVE_VERSION 0x00010008
 
 int dreamcast_save_state( const gchar *filename );
 int dreamcast_load_state( const gchar *filename );
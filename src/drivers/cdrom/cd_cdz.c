@@ -0,0 +1,506 @@
+/**
+ * $Id$
+ *
+ * Compressed disc image (.cdz) support. The image stores each track in its
+ * native block format, split into fixed-size hunks of CDZ_HUNK_SECTORS
+ * sectors which are deflated independently, so that any sector can be read
+ * by decompressing just the one hunk. Hunks never span tracks.
+ *
+ * File layout (all values little-endian):
+ *   header       struct cdz_header
+ *   tracks       struct cdz_track[track_count]
+ *   hunk data    compressed hunks, in order
+ *   index        struct cdz_hunk[hunk_count], at header.index_offset
+ *
+ * Decompressed hunks are kept in a small LRU cache. When a track is being
+ * read sequentially, a miss decompresses the following hunks of the track
+ * as well, in parallel on the work pool.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <glib.h>
+#include "drivers/cdrom/cdimpl.h"
+#include "workpool.h"
+
+#define CDZ_MAGIC "LXDCDZ\r\n"
+#define CDZ_VERSION 1
+#define CDZ_HUNK_SECTORS 16
+#define CDZ_CACHE_HUNKS 32      /* Decompressed hunks kept in memory */
+#define CDZ_PREFETCH_HUNKS 8    /* Hunks decompressed at a time when reading sequentially */
+#define CDZ_WRITE_BATCH 64      /* Hunks compressed at a time by the writer */
+#define CDZ_MAX_HUNK_SIZE (CDZ_HUNK_SECTORS * 2448) /* Largest native sector is CDDA+subchannel */
+
+#define CDZ_HUNK_STORED 0x0001  /* Hunk is stored uncompressed */
+
+struct cdz_header {
+    char magic[8];
+    uint64_t index_offset;
+    uint32_t version;
+    uint32_t hunk_sectors;
+    uint32_t hunk_count;
+    uint32_t track_count;
+    uint32_t session_count;
+    uint32_t disc_type;
+    uint32_t leadout;
+    char mcn[14];
+    uint16_t reserved;
+    uint32_t reserved2;
+};
+
+struct cdz_track {
+    uint32_t lba;
+    uint32_t sector_count;
+    uint32_t first_hunk;
+    uint8_t mode;
+    uint8_t flags;
+    uint8_t sessionno;
+    uint8_t trackno;
+};
+
+struct cdz_hunk {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t flags;
+};
+
+static gboolean cdz_image_is_valid( FILE *f );
+static gboolean cdz_image_read_toc( cdrom_disc_t disc, ERROR *err );
+
+struct cdrom_disc_factory cdz_disc_factory = { "Compressed Disc Image", "cdz",
+        cdz_image_is_valid, NULL, cdz_image_read_toc };
+
+/************************** Hunk cache ****************************/
+
+struct cdz_cache_slot {
+    uint32_t hunk;              /* Hunk held in the slot, or -1 if empty */
+    uint32_t last_used;
+    uint32_t length;            /* Length of the decompressed hunk */
+    unsigned char *data;
+    unsigned char *cdata;       /* Compressed data buffer */
+};
+
+typedef struct cdz_image {
+    int ref_count;              /* Number of tracks using the image */
+    sector_source_t base_source;
+    int fd;
+    pthread_mutex_t lock;
+    uint32_t hunk_sectors;
+    uint32_t hunk_count;
+    uint32_t hunk_size;         /* Maximum decompressed size of a hunk */
+    struct cdz_hunk *index;
+    int16_t *hunk_slot;         /* Cache slot for each hunk, or -1 */
+    uint32_t last_hunk;
+    uint32_t clock;
+    struct cdz_cache_slot slots[CDZ_CACHE_HUNKS];
+} *cdz_image_t;
+
+typedef struct cdz_track_source {
+    struct sector_source dev;
+    cdz_image_t image;
+    uint32_t first_hunk;
+} *cdz_track_source_t;
+
+/* Decompression job for the work pool */
+struct cdz_decode_job {
+    cdz_image_t image;
+    int count;
+    struct cdz_cache_slot *slot[CDZ_PREFETCH_HUNKS];
+    uint32_t length[CDZ_PREFETCH_HUNKS];   /* Expected decompressed length */
+    gboolean ok[CDZ_PREFETCH_HUNKS];
+};
+
+static void cdz_image_unref( cdz_image_t image )
+{
+    int i;
+    if( --image->ref_count > 0 )
+        return;
+    for( i=0; i<CDZ_CACHE_HUNKS; i++ ) {
+        g_free( image->slots[i].data );
+        g_free( image->slots[i].cdata );
+    }
+    pthread_mutex_destroy( &image->lock );
+    g_free( image->index );
+    g_free( image->hunk_slot );
+    sector_source_unref( image->base_source );
+    g_free( image );
+}
+
+static void cdz_decode_hunk( void *data, int i )
+{
+    struct cdz_decode_job *job = (struct cdz_decode_job *)data;
+    struct cdz_cache_slot *slot = job->slot[i];
+    struct cdz_hunk *hunk = &job->image->index[slot->hunk];
+    uLongf length = job->length[i];
+
+    job->ok[i] = FALSE;
+    if( hunk->length > job->image->hunk_size ) {
+        return;
+    }
+    unsigned char *buf = (hunk->flags & CDZ_HUNK_STORED) ? slot->data : slot->cdata;
+    if( pread( job->image->fd, buf, hunk->length, (off_t)hunk->offset ) != hunk->length ) {
+        return;
+    }
+    if( hunk->flags & CDZ_HUNK_STORED ) {
+        job->ok[i] = hunk->length == length;
+    } else {
+        job->ok[i] = uncompress( slot->data, &length, slot->cdata, hunk->length ) == Z_OK &&
+                length == job->length[i];
+    }
+    slot->length = length;
+}
+
+/**
+ * Claim the least-recently used cache slot for the given hunk.
+ */
+static struct cdz_cache_slot *cdz_cache_alloc( cdz_image_t image, uint32_t hunk )
+{
+    struct cdz_cache_slot *slot = &image->slots[0];
+    int i;
+    for( i=1; i<CDZ_CACHE_HUNKS; i++ ) {
+        if( image->slots[i].last_used < slot->last_used ) {
+            slot = &image->slots[i];
+        }
+    }
+    if( slot->hunk != (uint32_t)-1 ) {
+        image->hunk_slot[slot->hunk] = -1;
+    }
+    if( slot->data == NULL ) {
+        slot->data = g_malloc( image->hunk_size );
+        slot->cdata = g_malloc( image->hunk_size );
+    }
+    slot->hunk = hunk;
+    slot->last_used = ++image->clock;
+    image->hunk_slot[hunk] = slot - image->slots;
+    return slot;
+}
+
+/**
+ * Return the cache slot holding the given hunk of the track, decompressing
+ * it (and possibly some of the hunks after it) if necessary. Must be called
+ * with the image lock held.
+ * @return the slot, or NULL if the hunk could not be read.
+ */
+static struct cdz_cache_slot *cdz_track_get_hunk( cdz_track_source_t track, uint32_t track_hunk )
+{
+    cdz_image_t image = track->image;
+    uint32_t hunk = track->first_hunk + track_hunk;
+    uint32_t sector_size = CDROM_SECTOR_SIZE(track->dev.mode);
+    uint32_t track_hunks = (track->dev.size + image->hunk_sectors - 1) / image->hunk_sectors;
+    gboolean sequential = (hunk == image->last_hunk + 1);
+    struct cdz_decode_job job;
+    int i;
+
+    image->last_hunk = hunk;
+    if( image->hunk_slot[hunk] != -1 ) {
+        struct cdz_cache_slot *slot = &image->slots[image->hunk_slot[hunk]];
+        slot->last_used = ++image->clock;
+        return slot;
+    }
+
+    /* Miss - decompress this hunk, plus the following uncached hunks if
+     * we're reading sequentially */
+    job.image = image;
+    job.count = 0;
+    do {
+        uint32_t sectors = track->dev.size - track_hunk * image->hunk_sectors;
+        if( sectors > image->hunk_sectors )
+            sectors = image->hunk_sectors;
+        job.length[job.count] = sectors * sector_size;
+        job.slot[job.count++] = cdz_cache_alloc( image, hunk );
+        hunk++;
+        track_hunk++;
+    } while( sequential && job.count < CDZ_PREFETCH_HUNKS && track_hunk < track_hunks &&
+             image->hunk_slot[hunk] == -1 );
+
+    workpool_run( cdz_decode_hunk, &job, job.count );
+
+    for( i=0; i<job.count; i++ ) {
+        if( !job.ok[i] ) {
+            image->hunk_slot[job.slot[i]->hunk] = -1;
+            job.slot[i]->hunk = (uint32_t)-1;
+            job.slot[i]->last_used = 0;
+        }
+    }
+    return job.ok[0] ? job.slot[0] : NULL;
+}
+
+static cdrom_error_t cdz_track_source_read( sector_source_t dev, cdrom_lba_t lba, cdrom_count_t count, unsigned char *buf )
+{
+    assert( IS_SECTOR_SOURCE_TYPE(dev,COMPRESSED_SECTOR_SOURCE) );
+    cdz_track_source_t track = (cdz_track_source_t)dev;
+    cdz_image_t image = track->image;
+    uint32_t sector_size = CDROM_SECTOR_SIZE(dev->mode);
+    cdrom_error_t status = CDROM_ERROR_OK;
+
+    pthread_mutex_lock( &image->lock );
+    while( count > 0 ) {
+        uint32_t offset = lba % image->hunk_sectors;
+        uint32_t n = image->hunk_sectors - offset;
+        if( n > count )
+            n = count;
+        struct cdz_cache_slot *slot = cdz_track_get_hunk( track, lba / image->hunk_sectors );
+        if( slot == NULL ) {
+            status = CDROM_ERROR_READERROR;
+            break;
+        }
+        memcpy( buf, slot->data + offset * sector_size, n * sector_size );
+        buf += n * sector_size;
+        lba += n;
+        count -= n;
+    }
+    pthread_mutex_unlock( &image->lock );
+    return status;
+}
+
+static void cdz_track_source_destroy( sector_source_t dev )
+{
+    assert( IS_SECTOR_SOURCE_TYPE(dev,COMPRESSED_SECTOR_SOURCE) );
+    cdz_track_source_t track = (cdz_track_source_t)dev;
+    cdz_image_unref( track->image );
+    default_sector_source_destroy( dev );
+}
+
+/************************** Image reader ****************************/
+
+static gboolean cdz_image_is_valid( FILE *f )
+{
+    char buf[8];
+    fseek( f, 0, SEEK_SET );
+    return fread( buf, sizeof(buf), 1, f ) == 1 && memcmp( buf, CDZ_MAGIC, 8 ) == 0;
+}
+
+static gboolean cdz_image_read_toc( cdrom_disc_t disc, ERROR *err )
+{
+    struct cdz_header header;
+    struct cdz_track tracks[99];
+    int fd = file_sector_source_get_fd( disc->base_source );
+    uint32_t i, max_sector_size = 0;
+
+    if( pread( fd, &header, sizeof(header), 0 ) != sizeof(header) ||
+            memcmp( header.magic, CDZ_MAGIC, 8 ) != 0 ) {
+        SET_ERROR( err, LX_ERR_FILE_INVALID, "Invalid CDZ image" );
+        return FALSE;
+    }
+    if( GUINT32_FROM_LE(header.version) != CDZ_VERSION ) {
+        SET_ERROR( err, LX_ERR_FILE_UNSUP, "Unsupported CDZ image version %d", GUINT32_FROM_LE(header.version) );
+        return FALSE;
+    }
+    uint32_t track_count = GUINT32_FROM_LE(header.track_count);
+    uint32_t hunk_count = GUINT32_FROM_LE(header.hunk_count);
+    uint32_t hunk_sectors = GUINT32_FROM_LE(header.hunk_sectors);
+    if( track_count == 0 || track_count > 99 || hunk_sectors == 0 || hunk_sectors > 256 ||
+            hunk_count > UINT32_MAX / sizeof(struct cdz_hunk) ||
+            pread( fd, tracks, track_count * sizeof(struct cdz_track), sizeof(header) ) != track_count * sizeof(struct cdz_track) ) {
+        SET_ERROR( err, LX_ERR_FILE_INVALID, "Invalid CDZ image (bad track table)" );
+        return FALSE;
+    }
+    for( i=0; i<track_count; i++ ) {
+        uint32_t sector_count = GUINT32_FROM_LE(tracks[i].sector_count);
+        uint32_t first_hunk = GUINT32_FROM_LE(tracks[i].first_hunk);
+        if( tracks[i].mode == SECTOR_UNKNOWN || tracks[i].mode > SECTOR_CDDA_SUBCHANNEL ||
+                first_hunk + (uint64_t)(sector_count + hunk_sectors - 1) / hunk_sectors > hunk_count ) {
+            SET_ERROR( err, LX_ERR_FILE_INVALID, "Invalid CDZ image (bad track %d)", i+1 );
+            return FALSE;
+        }
+        if( CDROM_SECTOR_SIZE(tracks[i].mode) > max_sector_size )
+            max_sector_size = CDROM_SECTOR_SIZE(tracks[i].mode);
+    }
+
+    cdz_image_t image = g_malloc0( sizeof(struct cdz_image) );
+    image->index = g_malloc( hunk_count * sizeof(struct cdz_hunk) + 1 );
+    if( pread( fd, image->index, hunk_count * sizeof(struct cdz_hunk), (off_t)GUINT64_FROM_LE(header.index_offset) ) !=
+            hunk_count * sizeof(struct cdz_hunk) ) {
+        SET_ERROR( err, LX_ERR_FILE_INVALID, "Invalid CDZ image (truncated hunk index)" );
+        g_free( image->index );
+        g_free( image );
+        return FALSE;
+    }
+    image->hunk_slot = g_malloc( hunk_count * sizeof(int16_t) + 1 );
+    for( i=0; i<hunk_count; i++ ) {
+        image->index[i].offset = GUINT64_FROM_LE(image->index[i].offset);
+        image->index[i].length = GUINT32_FROM_LE(image->index[i].length);
+        image->index[i].flags = GUINT32_FROM_LE(image->index[i].flags);
+        image->hunk_slot[i] = -1;
+    }
+    for( i=0; i<CDZ_CACHE_HUNKS; i++ ) {
+        image->slots[i].hunk = (uint32_t)-1;
+    }
+    image->base_source = disc->base_source;
+    sector_source_ref( image->base_source );
+    image->fd = fd;
+    pthread_mutex_init( &image->lock, NULL );
+    image->hunk_sectors = hunk_sectors;
+    image->hunk_count = hunk_count;
+    image->hunk_size = hunk_sectors * max_sector_size;
+    image->last_hunk = (uint32_t)-1;
+    image->ref_count = track_count;
+
+    for( i=0; i<track_count; i++ ) {
+        cdz_track_source_t track = g_malloc( sizeof(struct cdz_track_source) );
+        track->image = image;
+        track->first_hunk = GUINT32_FROM_LE(tracks[i].first_hunk);
+        sector_source_init( &track->dev, COMPRESSED_SECTOR_SOURCE, tracks[i].mode,
+                GUINT32_FROM_LE(tracks[i].sector_count), cdz_track_source_read, cdz_track_source_destroy );
+        disc->track[i].source = &track->dev;
+        sector_source_ref( &track->dev );
+        disc->track[i].lba = GUINT32_FROM_LE(tracks[i].lba);
+        disc->track[i].flags = tracks[i].flags;
+        disc->track[i].sessionno = tracks[i].sessionno;
+        disc->track[i].trackno = tracks[i].trackno;
+    }
+    disc->track_count = track_count;
+    disc->session_count = GUINT32_FROM_LE(header.session_count);
+    disc->disc_type = GUINT32_FROM_LE(header.disc_type);
+    disc->leadout = GUINT32_FROM_LE(header.leadout);
+    memcpy( disc->mcn, header.mcn, sizeof(disc->mcn) );
+    disc->mcn[13] = '\0';
+    return TRUE;
+}
+
+/************************** Image writer ****************************/
+
+struct cdz_encode_job {
+    unsigned char *data[CDZ_WRITE_BATCH];
+    uint32_t length[CDZ_WRITE_BATCH];
+    unsigned char *cdata[CDZ_WRITE_BATCH];
+    uLongf clength[CDZ_WRITE_BATCH];
+};
+
+static void cdz_encode_hunk( void *data, int i )
+{
+    struct cdz_encode_job *job = (struct cdz_encode_job *)data;
+    job->clength[i] = compressBound( job->length[i] );
+    if( compress2( job->cdata[i], &job->clength[i], job->data[i], job->length[i], Z_BEST_COMPRESSION ) != Z_OK ||
+            job->clength[i] >= job->length[i] ) {
+        job->clength[i] = 0; /* Store it uncompressed */
+    }
+}
+
+gboolean cdrom_disc_write_compressed( cdrom_disc_t disc, const gchar *filename, ERROR *err )
+{
+    struct cdz_header header;
+    struct cdz_track tracks[99];
+    struct cdz_encode_job *job;
+    GArray *index = g_array_new( FALSE, FALSE, sizeof(struct cdz_hunk) );
+    uint64_t offset = sizeof(header) + disc->track_count * sizeof(struct cdz_track);
+    uint64_t total = 0;
+    gboolean result = FALSE;
+    int i, j, n;
+
+    FILE *f = fopen( filename, "wb" );
+    if( f == NULL ) {
+        SET_ERROR( err, LX_ERR_FILE_NOOPEN, "Unable to create '%s': %s", filename, strerror(errno) );
+        g_array_free( index, TRUE );
+        return FALSE;
+    }
+
+    job = g_malloc0( sizeof(struct cdz_encode_job) );
+    for( i=0; i<CDZ_WRITE_BATCH; i++ ) {
+        job->data[i] = g_malloc( CDZ_MAX_HUNK_SIZE );
+        job->cdata[i] = g_malloc( compressBound( CDZ_MAX_HUNK_SIZE ) );
+    }
+
+    fseeko( f, offset, SEEK_SET );
+    for( i=0; i<disc->track_count; i++ ) {
+        cdrom_track_t track = &disc->track[i];
+        sector_source_t source = track->source;
+        cdrom_count_t size = source == NULL ? 0 : source->size;
+        uint32_t sector_size = source == NULL ? 0 : CDROM_SECTOR_SIZE(source->mode);
+        cdrom_lba_t lba = 0;
+
+        memset( &tracks[i], 0, sizeof(struct cdz_track) );
+        tracks[i].lba = GUINT32_TO_LE(track->lba);
+        tracks[i].sector_count = GUINT32_TO_LE(size);
+        tracks[i].first_hunk = GUINT32_TO_LE(index->len);
+        tracks[i].mode = source == NULL ? SECTOR_MODE1 : source->mode;
+        tracks[i].flags = track->flags;
+        tracks[i].sessionno = track->sessionno;
+        tracks[i].trackno = track->trackno;
+
+        while( lba < size ) {
+            /* Read a batch of hunks, compress them in parallel, write them in order */
+            for( n=0; n<CDZ_WRITE_BATCH && lba < size; n++ ) {
+                uint32_t count = size - lba < CDZ_HUNK_SECTORS ? size - lba : CDZ_HUNK_SECTORS;
+                if( sector_source_read( source, lba, count, job->data[n] ) != CDROM_ERROR_OK ) {
+                    SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to read track %d sector %d", track->trackno, lba );
+                    goto done;
+                }
+                job->length[n] = count * sector_size;
+                lba += count;
+            }
+            workpool_run( cdz_encode_hunk, job, n );
+            for( j=0; j<n; j++ ) {
+                struct cdz_hunk hunk;
+                unsigned char *data = job->clength[j] == 0 ? job->data[j] : job->cdata[j];
+                uint32_t length = job->clength[j] == 0 ? job->length[j] : job->clength[j];
+                hunk.offset = GUINT64_TO_LE(offset);
+                hunk.length = GUINT32_TO_LE(length);
+                hunk.flags = GUINT32_TO_LE(job->clength[j] == 0 ? CDZ_HUNK_STORED : 0);
+                g_array_append_val( index, hunk );
+                if( fwrite( data, length, 1, f ) != 1 ) {
+                    SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to write '%s': %s", filename, strerror(errno) );
+                    goto done;
+                }
+                offset += length;
+                total += job->length[j];
+            }
+        }
+    }
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, CDZ_MAGIC, 8 );
+    header.index_offset = GUINT64_TO_LE(offset);
+    header.version = GUINT32_TO_LE(CDZ_VERSION);
+    header.hunk_sectors = GUINT32_TO_LE(CDZ_HUNK_SECTORS);
+    header.hunk_count = GUINT32_TO_LE(index->len);
+    header.track_count = GUINT32_TO_LE(disc->track_count);
+    header.session_count = GUINT32_TO_LE(disc->session_count);
+    header.disc_type = GUINT32_TO_LE(disc->disc_type);
+    header.leadout = GUINT32_TO_LE(disc->leadout);
+    memcpy( header.mcn, disc->mcn, sizeof(header.mcn) );
+    if( (index->len != 0 && fwrite( index->data, sizeof(struct cdz_hunk), index->len, f ) != index->len) ||
+            fseek( f, 0, SEEK_SET ) != 0 ||
+            fwrite( &header, sizeof(header), 1, f ) != 1 ||
+            fwrite( tracks, sizeof(struct cdz_track), disc->track_count, f ) != disc->track_count ) {
+        SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to write '%s': %s", filename, strerror(errno) );
+        goto done;
+    }
+    INFO( "Wrote %s: %lld bytes compressed to %lld (%d hunks)", filename, (long long)total,
+          (long long)offset, index->len );
+    result = TRUE;
+
+done:
+    if( fclose( f ) != 0 && result ) {
+        SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to write '%s': %s", filename, strerror(errno) );
+        result = FALSE;
+    }
+    if( !result ) {
+        unlink( filename );
+    }
+    for( i=0; i<CDZ_WRITE_BATCH; i++ ) {
+        g_free( job->data[i] );
+        g_free( job->cdata[i] );
+    }
+    g_free( job );
+    g_array_free( index, TRUE );
+    return result;
+}
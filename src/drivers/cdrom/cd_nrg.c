@@ -257,7 +257,7 @@ static gboolean nrg_image_read_toc( cdrom_disc_t disc, ERROR *err )
                 RETURN_PARSE_ERROR( "Invalid NRG image file (bad DAOX block)" );
             }
             for( i=0; i<count; i++ ) {
-                uint32_t offset = (uint32_t)GUINT64_FROM_BE(daox->track[i].offset);
+                uint64_t offset = GUINT64_FROM_BE(daox->track[i].offset);
                 sector_mode_t mode = nrg_track_mode( daox->track[i].mode );
                 if( mode == SECTOR_UNKNOWN ) {
                     RETURN_PARSE_ERROR("Unknown track mode in NRG image file (%d)", daox->track[i].mode);
@@ -306,7 +306,7 @@ static gboolean nrg_image_read_toc( cdrom_disc_t disc, ERROR *err )
             etn2 = (struct nrg_etn2 *)data;
             count = chunk.length / sizeof(struct nrg_etn2);
             for( i=0; i < count; i++, etn2++ ) {
-                uint32_t offset = (uint32_t)GUINT64_FROM_BE(etn2->offset);
+                uint64_t offset = GUINT64_FROM_BE(etn2->offset);
                 sector_mode_t mode = nrg_track_mode( GUINT32_FROM_BE(etn2->mode) );
                 if( mode == SECTOR_UNKNOWN ) {
                     RETURN_PARSE_ERROR("Unknown track mode in NRG image file (%d)", etn2->mode);
@@ -29,6 +29,7 @@ extern struct cdrom_disc_factory linux_cdrom_drive_factory;
 extern struct cdrom_disc_factory nrg_disc_factory;
 extern struct cdrom_disc_factory cdi_disc_factory;
 extern struct cdrom_disc_factory gdi_disc_factory;
+extern struct cdrom_disc_factory cdz_disc_factory;
 
 cdrom_disc_factory_t cdrom_disc_factories[] = {
 #ifdef HAVE_LINUX_CDROM
@@ -37,6 +38,7 @@ cdrom_disc_factory_t cdrom_disc_factories[] = {
         &nrg_disc_factory,
         &cdi_disc_factory,
         &gdi_disc_factory,
+        &cdz_disc_factory,
         NULL };
 
 /********************* Implementation Support functions ************************/
@@ -280,6 +282,65 @@ cdrom_disc_t cdrom_disc_open( const char *inFilename, ERROR *err )
     }
 }
 
+cdrom_disc_t cdrom_disc_open_layout( const char *filename, const struct cdrom_disc_layout *layout, ERROR *err )
+{
+    cdrom_disc_t disc;
+    int i;
+
+    if( layout->track_count > CDROM_MAX_TRACKS ) {
+        SET_ERROR( err, LX_ERR_FILE_INVALID, "Invalid disc layout for '%s'", filename );
+        return NULL;
+    }
+    disc = cdrom_disc_image_new( filename, err );
+    if( disc == NULL )
+        return NULL;
+
+    disc->disc_type = layout->disc_type;
+    memcpy( disc->mcn, layout->mcn, sizeof(disc->mcn) );
+    disc->mcn[sizeof(disc->mcn)-1] = '\0';
+    disc->session_count = layout->session_count;
+    disc->leadout = layout->leadout;
+    for( i=0; i<layout->track_count; i++ ) {
+        disc->track[i].trackno = layout->track[i].trackno;
+        disc->track[i].sessionno = layout->track[i].sessionno;
+        disc->track[i].lba = layout->track[i].lba;
+        disc->track[i].flags = layout->track[i].flags;
+        disc->track[i].source = file_sector_source_new_source( disc->base_source, layout->track[i].mode,
+                layout->track[i].offset, layout->track[i].sector_count );
+    }
+    disc->track_count = layout->track_count;
+    return disc;
+}
+
+gboolean cdrom_disc_get_layout( cdrom_disc_t disc, struct cdrom_disc_layout *layout )
+{
+    FILE *f;
+    int i;
+
+    if( disc->base_source == NULL || !IS_SECTOR_SOURCE_TYPE(disc->base_source, FILE_SECTOR_SOURCE) )
+        return FALSE;
+    f = file_sector_source_get_file(disc->base_source);
+    for( i=0; i<disc->track_count; i++ ) {
+        sector_source_t source = disc->track[i].source;
+        if( source == NULL || !IS_SECTOR_SOURCE_TYPE(source, FILE_SECTOR_SOURCE) ||
+                file_sector_source_get_file(source) != f )
+            return FALSE;
+        layout->track[i].trackno = disc->track[i].trackno;
+        layout->track[i].sessionno = disc->track[i].sessionno;
+        layout->track[i].lba = disc->track[i].lba;
+        layout->track[i].flags = disc->track[i].flags;
+        layout->track[i].mode = source->mode;
+        layout->track[i].sector_count = source->size;
+        layout->track[i].offset = file_sector_source_get_offset(source);
+    }
+    layout->disc_type = disc->disc_type;
+    memcpy( layout->mcn, disc->mcn, sizeof(layout->mcn) );
+    layout->track_count = disc->track_count;
+    layout->session_count = disc->session_count;
+    layout->leadout = disc->leadout;
+    return TRUE;
+}
+
 /**
  * Construct a disc around a source track.
  * @param type Disc type, which must be compatible with the track mode
@@ -91,11 +91,56 @@ struct cdrom_disc {
 
 };
 
+/**
+ * Physical layout of a disc image whose tracks are all stored directly in
+ * the one image file (eg CDI and NRG images). This is everything needed to
+ * reopen the image without parsing it again.
+ */
+struct cdrom_disc_layout {
+    cdrom_disc_type_t disc_type;
+    gchar mcn[14];
+    cdrom_trackno_t track_count;
+    cdrom_sessionno_t session_count;
+    cdrom_lba_t leadout;
+    struct {
+        cdrom_trackno_t trackno;
+        cdrom_sessionno_t sessionno;
+        cdrom_lba_t lba;
+        uint8_t flags;
+        sector_mode_t mode;
+        cdrom_count_t sector_count;
+        uint64_t offset;        /* Byte offset of the track in the image file */
+    } track[99];
+};
+
 /**
  * Open an image file or device
  */
 cdrom_disc_t cdrom_disc_open( const char *filename, ERROR *err );
 
+/**
+ * Open an image file using a layout previously retrieved from
+ * cdrom_disc_get_layout, without reparsing the image. The caller is responsible
+ * for ensuring the layout still matches the file.
+ */
+cdrom_disc_t cdrom_disc_open_layout( const char *filename, const struct cdrom_disc_layout *layout, ERROR *err );
+
+/**
+ * Retrieve the layout of the disc image, if all of its tracks are read
+ * directly out of the base image file.
+ * @return TRUE if the layout was retrieved, or FALSE if the disc can't be
+ * described this way (devices, multi-file and compressed images).
+ */
+gboolean cdrom_disc_get_layout( cdrom_disc_t disc, struct cdrom_disc_layout *layout );
+
+/**
+ * Write the disc out as a compressed (.cdz) image, which can subsequently
+ * be opened with cdrom_disc_open. Track data is stored in its native
+ * sector format, so the image reads back exactly as the original disc.
+ * @return TRUE on success, otherwise FALSE with err set.
+ */
+gboolean cdrom_disc_write_compressed( cdrom_disc_t disc, const gchar *filename, ERROR *err );
+
 /**
  * Construct a disc around a source track.
  * @param type Disc type, which must be compatible with the track mode
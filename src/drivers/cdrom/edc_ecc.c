@@ -40,9 +40,13 @@
  * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "drivers/cdrom/defs.h"
 #include "drivers/cdrom/ecc.h"
 
@@ -121,86 +125,166 @@ int scramble_L2(unsigned char *inout)
 	return (0);
 }
 
-#include "edc_l2sq.h"
+/*
+ * lxdream: the P and Q parity is computed here by Horner's rule rather than
+ * with the L2sq product tables (edc_l2sq.h). Each parity pair (a, b) of a
+ * column x[0..n-1] satisfies
+ *     a + b = sum(x[i])  and  alpha*a + b = sum(x[i] * alpha^(n-i))
+ * so the column only needs one XOR and one multiply by alpha per byte,
+ * followed by a single division by (1 + alpha) at the end. Multiplying by
+ * alpha is a shift and a conditional XOR, which SSE2 can do 16 columns at a
+ * time.
+ */
+static unsigned char ecc_f_lut[256];	/* x * alpha */
+static unsigned char ecc_b_lut[256];	/* x / (1 + alpha) */
+static unsigned int EDC_slice[8][256];	/* EDC_crctable extended for 8 bytes at a time */
+static pthread_once_t edc_ecc_tables_once = PTHREAD_ONCE_INIT;
 
-static int encode_L2_Q(unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P + L2_Q]);
+#include "edc_crctable.h"
 
-static int encode_L2_Q(unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P + L2_Q])
+static void init_edc_ecc_tables(void)
 {
-	unsigned char *dps;
-	unsigned char *dp;
-	unsigned char *Q;
-	register int i;
-	int j;
+	int i, k;
 
-	Q = inout + 4 + L2_RAW + 4 + 8 + L2_P;
+	for (i = 0; i < 256; i++) {
+		unsigned char j = (i << 1) ^ ((i & 0x80) ? 0x1D : 0);
+		ecc_f_lut[i] = j;
+		ecc_b_lut[i ^ j] = i;
+		EDC_slice[0][i] = EDC_crctable[i];
+	}
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			unsigned int crc = EDC_slice[k-1][i];
+			EDC_slice[k][i] = (crc >> 8) ^ EDC_crctable[crc & 0xff];
+		}
+	}
+}
 
-	dps = inout;
-	for (j = 0; j < 26; j++) {
-		register unsigned short a;
-		register unsigned short b;
-		a = b = 0;
+#ifdef __SSE2__
+/* Multiply each byte by alpha in GF(2^8) */
+static inline __m128i gf_mul_alpha(__m128i x)
+{
+	__m128i hi = _mm_cmplt_epi8(x, _mm_setzero_si128());
+	return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(hi, _mm_set1_epi8(0x1D)));
+}
 
-		dp = dps;
-		for (i = 0; i < 43; i++) {
+/*
+ * Run Horner's rule over minor_count rows of 16 columns. Row i of column j
+ * is at src[i*minor_inc + j]. Leaves alpha*a + b in a, and a + b in b.
+ */
+static inline void encode_L2_columns(const unsigned char *src, int minor_count, int minor_inc,
+				     unsigned char *a_out, unsigned char *b_out)
+{
+	__m128i a = _mm_setzero_si128();
+	__m128i b = _mm_setzero_si128();
+	int i;
 
-			/* LSB */
-			a ^= L2sq[i][*dp++];
+	for (i = 0; i < minor_count; i++) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + i*minor_inc));
+		a = gf_mul_alpha(_mm_xor_si128(a, x));
+		b = _mm_xor_si128(b, x);
+	}
+	_mm_storeu_si128((__m128i *)a_out, _mm_xor_si128(gf_mul_alpha(a), b));
+	_mm_storeu_si128((__m128i *)b_out, b);
+}
+#endif
 
-			/* MSB */
-			b ^= L2sq[i][*dp];
+/*
+ * Produce the parity bytes from the Horner sums of each column
+ */
+static void encode_L2_finish(const unsigned char *a, const unsigned char *b, int major_count,
+			     unsigned char *dest)
+{
+	int i;
+
+	for (i = 0; i < major_count; i++) {
+		dest[i] = ecc_b_lut[a[i]];
+		dest[i + major_count] = dest[i] ^ b[i];
+	}
+}
+
+static int encode_L2_Q(unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P + L2_Q]);
 
-			dp += 2*44-1;
+/*
+ * Q parity runs diagonally through the 26 rows of 43 words (the data plus
+ * the P parity): step i of column j is word i of row (j + i) % 26.
+ */
+static int encode_L2_Q(unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P + L2_Q])
+{
+	unsigned char *Q = inout + 4 + L2_RAW + 4 + 8 + L2_P;
+	unsigned char a[64], b[64];
+#ifdef __SSE2__
+	/* Gather the diagonals so that step i of every column is contiguous */
+	unsigned char diag[43][64];
+	int i, j;
+
+	for (i = 0; i < 26; i++) {
+		const unsigned char *src = inout + i*86;
+		int col = i;	/* column (diagonal) that word j of this row belongs to */
+		for (j = 0; j < 43; j++) {
+			memcpy(&diag[j][col*2], &src[j*2], 2);
+			if (--col < 0)
+				col = 25;
+		}
+	}
+	encode_L2_columns(&diag[0][0], 43, 64, a, b);
+	encode_L2_columns(&diag[0][16], 43, 64, a+16, b+16);
+	encode_L2_columns(&diag[0][32], 43, 64, a+32, b+32);
+	encode_L2_columns(&diag[0][36], 43, 64, a+36, b+36);
+#else
+	int i, j;
+
+	for (j = 0; j < 52; j++) {
+		unsigned char *dp = inout + (j >> 1) * 86 + (j & 1);
+		unsigned char ca = 0, cb = 0;
+		for (i = 0; i < 43; i++) {
+			ca = ecc_f_lut[ca ^ *dp];
+			cb ^= *dp;
+			dp += 2*44;
 			if (dp >= &inout[(4 + L2_RAW + 4 + 8 + L2_P)]) {
 				dp -= (4 + L2_RAW + 4 + 8 + L2_P);
-			} 
+			}
 		}
-		Q[0]      = a >> 8;
-		Q[26*2]   = a;
-		Q[1]      = b >> 8;
-		Q[26*2+1] = b;
-
-		Q += 2;
-		dps += 2*43;
+		a[j] = ecc_f_lut[ca] ^ cb;
+		b[j] = cb;
 	}
+#endif
+	encode_L2_finish(a, b, 52, Q);
 	return (0);
 }
 
 static int encode_L2_P(unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P]);
 
+/*
+ * P parity runs down the 43 columns of words, through 24 rows.
+ */
 static int encode_L2_P(unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P])
 {
-	unsigned char *dp;
-	unsigned char *P;
-	register int i;
-	int j;
-
-	P = inout + 4 + L2_RAW + 4 + 8;
-
-	for (j = 0; j < 43; j++) {
-		register unsigned short a;
-		register unsigned short b;
-
-		a = b = 0;
-		dp = inout;
-		for (i = 19; i < 43; i++) {
-
-			/* LSB */
-			a ^= L2sq[i][*dp++];
-
-			/* MSB */
-			b ^= L2sq[i][*dp];
-
-			dp += 2*43 -1;
+	unsigned char *P = inout + 4 + L2_RAW + 4 + 8;
+	unsigned char a[96], b[96];
+#ifdef __SSE2__
+	encode_L2_columns(inout, 24, 86, a, b);
+	encode_L2_columns(inout+16, 24, 86, a+16, b+16);
+	encode_L2_columns(inout+32, 24, 86, a+32, b+32);
+	encode_L2_columns(inout+48, 24, 86, a+48, b+48);
+	encode_L2_columns(inout+64, 24, 86, a+64, b+64);
+	encode_L2_columns(inout+70, 24, 86, a+70, b+70);
+#else
+	int i, j;
+
+	for (j = 0; j < 86; j++) {
+		unsigned char *dp = inout + j;
+		unsigned char ca = 0, cb = 0;
+		for (i = 0; i < 24; i++) {
+			ca = ecc_f_lut[ca ^ *dp];
+			cb ^= *dp;
+			dp += 2*43;
 		}
-		P[0]      = a >> 8;
-		P[43*2]   = a;
-		P[1]      = b >> 8;
-		P[43*2+1] = b;
-
-		P += 2;
-		inout += 2;
+		a[j] = ecc_f_lut[ca] ^ cb;
+		b[j] = cb;
 	}
+#endif
+	encode_L2_finish(a, b, 86, P);
 	return (0);
 }
 
@@ -231,8 +315,6 @@ int cd_build_address(unsigned char inout[], int sectortype, unsigned address)
 	return (0);
 }
 
-#include "edc_crctable.h"
-
 /*
  * Called with 2064, 2056 or 2332 byte difference - all dividable by 4.
  */
@@ -242,13 +324,20 @@ unsigned int build_edc(unsigned char inout[], int from, int upto)
 {
 	unsigned char *p = inout+from;
 	unsigned int result = 0;
-
-	upto -= from-1;
-	upto /= 4;
-	while (--upto >= 0) {
-		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
-		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
-		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
+	int len = upto - from + 1;
+
+	pthread_once(&edc_ecc_tables_once, init_edc_ecc_tables);
+
+	/* lxdream: slice-by-8, consuming 8 bytes per step */
+	for (; len >= 8; len -= 8, p += 8) {
+		unsigned int lo = result ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+		unsigned int hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((unsigned int)p[7] << 24);
+		result = EDC_slice[7][lo & 0xff] ^ EDC_slice[6][(lo >> 8) & 0xff] ^
+			EDC_slice[5][(lo >> 16) & 0xff] ^ EDC_slice[4][lo >> 24] ^
+			EDC_slice[3][hi & 0xff] ^ EDC_slice[2][(hi >> 8) & 0xff] ^
+			EDC_slice[1][(hi >> 16) & 0xff] ^ EDC_slice[0][hi >> 24];
+	}
+	while (--len >= 0) {
 		result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
 	}
 	return (result);
@@ -264,6 +353,8 @@ int do_encode_L2(unsigned char inout[(12 + 4 + L2_RAW+4+8+L2_Q+L2_P)],
 /*	SYNCPATTERN "\x00\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff" */
 #define SYNCPATTERN "\000\377\377\377\377\377\377\377\377\377\377"
 
+	pthread_once(&edc_ecc_tables_once, init_edc_ecc_tables);
+
 	/* supply initial sync pattern */
 	memcpy(inout, SYNCPATTERN, sizeof(SYNCPATTERN));
 
@@ -0,0 +1,211 @@
+/**
+ * $Id$
+ *
+ * Flat path index of an ISO9660 filesystem. The directory tree is read
+ * once (a directory extent per read), and every file is entered into a
+ * hash table by its full normalized path, so lookups need no further disc
+ * access. Only the primary volume descriptor is used - Dreamcast discs
+ * don't use Joliet or Rock Ridge names.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "drivers/cdrom/cdrom.h"
+#include "drivers/cdrom/isoindex.h"
+
+#define ISO_MAX_DEPTH 8
+#define ISO_MAX_DIR_SIZE (1024*1024)
+#define ISO_MAX_FILES 65536
+#define ISO_MAX_PATH 256
+
+struct iso_path_entry {
+    cdrom_lba_t lba;
+    uint32_t size;
+};
+
+struct iso_path_index {
+    GHashTable *files;          /* Normalized path => struct iso_path_entry */
+    GHashTable *visited;        /* Directory extents already read (build only) */
+    cdrom_disc_t disc;
+};
+
+static uint32_t iso_read_le32( const unsigned char *p )
+{
+    return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+/**
+ * Append a path component to a normalized path: upper-case, with any
+ * ";version" suffix and trailing '.' removed.
+ * @return the new length of the path, or 0 if it would exceed ISO_MAX_PATH.
+ */
+static size_t iso_path_append( char *path, size_t pos, const char *name, size_t len )
+{
+    size_t i;
+    for( i=0; i<len && name[i] != ';'; i++ );
+    len = i;
+    while( len > 0 && name[len-1] == '.' ) {
+        len--;
+    }
+    if( pos + len + 2 > ISO_MAX_PATH ) {
+        return 0;
+    }
+    path[pos++] = '/';
+    for( i=0; i<len; i++ ) {
+        path[pos++] = toupper((unsigned char)name[i]);
+    }
+    path[pos] = '\0';
+    return pos;
+}
+
+static gboolean iso_path_index_read_dir( iso_path_index_t index, const char *prefix, size_t prefix_len,
+                                         cdrom_lba_t lba, uint32_t size, int depth )
+{
+    char path[ISO_MAX_PATH];
+    cdrom_count_t count;
+    unsigned char *buf;
+    size_t length = 0;
+    cdrom_count_t sector;
+
+    if( size > ISO_MAX_DIR_SIZE || g_hash_table_size(index->files) >= ISO_MAX_FILES ||
+            g_hash_table_lookup( index->visited, GUINT_TO_POINTER(lba+1) ) != NULL ) {
+        /* Corrupt or looped directory - just ignore it */
+        return TRUE;
+    }
+    g_hash_table_insert( index->visited, GUINT_TO_POINTER(lba+1), GUINT_TO_POINTER(1) );
+
+    count = (size + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE;
+    buf = g_malloc( count * ISO_SECTOR_SIZE );
+    if( cdrom_disc_read_sectors( index->disc, lba, count, CDROM_READ_MODE2_FORM1|CDROM_READ_DATA,
+            buf, &length ) != CDROM_ERROR_OK || length != count * ISO_SECTOR_SIZE ) {
+        g_free( buf );
+        return FALSE;
+    }
+
+    for( sector = 0; sector < count; sector++ ) {
+        const unsigned char *p = buf + sector * ISO_SECTOR_SIZE;
+        const unsigned char *end = p + ISO_SECTOR_SIZE;
+        /* Records never cross a sector boundary, a zero length pads out the sector */
+        while( p + ISO_DR_MIN_LENGTH <= end && p[ISO_DR_LENGTH] >= ISO_DR_MIN_LENGTH &&
+                p + p[ISO_DR_LENGTH] <= end ) {
+            unsigned name_len = p[ISO_DR_NAME_LENGTH];
+            if( ISO_DR_NAME + name_len <= p[ISO_DR_LENGTH] &&
+                    !(name_len == 1 && (p[ISO_DR_NAME] == 0 || p[ISO_DR_NAME] == 1)) ) {
+                cdrom_lba_t extent = iso_read_le32( p + ISO_DR_EXTENT );
+                uint32_t extent_size = iso_read_le32( p + ISO_DR_SIZE );
+                size_t path_len;
+
+                memcpy( path, prefix, prefix_len );
+                path_len = iso_path_append( path, prefix_len, (const char *)p + ISO_DR_NAME, name_len );
+                if( path_len == 0 ) {
+                    /* Path too long to ever be looked up */
+                } else if( p[ISO_DR_FLAGS] & ISO_FLAG_DIRECTORY ) {
+                    if( depth < ISO_MAX_DEPTH &&
+                            !iso_path_index_read_dir( index, path, path_len, extent, extent_size, depth+1 ) ) {
+                        g_free( buf );
+                        return FALSE;
+                    }
+                } else {
+                    struct iso_path_entry *entry = g_malloc( sizeof(struct iso_path_entry) );
+                    entry->lba = extent;
+                    entry->size = extent_size;
+                    g_hash_table_insert( index->files, g_strdup( path ), entry );
+                }
+            }
+            p += p[ISO_DR_LENGTH];
+        }
+    }
+    g_free( buf );
+    return TRUE;
+}
+
+iso_path_index_t iso_path_index_new( cdrom_disc_t disc, cdrom_lba_t start, ERROR *err )
+{
+    unsigned char pvd[ISO_SECTOR_SIZE];
+    size_t length = 0;
+    const unsigned char *root = pvd + ISO_ROOT_RECORD;
+    iso_path_index_t index;
+    gboolean ok;
+
+    if( cdrom_disc_read_sectors( disc, start + ISO_PVD_SECTOR, 1, CDROM_READ_MODE2_FORM1|CDROM_READ_DATA,
+            pvd, &length ) != CDROM_ERROR_OK || length != ISO_SECTOR_SIZE ) {
+        SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to read ISO9660 volume descriptor" );
+        return NULL;
+    }
+    if( pvd[0] != 1 || memcmp( pvd+1, "CD001", 5 ) != 0 || root[ISO_DR_LENGTH] < ISO_DR_MIN_LENGTH ) {
+        SET_ERROR( err, LX_ERR_FILE_INVALID, "Invalid ISO9660 filesystem" );
+        return NULL;
+    }
+
+    index = g_malloc0( sizeof(struct iso_path_index) );
+    index->files = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+    index->visited = g_hash_table_new( g_direct_hash, g_direct_equal );
+    index->disc = disc;
+    ok = iso_path_index_read_dir( index, "", 0, iso_read_le32( root + ISO_DR_EXTENT ),
+                                  iso_read_le32( root + ISO_DR_SIZE ), 1 );
+    g_hash_table_destroy( index->visited );
+    index->visited = NULL;
+    index->disc = NULL;
+    if( !ok ) {
+        SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to read ISO9660 directory" );
+        iso_path_index_destroy( index );
+        return NULL;
+    }
+    return index;
+}
+
+void iso_path_index_destroy( iso_path_index_t index )
+{
+    if( index != NULL ) {
+        g_hash_table_destroy( index->files );
+        g_free( index );
+    }
+}
+
+gboolean iso_path_index_lookup( iso_path_index_t index, const char *path, cdrom_lba_t *lba, uint32_t *size )
+{
+    char key[ISO_MAX_PATH] = "";
+    size_t key_len = 0;
+    struct iso_path_entry *entry;
+
+    while( *path != '\0' ) {
+        const char *next;
+        while( *path == '/' ) {
+            path++;
+        }
+        for( next = path; *next != '\0' && *next != '/'; next++ );
+        if( next != path ) {
+            key_len = iso_path_append( key, key_len, path, next - path );
+            if( key_len == 0 ) {
+                return FALSE;
+            }
+        }
+        path = next;
+    }
+    entry = g_hash_table_lookup( index->files, key );
+    if( entry == NULL ) {
+        return FALSE;
+    }
+    *lba = entry->lba;
+    *size = entry->size;
+    return TRUE;
+}
+
+int iso_path_index_size( iso_path_index_t index )
+{
+    return g_hash_table_size( index->files );
+}
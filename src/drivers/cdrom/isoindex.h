@@ -0,0 +1,74 @@
+/**
+ * $Id$
+ *
+ * Flat path index of an ISO9660 filesystem, for looking up files by name
+ * without going through libisofs.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef cdrom_isoindex_H
+#define cdrom_isoindex_H 1
+
+#include <glib.h>
+#include "drivers/cdrom/cdrom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ISO_SECTOR_SIZE 2048
+#define ISO_PVD_SECTOR 16
+#define ISO_ROOT_RECORD 156     /* Offset of the root directory record in the PVD */
+
+/* Directory record fields */
+#define ISO_DR_LENGTH 0
+#define ISO_DR_EXTENT 2         /* Both-endian, LE first */
+#define ISO_DR_SIZE 10          /* Both-endian, LE first */
+#define ISO_DR_FLAGS 25
+#define ISO_DR_NAME_LENGTH 32
+#define ISO_DR_NAME 33
+#define ISO_DR_MIN_LENGTH 34
+
+#define ISO_FLAG_DIRECTORY 0x02
+
+typedef struct iso_path_index *iso_path_index_t;
+
+/**
+ * Read the entire directory tree of the ISO9660 filesystem starting at
+ * the given sector, and build an index of every file in it.
+ * @return the new index, or NULL if there's no valid filesystem there.
+ */
+iso_path_index_t iso_path_index_new( cdrom_disc_t disc, cdrom_lba_t start, ERROR *err );
+
+void iso_path_index_destroy( iso_path_index_t index );
+
+/**
+ * Find the file with the given absolute path (eg "/1ST_READ.BIN"). Matching
+ * is case-insensitive, and ignores the ";1" version suffix.
+ * @param lba Set to the first sector of the file
+ * @param size Set to the length of the file in bytes
+ * @return TRUE if the file was found, otherwise FALSE.
+ */
+gboolean iso_path_index_lookup( iso_path_index_t index, const char *path, cdrom_lba_t *lba, uint32_t *size );
+
+/**
+ * @return the number of files in the index.
+ */
+int iso_path_index_size( iso_path_index_t index );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !cdrom_isoindex_H */
@@ -18,12 +18,16 @@
 
 #include <sys/stat.h>
 #include <glib.h>
+#include <pthread.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include "lxpaths.h"
 #include "drivers/cdrom/sector.h"
@@ -218,6 +222,82 @@ static sector_mode_t identify_sector( sector_mode_t raw_mode, unsigned char *buf
     }
 }
 
+/**
+ * Cache of raw sectors synthesized from data-only sources, so that repeated
+ * raw reads of the same sector don't regenerate the EDC/ECC each time.
+ * Direct-mapped by LBA, and only allocated while enabled.
+ */
+#define RAW_SECTOR_CACHE_SIZE 256 /* Must be a power of 2 */
+
+struct raw_sector_cache_entry {
+    sector_source_t device;
+    cdrom_lba_t lba;
+    unsigned char data[CDROM_MAX_SECTOR_SIZE];
+};
+
+static struct {
+    pthread_mutex_t lock;
+    struct raw_sector_cache_entry *entries;
+} raw_sector_cache = { PTHREAD_MUTEX_INITIALIZER, NULL };
+
+#define RAW_CACHE_ENTRY(lba) (&raw_sector_cache.entries[(lba)&(RAW_SECTOR_CACHE_SIZE-1)])
+
+void sector_source_set_raw_cache_enabled( gboolean enabled )
+{
+    pthread_mutex_lock( &raw_sector_cache.lock );
+    if( enabled && raw_sector_cache.entries == NULL ) {
+        raw_sector_cache.entries = g_malloc0( RAW_SECTOR_CACHE_SIZE * sizeof(struct raw_sector_cache_entry) );
+    } else if( !enabled ) {
+        g_free( raw_sector_cache.entries );
+        raw_sector_cache.entries = NULL;
+    }
+    pthread_mutex_unlock( &raw_sector_cache.lock );
+}
+
+static gboolean raw_sector_cache_lookup( sector_source_t device, cdrom_lba_t lba, unsigned char *buf )
+{
+    gboolean found = FALSE;
+    pthread_mutex_lock( &raw_sector_cache.lock );
+    if( raw_sector_cache.entries != NULL ) {
+        struct raw_sector_cache_entry *entry = RAW_CACHE_ENTRY(lba);
+        if( entry->device == device && entry->lba == lba ) {
+            memcpy( buf, entry->data, CDROM_MAX_SECTOR_SIZE );
+            found = TRUE;
+        }
+    }
+    pthread_mutex_unlock( &raw_sector_cache.lock );
+    return found;
+}
+
+static void raw_sector_cache_store( sector_source_t device, cdrom_lba_t lba, unsigned char *buf )
+{
+    pthread_mutex_lock( &raw_sector_cache.lock );
+    if( raw_sector_cache.entries != NULL ) {
+        struct raw_sector_cache_entry *entry = RAW_CACHE_ENTRY(lba);
+        entry->device = device;
+        entry->lba = lba;
+        memcpy( entry->data, buf, CDROM_MAX_SECTOR_SIZE );
+    }
+    pthread_mutex_unlock( &raw_sector_cache.lock );
+}
+
+/**
+ * Drop any cached sectors belonging to the device (which is being destroyed)
+ */
+static void raw_sector_cache_invalidate( sector_source_t device )
+{
+    int i;
+    pthread_mutex_lock( &raw_sector_cache.lock );
+    if( raw_sector_cache.entries != NULL ) {
+        for( i=0; i<RAW_SECTOR_CACHE_SIZE; i++ ) {
+            if( raw_sector_cache.entries[i].device == device ) {
+                raw_sector_cache.entries[i].device = NULL;
+            }
+        }
+    }
+    pthread_mutex_unlock( &raw_sector_cache.lock );
+}
+
 /**
  * Read a single raw sector from the device. Generate sync, ECC/EDC data etc where
  * necessary.
@@ -226,6 +306,19 @@ static cdrom_error_t read_raw_sector( sector_source_t device, cdrom_lba_t lba, u
 {
     cdrom_error_t err;
 
+    switch( device->mode ) {
+    case SECTOR_MODE1:
+    case SECTOR_MODE2_FORMLESS:
+    case SECTOR_MODE2_FORM1:
+    case SECTOR_MODE2_FORM2:
+        if( raw_sector_cache_lookup( device, lba, buf ) ) {
+            return CDROM_ERROR_OK;
+        }
+        break;
+    default:
+        break;
+    }
+
     switch( device->mode ) {
     case SECTOR_RAW_XA:
     case SECTOR_RAW_NONXA:
@@ -239,6 +332,7 @@ static cdrom_error_t read_raw_sector( sector_source_t device, cdrom_lba_t lba, u
         err = device->read_blocks(device, lba, 1, &buf[16]);
         if( err == CDROM_ERROR_OK ) {
             do_encode_L2( buf, device->mode, lba );
+            raw_sector_cache_store( device, lba, buf );
         }
         return err;
     case SECTOR_MODE2_FORM1:
@@ -246,6 +340,7 @@ static cdrom_error_t read_raw_sector( sector_source_t device, cdrom_lba_t lba, u
         err = device->read_blocks(device, lba, 1, &buf[24]);
         if( err == CDROM_ERROR_OK ) {
             do_encode_L2( buf, device->mode, lba );
+            raw_sector_cache_store( device, lba, buf );
         }
         return err;
     case SECTOR_MODE2_FORM2:
@@ -253,6 +348,7 @@ static cdrom_error_t read_raw_sector( sector_source_t device, cdrom_lba_t lba, u
         err = device->read_blocks(device, lba, 1, &buf[24]);
         if( err == CDROM_ERROR_OK ) {
             do_encode_L2( buf, device->mode, lba );
+            raw_sector_cache_store( device, lba, buf );
         }
         return err;
     default:
@@ -396,6 +492,7 @@ cdrom_error_t default_sector_source_read_sectors( sector_source_t device,
 void default_sector_source_destroy( sector_source_t device )
 {
     assert( device != NULL && device->ref_count == 0 );
+    raw_sector_cache_invalidate( device );
     device->tag = 0;
     g_free( device );
 }
@@ -431,19 +528,62 @@ sector_source_t null_sector_source_new( sector_mode_t mode, cdrom_count_t size )
 }
 
 /************************ File device implementation *************************/
+/*
+ * Image files are mapped into memory where possible, so that a read is just
+ * a memcpy out of the page cache (or no copy at all - see
+ * file_sector_source_get_data). Anything that can't be mapped (devices,
+ * files that are still growing such as the tmpfile source below, or large
+ * images on 32-bit hosts) falls back to pread(). Neither path touches the
+ * FILE position, so reads are safe from multiple threads, and the image
+ * parsers can continue to use the FILE for their own purposes.
+ */
 typedef struct file_sector_source {
     struct sector_source dev;
     FILE *file;
-    uint32_t offset; /* offset in file where source begins */
+    uint64_t offset; /* offset in file where source begins */
     sector_source_t ref; /* Parent source reference */
     gboolean closeOnDestroy;
+    unsigned char *map; /* Mapping of the entire file, or NULL to use pread */
+    uint64_t map_size;
+    gboolean ownMap; /* TRUE if the mapping belongs to this source rather than ref */
 } *file_sector_source_t;
 
+static gboolean file_sector_map_enabled = TRUE;
+
+void file_sector_source_set_map_enabled( gboolean enabled )
+{
+    file_sector_map_enabled = enabled;
+}
+
+/**
+ * Map the entire file read-only, if it's a regular file that fits in the
+ * address space.
+ */
+static void file_sector_source_map( file_sector_source_t fdev )
+{
+    struct stat st;
+
+    if( !file_sector_map_enabled || fdev->file == NULL || fstat( fileno(fdev->file), &st ) != 0 ||
+            !S_ISREG(st.st_mode) || st.st_size <= 0 || (uint64_t)st.st_size > (uint64_t)SIZE_MAX ) {
+        return;
+    }
+    void *map = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(fdev->file), 0 );
+    if( map != MAP_FAILED ) {
+        fdev->map = map;
+        fdev->map_size = st.st_size;
+        fdev->ownMap = TRUE;
+    }
+}
+
 void file_sector_source_destroy( sector_source_t dev )
 {
     assert( IS_SECTOR_SOURCE_TYPE(dev,FILE_SECTOR_SOURCE) );
     file_sector_source_t fdev = (file_sector_source_t)dev;
 
+    if( fdev->ownMap && fdev->map != NULL ) {
+        munmap( fdev->map, (size_t)fdev->map_size );
+    }
+    fdev->map = NULL;
     if( fdev->closeOnDestroy && fdev->file != NULL ) {
         fclose( fdev->file );
     }
@@ -457,21 +597,38 @@ cdrom_error_t file_sector_source_read( sector_source_t dev, cdrom_lba_t lba, cdr
     assert( IS_SECTOR_SOURCE_TYPE(dev,FILE_SECTOR_SOURCE) );
     file_sector_source_t fdev = (file_sector_source_t)dev;
 
-    uint32_t off = fdev->offset + lba * CDROM_SECTOR_SIZE(dev->mode);
-    uint32_t size = block_count * CDROM_SECTOR_SIZE(dev->mode);
-    fseek( fdev->file, off, SEEK_SET );
-
-    size_t len = fread( buf, 1, size, fdev->file );
-    if( len == -1 ) {
-        return CDROM_ERROR_READERROR;
-    } else if( len < size ) {
-        /* zero-fill */
-        memset( buf + len, 0, size-len );
+    uint64_t off = fdev->offset + (uint64_t)lba * CDROM_SECTOR_SIZE(dev->mode);
+    size_t size = (size_t)block_count * CDROM_SECTOR_SIZE(dev->mode);
+
+    if( fdev->map != NULL ) {
+        if( off < fdev->map_size ) {
+            size_t len = fdev->map_size - off < size ? (size_t)(fdev->map_size - off) : size;
+            memcpy( buf, fdev->map + off, len );
+            buf += len;
+            size -= len;
+        }
+    } else {
+        int fd = fileno(fdev->file);
+        while( size > 0 ) {
+            ssize_t len = pread( fd, buf, size, (off_t)off );
+            if( len == -1 ) {
+                if( errno == EINTR )
+                    continue;
+                return CDROM_ERROR_READERROR;
+            } else if( len == 0 ) {
+                break;
+            }
+            buf += len;
+            off += len;
+            size -= len;
+        }
     }
+    /* zero-fill past end of file */
+    memset( buf, 0, size );
     return CDROM_ERROR_OK;
 }
 
-sector_source_t file_sector_source_new( FILE *f, sector_mode_t mode, uint32_t offset,
+sector_source_t file_sector_source_new( FILE *f, sector_mode_t mode, uint64_t offset,
                                         cdrom_count_t sector_count, gboolean closeOnDestroy )
 {
     if( sector_count == FILE_SECTOR_FULL_FILE ) {
@@ -493,6 +650,10 @@ sector_source_t file_sector_source_new( FILE *f, sector_mode_t mode, uint32_t of
     dev->offset = offset;
     dev->closeOnDestroy = closeOnDestroy;
     dev->ref = NULL;
+    dev->map = NULL;
+    dev->map_size = 0;
+    dev->ownMap = FALSE;
+    file_sector_source_map( dev );
     return sector_source_init( &dev->dev, FILE_SECTOR_SOURCE, mode,  sector_count, file_sector_source_read, file_sector_source_destroy );
 }
 
@@ -501,7 +662,7 @@ sector_source_t file_sector_source_new_full( FILE *f, sector_mode_t mode, gboole
     return file_sector_source_new( f, mode, 0, FILE_SECTOR_FULL_FILE, closeOnDestroy );
 }
 
-sector_source_t file_sector_source_new_filename( const gchar *filename, sector_mode_t mode, uint32_t offset,
+sector_source_t file_sector_source_new_filename( const gchar *filename, sector_mode_t mode, uint64_t offset,
                                                  cdrom_count_t sector_count )
 {
     int fd = open( filename, O_RDONLY|O_NONBLOCK );
@@ -517,16 +678,35 @@ sector_source_t file_sector_source_new_filename( const gchar *filename, sector_m
     }
 }
 
-sector_source_t file_sector_source_new_source( sector_source_t ref, sector_mode_t mode, uint32_t offset,
+sector_source_t file_sector_source_new_source( sector_source_t ref, sector_mode_t mode, uint64_t offset,
                                                cdrom_count_t sector_count )
 {
     assert( IS_SECTOR_SOURCE_TYPE(ref,FILE_SECTOR_SOURCE) );
     file_sector_source_t fref = (file_sector_source_t)ref;
 
-    sector_source_t source = file_sector_source_new( fref->file, mode, offset, sector_count, FALSE );
-    ((file_sector_source_t)source)->ref = ref;
+    file_sector_source_t dev = g_malloc(sizeof(struct file_sector_source));
+    dev->file = fref->file;
+    dev->offset = offset;
+    dev->closeOnDestroy = FALSE;
+    dev->ref = ref;
+    dev->map = fref->map;
+    dev->map_size = fref->map_size;
+    dev->ownMap = FALSE;
     sector_source_ref(ref);
-    return source;
+    return sector_source_init( &dev->dev, FILE_SECTOR_SOURCE, mode, sector_count, file_sector_source_read, file_sector_source_destroy );
+}
+
+const unsigned char *file_sector_source_get_data( sector_source_t ref, cdrom_lba_t lba, cdrom_count_t block_count )
+{
+    assert( IS_SECTOR_SOURCE_TYPE(ref,FILE_SECTOR_SOURCE) );
+    file_sector_source_t fref = (file_sector_source_t)ref;
+
+    uint64_t off = fref->offset + (uint64_t)lba * CDROM_SECTOR_SIZE(ref->mode);
+    uint64_t size = (uint64_t)block_count * CDROM_SECTOR_SIZE(ref->mode);
+    if( fref->map == NULL || lba + block_count > ref->size || off + size > fref->map_size ) {
+        return NULL;
+    }
+    return fref->map + off;
 }
 
 FILE *file_sector_source_get_file( sector_source_t ref )
@@ -536,6 +716,13 @@ FILE *file_sector_source_get_file( sector_source_t ref )
     return fref->file;
 }
 
+uint64_t file_sector_source_get_offset( sector_source_t ref )
+{
+    assert( IS_SECTOR_SOURCE_TYPE(ref,FILE_SECTOR_SOURCE) );
+    file_sector_source_t fref = (file_sector_source_t)ref;
+    return fref->offset;
+}
+
 int file_sector_source_get_fd( sector_source_t ref )
 {
     return fileno(file_sector_source_get_file(ref));
@@ -35,7 +35,8 @@ typedef enum {
     FILE_SECTOR_SOURCE,
     MEM_SECTOR_SOURCE,
     DISC_SECTOR_SOURCE,
-    TRACK_SECTOR_SOURCE
+    TRACK_SECTOR_SOURCE,
+    COMPRESSED_SECTOR_SOURCE
 } sector_source_type_t;
 
 typedef cdrom_error_t (*sector_source_read_fn_t)(sector_source_t, cdrom_lba_t, cdrom_count_t, unsigned char *outbuf);
@@ -90,14 +91,22 @@ sector_source_t null_sector_source_new( sector_mode_t mode, cdrom_count_t size )
 #define FILE_SECTOR_FULL_FILE ((cdrom_count_t)-1)
 
 /**
- * File reader. Last block is 0-padded.
+ * File reader. Last block is 0-padded. Regular files are memory-mapped where
+ * possible (falling back to pread otherwise), and may be read from multiple
+ * threads concurrently.
  */
 sector_source_t file_sector_source_new_filename( const gchar *filename, sector_mode_t mode,
-                                                 uint32_t offset, cdrom_count_t sector_count );
-sector_source_t file_sector_source_new( FILE *f, sector_mode_t mode, uint32_t offset, cdrom_count_t sector_count,
+                                                 uint64_t offset, cdrom_count_t sector_count );
+sector_source_t file_sector_source_new( FILE *f, sector_mode_t mode, uint64_t offset, cdrom_count_t sector_count,
                                                 gboolean closeOnDestroy );
 sector_source_t file_sector_source_new_full( FILE *f, sector_mode_t mode, gboolean closeOnDestroy );
 
+/**
+ * Enable or disable memory-mapping for file sources created after this
+ * call (default enabled). Mostly useful for benchmarking the pread path.
+ */
+void file_sector_source_set_map_enabled( gboolean enabled );
+
 /**
  * Temp-file creator - initially empty. Creates a file in the system temp dir,
  * unlinked on destruction or program exit.
@@ -108,9 +117,17 @@ sector_source_t tmpfile_sector_source_new(  sector_mode_t mode );
  * Construct a file source that shares its file descriptor with another
  * file source.
  */
-sector_source_t file_sector_source_new_source( sector_source_t ref, sector_mode_t mode, uint32_t offset,
+sector_source_t file_sector_source_new_source( sector_source_t ref, sector_mode_t mode, uint64_t offset,
                                                cdrom_count_t sector_count );
 
+/**
+ * Return a pointer directly to the given blocks in the source's file mapping,
+ * or NULL if the source isn't mapped (in which case the caller should use
+ * sector_source_read instead). The data remains valid for as long as the
+ * source is referenced.
+ */
+const unsigned char *file_sector_source_get_data( sector_source_t ref, cdrom_lba_t lba, cdrom_count_t block_count );
+
 /**
  * Change the value of the source's closeOnDestroy flag
  */
@@ -121,6 +138,11 @@ void file_sector_source_set_close_on_destroy( sector_source_t ref, gboolean clos
  */
 FILE *file_sector_source_get_file( sector_source_t ref );
 
+/**
+ * Retrieve the byte offset of the source within its file
+ */
+uint64_t file_sector_source_get_offset( sector_source_t ref );
+
 /**
  * Retrieve the source's underlying file descriptor
  */
@@ -167,6 +189,14 @@ cdrom_error_t sector_source_read( sector_source_t device, cdrom_lba_t lba, cdrom
 cdrom_error_t sector_source_read_sectors( sector_source_t device, cdrom_lba_t lba, cdrom_count_t block_count,
                                           cdrom_read_mode_t mode, unsigned char *buf, size_t *length );
 
+/**
+ * Enable or disable caching of raw sectors synthesized from data-only
+ * sources (ie the generated sync, header and EDC/ECC fields). Repeated raw
+ * reads of recently-read sectors are then served from the cache. Disabled
+ * by default.
+ */
+void sector_source_set_raw_cache_enabled( gboolean enabled );
+
 /***** Internals for sector source implementations *****/
 
 /**
@@ -25,6 +25,7 @@
 #define GL_GLEXT_PROTOTYPES 1
 
 #include <stdlib.h>
+#include <string.h>
 #include "lxdream.h"
 #include "display.h"
 #include "drivers/video_gl.h"
@@ -44,6 +45,9 @@ static void gl_fbo_load_frame_buffer( frame_buffer_t frame, render_buffer_t buff
 static void gl_fbo_display_blank( uint32_t colour );
 static gboolean gl_fbo_test_framebuffer( );
 static gboolean gl_fbo_read_render_buffer( unsigned char *target, render_buffer_t buffer, int rowstride, int format );
+#if defined(GL_PIXEL_PACK_BUFFER_ARB) && !defined(HAVE_GLES2)
+static void gl_fbo_start_read_render_buffer( render_buffer_t buffer, int rowstride, int format );
+#endif
 
 extern uint32_t video_width, video_height;
 
@@ -118,6 +122,11 @@ void gl_fbo_init( display_driver_t driver )
     driver->load_frame_buffer = gl_fbo_load_frame_buffer;
     driver->display_blank = gl_fbo_display_blank;
     driver->read_render_buffer = gl_fbo_read_render_buffer;
+#if defined(GL_PIXEL_PACK_BUFFER_ARB) && !defined(HAVE_GLES2)
+    if( isGLPixelBufferSupported() ) {
+        driver->start_read_render_buffer = gl_fbo_start_read_render_buffer;
+    }
+#endif
 
     gl_fbo_test_framebuffer();
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -299,6 +308,12 @@ static void gl_fbo_detach_render_buffer( render_buffer_t buffer )
 static void gl_fbo_destroy_render_buffer( render_buffer_t buffer )
 {
     gl_fbo_detach_render_buffer( buffer );
+#if defined(GL_PIXEL_PACK_BUFFER_ARB) && !defined(HAVE_GLES2)
+    if( buffer->pbo_id != 0 ) {
+        GLuint pbo = buffer->pbo_id;
+        glDeleteBuffersARB( 1, &pbo );
+    }
+#endif
 
     if( buffer->buf_id != buffer->tex_id ) {
         // If tex_id was set at buffer creation, we don't own the texture.
@@ -313,6 +328,7 @@ static void gl_fbo_destroy_render_buffer( render_buffer_t buffer )
 
 static gboolean gl_fbo_set_render_target( render_buffer_t buffer )
 {
+    buffer->readback_pending = FALSE;
     int fb = gl_fbo_get_framebuffer( buffer->width, buffer->height );
     gl_fbo_attach_texture( fb, buffer->buf_id );
     /* setup the gl context */
@@ -341,6 +357,7 @@ static void gl_fbo_display_render_buffer( render_buffer_t buffer )
 
 static void gl_fbo_load_frame_buffer( frame_buffer_t frame, render_buffer_t buffer )
 {
+    buffer->readback_pending = FALSE;
     gl_fbo_detach();
     gl_frame_buffer_to_tex( frame, buffer->buf_id );
 }
@@ -363,9 +380,81 @@ void gl_fbo_detach()
 #endif
 }    
 
+#if defined(GL_PIXEL_PACK_BUFFER_ARB) && !defined(HAVE_GLES2)
+/**
+ * Kick off a glReadPixels into the buffer's PBO. This returns as soon as the
+ * transfer is queued - the wait (if any) happens when the PBO is mapped in
+ * gl_fbo_read_render_buffer.
+ */
+static void gl_fbo_start_read_render_buffer( render_buffer_t buffer, int rowstride, int format )
+{
+    int bpp = colour_formats[format].bpp;
+    int fb;
+
+    if( rowstride != buffer->width * bpp ) {
+        return; /* Only tightly packed readbacks are supported */
+    }
+    if( buffer->pbo_id == 0 ) {
+        GLuint pbo;
+        glGenBuffersARB( 1, &pbo );
+        buffer->pbo_id = pbo;
+    }
+    fb = gl_fbo_get_framebuffer( buffer->width, buffer->height );
+    gl_fbo_attach_texture( fb, buffer->buf_id );
+    glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, buffer->pbo_id );
+    glBufferDataARB( GL_PIXEL_PACK_BUFFER_ARB, buffer->width * buffer->height * bpp,
+                     NULL, GL_STREAM_READ_ARB );
+    glReadPixels( 0, 0, buffer->width, buffer->height, colour_formats[format].format,
+                  colour_formats[format].type, NULL );
+    glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+    buffer->readback_pending = gl_check_error( "Starting render buffer readback" );
+    buffer->readback_format = format;
+    gl_fbo_detach_render_buffer( buffer );
+}
+
+/**
+ * Complete a readback started by gl_fbo_start_read_render_buffer, if there
+ * is one that matches the requested layout.
+ * @return TRUE if the target was filled, otherwise FALSE.
+ */
+static gboolean gl_fbo_finish_read_render_buffer( unsigned char *target, render_buffer_t buffer,
+                                                  int rowstride, int format )
+{
+    int size = buffer->width * buffer->height * colour_formats[format].bpp;
+    gboolean result = FALSE;
+    void *data;
+
+    if( !buffer->readback_pending ) {
+        return FALSE;
+    }
+    buffer->readback_pending = FALSE;
+    if( format != buffer->readback_format || rowstride != buffer->width * colour_formats[format].bpp ) {
+        return FALSE;
+    }
+    glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, buffer->pbo_id );
+    data = glMapBufferARB( GL_PIXEL_PACK_BUFFER_ARB, GL_READ_ONLY_ARB );
+    if( data != NULL ) {
+        memcpy( target, data, size );
+        glUnmapBufferARB( GL_PIXEL_PACK_BUFFER_ARB );
+        result = TRUE;
+    }
+    glBindBufferARB( GL_PIXEL_PACK_BUFFER_ARB, 0 );
+    return result;
+}
+#else
+static gboolean gl_fbo_finish_read_render_buffer( unsigned char *target, render_buffer_t buffer,
+                                                  int rowstride, int format )
+{
+    return FALSE;
+}
+#endif
+
 static gboolean gl_fbo_read_render_buffer( unsigned char *target, render_buffer_t buffer, 
                                            int rowstride, int format )
 {
+    if( gl_fbo_finish_read_render_buffer( target, buffer, rowstride, format ) ) {
+        return TRUE;
+    }
     int fb = gl_fbo_get_framebuffer( buffer->width, buffer->height );
     gl_fbo_attach_texture( fb, buffer->buf_id );
     return gl_read_render_buffer( target, buffer, rowstride, format );
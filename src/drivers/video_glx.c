@@ -45,6 +45,7 @@ static int glx_depth_bits = 0;
 
 static void video_glx_swap_buffers( void );
 static void video_glx_print_info( FILE *out );
+static gboolean video_glx_set_context_current( gboolean current );
 
 /* Prototypes for pbuffer support methods */
 static void glx_pbuffer_init( display_driver_t driver );
@@ -247,6 +248,10 @@ gboolean video_glx_init_driver( display_driver_t driver )
     if( driver->create_render_buffer == NULL ) {
         /* If we get here, pbuffers are supported and FBO didn't work */
         glx_pbuffer_init(driver);
+    } else {
+        /* FBOs only ever need the window drawable, so the context can be
+         * moved to another thread as a unit */
+        driver->set_context_current = video_glx_set_context_current;
     }
     return TRUE;
 }
@@ -297,6 +302,15 @@ void video_glx_make_window_current( void )
     glXMakeCurrent( video_x11_display, video_x11_window, glx_context );
 }
 
+static gboolean video_glx_set_context_current( gboolean current )
+{
+    if( current ) {
+        return glXMakeCurrent( video_x11_display, video_x11_window, glx_context );
+    } else {
+        return glXMakeCurrent( video_x11_display, None, NULL );
+    }
+}
+
 
 // Pbuffer support
 
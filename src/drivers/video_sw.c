@@ -0,0 +1,184 @@
+/**
+ * $Id$
+ *
+ * Software video driver - renders scenes with the software PVR2 renderer
+ * into system memory, without producing any visible output. Useful for
+ * headless operation where the rendered frames still need to be written
+ * back to video RAM (ie render-to-texture) or captured.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include "display.h"
+#include "drivers/video_gl.h"
+#include "pvr2/swrender.h"
+
+static gboolean video_sw_init( void );
+
+static render_buffer_t video_sw_create_render_buffer( uint32_t width, uint32_t height, GLuint tex_id )
+{
+    sw_render_buffer_t buffer = g_malloc0( sizeof(struct sw_render_buffer) );
+    buffer->buffer.width = width;
+    buffer->buffer.height = height;
+    buffer->buffer.tex_id = tex_id;
+    buffer->pixels = g_malloc0( width * height * sizeof(uint32_t) );
+    return &buffer->buffer;
+}
+
+static void video_sw_destroy_render_buffer( render_buffer_t buffer )
+{
+    sw_render_buffer_t swbuf = (sw_render_buffer_t)buffer;
+    g_free( swbuf->pixels );
+    g_free( swbuf );
+}
+
+static gboolean video_sw_set_render_target( render_buffer_t buffer )
+{
+    return TRUE;
+}
+
+static void video_sw_finish_render( render_buffer_t buffer )
+{
+}
+
+static void video_sw_display_render_buffer( render_buffer_t buffer )
+{
+}
+
+/**
+ * Convert a single pixel in the given colour format to 0xAARRGGBB
+ */
+static uint32_t video_sw_read_pixel( const unsigned char *p, int format )
+{
+    uint32_t v, r, g, b, a;
+    switch( format ) {
+    case COLFMT_BGRA1555:
+        v = *(uint16_t *)p;
+        a = (v & 0x8000) ? 0xFF : 0;
+        r = (v >> 10) & 0x1F; g = (v >> 5) & 0x1F; b = v & 0x1F;
+        return (a<<24) | (((r<<3)|(r>>2))<<16) | (((g<<3)|(g>>2))<<8) | ((b<<3)|(b>>2));
+    case COLFMT_RGB565:
+        v = *(uint16_t *)p;
+        r = v >> 11; g = (v >> 5) & 0x3F; b = v & 0x1F;
+        return 0xFF000000 | (((r<<3)|(r>>2))<<16) | (((g<<2)|(g>>4))<<8) | ((b<<3)|(b>>2));
+    case COLFMT_BGRA4444:
+        v = *(uint16_t *)p;
+        return ((v & 0xF000) * 0x11000) | ((v & 0x0F00) * 0x1100) | ((v & 0x00F0) * 0x110) | ((v & 0x000F) * 0x11);
+    case COLFMT_BGR888:
+        return 0xFF000000 | (p[2]<<16) | (p[1]<<8) | p[0];
+    case COLFMT_RGB888:
+        return 0xFF000000 | (p[0]<<16) | (p[1]<<8) | p[2];
+    case COLFMT_BGR0888:
+        return 0xFF000000 | *(uint32_t *)p;
+    default:
+        return *(uint32_t *)p;
+    }
+}
+
+static void video_sw_write_pixel( unsigned char *p, uint32_t v, int format )
+{
+    switch( format ) {
+    case COLFMT_BGRA1555:
+        *(uint16_t *)p = ((v >> 16) & 0x8000) | ((v >> 9) & 0x7C00) | ((v >> 6) & 0x03E0) | ((v >> 3) & 0x001F);
+        break;
+    case COLFMT_RGB565:
+        *(uint16_t *)p = ((v >> 8) & 0xF800) | ((v >> 5) & 0x07E0) | ((v >> 3) & 0x001F);
+        break;
+    case COLFMT_BGRA4444:
+        *(uint16_t *)p = ((v >> 16) & 0xF000) | ((v >> 12) & 0x0F00) | ((v >> 8) & 0x00F0) | ((v >> 4) & 0x000F);
+        break;
+    case COLFMT_BGR888:
+        p[0] = v; p[1] = v >> 8; p[2] = v >> 16;
+        break;
+    case COLFMT_RGB888:
+        p[0] = v >> 16; p[1] = v >> 8; p[2] = v;
+        break;
+    default:
+        *(uint32_t *)p = v;
+        break;
+    }
+}
+
+static gboolean video_sw_read_render_buffer( unsigned char *target,
+                                             render_buffer_t buffer,
+                                             int rowstride, int format )
+{
+    sw_render_buffer_t swbuf = (sw_render_buffer_t)buffer;
+    int bpp = colour_formats[format].bpp;
+    int x, y;
+
+    for( y=0; y<buffer->height; y++ ) {
+        uint32_t *in = swbuf->pixels + y*buffer->width;
+        unsigned char *out = target + y*rowstride;
+        if( format == COLFMT_BGRA8888 ) {
+            memcpy( out, in, buffer->width * sizeof(uint32_t) );
+        } else {
+            for( x=0; x<buffer->width; x++ ) {
+                video_sw_write_pixel( out + x*bpp, in[x], format );
+            }
+        }
+    }
+    return TRUE;
+}
+
+static void video_sw_load_frame_buffer( frame_buffer_t frame,
+                                        render_buffer_t buffer )
+{
+    sw_render_buffer_t swbuf = (sw_render_buffer_t)buffer;
+    int bpp = colour_formats[frame->colour_format].bpp;
+    int width = MIN(frame->width, buffer->width);
+    int height = MIN(frame->height, buffer->height);
+    int x, y;
+
+    for( y=0; y<height; y++ ) {
+        unsigned char *in = frame->data + y*frame->rowstride;
+        uint32_t *out = swbuf->pixels + y*buffer->width;
+        for( x=0; x<width; x++ ) {
+            out[x] = video_sw_read_pixel( in + x*bpp, frame->colour_format );
+        }
+    }
+}
+
+static void video_sw_display_blank( uint32_t colour )
+{
+}
+
+static void video_sw_swap_buffers(void)
+{
+}
+
+struct display_driver display_sw_driver = {
+        "soft",
+        N_("Software renderer (no video output)"),
+        video_sw_init,
+        NULL,
+        NULL,
+        NULL,
+        NULL,
+        video_sw_create_render_buffer,
+        video_sw_destroy_render_buffer,
+        video_sw_set_render_target,
+        video_sw_finish_render,
+        video_sw_load_frame_buffer,
+        video_sw_display_render_buffer,
+        video_sw_display_blank,
+        video_sw_swap_buffers,
+        video_sw_read_render_buffer,
+        NULL };
+
+static gboolean video_sw_init( void )
+{
+    gl_vbo_fallback_init(&display_sw_driver);
+    return TRUE;
+}
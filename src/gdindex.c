@@ -0,0 +1,635 @@
+/**
+ * $Id$
+ *
+ * Persistent disc image index. The index file is a flat table that is
+ * mapped directly into memory, laid out as:
+ *   header
+ *   records (sorted by path hash, for binary search)
+ *   track records (referenced by index from each record)
+ *   string table (NUL-terminated paths)
+ * It's stored in host byte order - it's purely a cache, so if the header
+ * doesn't match it's simply discarded and rebuilt. Updates are written to a
+ * temporary file which is then renamed over the top of the index, so
+ * readers never see a partially written file.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "lxpaths.h"
+#include "bootstrap.h"
+#include "workpool.h"
+#include "gdindex.h"
+#include "gdrom/gdrom.h"
+
+#define GDROM_INDEX_FILENAME "discindex"
+
+/**
+ * An image being (re)indexed
+ */
+struct gdrom_index_scan {
+    gchar *path;
+    gboolean valid;
+    struct gdrom_index_record record;
+    struct gdrom_index_track *tracks;
+};
+
+/**
+ * An entry to be written to a new index, either carried over from the
+ * current index or from a scan.
+ */
+struct gdrom_index_item {
+    const char *path;
+    const struct gdrom_index_record *record;
+    const struct gdrom_index_track *tracks;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    gchar *filename;
+    gboolean loaded;
+    unsigned char *map;
+    size_t map_size;
+    const struct gdrom_index_header *header;
+    const struct gdrom_index_record *records;
+    const struct gdrom_index_track *tracks;
+    const char *strings;
+} gdindex = { PTHREAD_MUTEX_INITIALIZER, NULL, FALSE, NULL, 0, NULL, NULL, NULL, NULL };
+
+/************************** Index file ****************************/
+
+static void gdrom_index_unload( void )
+{
+    if( gdindex.map != NULL ) {
+        munmap( gdindex.map, gdindex.map_size );
+        gdindex.map = NULL;
+        gdindex.map_size = 0;
+    }
+    gdindex.header = NULL;
+    gdindex.records = NULL;
+    gdindex.tracks = NULL;
+    gdindex.strings = NULL;
+    gdindex.loaded = FALSE;
+}
+
+/**
+ * Check that the mapped index is internally consistent, so that lookups
+ * don't need to check bounds.
+ */
+static gboolean gdrom_index_validate( void )
+{
+    const struct gdrom_index_header *header = (const struct gdrom_index_header *)gdindex.map;
+    uint64_t size;
+    uint32_t i, j;
+
+    if( gdindex.map_size < sizeof(struct gdrom_index_header) ||
+            memcmp( header->magic, GDROM_INDEX_MAGIC, sizeof(header->magic) ) != 0 ||
+            header->version != GDROM_INDEX_VERSION ||
+            header->record_size != sizeof(struct gdrom_index_record) ) {
+        return FALSE;
+    }
+    size = sizeof(struct gdrom_index_header) +
+           (uint64_t)header->record_count * sizeof(struct gdrom_index_record) +
+           (uint64_t)header->track_count * sizeof(struct gdrom_index_track) +
+           header->string_size;
+    if( size != gdindex.map_size || header->string_size == 0 ) {
+        return FALSE;
+    }
+    gdindex.header = header;
+    gdindex.records = (const struct gdrom_index_record *)(header+1);
+    gdindex.tracks = (const struct gdrom_index_track *)(gdindex.records + header->record_count);
+    gdindex.strings = (const char *)(gdindex.tracks + header->track_count);
+    if( gdindex.strings[header->string_size-1] != '\0' ) {
+        return FALSE;
+    }
+    for( i=0; i<header->record_count; i++ ) {
+        const struct gdrom_index_record *rec = &gdindex.records[i];
+        if( rec->path >= header->string_size || rec->track_count > CDROM_MAX_TRACKS ||
+                (uint64_t)rec->first_track + rec->track_count > header->track_count ||
+                rec->title[sizeof(rec->title)-1] != '\0' || rec->mcn[sizeof(rec->mcn)-1] != '\0' ||
+                rec->product_id[sizeof(rec->product_id)-1] != '\0' ||
+                (i > 0 && rec->hash < gdindex.records[i-1].hash) ) {
+            return FALSE;
+        }
+        for( j=0; j<rec->track_count; j++ ) {
+            const struct gdrom_index_track *track = &gdindex.tracks[rec->first_track + j];
+            if( track->mode > SECTOR_CDDA_SUBCHANNEL ) {
+                return FALSE;
+            }
+            /* Direct tracks are read straight from the image, so must lie within it */
+            if( (rec->flags & GDROM_INDEX_DIRECT) && (track->offset > rec->size ||
+                    (uint64_t)track->sector_count * CDROM_SECTOR_SIZE(track->mode) > rec->size - track->offset) ) {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+static void gdrom_index_load( void )
+{
+    struct stat st;
+    int fd;
+
+    gdrom_index_unload();
+    gdindex.loaded = TRUE;
+    if( gdindex.filename == NULL ) {
+        gdindex.filename = g_strdup_printf( "%s/%s", get_user_data_path(), GDROM_INDEX_FILENAME );
+    }
+    fd = open( gdindex.filename, O_RDONLY );
+    if( fd == -1 ) {
+        return; /* Not created yet */
+    }
+    if( fstat( fd, &st ) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= (uint64_t)SIZE_MAX ) {
+        void *map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( map != MAP_FAILED ) {
+            gdindex.map = map;
+            gdindex.map_size = st.st_size;
+            if( !gdrom_index_validate() ) {
+                WARN( "Ignoring invalid disc index %s", gdindex.filename );
+                gdrom_index_unload();
+                gdindex.loaded = TRUE;
+            }
+        }
+    }
+    close(fd);
+}
+
+static void gdrom_index_ensure_loaded( void )
+{
+    if( !gdindex.loaded ) {
+        gdrom_index_load();
+    }
+}
+
+static uint32_t gdrom_index_record_count( void )
+{
+    return gdindex.header == NULL ? 0 : gdindex.header->record_count;
+}
+
+static const struct gdrom_index_record *gdrom_index_find( const char *path, uint32_t hash )
+{
+    uint32_t lo = 0, hi = gdrom_index_record_count();
+
+    while( lo < hi ) {
+        uint32_t mid = (lo + hi) / 2;
+        if( gdindex.records[mid].hash < hash ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for( ; lo < gdrom_index_record_count() && gdindex.records[lo].hash == hash; lo++ ) {
+        if( strcmp( gdindex.strings + gdindex.records[lo].path, path ) == 0 ) {
+            return &gdindex.records[lo];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Stat the file, which must be a regular file for it to be indexed.
+ */
+static gboolean gdrom_index_stat( const char *path, uint64_t *mtime, uint64_t *size )
+{
+    struct stat st;
+    if( stat( path, &st ) != 0 || !S_ISREG(st.st_mode) ) {
+        return FALSE;
+    }
+    *mtime = (uint64_t)st.st_mtime;
+    *size = (uint64_t)st.st_size;
+    return TRUE;
+}
+
+/**
+ * @return the record for the file if it's indexed and unchanged since, otherwise NULL
+ */
+static const struct gdrom_index_record *gdrom_index_find_current( const char *path )
+{
+    uint64_t mtime, size;
+    const struct gdrom_index_record *rec;
+
+    if( !gdrom_index_stat( path, &mtime, &size ) ) {
+        return NULL;
+    }
+    rec = gdrom_index_find( path, g_str_hash(path) );
+    if( rec == NULL || rec->mtime != mtime || rec->size != size ) {
+        return NULL;
+    }
+    return rec;
+}
+
+static int gdrom_index_item_compare( const void *a, const void *b )
+{
+    const struct gdrom_index_item *x = (const struct gdrom_index_item *)a;
+    const struct gdrom_index_item *y = (const struct gdrom_index_item *)b;
+    if( x->record->hash != y->record->hash ) {
+        return x->record->hash < y->record->hash ? -1 : 1;
+    }
+    return strcmp( x->path, y->path );
+}
+
+/**
+ * Write out a new index containing the given items, and switch over to it.
+ */
+static gboolean gdrom_index_write( struct gdrom_index_item *items, uint32_t count )
+{
+    struct gdrom_index_header header;
+    gchar *tmpname = g_strdup_printf( "%s.tmp", gdindex.filename );
+    uint32_t i, track = 0, string = 0;
+    gboolean ok = TRUE;
+    FILE *f;
+
+    qsort( items, count, sizeof(struct gdrom_index_item), gdrom_index_item_compare );
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, GDROM_INDEX_MAGIC, sizeof(header.magic) );
+    header.version = GDROM_INDEX_VERSION;
+    header.record_size = sizeof(struct gdrom_index_record);
+    header.record_count = count;
+    header.string_size = 1; /* Leading empty string, so the table is never empty */
+    for( i=0; i<count; i++ ) {
+        header.track_count += items[i].record->track_count;
+        header.string_size += strlen(items[i].path) + 1;
+    }
+
+    f = fopen( tmpname, "wb" );
+    if( f == NULL ) {
+        WARN( "Unable to write disc index %s: %s", tmpname, strerror(errno) );
+        g_free( tmpname );
+        return FALSE;
+    }
+    ok = fwrite( &header, sizeof(header), 1, f ) == 1;
+    for( i=0; i<count && ok; i++ ) {
+        struct gdrom_index_record rec = *items[i].record;
+        rec.path = string + 1;
+        rec.first_track = track;
+        string += strlen(items[i].path) + 1;
+        track += rec.track_count;
+        ok = fwrite( &rec, sizeof(rec), 1, f ) == 1;
+    }
+    for( i=0; i<count && ok; i++ ) {
+        uint32_t n = items[i].record->track_count;
+        ok = n == 0 || fwrite( items[i].tracks, sizeof(struct gdrom_index_track), n, f ) == n;
+    }
+    ok = ok && fputc( '\0', f ) != EOF;
+    for( i=0; i<count && ok; i++ ) {
+        ok = fwrite( items[i].path, strlen(items[i].path)+1, 1, f ) == 1;
+    }
+    if( fclose(f) != 0 ) {
+        ok = FALSE;
+    }
+    if( ok && rename( tmpname, gdindex.filename ) != 0 ) {
+        ok = FALSE;
+    }
+    if( !ok ) {
+        WARN( "Unable to write disc index %s: %s", gdindex.filename, strerror(errno) );
+        unlink( tmpname );
+    }
+    g_free( tmpname );
+
+    /* Items may point into the old mapping, so only reload once we're done */
+    gdrom_index_load();
+    return ok;
+}
+
+/**
+ * Merge the scan results into the index. Existing entries for the scanned
+ * paths are replaced, and if prune is TRUE, entries for files that have
+ * been removed or changed are dropped. Must be called with the lock held.
+ */
+static void gdrom_index_commit( struct gdrom_index_scan *scans, int scan_count, gboolean prune )
+{
+    uint32_t count = gdrom_index_record_count();
+    struct gdrom_index_item *items = g_malloc( (count + scan_count + 1) * sizeof(struct gdrom_index_item) );
+    GHashTable *replaced = g_hash_table_new( g_str_hash, g_str_equal );
+    uint32_t i, item_count = 0;
+    gboolean changed = FALSE;
+
+    for( i=0; i<(uint32_t)scan_count; i++ ) {
+        if( scans[i].valid ) {
+            g_hash_table_insert( replaced, scans[i].path, scans[i].path );
+            items[item_count].path = scans[i].path;
+            items[item_count].record = &scans[i].record;
+            items[item_count].tracks = scans[i].tracks;
+            item_count++;
+            changed = TRUE;
+        }
+    }
+    for( i=0; i<count; i++ ) {
+        const struct gdrom_index_record *rec = &gdindex.records[i];
+        const char *path = gdindex.strings + rec->path;
+        if( g_hash_table_lookup( replaced, path ) != NULL ) {
+            continue;
+        }
+        if( prune ) {
+            uint64_t mtime, size;
+            if( !gdrom_index_stat( path, &mtime, &size ) || mtime != rec->mtime || size != rec->size ) {
+                changed = TRUE;
+                continue;
+            }
+        }
+        items[item_count].path = path;
+        items[item_count].record = rec;
+        items[item_count].tracks = &gdindex.tracks[rec->first_track];
+        item_count++;
+    }
+    if( changed ) {
+        gdrom_index_write( items, item_count );
+    }
+    g_hash_table_destroy( replaced );
+    g_free( items );
+}
+
+/************************** Image scanning ****************************/
+
+/**
+ * Copy a space-padded bootstrap field, trimming the trailing spaces.
+ */
+static void gdrom_index_copy_field( char *out, const char *in, int len )
+{
+    while( len > 0 && (in[len-1] == ' ' || in[len-1] == '\0') ) {
+        len--;
+    }
+    memcpy( out, in, len );
+    out[len] = '\0';
+}
+
+static void gdrom_index_scan_disc( struct gdrom_index_scan *scan, cdrom_disc_t disc )
+{
+    struct gdrom_index_record *rec = &scan->record;
+    struct cdrom_disc_layout layout;
+    cdrom_track_t boot_track;
+    int i;
+
+    rec->disc_type = disc->disc_type;
+    rec->track_count = disc->track_count;
+    rec->session_count = disc->session_count;
+    rec->leadout = disc->leadout;
+    memcpy( rec->mcn, disc->mcn, sizeof(rec->mcn) );
+    rec->mcn[sizeof(rec->mcn)-1] = '\0';
+
+    scan->tracks = g_malloc0( (disc->track_count + 1) * sizeof(struct gdrom_index_track) );
+    for( i=0; i<disc->track_count; i++ ) {
+        scan->tracks[i].lba = disc->track[i].lba;
+        scan->tracks[i].trackno = disc->track[i].trackno;
+        scan->tracks[i].sessionno = disc->track[i].sessionno;
+        scan->tracks[i].flags = disc->track[i].flags;
+        if( disc->track[i].source != NULL ) {
+            scan->tracks[i].sector_count = disc->track[i].source->size;
+            scan->tracks[i].mode = disc->track[i].source->mode;
+        }
+    }
+    if( cdrom_disc_get_layout( disc, &layout ) ) {
+        for( i=0; i<disc->track_count; i++ ) {
+            scan->tracks[i].offset = layout.track[i].offset;
+        }
+        rec->flags |= GDROM_INDEX_DIRECT;
+    }
+
+    boot_track = gdrom_disc_get_boot_track( disc );
+    if( boot_track != NULL ) {
+        unsigned char boot_sector[CDROM_MAX_SECTOR_SIZE];
+        size_t length = sizeof(boot_sector);
+        rec->boot_track = boot_track->trackno;
+        if( cdrom_disc_read_sectors( disc, boot_track->lba, 1, CDROM_READ_DATA|CDROM_READ_MODE2_FORM1,
+                boot_sector, &length ) == CDROM_ERROR_OK &&
+                memcmp( boot_sector, BOOTSTRAP_MAGIC, BOOTSTRAP_MAGIC_SIZE ) == 0 ) {
+            dc_bootstrap_head_t bootstrap = (dc_bootstrap_head_t)boot_sector;
+            gdrom_index_copy_field( rec->product_id, bootstrap->product_id, sizeof(bootstrap->product_id) );
+            gdrom_index_copy_field( rec->title, bootstrap->product_name, sizeof(bootstrap->product_name) );
+        }
+    }
+    scan->valid = TRUE;
+}
+
+static void gdrom_index_scan_fn( void *data, int index )
+{
+    struct gdrom_index_scan *scan = ((struct gdrom_index_scan *)data) + index;
+    ERROR err;
+    cdrom_disc_t disc = cdrom_disc_open( scan->path, &err );
+
+    if( disc == NULL ) {
+        DEBUG( "Not indexing %s: %s", scan->path, err.msg );
+    } else {
+        gdrom_index_scan_disc( scan, disc );
+        cdrom_disc_unref( disc );
+    }
+}
+
+static void gdrom_index_scan_init( struct gdrom_index_scan *scan, gchar *path, uint64_t mtime, uint64_t size )
+{
+    memset( scan, 0, sizeof(struct gdrom_index_scan) );
+    scan->path = path;
+    scan->record.hash = g_str_hash(path);
+    scan->record.mtime = mtime;
+    scan->record.size = size;
+}
+
+/************************** Public interface ****************************/
+
+void gdrom_index_init( const gchar *filename )
+{
+    gchar *old_filename;
+
+    pthread_mutex_lock( &gdindex.lock );
+    gdrom_index_unload();
+    old_filename = gdindex.filename;
+    gdindex.filename = filename == NULL ? NULL : g_strdup(filename);
+    g_free( old_filename );
+    pthread_mutex_unlock( &gdindex.lock );
+}
+
+int gdrom_index_update( GList *filenames )
+{
+    GArray *scans = g_array_new( FALSE, FALSE, sizeof(struct gdrom_index_scan) );
+    GHashTable *seen = g_hash_table_new( g_str_hash, g_str_equal );
+    int i, result = 0;
+    GList *ptr;
+
+    pthread_mutex_lock( &gdindex.lock );
+    gdrom_index_ensure_loaded();
+    for( ptr = filenames; ptr != NULL; ptr = g_list_next(ptr) ) {
+        gchar *path = get_absolute_path( (const gchar *)ptr->data );
+        const struct gdrom_index_record *rec;
+        uint64_t mtime, size;
+
+        if( g_hash_table_lookup( seen, path ) != NULL || !gdrom_index_stat( path, &mtime, &size ) ) {
+            g_free( path );
+            continue;
+        }
+        rec = gdrom_index_find( path, g_str_hash(path) );
+        if( rec != NULL && rec->mtime == mtime && rec->size == size ) {
+            g_free( path );
+            continue;
+        }
+        struct gdrom_index_scan scan;
+        gdrom_index_scan_init( &scan, path, mtime, size );
+        g_array_append_val( scans, scan );
+        g_hash_table_insert( seen, path, path );
+    }
+    pthread_mutex_unlock( &gdindex.lock );
+
+    /* Parse outside of the lock - this is the slow part */
+    workpool_run( gdrom_index_scan_fn, scans->data, scans->len );
+
+    pthread_mutex_lock( &gdindex.lock );
+    gdrom_index_ensure_loaded();
+    gdrom_index_commit( (struct gdrom_index_scan *)scans->data, scans->len, TRUE );
+    pthread_mutex_unlock( &gdindex.lock );
+
+    for( i=0; i<scans->len; i++ ) {
+        struct gdrom_index_scan *scan = &g_array_index( scans, struct gdrom_index_scan, i );
+        if( scan->valid ) {
+            result++;
+        }
+        g_free( scan->tracks );
+        g_free( scan->path );
+    }
+    g_hash_table_destroy( seen );
+    g_array_free( scans, TRUE );
+    return result;
+}
+
+gboolean gdrom_index_lookup( const gchar *filename, struct gdrom_index_info *info )
+{
+    gchar *path = get_absolute_path( filename );
+    const struct gdrom_index_record *rec;
+
+    pthread_mutex_lock( &gdindex.lock );
+    gdrom_index_ensure_loaded();
+    rec = gdrom_index_find_current( path );
+    if( rec != NULL ) {
+        info->disc_type = rec->disc_type;
+        info->track_count = rec->track_count;
+        info->session_count = rec->session_count;
+        info->leadout = rec->leadout;
+        info->boot_track = rec->boot_track;
+        memcpy( info->mcn, rec->mcn, sizeof(info->mcn) );
+        memcpy( info->product_id, rec->product_id, sizeof(info->product_id) );
+        memcpy( info->title, rec->title, sizeof(info->title) );
+    }
+    pthread_mutex_unlock( &gdindex.lock );
+    g_free( path );
+    return rec != NULL;
+}
+
+cdrom_disc_t gdrom_index_open_disc( const gchar *filename, ERROR *err )
+{
+    gchar *path = get_absolute_path( filename );
+    struct cdrom_disc_layout layout;
+    const struct gdrom_index_record *rec;
+    uint64_t mtime, size;
+    gboolean indexed = FALSE, direct = FALSE;
+    cdrom_disc_t disc = NULL;
+    int i;
+
+    if( !gdrom_index_stat( path, &mtime, &size ) ) {
+        /* Devices and anything else that isn't a plain file */
+        g_free( path );
+        return cdrom_disc_open( filename, err );
+    }
+
+    pthread_mutex_lock( &gdindex.lock );
+    gdrom_index_ensure_loaded();
+    rec = gdrom_index_find_current( path );
+    if( rec != NULL ) {
+        indexed = TRUE;
+        if( rec->flags & GDROM_INDEX_DIRECT ) {
+            const struct gdrom_index_track *tracks = &gdindex.tracks[rec->first_track];
+            layout.disc_type = rec->disc_type;
+            memcpy( layout.mcn, rec->mcn, sizeof(layout.mcn) );
+            layout.track_count = rec->track_count;
+            layout.session_count = rec->session_count;
+            layout.leadout = rec->leadout;
+            for( i=0; i<rec->track_count; i++ ) {
+                layout.track[i].trackno = tracks[i].trackno;
+                layout.track[i].sessionno = tracks[i].sessionno;
+                layout.track[i].lba = tracks[i].lba;
+                layout.track[i].flags = tracks[i].flags;
+                layout.track[i].mode = tracks[i].mode;
+                layout.track[i].sector_count = tracks[i].sector_count;
+                layout.track[i].offset = tracks[i].offset;
+            }
+            direct = TRUE;
+        }
+    }
+    pthread_mutex_unlock( &gdindex.lock );
+
+    if( direct ) {
+        disc = cdrom_disc_open_layout( filename, &layout, err );
+    }
+    if( disc == NULL ) {
+        disc = cdrom_disc_open( filename, err );
+        if( disc != NULL && !indexed ) {
+            struct gdrom_index_scan scan;
+            gdrom_index_scan_init( &scan, path, mtime, size );
+            gdrom_index_scan_disc( &scan, disc );
+            pthread_mutex_lock( &gdindex.lock );
+            gdrom_index_ensure_loaded();
+            gdrom_index_commit( &scan, 1, FALSE );
+            pthread_mutex_unlock( &gdindex.lock );
+            g_free( scan.tracks );
+        }
+    }
+    g_free( path );
+    return disc;
+}
+
+static int gdrom_index_path_compare( const void *a, const void *b )
+{
+    const struct gdrom_index_record *x = *(const struct gdrom_index_record **)a;
+    const struct gdrom_index_record *y = *(const struct gdrom_index_record **)b;
+    return strcmp( gdindex.strings + x->path, gdindex.strings + y->path );
+}
+
+void gdrom_index_dump( FILE *f )
+{
+    const struct gdrom_index_record **sorted;
+    uint32_t i, count;
+    int j;
+
+    pthread_mutex_lock( &gdindex.lock );
+    gdrom_index_ensure_loaded();
+    count = gdrom_index_record_count();
+    fprintf( f, "Disc index %s: %d entries\n", gdindex.filename, count );
+    sorted = g_malloc( (count+1) * sizeof(struct gdrom_index_record *) );
+    for( i=0; i<count; i++ ) {
+        sorted[i] = &gdindex.records[i];
+    }
+    qsort( sorted, count, sizeof(struct gdrom_index_record *), gdrom_index_path_compare );
+    for( i=0; i<count; i++ ) {
+        const struct gdrom_index_record *rec = sorted[i];
+        const struct gdrom_index_track *tracks = &gdindex.tracks[rec->first_track];
+        fprintf( f, "%s\n", gdindex.strings + rec->path );
+        fprintf( f, "  %-10s %s\n", rec->product_id, rec->title );
+        fprintf( f, "  Type %02X, %d track(s) in %d session(s), leadout %d, boot track %d%s\n",
+                 rec->disc_type, rec->track_count, rec->session_count, rec->leadout, rec->boot_track,
+                 (rec->flags & GDROM_INDEX_DIRECT) ? " (direct)" : "" );
+        for( j=0; j<rec->track_count; j++ ) {
+            fprintf( f, "    %02d. %6d %02x %6d sectors\n", tracks[j].trackno, tracks[j].lba,
+                     tracks[j].flags, tracks[j].sector_count );
+        }
+    }
+    g_free( sorted );
+    pthread_mutex_unlock( &gdindex.lock );
+}
@@ -0,0 +1,133 @@
+/**
+ * $Id$
+ *
+ * Persistent disc image index - caches the TOC, title and product ID of
+ * each disc image seen, keyed by path, mtime and size, so that the recent
+ * list and launchers don't need to open and parse every image, and images
+ * can be remounted without reparsing their headers/trailers.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_gdindex_H
+#define lxdream_gdindex_H 1
+
+#include <stdio.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "drivers/cdrom/cdrom.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Summary of an indexed disc image.
+ */
+struct gdrom_index_info {
+    cdrom_disc_type_t disc_type;
+    int track_count;
+    int session_count;
+    cdrom_lba_t leadout;
+    int boot_track;       /* Track number of the boot track, or 0 if none */
+    char mcn[14];
+    char product_id[11];
+    char title[129];
+};
+
+/* Index file format (see gdindex.c) */
+#define GDROM_INDEX_MAGIC "LXDIDX\r\n"
+#define GDROM_INDEX_VERSION 1
+
+/* The track layout can be used to open the image directly */
+#define GDROM_INDEX_DIRECT 0x01
+
+struct gdrom_index_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;   /* sizeof(struct gdrom_index_record) */
+    uint32_t record_count;
+    uint32_t track_count;
+    uint32_t string_size;
+    uint32_t reserved;
+};
+
+struct gdrom_index_record {
+    uint64_t mtime;
+    uint64_t size;
+    uint32_t hash;          /* Hash of the path */
+    uint32_t path;          /* Offset of the path in the string table */
+    uint32_t first_track;   /* Index of the first track in the track table */
+    uint32_t leadout;
+    uint8_t disc_type;
+    uint8_t track_count;
+    uint8_t session_count;
+    uint8_t boot_track;     /* Track number, or 0 if not bootable */
+    uint8_t flags;
+    uint8_t reserved;
+    char mcn[14];
+    char product_id[11];
+    char title[129];
+};
+
+struct gdrom_index_track {
+    uint64_t offset;        /* Byte offset of the track in the image (direct images only) */
+    uint32_t lba;
+    uint32_t sector_count;
+    uint8_t trackno;
+    uint8_t sessionno;
+    uint8_t flags;
+    uint8_t mode;
+    uint32_t reserved;
+};
+
+/**
+ * Select the index file to use. This is optional - by default the index is
+ * kept in the user data directory, and is loaded on first use.
+ * @param filename Index filename, or NULL for the default.
+ */
+void gdrom_index_init( const gchar *filename );
+
+/**
+ * Bring the index up to date for the given list of image files (gchar *).
+ * Images that aren't in the index or have changed since they were indexed
+ * are parsed in parallel; entries for images that no longer exist are
+ * dropped.
+ * @return the number of images that were (re)indexed.
+ */
+int gdrom_index_update( GList *filenames );
+
+/**
+ * Look up an image in the index without opening it.
+ * @return TRUE if the image is indexed and unchanged, in which case info is
+ * filled in, otherwise FALSE.
+ */
+gboolean gdrom_index_lookup( const gchar *filename, struct gdrom_index_info *info );
+
+/**
+ * Open a disc image, using the index to skip parsing the image where
+ * possible. Images that weren't already indexed are added to it.
+ * Otherwise behaves exactly like cdrom_disc_open.
+ */
+cdrom_disc_t gdrom_index_open_disc( const gchar *filename, ERROR *err );
+
+/**
+ * Print the contents of the index to the given output stream.
+ */
+void gdrom_index_dump( FILE *f );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_gdindex_H */
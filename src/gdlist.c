@@ -19,12 +19,13 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <glib.h>
-#include <libgen.h>
 #include "gettext.h"
 #include "gdrom/gdrom.h"
 #include "drivers/cdrom/drive.h"
 #include "gdlist.h"
+#include "gdindex.h"
 #include "lxdream.h"
 #include "config.h"
 
@@ -37,6 +38,7 @@ DEFINE_HOOK(gdrom_list_change_hook, gdrom_list_change_hook_t);
 static GList *gdrom_device_list = NULL;
 static GList *gdrom_recent_list = NULL;
 static unsigned int gdrom_device_count = 0, gdrom_recent_count = 0;
+static GHashTable *gdrom_display_names = NULL;
 
 gint gdrom_list_find( const gchar *name )
 {
@@ -132,6 +134,41 @@ void gdrom_list_drives_changed( GList *device_list )
 {
 }
 
+/**
+ * Bring the disc index up to date for the recent list. Parsing the images
+ * can take a while, so this runs on its own thread with a private copy of
+ * the list - display names pick up the indexed titles once it's done.
+ */
+static void *gdrom_list_index_thread_main( void *data )
+{
+    GList *files = (GList *)data, *ptr;
+
+    gdrom_index_update( files );
+    for( ptr = files; ptr != NULL; ptr = g_list_next(ptr) ) {
+        g_free( ptr->data );
+    }
+    g_list_free( files );
+    return NULL;
+}
+
+static void gdrom_list_index_start( void )
+{
+    GList *files = NULL, *ptr;
+    pthread_t thread;
+
+    for( ptr = gdrom_recent_list; ptr != NULL; ptr = g_list_next(ptr) ) {
+        files = g_list_append( files, g_strdup((gchar *)ptr->data) );
+    }
+    if( files != NULL ) {
+        if( pthread_create( &thread, NULL, gdrom_list_index_thread_main, files ) == 0 ) {
+            pthread_detach( thread );
+        } else {
+            WARN( "Unable to create disc index thread" );
+            gdrom_list_index_thread_main( files );
+        }
+    }
+}
+
 /************ Public interface ***********/
 
 void gdrom_list_init()
@@ -142,6 +179,8 @@ void gdrom_list_init()
     gdrom_device_list = cdrom_drive_get_list();
     gdrom_device_count = g_list_length(gdrom_device_list);
     gdrom_recent_count = g_list_length(gdrom_recent_list);
+    gdrom_display_names = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+    gdrom_list_index_start();
 
     // Run the hooks in case anyone registered before the list was initialized
     CALL_HOOKS( gdrom_list_change_hook, TRUE, gdrom_list_get_selection() );
@@ -205,7 +244,16 @@ const gchar *gdrom_list_get_display_name( int posn )
     }
 
     gchar *entry = g_list_nth_data(gdrom_recent_list, posn-FIRST_RECENT_INDEX);
-    return basename(entry);
+    struct gdrom_index_info info;
+    gchar *name;
+    if( gdrom_index_lookup( entry, &info ) && info.title[0] != '\0' ) {
+        name = g_strdup(info.title);
+    } else {
+        name = g_path_get_basename(entry);
+    }
+    /* Keep the most recent name for each entry so the caller doesn't need to free it */
+    g_hash_table_replace( gdrom_display_names, g_strdup(entry), name );
+    return name;
 }
 
 const gchar *gdrom_list_get_filename( int posn )
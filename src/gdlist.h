@@ -56,7 +56,9 @@ int gdrom_list_size(void);
  *   "Empty" (localised)
  *   Any CD/DVD drives attached to the system
  *   "" (empty string) - separator item
- *   An LRU list of disc image files (note without directory components).
+ *   An LRU list of disc image files, by title where the disc index knows
+ *   it, otherwise by filename (without directory components).
+ * The returned string remains valid until the name is next requested.
  */
 const gchar *gdrom_list_get_display_name(int index);
 
@@ -0,0 +1,413 @@
+/**
+ * $Id$
+ *
+ * CD-DA playback from disc images. The AICA mixes the drive's audio output
+ * in through its two external input slots (EFSDL/EFPAN 16 and 17), so for
+ * discs that can't play audio themselves we stream the audio track here:
+ *
+ *   - A reader thread reads CD-DA sectors from the disc ahead of the play
+ *     position into a single-producer/single-consumer ring of 44.1kHz
+ *     stereo frames.
+ *   - The mixer (on the emulation thread) pulls frames out of the ring,
+ *     resamples them to the output rate and adds them into the AICA mix
+ *     at the CDDA input level and pan.
+ *
+ * Play/pause/seek/stop all happen on the emulation thread too, so the
+ * mixer side never needs to take a lock - only the reader does, to check
+ * that what it just read is still wanted before publishing it.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/time.h>
+#include "lxdream.h"
+#include "gdrom/gdrom.h"
+#include "drivers/cdrom/cdrom.h"
+
+#define CDDA_SAMPLE_RATE 44100
+#define CDDA_FRAMES_PER_SECTOR (CDROM_MAX_SECTOR_SIZE/4) /* 16-bit stereo */
+#define CDDA_RING_SECTORS 32  /* About 0.4s of audio */
+#define CDDA_RING_FRAMES (CDDA_RING_SECTORS*CDDA_FRAMES_PER_SECTOR)
+#define CDDA_READ_SECTORS 4   /* Sectors per read by the reader thread */
+#define CDDA_REPEAT_FOREVER 0x0F
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_wait;  /* reader waits here for something to do */
+    pthread_cond_t idle_wait;  /* stop waits here for a read in progress */
+    gboolean started;
+    gboolean reading;          /* Reader is currently reading from the disc */
+
+    /* Reader state, protected by the mutex */
+    cdrom_disc_t disc;
+    cdrom_lba_t start_lba;     /* Range being played (for repeats) */
+    cdrom_lba_t end_lba;
+    int repeat;                /* Repeats remaining, or CDDA_REPEAT_FOREVER */
+    cdrom_lba_t read_lba;      /* Next sector to be read */
+    uint32_t generation;       /* Incremented whenever the ring is flushed */
+
+    /* The ring itself. head is only written by the reader, tail by the mixer
+     * (and by flushes, which happen with the mutex held) */
+    volatile uint32_t head;    /* In frames, free-running */
+    volatile uint32_t tail;
+    volatile gboolean read_done; /* No more sectors will be added */
+    gboolean read_error;       /* ...because a read failed */
+    cdrom_lba_t ring_lba[CDDA_RING_SECTORS];
+    int16_t ring[CDDA_RING_FRAMES][2];
+
+    /* Mixer state */
+    int status;                /* GDROM_AUDIO_* */
+    cdrom_lba_t position;      /* Sector of the frame currently playing */
+    cdrom_lba_t next_position; /* Sector of the following frame */
+    uint32_t phase;            /* Position between cur and next, in 1/output_rate units */
+    gboolean primed;           /* cur/next hold valid frames */
+    gboolean draining;         /* next is the silence following the last frame */
+    int16_t cur[2], next[2];
+    uint32_t underruns;
+    pthread_t thread;
+} gdrom_cdda = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                 FALSE, FALSE, NULL, 0, 0, 0, 0, 0, 0, 0, TRUE, FALSE, {0}, {{0}}, GDROM_AUDIO_NO_STATUS };
+
+/**
+ * Sectors to read next, and where to - returns 0 if there's nothing to do.
+ * Must be called with the mutex held.
+ */
+static cdrom_count_t gdrom_cdda_next_read( cdrom_lba_t *lba )
+{
+    uint32_t free_sectors = (CDDA_RING_FRAMES - (gdrom_cdda.head - gdrom_cdda.tail)) / CDDA_FRAMES_PER_SECTOR;
+    if( gdrom_cdda.disc == NULL || gdrom_cdda.read_done ) {
+        return 0;
+    }
+    if( gdrom_cdda.read_lba >= gdrom_cdda.end_lba ) {
+        if( gdrom_cdda.repeat == 0 ) {
+            __sync_synchronize(); /* Everything already published must be visible first */
+            gdrom_cdda.read_done = TRUE;
+            return 0;
+        }
+        if( gdrom_cdda.repeat != CDDA_REPEAT_FOREVER ) {
+            gdrom_cdda.repeat--;
+        }
+        gdrom_cdda.read_lba = gdrom_cdda.start_lba;
+    }
+    if( free_sectors == 0 ) {
+        return 0;
+    }
+    cdrom_count_t count = MIN( CDDA_READ_SECTORS, free_sectors );
+    if( count > gdrom_cdda.end_lba - gdrom_cdda.read_lba ) {
+        count = gdrom_cdda.end_lba - gdrom_cdda.read_lba;
+    }
+    *lba = gdrom_cdda.read_lba;
+    return count;
+}
+
+static void *gdrom_cdda_thread_main( void *arg )
+{
+    static unsigned char buf[CDDA_READ_SECTORS*CDROM_MAX_SECTOR_SIZE];
+
+    pthread_mutex_lock(&gdrom_cdda.mutex);
+    for(;;) {
+        cdrom_lba_t lba;
+        cdrom_count_t count = gdrom_cdda_next_read( &lba );
+        if( count == 0 ) {
+            /* The mixer doesn't take the mutex, so may not get a wakeup to
+             * us when it frees space in the ring. Poll as a backstop */
+            struct timeval now;
+            struct timespec timeout;
+            gettimeofday( &now, NULL );
+            timeout.tv_sec = now.tv_sec;
+            timeout.tv_nsec = now.tv_usec * 1000 + 5000000;
+            if( timeout.tv_nsec >= 1000000000 ) {
+                timeout.tv_sec++;
+                timeout.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&gdrom_cdda.work_wait, &gdrom_cdda.mutex, &timeout);
+            continue;
+        }
+        cdrom_disc_t disc = gdrom_cdda.disc;
+        uint32_t generation = gdrom_cdda.generation;
+        gdrom_cdda.reading = TRUE;
+        pthread_mutex_unlock(&gdrom_cdda.mutex);
+
+        size_t length = 0;
+        cdrom_error_t status = cdrom_disc_read_sectors( disc, lba, count, CDROM_READ_CDDA|CDROM_READ_DATA,
+                                                        buf, &length );
+
+        pthread_mutex_lock(&gdrom_cdda.mutex);
+        gdrom_cdda.reading = FALSE;
+        pthread_cond_broadcast(&gdrom_cdda.idle_wait);
+        if( generation != gdrom_cdda.generation ) {
+            continue; /* Stopped or moved while we were reading - discard */
+        }
+        if( status != CDROM_ERROR_OK || length != count * CDROM_MAX_SECTOR_SIZE ) {
+            WARN( "CD-DA read failed at %d (error %04X)", lba, status );
+            gdrom_cdda.read_error = TRUE;
+            gdrom_cdda.read_done = TRUE;
+            continue;
+        }
+        /* Samples are little-endian 16-bit stereo, same as the host */
+        uint32_t head = gdrom_cdda.head;
+        int i;
+        for( i=0; i<count; i++ ) {
+            uint32_t offset = head % CDDA_RING_FRAMES;
+            gdrom_cdda.ring_lba[offset / CDDA_FRAMES_PER_SECTOR] = lba + i;
+            memcpy( gdrom_cdda.ring[offset], buf + i*CDROM_MAX_SECTOR_SIZE, CDROM_MAX_SECTOR_SIZE );
+            head += CDDA_FRAMES_PER_SECTOR;
+        }
+        gdrom_cdda.read_lba = lba + count;
+        __sync_synchronize(); /* Frames must be visible before the new head */
+        gdrom_cdda.head = head;
+    }
+    pthread_mutex_unlock(&gdrom_cdda.mutex);
+    return NULL;
+}
+
+/**
+ * Discard everything in the ring and anything being read, and point the
+ * reader at the given range. Must be called with the mutex held.
+ */
+static void gdrom_cdda_restart( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_lba_t end, int repeat )
+{
+    gdrom_cdda.generation++;
+    gdrom_cdda.tail = gdrom_cdda.head;
+    gdrom_cdda.disc = disc;
+    gdrom_cdda.start_lba = lba;
+    gdrom_cdda.end_lba = end;
+    gdrom_cdda.read_lba = lba;
+    gdrom_cdda.repeat = repeat;
+    gdrom_cdda.read_done = (disc == NULL);
+    gdrom_cdda.read_error = FALSE;
+    gdrom_cdda.position = lba;
+    gdrom_cdda.next_position = lba;
+    gdrom_cdda.phase = 0;
+    gdrom_cdda.primed = FALSE;
+    gdrom_cdda.draining = FALSE;
+
+    if( disc != NULL && !gdrom_cdda.started ) {
+        if( pthread_create( &gdrom_cdda.thread, NULL, gdrom_cdda_thread_main, NULL ) == 0 ) {
+            gdrom_cdda.started = TRUE;
+        } else {
+            WARN( "Unable to create CD-DA reader thread" );
+        }
+    }
+    pthread_cond_signal(&gdrom_cdda.work_wait);
+}
+
+cdrom_error_t gdrom_cdda_play( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count, int repeat )
+{
+    cdrom_track_t track = cdrom_disc_get_track_by_lba( disc, lba );
+    if( track == NULL || (track->flags & TRACK_FLAG_DATA) || count == 0 ) {
+        return CDROM_ERROR_BADFIELD;
+    }
+    pthread_mutex_lock(&gdrom_cdda.mutex);
+    gdrom_cdda_restart( disc, lba, lba + count, repeat & CDDA_REPEAT_FOREVER );
+    gdrom_cdda.status = GDROM_AUDIO_PLAYING;
+    pthread_mutex_unlock(&gdrom_cdda.mutex);
+    return CDROM_ERROR_OK;
+}
+
+cdrom_error_t gdrom_cdda_resume( void )
+{
+    if( gdrom_cdda.status != GDROM_AUDIO_PAUSED ) {
+        return CDROM_ERROR_BADFIELD;
+    }
+    gdrom_cdda.status = GDROM_AUDIO_PLAYING;
+    return CDROM_ERROR_OK;
+}
+
+void gdrom_cdda_pause( void )
+{
+    if( gdrom_cdda.status == GDROM_AUDIO_PLAYING ) {
+        gdrom_cdda.status = GDROM_AUDIO_PAUSED;
+    }
+}
+
+void gdrom_cdda_seek( cdrom_disc_t disc, cdrom_lba_t lba )
+{
+    cdrom_lba_t start = lba, end = disc->leadout;
+    int repeat = 0;
+
+    pthread_mutex_lock(&gdrom_cdda.mutex);
+    if( (gdrom_cdda.status == GDROM_AUDIO_PLAYING || gdrom_cdda.status == GDROM_AUDIO_PAUSED) &&
+            lba < gdrom_cdda.end_lba ) {
+        /* Moving within the range being played - keep the range and repeats */
+        start = MIN( gdrom_cdda.start_lba, lba );
+        end = gdrom_cdda.end_lba;
+        repeat = gdrom_cdda.repeat;
+    }
+    gdrom_cdda_restart( disc, lba, end, repeat );
+    gdrom_cdda.start_lba = start;
+    gdrom_cdda.status = GDROM_AUDIO_PAUSED;
+    pthread_mutex_unlock(&gdrom_cdda.mutex);
+}
+
+void gdrom_cdda_stop( void )
+{
+    pthread_mutex_lock(&gdrom_cdda.mutex);
+    gdrom_cdda_restart( NULL, gdrom_cdda.position, gdrom_cdda.position, 0 );
+    gdrom_cdda.status = GDROM_AUDIO_NO_STATUS;
+    /* The disc may be about to go away, so make sure the reader is done with it */
+    while( gdrom_cdda.reading ) {
+        pthread_cond_wait(&gdrom_cdda.idle_wait, &gdrom_cdda.mutex);
+    }
+    pthread_mutex_unlock(&gdrom_cdda.mutex);
+}
+
+int gdrom_cdda_get_status( cdrom_lba_t *lba )
+{
+    if( lba != NULL ) {
+        *lba = gdrom_cdda.position;
+    }
+    return gdrom_cdda.status;
+}
+
+gboolean gdrom_cdda_is_buffered( void )
+{
+    return gdrom_cdda.head - gdrom_cdda.tail >= CDDA_RING_FRAMES - CDDA_FRAMES_PER_SECTOR ||
+        gdrom_cdda.read_done;
+}
+
+uint32_t gdrom_cdda_get_underruns( void )
+{
+    return gdrom_cdda.underruns;
+}
+
+/**
+ * Take the next frame out of the ring into cur/next.
+ * @return FALSE if the ring is empty.
+ */
+static gboolean gdrom_cdda_advance( void )
+{
+    uint32_t tail = gdrom_cdda.tail;
+    if( tail == gdrom_cdda.head ) {
+        return FALSE;
+    }
+    __sync_synchronize(); /* Don't read the frame before the head */
+    uint32_t offset = tail % CDDA_RING_FRAMES;
+    gdrom_cdda.cur[0] = gdrom_cdda.next[0];
+    gdrom_cdda.cur[1] = gdrom_cdda.next[1];
+    gdrom_cdda.next[0] = gdrom_cdda.ring[offset][0];
+    gdrom_cdda.next[1] = gdrom_cdda.ring[offset][1];
+    gdrom_cdda.position = gdrom_cdda.next_position;
+    gdrom_cdda.next_position = gdrom_cdda.ring_lba[offset / CDDA_FRAMES_PER_SECTOR];
+    __sync_synchronize(); /* Finished with the frame before it's released */
+    gdrom_cdda.tail = tail + 1;
+    if( (tail+1) % (CDDA_RING_FRAMES/2) == 0 ) {
+        pthread_cond_signal(&gdrom_cdda.work_wait);
+    }
+    return TRUE;
+}
+
+/**
+ * Attenuation in 3dB steps as a 2.14 fixed-point gain, with the last step
+ * being -infinity (as for both the send level and the pan)
+ */
+static const int32_t gdrom_cdda_atten[16] = {
+        16384, 11599, 8211, 5813, 4115, 2914, 2063, 1460, 1034, 732, 518, 367, 260, 184, 130, 0 };
+
+/**
+ * Convert an AICA EFSDL/EFPAN register into left and right gains (2.14).
+ * Bits 8-11 are the send level (0 = off, 15 = 0dB), bits 0-3 of the pan
+ * attenuate the right side (or the left side when bit 4 is set).
+ */
+static void gdrom_cdda_gain( uint32_t reg, int32_t gain[2] )
+{
+    int32_t level = gdrom_cdda_atten[15 - ((reg >> 8) & 0x0F)];
+    int32_t pan = gdrom_cdda_atten[reg & 0x0F];
+    if( reg & 0x10 ) {
+        gain[0] = (level * pan) >> 14;
+        gain[1] = level;
+    } else {
+        gain[0] = level;
+        gain[1] = (level * pan) >> 14;
+    }
+}
+
+/**
+ * Called when the ring runs dry.
+ * @return TRUE if that's because everything has been played, or FALSE if
+ * the reader has just fallen behind.
+ */
+static gboolean gdrom_cdda_drained( void )
+{
+    if( !gdrom_cdda.read_done ) {
+        return FALSE;
+    }
+    __sync_synchronize(); /* read_done is set after the last head update */
+    return gdrom_cdda.tail == gdrom_cdda.head;
+}
+
+static void gdrom_cdda_complete( void )
+{
+    gdrom_cdda.status = gdrom_cdda.read_error ? GDROM_AUDIO_ERROR : GDROM_AUDIO_COMPLETED;
+}
+
+void gdrom_cdda_mix( int32_t (*buf)[2], int num_samples, uint32_t output_rate,
+                     uint32_t left_reg, uint32_t right_reg )
+{
+    int32_t left_gain[2], right_gain[2];
+    int i;
+
+    if( gdrom_cdda.status != GDROM_AUDIO_PLAYING ) {
+        return;
+    }
+    if( !gdrom_cdda.primed ) {
+        if( gdrom_cdda.head - gdrom_cdda.tail < 2 ) {
+            if( gdrom_cdda_drained() ) {
+                gdrom_cdda_complete();
+            }
+            return; /* Still waiting for the reader to get going */
+        }
+        gdrom_cdda_advance();
+        gdrom_cdda_advance();
+        gdrom_cdda.primed = TRUE;
+    }
+
+    gdrom_cdda_gain( left_reg, left_gain );
+    gdrom_cdda_gain( right_reg, right_gain );
+
+    /* Step through the source at 44100/output_rate frames per sample (in the
+     * same way as the AICA channels), interpolating between frames. Gains
+     * are 2.14, and the mix is 10.6 relative to the final output */
+    for( i=0; i<num_samples; i++ ) {
+        while( gdrom_cdda.phase >= output_rate ) {
+            if( !gdrom_cdda_advance() ) {
+                if( !gdrom_cdda_drained() ) {
+                    /* Reader fell behind - leave a gap and pick up where
+                     * we left off, rather than skipping anything */
+                    gdrom_cdda.underruns++;
+                    return;
+                }
+                if( gdrom_cdda.draining ) {
+                    gdrom_cdda_complete();
+                    return;
+                }
+                /* Play out the last frame, fading into silence */
+                gdrom_cdda.draining = TRUE;
+                gdrom_cdda.cur[0] = gdrom_cdda.next[0];
+                gdrom_cdda.cur[1] = gdrom_cdda.next[1];
+                gdrom_cdda.next[0] = gdrom_cdda.next[1] = 0;
+                gdrom_cdda.position = gdrom_cdda.next_position;
+            }
+            gdrom_cdda.phase -= output_rate;
+        }
+        int32_t l = gdrom_cdda.cur[0] +
+                (int32_t)(((int64_t)(gdrom_cdda.next[0] - gdrom_cdda.cur[0]) * gdrom_cdda.phase) / output_rate);
+        int32_t r = gdrom_cdda.cur[1] +
+                (int32_t)(((int64_t)(gdrom_cdda.next[1] - gdrom_cdda.cur[1]) * gdrom_cdda.phase) / output_rate);
+        buf[i][0] += (l * left_gain[0] + r * right_gain[0]) >> 8;
+        buf[i][1] += (l * left_gain[1] + r * right_gain[1]) >> 8;
+        gdrom_cdda.phase += CDDA_SAMPLE_RATE;
+    }
+}
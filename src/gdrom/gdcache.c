@@ -0,0 +1,218 @@
+/**
+ * $Id$
+ *
+ * GD-Rom sector cache and read-ahead. Sectors are held in a small
+ * direct-mapped cache (indexed by LBA, so a sequential stream behaves as a
+ * ring buffer) along with the read mode they were read with. When the guest
+ * reads sequentially, a worker thread prefetches the next
+ * GDROM_READAHEAD_SECTORS sectors in the same mode, so that by the time the
+ * next read command arrives the sectors (including any regenerated
+ * EDC/ECC) are already sitting in memory.
+ *
+ * Everything here is transparent to the guest - the data returned is
+ * exactly what cdrom_disc_read_sectors would have returned, it just
+ * (usually) arrives sooner.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "lxdream.h"
+#include "gdrom/gdrom.h"
+#include "drivers/cdrom/cdrom.h"
+
+#define GDROM_CACHE_SLOTS 128 /* Must be a power of 2, and larger than the read-ahead window */
+#define GDROM_READAHEAD_SECTORS 64
+
+#define SLOT_EMPTY   0
+#define SLOT_PENDING 1 /* Being read by the worker */
+#define SLOT_VALID   2
+
+struct gdrom_cache_slot {
+    int state;
+    cdrom_lba_t lba;
+    cdrom_read_mode_t mode;
+    uint32_t length;
+    unsigned char data[CDROM_MAX_SECTOR_SIZE];
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_wait;    /* worker waits here for a new read-ahead window */
+    pthread_cond_t slot_wait;    /* readers wait here for pending slots */
+    pthread_mutex_t read_lock;   /* serializes reads from the disc itself */
+    gboolean started;
+
+    /* Read-ahead window */
+    cdrom_disc_t disc;
+    cdrom_lba_t next_lba;        /* Next sector the worker should consider */
+    cdrom_lba_t end_lba;         /* End of the read-ahead window */
+    cdrom_read_mode_t mode;
+
+    /* Sequential access detection */
+    cdrom_lba_t last_end;        /* LBA following the last read */
+    cdrom_read_mode_t last_mode;
+
+    struct gdrom_cache_slot slots[GDROM_CACHE_SLOTS];
+    pthread_t thread;
+} gdrom_cache = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                  PTHREAD_MUTEX_INITIALIZER, FALSE, NULL, 0, 0, 0, (cdrom_lba_t)-1, 0 };
+
+#define CACHE_SLOT(lba) (&gdrom_cache.slots[(lba)&(GDROM_CACHE_SLOTS-1)])
+#define SLOT_MATCHES(slot,l,m) ((slot)->lba == (l) && (slot)->mode == (m))
+
+static cdrom_error_t gdrom_cache_read_disc( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count,
+                                           cdrom_read_mode_t mode, unsigned char *buf, size_t *length )
+{
+    pthread_mutex_lock(&gdrom_cache.read_lock);
+    cdrom_error_t status = cdrom_disc_read_sectors( disc, lba, count, mode, buf, length );
+    pthread_mutex_unlock(&gdrom_cache.read_lock);
+    return status;
+}
+
+static void *gdrom_cache_thread_main( void *arg )
+{
+    pthread_mutex_lock(&gdrom_cache.mutex);
+    for(;;) {
+        while( gdrom_cache.next_lba >= gdrom_cache.end_lba ) {
+            pthread_cond_wait(&gdrom_cache.work_wait, &gdrom_cache.mutex);
+        }
+        cdrom_lba_t lba = gdrom_cache.next_lba++;
+        cdrom_read_mode_t mode = gdrom_cache.mode;
+        cdrom_disc_t disc = gdrom_cache.disc;
+        struct gdrom_cache_slot *slot = CACHE_SLOT(lba);
+        if( slot->state != SLOT_EMPTY && SLOT_MATCHES(slot, lba, mode) ) {
+            continue; /* Already have it */
+        }
+        if( slot->state == SLOT_PENDING ) {
+            /* Can't happen while the window is smaller than the cache */
+            continue;
+        }
+        slot->state = SLOT_PENDING;
+        slot->lba = lba;
+        slot->mode = mode;
+        pthread_mutex_unlock(&gdrom_cache.mutex);
+
+        size_t length;
+        cdrom_error_t status = gdrom_cache_read_disc( disc, lba, 1, mode, slot->data, &length );
+
+        pthread_mutex_lock(&gdrom_cache.mutex);
+        if( status == CDROM_ERROR_OK ) {
+            slot->length = length;
+            slot->state = SLOT_VALID;
+        } else {
+            /* Leave it to the guest's own read to report the error */
+            slot->state = SLOT_EMPTY;
+            gdrom_cache.end_lba = gdrom_cache.next_lba;
+        }
+        pthread_cond_broadcast(&gdrom_cache.slot_wait);
+    }
+    pthread_mutex_unlock(&gdrom_cache.mutex);
+    return NULL;
+}
+
+/**
+ * Stop the read-ahead, wait for any read in progress to complete, and
+ * discard everything in the cache. Must be called with the mutex held.
+ */
+static void gdrom_cache_clear( void )
+{
+    int i;
+    gdrom_cache.end_lba = gdrom_cache.next_lba;
+    for( i=0; i<GDROM_CACHE_SLOTS; i++ ) {
+        while( gdrom_cache.slots[i].state == SLOT_PENDING ) {
+            pthread_cond_wait(&gdrom_cache.slot_wait, &gdrom_cache.mutex);
+        }
+        gdrom_cache.slots[i].state = SLOT_EMPTY;
+    }
+    gdrom_cache.last_end = (cdrom_lba_t)-1;
+}
+
+void gdrom_cache_flush( void )
+{
+    pthread_mutex_lock(&gdrom_cache.mutex);
+    gdrom_cache_clear();
+    gdrom_cache.disc = NULL;
+    pthread_mutex_unlock(&gdrom_cache.mutex);
+}
+
+cdrom_error_t gdrom_cache_read( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count,
+                                cdrom_read_mode_t mode, unsigned char *buf, size_t *length )
+{
+    cdrom_error_t status = CDROM_ERROR_OK;
+    cdrom_lba_t start_lba = lba;
+    size_t len = 0;
+
+    pthread_mutex_lock(&gdrom_cache.mutex);
+    if( disc != gdrom_cache.disc ) {
+        gdrom_cache_clear();
+        gdrom_cache.disc = disc;
+    }
+
+    /* Serve as much as possible from the front of the request out of the cache */
+    while( count > 0 ) {
+        struct gdrom_cache_slot *slot = CACHE_SLOT(lba);
+        while( slot->state == SLOT_PENDING && SLOT_MATCHES(slot, lba, mode) ) {
+            pthread_cond_wait(&gdrom_cache.slot_wait, &gdrom_cache.mutex);
+        }
+        if( slot->state != SLOT_VALID || !SLOT_MATCHES(slot, lba, mode) ) {
+            break;
+        }
+        memcpy( buf + len, slot->data, slot->length );
+        len += slot->length;
+        lba++;
+        count--;
+    }
+
+    /* Treat the read as part of a sequential stream if it follows on from the
+     * last one, or if it was (at least partly) prefetched */
+    gboolean sequential = mode == gdrom_cache.last_mode &&
+            (start_lba == gdrom_cache.last_end || len != 0);
+    pthread_mutex_unlock(&gdrom_cache.mutex);
+
+    if( count > 0 ) {
+        size_t tmplen = 0;
+        status = gdrom_cache_read_disc( disc, lba, count, mode, buf + len, &tmplen );
+        len += tmplen;
+        lba += count;
+    }
+
+    pthread_mutex_lock(&gdrom_cache.mutex);
+    if( sequential && status == CDROM_ERROR_OK ) {
+        if( !gdrom_cache.started ) {
+            if( pthread_create( &gdrom_cache.thread, NULL, gdrom_cache_thread_main, NULL ) == 0 ) {
+                gdrom_cache.started = TRUE;
+            } else {
+                WARN( "Unable to create GD-Rom read-ahead thread" );
+            }
+        }
+        /* Move the read-ahead window to just past the end of this read */
+        cdrom_lba_t end_lba = lba + GDROM_READAHEAD_SECTORS;
+        if( gdrom_cache.mode != mode || gdrom_cache.next_lba < lba ||
+                gdrom_cache.next_lba > end_lba ) {
+            gdrom_cache.next_lba = lba;
+        }
+        gdrom_cache.mode = mode;
+        gdrom_cache.end_lba = end_lba;
+        pthread_cond_signal(&gdrom_cache.work_wait);
+    }
+    gdrom_cache.last_end = lba;
+    gdrom_cache.last_mode = mode;
+    pthread_mutex_unlock(&gdrom_cache.mutex);
+
+    if( length != NULL ) {
+        *length = len;
+    }
+    return status;
+}
@@ -22,6 +22,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <ctype.h>
+#include <time.h>
 #include <glib.h>
 #include <netinet/in.h>
 #include "gdrom/ide.h"
@@ -29,9 +30,10 @@
 #include "gdrom/packet.h"
 #include "bootstrap.h"
 #include "loader.h"
+#include "gdindex.h"
 #include "drivers/cdrom/cdrom.h"
+#include "drivers/cdrom/isoindex.h"
 
-#define GDROM_LBA_OFFSET 150
 
 DEFINE_HOOK( gdrom_disc_change_hook, gdrom_disc_change_hook_t )
 
@@ -46,11 +48,21 @@ struct gdrom_drive {
     cdrom_disc_t disc;
     int boot_track;
     char title[129];
+    iso_path_index_t boot_index; /* Built on first use */
 } gdrom_drive;
 
+static void gdrom_release_boot_index( void )
+{
+    iso_path_index_destroy( gdrom_drive.boot_index );
+    gdrom_drive.boot_index = NULL;
+}
+
 void gdrom_mount_disc( cdrom_disc_t disc )
 {
     if( disc != gdrom_drive.disc ) {
+        gdrom_cdda_stop();
+        gdrom_cache_flush();
+        gdrom_release_boot_index();
         cdrom_disc_unref(gdrom_drive.disc);
         gdrom_drive.disc = disc;
         cdrom_disc_ref(disc);
@@ -61,7 +73,7 @@ void gdrom_mount_disc( cdrom_disc_t disc )
 
 gboolean gdrom_mount_image( const gchar *filename,  ERROR *err )
 {
-    cdrom_disc_t disc = cdrom_disc_open(filename, err);
+    cdrom_disc_t disc = gdrom_index_open_disc(filename, err);
     if( disc == NULL && err->code == LX_ERR_FILE_UNKNOWN ) {
         disc = cdrom_wrap_magic( CDROM_DISC_XA, filename, err );
     } 
@@ -75,6 +87,9 @@ gboolean gdrom_mount_image( const gchar *filename,  ERROR *err )
 void gdrom_unmount_disc( ) 
 {
     if( gdrom_drive.disc != NULL ) {
+        gdrom_cdda_stop();
+        gdrom_cache_flush();
+        gdrom_release_boot_index();
         cdrom_disc_unref(gdrom_drive.disc);
         gdrom_fire_disc_changed(NULL);
         gdrom_drive.disc = NULL;
@@ -164,6 +179,14 @@ cdrom_error_t gdrom_read_short_status( cdrom_lba_t lba, unsigned char *buf )
 {
     cdrom_lba_t real_lba = lba - GDROM_LBA_OFFSET;
 	CHECK_DISC();
+
+    /* While audio is active, report the play position rather than the last read */
+    int audio_status = gdrom_cdda_get_status( &real_lba );
+    if( audio_status == GDROM_AUDIO_NO_STATUS ) {
+        real_lba = lba - GDROM_LBA_OFFSET;
+    } else {
+        lba = real_lba + GDROM_LBA_OFFSET;
+    }
 	
     cdrom_track_t track = cdrom_disc_get_track_by_lba( gdrom_drive.disc, real_lba );
     if( track == NULL ) {
@@ -174,7 +197,7 @@ cdrom_error_t gdrom_read_short_status( cdrom_lba_t lba, unsigned char *buf )
     }
     uint32_t offset = real_lba - track->lba;
 	buf[0] = 0x00;
-	buf[1] = 0x15; /* audio status ? */
+	buf[1] = audio_status;
     buf[2] = 0x00;
     buf[3] = 0x0E;
     buf[4] = track->flags;
@@ -197,19 +220,54 @@ int gdrom_get_drive_status( )
 	}
 	
     if( cdrom_disc_check_media(gdrom_drive.disc) == CDROM_DISC_NONE ) {
+        gdrom_cache_flush(); /* Media removed - don't serve stale sectors from the next one */
         return CDROM_DISC_NONE;
+    } else if( gdrom_cdda_get_status(NULL) == GDROM_AUDIO_PLAYING ) {
+        return gdrom_drive.disc->disc_type | IDE_DISC_PLAYING;
     } else {
         return gdrom_drive.disc->disc_type | IDE_DISC_READY;
     }
 }
 
-cdrom_error_t gdrom_play_audio( cdrom_lba_t lba, cdrom_count_t count )
+cdrom_error_t gdrom_play_audio( cdrom_lba_t lba, cdrom_count_t count, int repeat )
 {
     CHECK_DISC();
     if( gdrom_drive.disc->play_audio ) {
         return gdrom_drive.disc->play_audio( gdrom_drive.disc, lba - GDROM_LBA_OFFSET, count );
     }
-    return CDROM_ERROR_BADFIELD;
+    return gdrom_cdda_play( gdrom_drive.disc, lba - GDROM_LBA_OFFSET, count, repeat );
+}
+
+cdrom_error_t gdrom_resume_audio( void )
+{
+    CHECK_DISC();
+    return gdrom_cdda_resume();
+}
+
+void gdrom_pause_audio( void )
+{
+    if( gdrom_drive.disc != NULL && gdrom_drive.disc->stop_audio ) {
+        gdrom_drive.disc->stop_audio( gdrom_drive.disc );
+    }
+    gdrom_cdda_pause();
+}
+
+void gdrom_stop_audio( void )
+{
+    if( gdrom_drive.disc != NULL && gdrom_drive.disc->stop_audio ) {
+        gdrom_drive.disc->stop_audio( gdrom_drive.disc );
+    }
+    gdrom_cdda_stop();
+}
+
+cdrom_error_t gdrom_seek( cdrom_lba_t lba )
+{
+    CHECK_DISC();
+    if( gdrom_drive.disc->stop_audio ) {
+        gdrom_drive.disc->stop_audio( gdrom_drive.disc );
+    }
+    gdrom_cdda_seek( gdrom_drive.disc, lba - GDROM_LBA_OFFSET );
+    return CDROM_ERROR_OK;
 }
 
 /* Parse CD read */
@@ -256,7 +314,16 @@ cdrom_error_t gdrom_read_cd( cdrom_lba_t lba, cdrom_count_t count,
     else
         real_mode |= (READ_CD_MODE(mode)<<1);
 
-    return cdrom_disc_read_sectors( gdrom_drive.disc, real_lba, count, real_mode, buf, length );
+    if( gdrom_trace_is_active() ) {
+        struct timespec start, end;
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        cdrom_error_t status = gdrom_cache_read( gdrom_drive.disc, real_lba, count, real_mode, buf, length );
+        clock_gettime( CLOCK_MONOTONIC, &end );
+        gdrom_trace_read( real_lba, count, real_mode, status,
+                          (end.tv_sec - start.tv_sec) * 1000000000 + (end.tv_nsec - start.tv_nsec) );
+        return status;
+    }
+    return gdrom_cache_read( gdrom_drive.disc, real_lba, count, real_mode, buf, length );
 }
 
 void gdrom_run_slice( uint32_t nanosecs )
@@ -277,9 +344,26 @@ cdrom_track_t gdrom_disc_get_boot_track( cdrom_disc_t disc ) {
             }
         }
     }
+    if( boot_track == -1 )
+        return NULL;
     return &disc->track[boot_track];
 }
 
+iso_path_index_t gdrom_get_boot_index( void )
+{
+    if( gdrom_drive.boot_index == NULL && gdrom_drive.disc != NULL ) {
+        cdrom_track_t track = gdrom_disc_get_boot_track( gdrom_drive.disc );
+        if( track != NULL ) {
+            ERROR err;
+            gdrom_drive.boot_index = iso_path_index_new( gdrom_drive.disc, track->lba, &err );
+            if( gdrom_drive.boot_index == NULL ) {
+                WARN( "Unable to read boot filesystem: %s", err.msg );
+            }
+        }
+    }
+    return gdrom_drive.boot_index;
+}
+
 /**
  * Check the disc for a useable DC bootstrap, and update the disc
  * with the title accordingly. Otherwise set the title to the empty string.
@@ -37,6 +37,14 @@ struct gdrom_toc {
 #define GDROM_TOC_SIZE (102*4) /* Size of GDROM TOC structure */
 #define GDROM_SESSION_INFO_SIZE 6 /* Size of GDROM session info structure */
 #define GDROM_SHORT_STATUS_SIZE 14 /* Size of GDROM short status structure */
+#define GDROM_LBA_OFFSET 150 /* Offset of disc LBA 0 in the drive's addressing (FAD) */
+
+/* Audio status, as reported in the subcode-Q position data */
+#define GDROM_AUDIO_PLAYING   0x11
+#define GDROM_AUDIO_PAUSED    0x12
+#define GDROM_AUDIO_COMPLETED 0x13
+#define GDROM_AUDIO_ERROR     0x14
+#define GDROM_AUDIO_NO_STATUS 0x15
 
 typedef gboolean (*gdrom_disc_change_hook_t)( cdrom_disc_t new_disc, const gchar *new_disc_name, void *user_data );
 DECLARE_HOOK(gdrom_disc_change_hook, gdrom_disc_change_hook_t);
@@ -75,6 +83,14 @@ const gchar *gdrom_get_current_disc_title();
  */
 cdrom_track_t gdrom_disc_get_boot_track( cdrom_disc_t disc );
 
+/**
+ * Return the path index of the ISO9660 filesystem on the current disc's
+ * boot track. This is built on first use and kept until the disc is changed,
+ * so repeated (biosless) boots don't need to reread the directory tree.
+ * @return the index, or NULL if there's no disc or no valid filesystem.
+ */
+struct iso_path_index *gdrom_get_boot_index( void );
+
 /** 
  * Check if the disc contains valid media.
  * @return CDROM_ERROR_OK if disc is present, otherwise CDROM_ERROR_NODISC
@@ -121,7 +137,190 @@ cdrom_error_t gdrom_read_short_status( uint32_t lba, unsigned char *buf );
 cdrom_error_t gdrom_read_cd( cdrom_lba_t lba, cdrom_count_t count,
                              unsigned read_mode, unsigned char *buf, size_t *length );
 
-cdrom_error_t gdrom_play_audio( cdrom_lba_t lba, cdrom_count_t count );
+/**
+ * Start playing audio from the current disc.
+ * @param lba GD-Rom address (FAD) of the first sector to play
+ * @param count Number of sectors to play
+ * @param repeat Number of times to repeat the range (0x0F = forever)
+ */
+cdrom_error_t gdrom_play_audio( cdrom_lba_t lba, cdrom_count_t count, int repeat );
+
+/**
+ * Resume audio playback from the current (paused) position
+ */
+cdrom_error_t gdrom_resume_audio( void );
+
+void gdrom_pause_audio( void );
+
+void gdrom_stop_audio( void );
+
+/**
+ * Move the head to the given GD-Rom address, pausing any audio playback.
+ */
+cdrom_error_t gdrom_seek( cdrom_lba_t lba );
+
+/**
+ * CD-DA streaming for discs which can't play audio themselves. Parameters
+ * are disc LBAs (not FADs).
+ */
+cdrom_error_t gdrom_cdda_play( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count, int repeat );
+cdrom_error_t gdrom_cdda_resume( void );
+void gdrom_cdda_pause( void );
+void gdrom_cdda_seek( cdrom_disc_t disc, cdrom_lba_t lba );
+
+/**
+ * Stop playback and wait for the reader to finish with the disc. Must be
+ * called before the disc is changed or released.
+ */
+void gdrom_cdda_stop( void );
+
+/**
+ * @param lba If not null, will be written with the current play position
+ * @return the audio status (one of the GDROM_AUDIO_* values)
+ */
+int gdrom_cdda_get_status( cdrom_lba_t *lba );
+
+/**
+ * @return TRUE if the stream has all the audio buffered that it can - the
+ * ring is full, or the reader has reached the end of the range.
+ */
+gboolean gdrom_cdda_is_buffered( void );
+
+/**
+ * @return the number of times the mixer has run out of buffered audio.
+ */
+uint32_t gdrom_cdda_get_underruns( void );
+
+/**
+ * Mix the next num_samples of CD-DA output into the AICA mix buffer,
+ * resampling from 44.1kHz to the output rate.
+ * @param left_reg AICA CDDA input register (EFSDL/EFPAN) for the left channel
+ * @param right_reg AICA CDDA input register for the right channel
+ */
+void gdrom_cdda_mix( int32_t (*buf)[2], int num_samples, uint32_t output_rate,
+                     uint32_t left_reg, uint32_t right_reg );
+
+/**
+ * Read sectors from the given disc through the drive's sector cache,
+ * starting read-ahead if the read continues a sequential stream. Parameters
+ * are as for cdrom_disc_read_sectors.
+ */
+cdrom_error_t gdrom_cache_read( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count,
+                                cdrom_read_mode_t mode, unsigned char *buf, size_t *length );
+
+/**
+ * Stop any read-ahead in progress and discard the contents of the sector
+ * cache. Must be called before the disc is changed or released.
+ */
+void gdrom_cache_flush( void );
+
+/* Drive timing modes */
+#define GDROM_TIMING_MAX       0  /* Reads complete immediately */
+#define GDROM_TIMING_REALISTIC 1  /* Seek, rotational latency and CAV transfer rate */
+#define GDROM_TIMING_ADAPTIVE  2  /* Realistic, except for bulk sequential reads */
+
+void gdrom_timing_set_mode( int mode );
+int gdrom_timing_get_mode( void );
+
+/**
+ * @return the timing mode with the given name ("max", "realistic" or
+ * "adaptive"), or -1 if the name isn't recognized.
+ */
+int gdrom_timing_parse_mode( const gchar *name );
+const gchar *gdrom_timing_get_mode_name( int mode );
+
+/**
+ * Return the drive to its initial state (head parked at the hub, empty buffer)
+ */
+void gdrom_timing_reset( void );
+
+/**
+ * Account for the drive reading count sectors starting at the given FAD,
+ * for a request made at emulated time now (nanoseconds).
+ * @return the number of nanoseconds from now until the last of the
+ * sectors is available (always 0 in GDROM_TIMING_MAX mode).
+ */
+uint32_t gdrom_timing_read( uint32_t fad, cdrom_count_t count, uint64_t now );
+
+/* Disc-read trace record types */
+#define GDROM_TRACE_READ    1  /* Sectors read from the disc (gdrom_read_cd) */
+#define GDROM_TRACE_COMMAND 2  /* ATAPI packet command received */
+
+/**
+ * Disc-read trace record, written in host byte order. For reads, lba is the
+ * disc LBA (ie without the 150 sector offset) and mode is the translated
+ * cdrom_read_mode_t. For commands, lba/count are taken from the packet
+ * where it has them.
+ */
+struct gdrom_trace_record {
+    uint64_t time;      /* Emulated time in nanoseconds */
+    uint32_t lba;
+    uint32_t count;
+    uint32_t host_ns;   /* Host time taken by the read */
+    uint16_t mode;
+    uint16_t status;    /* cdrom_error_t result of the read */
+    uint8_t type;       /* GDROM_TRACE_* */
+    uint8_t opcode;     /* Packet command opcode */
+    uint8_t reserved[6];
+};
+
+/**
+ * Summary of a trace replay
+ */
+struct gdrom_trace_stats {
+    uint32_t reads;
+    uint32_t commands;
+    uint32_t errors;           /* Reads that failed during the replay */
+    uint64_t sectors;
+    uint64_t bytes;
+    uint64_t emulated_ns;      /* Emulated time covered by the trace */
+    uint64_t recorded_ns;      /* Total host time for reads when recorded */
+    uint64_t replay_ns;        /* Total host time for reads when replayed */
+    uint32_t replay_median_ns;
+    uint32_t replay_p99_ns;
+    uint32_t replay_max_ns;
+    uint64_t drive_ns[3];      /* Time spent waiting for the drive under each GDROM_TIMING_* mode */
+};
+
+/**
+ * Start recording every disc read and packet command to the given file,
+ * replacing any existing trace.
+ * @return TRUE on success, otherwise FALSE with err set.
+ */
+gboolean gdrom_trace_start( const gchar *filename, ERROR *err );
+
+/**
+ * Flush and close the current trace, if any.
+ */
+void gdrom_trace_stop( void );
+
+/**
+ * Write any buffered records out to the trace file.
+ */
+void gdrom_trace_flush( void );
+
+gboolean gdrom_trace_is_active( void );
+
+/**
+ * Record a packet command. No-op if the trace isn't active.
+ */
+void gdrom_trace_command( const unsigned char *cmd );
+
+/**
+ * Record a disc read. No-op if the trace isn't active.
+ */
+void gdrom_trace_read( cdrom_lba_t lba, cdrom_count_t count, cdrom_read_mode_t mode,
+                       cdrom_error_t status, uint32_t host_ns );
+
+/**
+ * Replay every read in the trace file against the given disc as fast as
+ * possible, timing each read. Also runs the reads through the drive timing
+ * model to estimate the loading time under each timing mode.
+ * @return TRUE on success, otherwise FALSE with err set (failed reads are
+ * counted in stats->errors, rather than being an error).
+ */
+gboolean gdrom_trace_replay( const gchar *filename, cdrom_disc_t disc,
+                             struct gdrom_trace_stats *stats, ERROR *err );
 
 /**
  * Return the 1-byte status code for the disc (combination of IDE_DISC_* flags)
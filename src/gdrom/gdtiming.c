@@ -0,0 +1,188 @@
+/**
+ * $Id$
+ *
+ * GD-Rom drive timing model. The drive spins at a constant angular
+ * velocity, so the transfer rate rises from about 5x at the hub to 12x at
+ * the rim. Reads that aren't already in (or just ahead of) the drive's
+ * buffer pay for a seek, whose time grows with the square root of the
+ * radial distance, plus half a revolution of rotational latency. While
+ * idle the drive keeps reading ahead into its buffer, so a guest that
+ * reads sequentially more slowly than the disc never waits.
+ *
+ * Three modes are supported:
+ *   max       - reads complete immediately (the historical behaviour)
+ *   realistic - every read takes as long as the model says
+ *   adaptive  - realistic, except that once a sequential stream has run
+ *               for GDROM_ADAPTIVE_RUN sectors further reads from it are
+ *               served immediately. Seeks and small reads (which is what
+ *               timing-sensitive code tends to wait on) keep their real
+ *               timing, while bulk loads go at full host speed.
+ *
+ * All positions are in FAD (ie LBA + 150), as seen by the drive.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "gdrom/gdrom.h"
+
+#define GDROM_RADIUS_INNER 23.0       /* mm, at FAD 0 */
+#define GDROM_RADIUS_OUTER 58.0       /* mm, at GDROM_MAX_FAD */
+#define GDROM_MAX_FAD 549150
+#define GDROM_OUTER_RATE 900.0        /* Sectors/second at the rim (12x) */
+#define GDROM_REVOLUTION_NS 23300000  /* ~2575 rpm */
+#define GDROM_SEEK_MIN_NS 1500000
+#define GDROM_SEEK_MAX_NS 180000000   /* Full-stroke seek */
+#define GDROM_BUFFER_SECTORS 64       /* 128KB drive buffer */
+#define GDROM_ADAPTIVE_RUN 64         /* Sequential sectors before adaptive mode accelerates */
+#define GDROM_TIMING_MAX_DELAY 2000000000
+
+static const char *gdrom_timing_names[] = { "max", "realistic", "adaptive" };
+
+static struct {
+    int mode;
+    uint32_t head_fad;     /* Next sector under the head */
+    uint64_t head_time;    /* Emulated time at which the head reaches head_fad */
+    uint32_t buffer_start; /* First sector still held in the drive buffer */
+    uint32_t run_length;   /* Sectors read sequentially in the current stream */
+} gdtiming = { GDROM_TIMING_MAX, 0, 0, 0, 0 };
+
+int gdrom_timing_parse_mode( const gchar *name )
+{
+    int i;
+    if( name != NULL ) {
+        for( i=0; i<3; i++ ) {
+            if( g_ascii_strcasecmp( name, gdrom_timing_names[i] ) == 0 ) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+const gchar *gdrom_timing_get_mode_name( int mode )
+{
+    if( mode < 0 || mode > GDROM_TIMING_ADAPTIVE ) {
+        return NULL;
+    }
+    return gdrom_timing_names[mode];
+}
+
+void gdrom_timing_set_mode( int mode )
+{
+    if( mode >= GDROM_TIMING_MAX && mode <= GDROM_TIMING_ADAPTIVE ) {
+        gdtiming.mode = mode;
+    }
+}
+
+int gdrom_timing_get_mode( void )
+{
+    return gdtiming.mode;
+}
+
+void gdrom_timing_reset( void )
+{
+    gdtiming.head_fad = 0;
+    gdtiming.head_time = 0;
+    gdtiming.buffer_start = 0;
+    gdtiming.run_length = 0;
+}
+
+static double gdrom_radius( uint32_t fad )
+{
+    double f = (fad > GDROM_MAX_FAD ? GDROM_MAX_FAD : fad) / (double)GDROM_MAX_FAD;
+    return sqrt( GDROM_RADIUS_INNER * GDROM_RADIUS_INNER +
+                 f * (GDROM_RADIUS_OUTER * GDROM_RADIUS_OUTER - GDROM_RADIUS_INNER * GDROM_RADIUS_INNER) );
+}
+
+/**
+ * @return the transfer rate at the given position, in sectors per second
+ */
+static double gdrom_rate( uint32_t fad )
+{
+    return GDROM_OUTER_RATE * gdrom_radius(fad) / GDROM_RADIUS_OUTER;
+}
+
+static uint64_t gdrom_transfer_ns( uint32_t fad, uint32_t count )
+{
+    return (uint64_t)(count * 1e9 / gdrom_rate( fad + count/2 ));
+}
+
+static uint64_t gdrom_seek_ns( uint32_t from, uint32_t to )
+{
+    double distance = fabs( gdrom_radius(to) - gdrom_radius(from) ) / (GDROM_RADIUS_OUTER - GDROM_RADIUS_INNER);
+    return GDROM_SEEK_MIN_NS + (uint64_t)(sqrt(distance) * (GDROM_SEEK_MAX_NS - GDROM_SEEK_MIN_NS));
+}
+
+uint32_t gdrom_timing_read( uint32_t fad, cdrom_count_t count, uint64_t now )
+{
+    uint32_t end = fad + count;
+    uint64_t ready;
+    gboolean sequential = FALSE;
+
+    if( gdtiming.mode == GDROM_TIMING_MAX || count == 0 ) {
+        return 0;
+    }
+
+    /* While idle the drive keeps reading ahead until its buffer is full */
+    if( now > gdtiming.head_time ) {
+        uint64_t ahead = (uint64_t)((now - gdtiming.head_time) * gdrom_rate(gdtiming.head_fad) / 1e9);
+        uint32_t room = gdtiming.buffer_start + GDROM_BUFFER_SECTORS > gdtiming.head_fad ?
+                gdtiming.buffer_start + GDROM_BUFFER_SECTORS - gdtiming.head_fad : 0;
+        gdtiming.head_fad += ahead < room ? (uint32_t)ahead : room;
+        gdtiming.head_time = now;
+    }
+
+    if( fad >= gdtiming.buffer_start && fad <= gdtiming.head_fad ) {
+        /* Already buffered, or starting right at the head */
+        sequential = TRUE;
+        if( end <= gdtiming.head_fad ) {
+            ready = now;
+        } else {
+            ready = gdtiming.head_time + gdrom_transfer_ns( gdtiming.head_fad, end - gdtiming.head_fad );
+        }
+    } else if( fad > gdtiming.head_fad &&
+            fad - gdtiming.head_fad <= gdrom_rate(gdtiming.head_fad) * GDROM_REVOLUTION_NS / 1e9 ) {
+        /* Within a revolution ahead - just wait for it to come round */
+        ready = gdtiming.head_time + gdrom_transfer_ns( gdtiming.head_fad, end - gdtiming.head_fad );
+        gdtiming.buffer_start = fad;
+    } else {
+        ready = gdtiming.head_time + gdrom_seek_ns( gdtiming.head_fad, fad ) +
+                GDROM_REVOLUTION_NS/2 + gdrom_transfer_ns( fad, count );
+        gdtiming.buffer_start = fad;
+        gdtiming.head_fad = fad;
+    }
+
+    gdtiming.run_length = sequential ? gdtiming.run_length + count : count;
+    if( gdtiming.mode == GDROM_TIMING_ADAPTIVE && sequential && gdtiming.run_length > GDROM_ADAPTIVE_RUN ) {
+        ready = now;
+    }
+
+    if( end > gdtiming.head_fad ) {
+        gdtiming.head_fad = end;
+        gdtiming.head_time = ready;
+    }
+    if( gdtiming.head_fad - gdtiming.buffer_start > GDROM_BUFFER_SECTORS ) {
+        gdtiming.buffer_start = gdtiming.head_fad - GDROM_BUFFER_SECTORS;
+    }
+
+    if( ready <= now ) {
+        return 0;
+    } else if( ready - now > GDROM_TIMING_MAX_DELAY ) {
+        return GDROM_TIMING_MAX_DELAY;
+    }
+    return (uint32_t)(ready - now);
+}
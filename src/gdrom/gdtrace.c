@@ -0,0 +1,278 @@
+/**
+ * $Id$
+ *
+ * GD-Rom disc-read trace recorder and replay. While recording, every
+ * packet command and every read through gdrom_read_cd is appended to a
+ * compact binary trace (a small header followed by fixed-size
+ * gdrom_trace_record structures), tagged with the emulated time and the
+ * host time the read took. Records are buffered in memory and written out
+ * in blocks, so tracing costs little more than the two clock reads.
+ *
+ * Replay drives a cdrom_disc_t directly with the reads from a trace, which
+ * gives a realistic access pattern for comparing the image backends
+ * without the emulator (or the GD-Rom sector cache) in the way.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "dreamcast.h"
+#include "gdrom/gdrom.h"
+#include "drivers/cdrom/cdrom.h"
+
+#define GDROM_TRACE_MAGIC "LXDTRC\r\n"
+#define GDROM_TRACE_VERSION 1
+#define GDROM_TRACE_BUFFER_RECORDS 1024
+#define GDROM_TRACE_MAX_READ 0x10000 /* Sanity limit on sectors per read when replaying */
+
+struct gdrom_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+static struct {
+    FILE *f;
+    int buffered;
+    struct gdrom_trace_record buffer[GDROM_TRACE_BUFFER_RECORDS];
+} gdtrace = { NULL, 0 };
+
+gboolean gdrom_trace_start( const gchar *filename, ERROR *err )
+{
+    struct gdrom_trace_header header;
+
+    gdrom_trace_stop();
+    FILE *f = fopen( filename, "wb" );
+    if( f == NULL ) {
+        SET_ERROR( err, LX_ERR_FILE_NOOPEN, "Unable to create disc trace '%s': %s", filename, strerror(errno) );
+        return FALSE;
+    }
+    memcpy( header.magic, GDROM_TRACE_MAGIC, sizeof(header.magic) );
+    header.version = GDROM_TRACE_VERSION;
+    header.record_size = sizeof(struct gdrom_trace_record);
+    if( fwrite( &header, sizeof(header), 1, f ) != 1 ) {
+        SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to write disc trace '%s': %s", filename, strerror(errno) );
+        fclose( f );
+        return FALSE;
+    }
+    gdtrace.f = f;
+    gdtrace.buffered = 0;
+    return TRUE;
+}
+
+void gdrom_trace_flush( void )
+{
+    if( gdtrace.f != NULL && gdtrace.buffered > 0 ) {
+        if( fwrite( gdtrace.buffer, sizeof(struct gdrom_trace_record), gdtrace.buffered, gdtrace.f ) != gdtrace.buffered ) {
+            WARN( "Unable to write disc trace: %s", strerror(errno) );
+        }
+        fflush( gdtrace.f );
+        gdtrace.buffered = 0;
+    }
+}
+
+void gdrom_trace_stop( void )
+{
+    if( gdtrace.f != NULL ) {
+        gdrom_trace_flush();
+        fclose( gdtrace.f );
+        gdtrace.f = NULL;
+    }
+}
+
+gboolean gdrom_trace_is_active( void )
+{
+    return gdtrace.f != NULL;
+}
+
+static struct gdrom_trace_record *gdrom_trace_next_record( void )
+{
+    if( gdtrace.buffered == GDROM_TRACE_BUFFER_RECORDS ) {
+        gdrom_trace_flush();
+    }
+    struct gdrom_trace_record *rec = &gdtrace.buffer[gdtrace.buffered++];
+    memset( rec, 0, sizeof(struct gdrom_trace_record) );
+    rec->time = dreamcast_get_emulated_time();
+    return rec;
+}
+
+void gdrom_trace_command( const unsigned char *cmd )
+{
+    if( gdtrace.f != NULL ) {
+        struct gdrom_trace_record *rec = gdrom_trace_next_record();
+        rec->type = GDROM_TRACE_COMMAND;
+        rec->opcode = cmd[0];
+        rec->lba = (cmd[2]<<16) | (cmd[3]<<8) | cmd[4];
+        rec->count = (cmd[8]<<16) | (cmd[9]<<8) | cmd[10];
+    }
+}
+
+void gdrom_trace_read( cdrom_lba_t lba, cdrom_count_t count, cdrom_read_mode_t mode,
+                       cdrom_error_t status, uint32_t host_ns )
+{
+    if( gdtrace.f != NULL ) {
+        struct gdrom_trace_record *rec = gdrom_trace_next_record();
+        rec->type = GDROM_TRACE_READ;
+        rec->lba = lba;
+        rec->count = count;
+        rec->mode = mode;
+        rec->status = status;
+        rec->host_ns = host_ns;
+    }
+}
+
+/**
+ * Load an entire trace file into memory.
+ * @return a newly allocated array of records, or NULL on error.
+ */
+static struct gdrom_trace_record *gdrom_trace_load( const gchar *filename, uint32_t *count, ERROR *err )
+{
+    struct gdrom_trace_header header;
+    struct gdrom_trace_record *records;
+    long size;
+
+    FILE *f = fopen( filename, "rb" );
+    if( f == NULL ) {
+        SET_ERROR( err, LX_ERR_FILE_NOOPEN, "Unable to open disc trace '%s': %s", filename, strerror(errno) );
+        return NULL;
+    }
+    if( fread( &header, sizeof(header), 1, f ) != 1 ||
+            memcmp( header.magic, GDROM_TRACE_MAGIC, sizeof(header.magic) ) != 0 ||
+            header.version != GDROM_TRACE_VERSION ||
+            header.record_size != sizeof(struct gdrom_trace_record) ) {
+        SET_ERROR( err, LX_ERR_FILE_INVALID, "'%s' is not a disc trace (or was recorded on a different host)", filename );
+        fclose( f );
+        return NULL;
+    }
+    fseek( f, 0, SEEK_END );
+    size = ftell( f ) - sizeof(header);
+    fseek( f, sizeof(header), SEEK_SET );
+
+    *count = size / sizeof(struct gdrom_trace_record);
+    records = g_malloc( (*count + 1) * sizeof(struct gdrom_trace_record) );
+    if( fread( records, sizeof(struct gdrom_trace_record), *count, f ) != *count ) {
+        SET_ERROR( err, LX_ERR_FILE_IOERROR, "Unable to read disc trace '%s'", filename );
+        g_free( records );
+        fclose( f );
+        return NULL;
+    }
+    fclose( f );
+    return records;
+}
+
+static uint64_t gdrom_trace_host_time( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ((uint64_t)ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static int gdrom_trace_compare_ns( const void *a, const void *b )
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/**
+ * Run the reads through the drive timing model in each mode, at the
+ * emulated times they were recorded, totalling the time spent waiting
+ * for the drive.
+ */
+static void gdrom_trace_model_drive_time( struct gdrom_trace_record *records, uint32_t count,
+                                          struct gdrom_trace_stats *stats )
+{
+    int old_mode = gdrom_timing_get_mode();
+    int mode;
+    uint32_t i;
+
+    for( mode = GDROM_TIMING_MAX; mode <= GDROM_TIMING_ADAPTIVE; mode++ ) {
+        gdrom_timing_set_mode( mode );
+        gdrom_timing_reset();
+        for( i=0; i<count; i++ ) {
+            if( records[i].type == GDROM_TRACE_READ ) {
+                stats->drive_ns[mode] += gdrom_timing_read( records[i].lba + GDROM_LBA_OFFSET,
+                                                            records[i].count, records[i].time );
+            }
+        }
+    }
+    gdrom_timing_set_mode( old_mode );
+    gdrom_timing_reset();
+}
+
+gboolean gdrom_trace_replay( const gchar *filename, cdrom_disc_t disc,
+                             struct gdrom_trace_stats *stats, ERROR *err )
+{
+    uint32_t count, i;
+    uint32_t *latency;
+    unsigned char *buf = NULL;
+    size_t buf_size = 0;
+
+    struct gdrom_trace_record *records = gdrom_trace_load( filename, &count, err );
+    if( records == NULL ) {
+        return FALSE;
+    }
+    memset( stats, 0, sizeof(struct gdrom_trace_stats) );
+    latency = g_malloc( (count + 1) * sizeof(uint32_t) );
+    if( count > 0 ) {
+        stats->emulated_ns = records[count-1].time - records[0].time;
+    }
+
+    for( i=0; i<count; i++ ) {
+        struct gdrom_trace_record *rec = &records[i];
+        if( rec->type == GDROM_TRACE_COMMAND ) {
+            stats->commands++;
+        } else if( rec->type == GDROM_TRACE_READ ) {
+            size_t length = 0;
+            if( rec->count == 0 || rec->count > GDROM_TRACE_MAX_READ ) {
+                stats->errors++;
+                continue;
+            }
+            if( buf_size < rec->count * CDROM_MAX_SECTOR_SIZE ) {
+                buf_size = rec->count * CDROM_MAX_SECTOR_SIZE;
+                buf = g_realloc( buf, buf_size );
+            }
+            uint64_t start = gdrom_trace_host_time();
+            cdrom_error_t status = cdrom_disc_read_sectors( disc, rec->lba, rec->count, rec->mode, buf, &length );
+            uint64_t ns = gdrom_trace_host_time() - start;
+
+            latency[stats->reads++] = ns > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)ns;
+            stats->replay_ns += ns;
+            stats->recorded_ns += rec->host_ns;
+            stats->sectors += rec->count;
+            if( status == CDROM_ERROR_OK ) {
+                stats->bytes += length;
+            } else {
+                stats->errors++;
+            }
+        }
+    }
+
+    gdrom_trace_model_drive_time( records, count, stats );
+
+    if( stats->reads > 0 ) {
+        qsort( latency, stats->reads, sizeof(uint32_t), gdrom_trace_compare_ns );
+        stats->replay_median_ns = latency[stats->reads/2];
+        stats->replay_p99_ns = latency[(uint64_t)stats->reads*99/100];
+        stats->replay_max_ns = latency[stats->reads-1];
+    }
+    g_free( latency );
+    g_free( buf );
+    g_free( records );
+    return TRUE;
+}
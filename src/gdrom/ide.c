@@ -26,14 +26,20 @@
 #include <stdlib.h>
 #include "dream.h"
 #include "mem.h"
+#include "dma.h"
+#include "config.h"
 #include "asic.h"
+#include "dreamcast.h"
+#include "eventq.h"
 #include "gdrom/ide.h"
 #include "gdrom/gdrom.h"
 #include "gdrom/packet.h"
+#include "drivers/cdrom/sector.h"
 
 #define MAX_WRITE_BUF 4096
 #define MAX_SECTOR_SIZE 2352 /* Audio sector */
 #define DEFAULT_DATA_SECTORS 8
+#define MAX_DMA_READ_SECTORS 32 /* Sectors buffered at a time for DMA reads */
 
 static void ide_init( void );
 static void ide_reset( void );
@@ -44,13 +50,30 @@ static void ide_raise_interrupt( void );
 static void ide_clear_interrupt( void );
 static void ide_packet_command( unsigned char *data );
 static void ide_read_next_sector(void);
+static void ide_timing_event( int eventid );
 
 struct dreamcast_module ide_module = { "IDE", ide_init, ide_reset, NULL, ide_run_slice,
         NULL, ide_save_state, ide_load_state };
 
 struct ide_registers idereg;
 
-unsigned char data_buffer[MAX_SECTOR_SIZE];
+unsigned char data_buffer[MAX_SECTOR_SIZE*MAX_DMA_READ_SECTORS];
+
+/* Size of each sector in a multi-sector DMA read buffer */
+static uint32_t read_sector_size;
+
+/* Drive timing - when the timing model says the drive hasn't finished a
+ * read yet, the step the guest is waiting on is deferred to EVENT_GDROM.
+ */
+#define IDE_PENDING_NONE     0
+#define IDE_PENDING_PIO_READ 1 /* PIO data is buffered, but not yet signalled */
+#define IDE_PENDING_DMA_DONE 2 /* DMA data has been transferred, but not completed */
+
+static struct {
+    int pending;
+    uint32_t pending_length;  /* Length of a pending PIO read */
+    uint64_t ready_time;      /* Emulated time at which the current DMA read is complete */
+} ide_timing;
 
 #define WRITE_BUFFER(x16) *((uint16_t *)(data_buffer + idereg.data_offset)) = x16
 #define READ_BUFFER() *((uint16_t *)(data_buffer + idereg.data_offset))
@@ -131,12 +154,34 @@ char gdrom_status[] = {
 
 static void ide_init( void )
 {
+    const gchar *timing;
+
+    sector_source_set_raw_cache_enabled( lxdream_get_config_boolean_value(
+            lxdream_get_config_group(CONFIG_GROUP_GLOBAL), CONFIG_RAW_SECTOR_CACHE ) );
+    timing = lxdream_get_global_config_value( CONFIG_GDROM_TIMING );
+    if( gdrom_timing_parse_mode( timing ) == -1 ) {
+        WARN( "Unknown GD-Rom timing mode '%s', using max", timing );
+    }
+    gdrom_timing_set_mode( gdrom_timing_parse_mode( timing ) );
+    register_event_callback( EVENT_GDROM, ide_timing_event );
     ide_reset();
 }
 
+static void ide_timing_cancel( void )
+{
+    if( ide_timing.pending != IDE_PENDING_NONE ) {
+        event_cancel( EVENT_GDROM );
+        ide_timing.pending = IDE_PENDING_NONE;
+    }
+    ide_timing.ready_time = 0;
+}
+
 static void ide_reset( void )
 {
     ide_clear_interrupt();
+    ide_timing_cancel();
+    gdrom_timing_reset();
+    gdrom_stop_audio();
     idereg.error = 0x01;
     idereg.count = 0x01;
     idereg.lba0 = /* 0x21; */ 0x81;
@@ -165,16 +210,52 @@ static uint32_t ide_run_slice( uint32_t nanosecs )
 
 static void ide_save_state( FILE *f )
 {
-    fwrite( &idereg, sizeof(idereg), 1, f );
-    fwrite( data_buffer, MAX_SECTOR_SIZE, 1, f );
+    struct ide_registers regs = idereg;
+    unsigned char *buf = data_buffer;
+    uint64_t now, ready_delay;
+
+    if( regs.state == IDE_STATE_DMA_READ && regs.data_length > MAX_SECTOR_SIZE ) {
+        /* Save a multi-sector DMA read as a read of just the current sector
+         * - the rest will be re-read after loading. */
+        int sector = regs.data_offset / read_sector_size;
+        int rest = regs.data_length / read_sector_size - sector - 1;
+        buf += sector * read_sector_size;
+        regs.data_offset -= sector * read_sector_size;
+        regs.data_length = read_sector_size;
+        regs.current_lba -= rest;
+        regs.sectors_left += rest;
+    }
+    fwrite( &regs, sizeof(regs), 1, f );
+    fwrite( buf, MAX_SECTOR_SIZE, 1, f );
+
+    /* A read that's still waiting on the drive is saved as pending, with the
+     * ready time relative to now. EVENT_GDROM itself is restored with the
+     * event queue, so the read completes (and raises INTRQ) after loading. */
+    now = dreamcast_get_emulated_time();
+    ready_delay = ide_timing.ready_time > now ? ide_timing.ready_time - now : 0;
+    fwrite( &ide_timing.pending, sizeof(ide_timing.pending), 1, f );
+    fwrite( &ide_timing.pending_length, sizeof(ide_timing.pending_length), 1, f );
+    fwrite( &ready_delay, sizeof(ready_delay), 1, f );
 }
 
 static int ide_load_state( FILE *f )
 {
+    uint64_t ready_delay;
+
+    ide_timing.pending = IDE_PENDING_NONE;
+    ide_timing.ready_time = 0;
+    gdrom_stop_audio();
     if( fread( &idereg, sizeof(idereg), 1, f ) != 1 ||
-        fread( data_buffer, MAX_SECTOR_SIZE, 1, f ) != 1 ) {
+        fread( data_buffer, MAX_SECTOR_SIZE, 1, f ) != 1 ||
+        fread( &ide_timing.pending, sizeof(ide_timing.pending), 1, f ) != 1 ||
+        fread( &ide_timing.pending_length, sizeof(ide_timing.pending_length), 1, f ) != 1 ||
+        fread( &ready_delay, sizeof(ready_delay), 1, f ) != 1 ) {
+        ide_timing.pending = IDE_PENDING_NONE;
         return -1;
     }
+    if( ready_delay != 0 ) {
+        ide_timing.ready_time = dreamcast_get_emulated_time() + ready_delay;
+    }
     return 0;
 }
 
@@ -313,6 +394,25 @@ uint16_t ide_read_data_pio( void ) {
 }
 
 
+static void ide_complete_dma_read( void )
+{
+    idereg.state = IDE_STATE_IDLE;
+    idereg.status = 0x50;
+    idereg.count = 0x03;
+    ide_raise_interrupt();
+}
+
+static void ide_timing_event( int eventid )
+{
+    int pending = ide_timing.pending;
+    ide_timing.pending = IDE_PENDING_NONE;
+    if( pending == IDE_PENDING_PIO_READ ) {
+        ide_start_read( ide_timing.pending_length, FALSE );
+    } else if( pending == IDE_PENDING_DMA_DONE ) {
+        ide_complete_dma_read();
+    }
+}
+
 /**
  * DMA read request
  *
@@ -331,7 +431,7 @@ uint32_t ide_read_data_dma( uint32_t addr, uint32_t length )
         if( xferlen > remaining ) {
             xferlen = remaining;
         }
-        mem_copy_to_sh4( addr, (data_buffer + idereg.data_offset), xferlen );
+        dma_write( addr, (data_buffer + idereg.data_offset), xferlen );
         xfercount += xferlen;
         addr += xferlen;
         idereg.data_offset += xferlen;
@@ -339,11 +439,17 @@ uint32_t ide_read_data_dma( uint32_t addr, uint32_t length )
             if( idereg.sectors_left > 0 ) {
                 ide_read_next_sector();
             } else {
+                uint64_t now = dreamcast_get_emulated_time();
                 idereg.data_offset = -1;
-                idereg.state = IDE_STATE_IDLE;
-                idereg.status = 0x50;
-                idereg.count = 0x03;
-                ide_raise_interrupt();
+                if( ide_timing.ready_time > now ) {
+                    /* The drive hasn't finished reading yet */
+                    uint64_t delay = ide_timing.ready_time - now;
+                    idereg.state = IDE_STATE_BUSY;
+                    ide_timing.pending = IDE_PENDING_DMA_DONE;
+                    event_schedule( EVENT_GDROM, delay > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)delay );
+                } else {
+                    ide_complete_dma_read();
+                }
                 break;
             }
         }
@@ -391,6 +497,7 @@ void ide_write_command( uint8_t val ) {
     idereg.command = val;
     switch( val ) {
     case IDE_CMD_NOP: /* Effectively an "abort" */
+        ide_timing_cancel();
         idereg.state = IDE_STATE_IDLE;
         idereg.status = 0x51;
         idereg.error = 0x04;
@@ -446,12 +553,41 @@ uint8_t ide_get_drive_status( void )
 #define REQUIRE_DISC() if( gdrom_get_drive_status() == IDE_DISC_NONE ) { ide_set_packet_result( PKT_ERR_NODISC ); return; }
 
 /**
- * Read the next sector from the active read, if any
+ * Read the next sector from the active read, if any. DMA reads are
+ * transferred in blocks of up to MAX_DMA_READ_SECTORS sectors (which the
+ * guest can't see, as there's only the one interrupt at the end).
  */
 static void ide_read_next_sector( void )
 {
-    size_t sector_size;
-    cdrom_error_t status = gdrom_read_cd( idereg.current_lba, 1, idereg.current_mode, data_buffer, &sector_size );
+    size_t length;
+    gboolean dma = (idereg.feature & IDE_FEAT_DMA) ? TRUE : FALSE;
+    uint32_t count = 1;
+    if( dma && idereg.sectors_left > 1 ) {
+        count = idereg.sectors_left < MAX_DMA_READ_SECTORS ? idereg.sectors_left : MAX_DMA_READ_SECTORS;
+    }
+    cdrom_error_t status = gdrom_read_cd( idereg.current_lba, count, idereg.current_mode, data_buffer, &length );
+    if( status != PKT_ERR_OK && count > 1 ) {
+        /* Retry one sector at a time, so that the guest still gets the good
+         * sectors ahead of the bad one, and the error (if it recurs) is
+         * reported against the sector that actually failed.
+         */
+        uint32_t good = 0;
+        size_t sector_length;
+        length = 0;
+        while( good < count ) {
+            status = gdrom_read_cd( idereg.current_lba + good, 1, idereg.current_mode,
+                                    data_buffer + length, &sector_length );
+            if( status != PKT_ERR_OK ) {
+                break;
+            }
+            length += sector_length;
+            good++;
+        }
+        if( good != 0 ) {
+            count = good;
+            status = PKT_ERR_OK;
+        }
+    }
     if( status != PKT_ERR_OK ) {
         ide_set_packet_result( status );
         idereg.gdrom_sense[5] = (idereg.current_lba >> 16) & 0xFF;
@@ -459,9 +595,22 @@ static void ide_read_next_sector( void )
         idereg.gdrom_sense[7] = idereg.current_lba & 0xFF;
         WARN( " => Read CD returned sense key %02X, %02X", status & 0xFF, status >> 8 );
     } else {
-        idereg.current_lba++;
-        idereg.sectors_left--;
-        ide_start_read( sector_size, (idereg.feature & IDE_FEAT_DMA) ? TRUE : FALSE );
+        uint64_t now = dreamcast_get_emulated_time();
+        uint32_t delay = gdrom_timing_read( idereg.current_lba, count, now );
+        read_sector_size = length / count;
+        idereg.current_lba += count;
+        idereg.sectors_left -= count;
+        if( delay != 0 && !dma ) {
+            /* Data is buffered, but not visible until the drive has read it */
+            idereg.state = IDE_STATE_BUSY;
+            idereg.status = (idereg.status & ~IDE_STATUS_DRQ) | IDE_STATUS_BSY;
+            ide_timing.pending = IDE_PENDING_PIO_READ;
+            ide_timing.pending_length = length;
+            event_schedule( EVENT_GDROM, delay );
+        } else {
+            ide_timing.ready_time = now + delay;
+            ide_start_read( length, dma );
+        }
     }
 }
 
@@ -479,6 +628,7 @@ void ide_packet_command( unsigned char *cmd )
     DEBUG( "ATAPI packet: %02X %02X %02X %02X  %02X %02X %02X %02X  %02X %02X %02X %02X", 
           cmd[0], cmd[1], cmd[2], cmd[3], cmd[4], cmd[5], cmd[6], cmd[7],
           cmd[8], cmd[9], cmd[10], cmd[11] );
+    gdrom_trace_command( cmd );
 
     if( cmd[0] != PKT_CMD_SENSE && idereg.was_reset ) {
         ide_set_packet_result( PKT_ERR_RESET );
@@ -576,9 +726,34 @@ void ide_packet_command( unsigned char *cmd )
         }
         break;
     case PKT_CMD_PLAY_AUDIO:
-        lba = (cmd[2] << 16) | (cmd[3]<<8) | cmd[4];
-        length = ((cmd[8]<<16) | (cmd[9]<<8) | cmd[10]) - lba;
-        status = gdrom_play_audio( lba, length );
+        if( (cmd[1] & 0x07) == 0x07 ) { /* Continue from the paused position */
+            status = gdrom_resume_audio();
+        } else {
+            lba = (cmd[2] << 16) | (cmd[3]<<8) | cmd[4];
+            length = ((cmd[8]<<16) | (cmd[9]<<8) | cmd[10]) - lba;
+            status = gdrom_play_audio( lba, length, cmd[6] & 0x0F );
+        }
+        ide_set_packet_result( status );
+        ide_raise_interrupt();
+        idereg.status = 0x50;
+        break;
+    case PKT_CMD_SEEK:
+        switch( cmd[1] & 0x0F ) {
+        case 1: /* Seek to FAD, then pause */
+            status = gdrom_seek( (cmd[2] << 16) | (cmd[3]<<8) | cmd[4] );
+            break;
+        case 3: /* Stop */
+            gdrom_stop_audio();
+            status = PKT_ERR_OK;
+            break;
+        case 4: /* Pause */
+            gdrom_pause_audio();
+            status = PKT_ERR_OK;
+            break;
+        default:
+            status = PKT_ERR_BADFIELD;
+            break;
+        }
         ide_set_packet_result( status );
         ide_raise_interrupt();
         idereg.status = 0x50;
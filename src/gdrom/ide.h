@@ -35,6 +35,7 @@ extern "C" {
 
 #define IDE_DISC_READY 0x01 /* ored with above */
 #define IDE_DISC_IDLE  0x02 /* ie spun-down */
+#define IDE_DISC_PLAYING 0x03 /* Playing audio */
 #define IDE_DISC_NONE  0x06 /* No media in drive */
 
 struct ide_registers {
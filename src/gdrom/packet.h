@@ -58,6 +58,7 @@
 #define PKT_CMD_SESSION_INFO 0x15
 #define PKT_CMD_READ_SECTOR 0x30
 #define PKT_CMD_PLAY_AUDIO  0x20 /* ? */
+#define PKT_CMD_SEEK        0x21
 #define PKT_CMD_STATUS  0x40
 #define PKT_CMD_SPIN_UP 0x70 /* ??? */
 #define PKT_CMD_71      0x71 /* ??? seems to return garbage */
@@ -27,6 +27,9 @@
 #include "display.h"
 #include "gdrom/gdrom.h"
 #include "gtkui/gtkui.h"
+#ifdef HAVE_GLX
+#include <X11/Xlib.h>
+#endif
 
 void gtk_gui_start( void );
 void gtk_gui_stop( void );
@@ -228,6 +231,11 @@ static const char *ui_description =
 
 gboolean gui_parse_cmdline( int *argc, char **argv[] )
 {
+#ifdef HAVE_GLX
+    /* The GL context may be handed over to the render thread, so Xlib has to
+     * be made thread-safe before anything else opens the display */
+    XInitThreads();
+#endif
     gtk_gui_init_ok = gtk_init_check( argc, argv );
     return gtk_gui_init_ok;
 }
@@ -28,6 +28,7 @@
 #include "dreamcast.h"
 #include "display.h"
 #include "gui.h"
+#include "gdindex.h"
 #include "gdlist.h"
 #include "hotkeys.h"
 #include "loader.h"
@@ -37,6 +38,8 @@
 #include "syscall.h"
 #include "aica/audio.h"
 #include "aica/armdasm.h"
+#include "drivers/cdrom/cdrom.h"
+#include "drivers/cdrom/sector.h"
 #include "gdrom/gdrom.h"
 #include "maple/maple.h"
 #include "pvr2/glutil.h"
@@ -44,14 +47,21 @@
 #include "vmu/vmulist.h"
 
 #define GL_INFO_OPT 1
+#define COMPRESS_DISC_OPT 2
+#define DISC_INDEX_OPT 3
+#define DISC_TRACE_OPT 4
+#define REPLAY_DISC_TRACE_OPT 5
 
 char *option_list = "a:A:bc:e:dfg:G:hHl:m:npPt:T:uvV:xX?";
 struct option longopts[] = {
         { "aica", required_argument, NULL, 'a' },
         { "audio", required_argument, NULL, 'A' },
         { "biosless", no_argument, NULL, 'b' },
+        { "compress-disc", required_argument, NULL, COMPRESS_DISC_OPT },
         { "config", required_argument, NULL, 'c' },
         { "debugger", no_argument, NULL, 'd' },
+        { "disc-index", no_argument, NULL, DISC_INDEX_OPT },
+        { "disc-trace", required_argument, NULL, DISC_TRACE_OPT },
         { "execute", required_argument, NULL, 'e' },
         { "fullscreen", no_argument, NULL, 'f' },
         { "gdb-sh4", required_argument, NULL, 'g' },  
@@ -61,6 +71,7 @@ struct option longopts[] = {
         { "headless", no_argument, NULL, 'H' },
         { "log", required_argument, NULL,'l' }, 
         { "multiplier", required_argument, NULL, 'm' },
+        { "replay-disc-trace", required_argument, NULL, REPLAY_DISC_TRACE_OPT },
         { "run-time", required_argument, NULL, 't' },
         { "shadow", no_argument, NULL, 'X' },
         { "trace", required_argument, NULL, 'T' },
@@ -73,8 +84,12 @@ char *aica_program = NULL;
 char *display_driver_name = NULL;
 char *audio_driver_name = NULL;
 char *trace_regions = NULL;
+char *compress_disc_name = NULL;
+char *disc_trace_name = NULL;
+char *replay_disc_trace_name = NULL;
 char *sh4_gdb_port = NULL;
 char *arm_gdb_port = NULL;
+gboolean dump_disc_index = FALSE;
 gboolean start_immediately = FALSE;
 gboolean no_start = FALSE;
 gboolean headless = FALSE;
@@ -99,6 +114,9 @@ static void print_usage()
     printf( "   -A, --audio=DRIVER     %s\n", _("Use the specified audio driver (? to list)") );
     printf( "   -b, --biosless         %s\n", _("Run without the BIOS boot rom even if available") );
     printf( "   -c, --config=CONFFILE  %s\n", _("Load configuration from CONFFILE") );
+    printf( "       --compress-disc=CDZFILE %s\n", _("Convert the disc-file to a compressed image and exit") );
+    printf( "       --disc-index       %s\n", _("Add any disc-files to the disc index, print the index and exit") );
+    printf( "       --disc-trace=TRACEFILE %s\n", _("Record all disc reads to TRACEFILE") );
     printf( "   -e, --execute=PROGRAM  %s\n", _("Load and execute the given SH4 program") );
     printf( "   -d, --debugger         %s\n", _("Start in debugger mode") );
     printf( "   -f, --fullscreen       %s\n", _("Start in fullscreen mode") );
@@ -110,6 +128,7 @@ static void print_usage()
     printf( "   -m, --multiplier=SCALE %s\n", _("Set the SH4 multiplier (1.0 = fullspeed)") );
     printf( "   -n                     %s\n", _("Don't start running immediately") );
     printf( "   -p                     %s\n", _("Start running immediately on startup") );
+    printf( "       --replay-disc-trace=TRACEFILE %s\n", _("Replay the reads in TRACEFILE against each disc-file and exit") );
     printf( "   -t, --run-time=SECONDS %s\n", _("Run for the specified number of seconds") );
     printf( "   -T, --trace=REGIONS    %s\n", _("Output trace information for the named regions") );
     printf( "   -u, --unsafe           %s\n", _("Allow unsafe dcload syscalls") );
@@ -119,6 +138,45 @@ static void print_usage()
     printf( "   -X                     %s\n", _("Run both SH4 interpreter and translator") );
 }
 
+/**
+ * Replay a disc trace against the image, once through pread and once
+ * through mmap (where the image format uses file sources).
+ */
+static gboolean replay_disc_trace( const gchar *trace_file, const gchar *disc_file )
+{
+    static const char *backends[] = { "pread", "mmap" };
+    struct gdrom_trace_stats stats;
+    ERROR err;
+    int i;
+
+    for( i=0; i<2; i++ ) {
+        file_sector_source_set_map_enabled( i == 1 );
+        cdrom_disc_t disc = cdrom_disc_open( disc_file, &err );
+        if( disc == NULL ) {
+            ERROR( err.msg );
+            return FALSE;
+        }
+        gboolean ok = gdrom_trace_replay( trace_file, disc, &stats, &err );
+        cdrom_disc_unref( disc );
+        if( !ok ) {
+            ERROR( err.msg );
+            return FALSE;
+        }
+        printf( "%s (%s): %u reads, %lld sectors, %u errors in %.3fs emulated\n",
+                disc_file, backends[i], stats.reads, (long long)stats.sectors, stats.errors, stats.emulated_ns / 1e9 );
+        printf( "    replay %.3fms (%.1fMB/s), median %.1fus, p99 %.1fus, max %.1fus; recorded %.3fms\n",
+                stats.replay_ns / 1e6, stats.replay_ns == 0 ? 0.0 : stats.bytes * 1e3 / stats.replay_ns,
+                stats.replay_median_ns / 1e3, stats.replay_p99_ns / 1e3, stats.replay_max_ns / 1e3,
+                stats.recorded_ns / 1e6 );
+    }
+    printf( "    drive time: %s %.3fs, %s %.3fs, %s %.3fs\n",
+            gdrom_timing_get_mode_name(GDROM_TIMING_MAX), stats.drive_ns[GDROM_TIMING_MAX] / 1e9,
+            gdrom_timing_get_mode_name(GDROM_TIMING_REALISTIC), stats.drive_ns[GDROM_TIMING_REALISTIC] / 1e9,
+            gdrom_timing_get_mode_name(GDROM_TIMING_ADAPTIVE), stats.drive_ns[GDROM_TIMING_ADAPTIVE] / 1e9 );
+    file_sector_source_set_map_enabled( TRUE );
+    return TRUE;
+}
+
 static void bind_gettext_domain()
 {
 #ifdef ENABLE_NLS
@@ -226,6 +284,18 @@ int main (int argc, char *argv[])
         case GL_INFO_OPT:
             print_glinfo = TRUE;
             break;
+        case COMPRESS_DISC_OPT:
+            compress_disc_name = optarg;
+            break;
+        case DISC_INDEX_OPT:
+            dump_disc_index = TRUE;
+            break;
+        case DISC_TRACE_OPT:
+            disc_trace_name = optarg;
+            break;
+        case REPLAY_DISC_TRACE_OPT:
+            replay_disc_trace_name = optarg;
+            break;
         }
     }
 
@@ -248,6 +318,52 @@ int main (int argc, char *argv[])
         exit(0);
     }
 
+    if( compress_disc_name != NULL ) {
+        ERROR err;
+        if( optind >= argc ) {
+            ERROR( "No disc image given to compress" );
+            exit(1);
+        }
+        cdrom_disc_t disc = cdrom_disc_open( argv[optind], &err );
+        if( disc == NULL ) {
+            ERROR( err.msg );
+            exit(2);
+        }
+        gboolean ok = cdrom_disc_write_compressed( disc, compress_disc_name, &err );
+        cdrom_disc_unref( disc );
+        if( !ok ) {
+            ERROR( err.msg );
+            exit(2);
+        }
+        exit(0);
+    }
+
+    if( dump_disc_index ) {
+        GList *files = NULL;
+        int i;
+        for( i=optind; i<argc; i++ ) {
+            files = g_list_append( files, argv[i] );
+        }
+        gdrom_index_update( files );
+        g_list_free( files );
+        gdrom_index_dump( stdout );
+        exit(0);
+    }
+
+    if( replay_disc_trace_name != NULL ) {
+        int i;
+        if( optind >= argc ) {
+            ERROR( "No disc image given to replay the trace against" );
+            exit(1);
+        }
+        for( i=optind; i<argc; i++ ) {
+            if( !replay_disc_trace( replay_disc_trace_name, argv[i] ) ) {
+                exit(2);
+            }
+        }
+        exit(0);
+    }
+
     if( print_glinfo ) {
         gui_init(FALSE, FALSE);
         display_driver_t display_driver = get_display_driver_by_name(display_driver_name);
@@ -282,9 +398,10 @@ int main (int argc, char *argv[])
 
     audio_init_driver( audio_driver_name );
 
-    headless = display_driver_name != NULL && strcasecmp( display_driver_name, "null" ) == 0;
+    headless = display_driver_name != NULL && (strcasecmp( display_driver_name, "null" ) == 0 ||
+            strcasecmp( display_driver_name, "soft" ) == 0);
     if( headless ) {
-        display_set_driver( &display_null_driver );
+        display_set_driver( get_display_driver_by_name(display_driver_name) );
     } else {
         gui_init(show_debugger, show_fullscreen);
 
@@ -358,6 +475,13 @@ int main (int argc, char *argv[])
         }
     }
 
+    if( disc_trace_name != NULL ) {
+        ERROR err;
+        if( !gdrom_trace_start( disc_trace_name, &err ) ) {
+            ERROR( err.msg );
+        }
+    }
+
     sh4_set_core( sh4_core );
     sh4_set_profile_blocks( sh4_profile_blocks );
 
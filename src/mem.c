@@ -35,6 +35,12 @@
 #include "mmio.h"
 #include "dreamcast.h"
 
+#ifdef HAVE_FASTMEM
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/syscall.h>
+#endif
+
 #ifndef PAGE_SIZE
 #define PAGE_SIZE 4096
 #endif
@@ -138,6 +144,161 @@ void mem_unprotect( void *region, uint32_t size )
     assert( status == 0 );
 }
 
+/************************** Fastmem window *****************************/
+
+unsigned char *mem_fastmem_base = NULL;
+
+#ifdef HAVE_FASTMEM
+#ifndef SYS_memfd_create
+#define SYS_memfd_create 319
+#endif
+
+#define FASTMEM_WINDOW_SIZE 0x100000000ULL
+#define FASTMEM_AREA_SIZE 0x20000000
+#define FASTMEM_AREA_COUNT 7 /* P0 (as 4 areas), P1, P2, P3 */
+#define FASTMEM_HUGEPAGE_SIZE 0x200000
+
+static int mem_fastmem_fd = -1;
+static off_t mem_fastmem_size = 0;
+static mem_fastmem_fault_fn_t mem_fastmem_fault_fn = NULL;
+static struct sigaction mem_fastmem_next_action;
+
+static void mem_fastmem_advise( void *ptr, size_t size )
+{
+#ifdef MADV_HUGEPAGE
+    if( size >= FASTMEM_HUGEPAGE_SIZE ) {
+        madvise( ptr, size, MADV_HUGEPAGE );
+    }
+#endif
+}
+
+static void mem_fastmem_signal( int sig, siginfo_t *info, void *context )
+{
+    ucontext_t *uc = (ucontext_t *)context;
+    unsigned char *addr = (unsigned char *)info->si_addr;
+
+    if( addr >= mem_fastmem_base && addr < mem_fastmem_base + FASTMEM_WINDOW_SIZE &&
+            mem_fastmem_fault_fn != NULL &&
+            mem_fastmem_fault_fn( (uintptr_t *)&uc->uc_mcontext.gregs[REG_RIP] ) ) {
+        return;
+    }
+
+    /* Not a fastmem fault - pass it on to whoever was there first */
+    if( mem_fastmem_next_action.sa_flags & SA_SIGINFO ) {
+        mem_fastmem_next_action.sa_sigaction( sig, info, context );
+    } else if( mem_fastmem_next_action.sa_handler == SIG_DFL ||
+            mem_fastmem_next_action.sa_handler == SIG_IGN ) {
+        /* Faulting instruction will be retried and take the default action */
+        signal( sig, SIG_DFL );
+    } else {
+        mem_fastmem_next_action.sa_handler( sig );
+    }
+}
+
+gboolean mem_fastmem_init( void )
+{
+    struct sigaction sa;
+    void *base;
+
+    if( mem_fastmem_base != NULL ) {
+        return TRUE;
+    }
+    base = mmap( NULL, FASTMEM_WINDOW_SIZE, PROT_NONE,
+            MAP_ANON|MAP_PRIVATE|MAP_NORESERVE, -1, 0 );
+    if( base == MAP_FAILED ) {
+        WARN( "Unable to reserve fastmem window (%s)", strerror(errno) );
+        return FALSE;
+    }
+    mem_fastmem_fd = syscall( SYS_memfd_create, "lxdream", 0 );
+    if( mem_fastmem_fd == -1 ) {
+        WARN( "Unable to create fastmem memory object (%s)", strerror(errno) );
+        munmap( base, FASTMEM_WINDOW_SIZE );
+        return FALSE;
+    }
+
+    sa.sa_sigaction = mem_fastmem_signal;
+    sigemptyset( &sa.sa_mask );
+    sa.sa_flags = SA_SIGINFO|SA_RESTART;
+    sigaction( SIGSEGV, &sa, &mem_fastmem_next_action );
+
+    mem_fastmem_base = base;
+    mem_fastmem_size = 0;
+    INFO( "Fastmem window at %p", base );
+    return TRUE;
+}
+
+void mem_fastmem_map_region( const char *name )
+{
+    struct mem_region *region = NULL;
+    uint32_t base;
+    off_t offset;
+    int i;
+
+    if( mem_fastmem_base == NULL ) {
+        return;
+    }
+    for( i=0; i<num_mem_rgns; i++ ) {
+        if( strcmp( mem_rgn[i].name, name ) == 0 ) {
+            region = &mem_rgn[i];
+            break;
+        }
+    }
+    if( region == NULL || region->mem == NULL ) {
+        return;
+    }
+    assert( (((uintptr_t)region->mem) & (PAGE_SIZE-1)) == 0 && (region->size & (PAGE_SIZE-1)) == 0 );
+
+    /* Move the region contents into the memory object, and replace the
+     * region memory with a shared mapping of it */
+    offset = mem_fastmem_size;
+    if( region->size >= FASTMEM_HUGEPAGE_SIZE ) {
+        offset = (offset + FASTMEM_HUGEPAGE_SIZE - 1) & ~((off_t)FASTMEM_HUGEPAGE_SIZE - 1);
+    }
+    if( ftruncate( mem_fastmem_fd, offset + region->size ) != 0 ||
+            pwrite( mem_fastmem_fd, region->mem, region->size, offset ) != region->size ) {
+        ERROR( "Unable to map %s into fastmem window (%s)", name, strerror(errno) );
+        return;
+    }
+    if( mmap( region->mem, region->size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED,
+            mem_fastmem_fd, offset ) == MAP_FAILED ) {
+        FATAL( "Unable to remap %s (%s)", name, strerror(errno) );
+    }
+    mem_fastmem_advise( region->mem, region->size );
+    mem_fastmem_size = offset + region->size;
+
+    for( i=0; i<FASTMEM_AREA_COUNT; i++ ) {
+        base = region->base;
+        do {
+            unsigned char *ptr = mem_fastmem_base + (uintptr_t)i*FASTMEM_AREA_SIZE + base;
+            if( mmap( ptr, region->size, PROT_READ, MAP_SHARED|MAP_FIXED,
+                    mem_fastmem_fd, offset ) == MAP_FAILED ) {
+                FATAL( "Unable to map %s into fastmem window (%s)", name, strerror(errno) );
+            }
+            mem_fastmem_advise( ptr, region->size );
+            base += region->repeat_offset;
+        } while( base <= region->repeat_until );
+    }
+}
+
+void mem_fastmem_set_fault_handler( mem_fastmem_fault_fn_t fn )
+{
+    mem_fastmem_fault_fn = fn;
+}
+#else
+gboolean mem_fastmem_init( void )
+{
+    return FALSE;
+}
+
+void mem_fastmem_map_region( const char *name )
+{
+}
+
+void mem_fastmem_set_fault_handler( mem_fastmem_fault_fn_t fn )
+{
+}
+#endif
+
 void mem_init( void )
 {
     int i;
@@ -350,6 +511,8 @@ struct mem_region *mem_map_region( void *mem, uint32_t base, uint32_t size,
     mem_rgn[num_mem_rgns].name = name;
     mem_rgn[num_mem_rgns].mem = mem;
     mem_rgn[num_mem_rgns].fn = fn;
+    mem_rgn[num_mem_rgns].repeat_offset = repeat_offset;
+    mem_rgn[num_mem_rgns].repeat_until = repeat_until;
     fn->prefetch = unmapped_prefetch;
     fn->read_byte_for_write = fn->read_byte;
     num_mem_rgns++;
@@ -76,6 +76,8 @@ typedef struct mem_region {
     sh4ptr_t mem;
     uint32_t flags;
     mem_region_fn_t fn;
+    uint32_t repeat_offset;
+    uint32_t repeat_until;
 } *mem_region_t;
 
 #define MAX_IO_REGIONS 24
@@ -108,6 +110,48 @@ struct mem_region *mem_map_region( void *mem, uint32_t base, uint32_t size,
  */
 gboolean mem_load_rom( void *output, const gchar *filename, uint32_t size, uint32_t crc ); 
 void *mem_alloc_pages( int n );
+
+/**
+ * Alignment for statically allocated region memory, so that it can be
+ * remapped into the fastmem window (on hugepages where possible).
+ */
+#define MEM_REGION_ALIGNED __attribute__((aligned(0x200000)))
+
+/**
+ * Fastmem support: a 4GB host window in which directly readable memory
+ * regions appear at mem_fastmem_base + SH4 address, in each of P0-P3 and
+ * including all of their mirrors. Everything else in the window is
+ * inaccessible, and faults are passed to the registered fault handler.
+ */
+#if defined(__linux__) && defined(__x86_64__)
+#define HAVE_FASTMEM 1
+#endif
+
+/**
+ * Fault handler for accesses to unmapped pages of the fastmem window.
+ * @param pc pointer to the faulting host PC, which may be updated.
+ * @return TRUE if the fault was handled and execution can resume at *pc.
+ */
+typedef gboolean (*mem_fastmem_fault_fn_t)( uintptr_t *pc );
+
+/** Base of the fastmem window, or NULL if fastmem isn't enabled */
+extern unsigned char *mem_fastmem_base;
+
+/**
+ * Reserve the fastmem window and install its fault handler.
+ * @return TRUE on success, FALSE if fastmem isn't available.
+ */
+gboolean mem_fastmem_init( void );
+
+/**
+ * Map the named memory region (and all its mirrors) read-only into the fastmem
+ * window. Only regions whose read functions have no side effects should be
+ * mapped, and the region mustn't be remapped afterwards. The region memory
+ * must be page aligned. No-op if fastmem isn't enabled.
+ */
+void mem_fastmem_map_region( const char *name );
+
+void mem_fastmem_set_fault_handler( mem_fastmem_fault_fn_t fn );
 sh4ptr_t mem_get_region( uint32_t addr );
 sh4ptr_t mem_get_region_by_name( const char *name );
 gboolean mem_has_page( uint32_t addr );
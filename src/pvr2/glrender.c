@@ -17,6 +17,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 #include <sys/time.h>
 #include "display.h"
 #include "pvr2/pvr2.h"
@@ -33,7 +34,6 @@
 static CGLContextObj CGL_MACRO_CONTEXT;
 #endif
 
-#define IS_NONEMPTY_TILE_LIST(p) (IS_TILE_PTR(p) && ((*((uint32_t *)(pvr2_main_ram+(p))) >> 28) != 0x0F))
 
 int pvr2_poly_depthmode[8] = { GL_NEVER, GL_LESS, GL_EQUAL, GL_LEQUAL,
         GL_GREATER, GL_NOTEQUAL, GL_GEQUAL, 
@@ -49,12 +49,43 @@ int pvr2_poly_dstblend[8] = {
 
 static gboolean have_shaders = FALSE;
 static int currentTexId = -1;
+static float render_alpha_ref = 0.0;
+
+/**
+ * Per-scene GL work counters, reported at the end of each render
+ */
+static struct {
+    uint32_t draw_calls;
+    uint32_t texture_binds;
+    uint32_t context_changes;
+} render_stats;
+
+/**
+ * GL state last set by render_set_base_context and render_set_tsp_context,
+ * so that context_changes only counts calls which actually change something.
+ * Anything that sets the depth or blend state directly must call
+ * render_forget_context() afterwards.
+ */
+static struct {
+    GLint depth_func;  /* 0 if unknown */
+    GLint depth_write; /* -1 if unknown */
+    gboolean tsp_valid;
+    uint32_t tsp_poly1, tsp_poly2;
+} render_context;
+
+static void render_forget_context()
+{
+    render_context.depth_func = 0;
+    render_context.depth_write = -1;
+    render_context.tsp_valid = FALSE;
+}
 
 static inline void bind_texture(int texid)
 {
     if( currentTexId != texid ) {
         currentTexId = texid;
         glBindTexture(GL_TEXTURE_2D, texid);
+        render_stats.texture_binds++;
     }
 }
 
@@ -162,11 +193,18 @@ void pvr2_shutdown_gl_context()
  */
 static void render_set_base_context( uint32_t poly1, gboolean set_depth )
 {
+    GLint depth_write = POLY1_DEPTH_WRITE(poly1) ? GL_TRUE : GL_FALSE;
+    if( depth_write != render_context.depth_write ||
+            (set_depth && POLY1_DEPTH_MODE(poly1) != render_context.depth_func) ) {
+        render_stats.context_changes++;
+    }
     if( set_depth ) {
         glDepthFunc( POLY1_DEPTH_MODE(poly1) );
+        render_context.depth_func = POLY1_DEPTH_MODE(poly1);
     }
 
-    glDepthMask( POLY1_DEPTH_WRITE(poly1) ? GL_TRUE : GL_FALSE );
+    glDepthMask( depth_write );
+    render_context.depth_write = depth_write;
 }
 
 /**
@@ -174,6 +212,15 @@ static void render_set_base_context( uint32_t poly1, gboolean set_depth )
  */
 static void render_set_tsp_context( uint32_t poly1, uint32_t poly2 )
 {
+    /* Only the shading and texture enable bits of poly1 affect the TSP state */
+    poly1 &= 0x02800000;
+    if( !render_context.tsp_valid || poly1 != render_context.tsp_poly1 ||
+            poly2 != render_context.tsp_poly2 ) {
+        render_stats.context_changes++;
+        render_context.tsp_valid = TRUE;
+        render_context.tsp_poly1 = poly1;
+        render_context.tsp_poly2 = poly2;
+    }
 #ifdef HAVE_OPENGL_FIXEDFUNC
     glShadeModel( POLY1_SHADE_MODEL(poly1) );
 
@@ -222,6 +269,7 @@ static inline void gl_draw_vertexes( struct polygon_struct *poly )
 {
     do {
         glDrawArrays(GL_TRIANGLE_STRIP, poly->vertex_index, poly->vertex_count);
+        render_stats.draw_calls++;
         poly = poly->sub_next;
     } while( poly != NULL );
 }
@@ -230,6 +278,7 @@ static inline void gl_draw_mod_vertexes( struct polygon_struct *poly )
 {
     do {
         glDrawArrays(GL_TRIANGLE_STRIP, poly->mod_vertex_index, poly->vertex_count);
+        render_stats.draw_calls++;
         poly = poly->sub_next;
     } while( poly != NULL );
 }
@@ -333,6 +382,7 @@ static void gl_render_bkgnd( struct polygon_struct *poly )
     render_set_tsp_context( poly->context[0], poly->context[1] );
     glDisable( GL_DEPTH_TEST );
     glBlendFunc( GL_ONE, GL_ZERO );
+    render_forget_context();
     gl_draw_vertexes(poly);
     glEnable( GL_DEPTH_TEST );
 }
@@ -342,9 +392,25 @@ void gl_render_triangle( struct polygon_struct *poly, int index )
     bind_texture(poly->tex_id);
     render_set_tsp_context( poly->context[0], poly->context[1] );
     glDrawArrays(GL_TRIANGLE_STRIP, poly->vertex_index + index, 3 );
+    render_stats.draw_calls++;
 
 }
 
+static void gl_render_sorted_triangle( struct polygon_struct *poly, int index, void *data )
+{
+    gl_render_triangle( poly, index );
+}
+
+static void gl_render_autosort_tile( struct tile_segment *segment )
+{
+    glDepthMask(GL_FALSE);
+    glDepthFunc(GL_GEQUAL);
+    render_forget_context();
+    if( !render_sort_tile( segment, gl_render_sorted_triangle, NULL ) ) {
+        gl_render_tilelist(segment->trans_ptr, FALSE);
+    }
+}
+
 void gl_render_tilelist( pvraddr_t tile_entry, gboolean set_depth )
 {
     tileentryiter list;
@@ -360,6 +426,118 @@ void gl_render_tilelist( pvraddr_t tile_entry, gboolean set_depth )
     }
 }
 
+#ifdef HAVE_GLES2
+/* Core GLES2 doesn't have 32-bit indexes, so just draw the lists as-is */
+#define gl_render_tilelist_batched gl_render_tilelist
+#else
+/**
+ * Draw batching for the opaque and punch-through lists. Consecutive polygons
+ * in a tile list which share the same texture and polygon context are drawn
+ * as a single indexed strip, with the individual strips joined by degenerate
+ * triangles (back faces have already been culled in the scene, so strip
+ * parity doesn't matter). Polygons are never reordered - with depth ties,
+ * blending and alpha test, the result can depend on the draw order even
+ * when depth testing is on. Polygons with modifier volumes need the stencil
+ * set up around them, so they end the current run and are drawn individually
+ * as before.
+ */
+static struct {
+    struct polygon_struct **polys;
+    uint32_t poly_count;
+    uint32_t poly_size;
+    GLuint *indexes;
+    uint32_t index_size;
+} render_batch;
+
+static gboolean render_batch_same_state( struct polygon_struct *a, struct polygon_struct *b )
+{
+    return a->tex_id == b->tex_id && a->context[0] == b->context[0] &&
+        a->context[1] == b->context[1];
+}
+
+static void render_batch_add( struct polygon_struct *poly )
+{
+    if( render_batch.poly_count == render_batch.poly_size ) {
+        render_batch.poly_size = render_batch.poly_size == 0 ? 256 : render_batch.poly_size * 2;
+        render_batch.polys = g_realloc( render_batch.polys,
+                render_batch.poly_size * sizeof(struct polygon_struct *) );
+    }
+    render_batch.polys[render_batch.poly_count++] = poly;
+}
+
+/**
+ * Draw the current run of polygons (which all share the same state) as one
+ * strip, and start a new run.
+ */
+static void render_batch_flush( gboolean set_depth )
+{
+    struct polygon_struct *poly;
+    uint32_t count = 0, i;
+
+    if( render_batch.poly_count == 0 )
+        return;
+
+    poly = render_batch.polys[0];
+    bind_texture(poly->tex_id);
+    render_set_context(poly->context, set_depth);
+    if( render_batch.poly_count == 1 && poly->sub_next == NULL ) {
+        glDrawArrays(GL_TRIANGLE_STRIP, poly->vertex_index, poly->vertex_count);
+        render_stats.draw_calls++;
+        render_batch.poly_count = 0;
+        return;
+    }
+
+    for( i=0; i<render_batch.poly_count; i++ ) {
+        for( poly = render_batch.polys[i]; poly != NULL; poly = poly->sub_next ) {
+            /* Worst case, each strip needs 2 extra indexes to join it on */
+            if( count + poly->vertex_count + 2 > render_batch.index_size ) {
+                render_batch.index_size = (count + poly->vertex_count + 2) * 2;
+                render_batch.indexes = g_realloc( render_batch.indexes,
+                        render_batch.index_size * sizeof(GLuint) );
+            }
+            GLuint *out = render_batch.indexes + count;
+            GLuint vertex = poly->vertex_index, last = vertex + poly->vertex_count;
+            if( count != 0 ) {
+                *out++ = render_batch.indexes[count-1];
+                *out++ = vertex;
+            }
+            while( vertex < last ) {
+                *out++ = vertex++;
+            }
+            count = out - render_batch.indexes;
+        }
+    }
+    glDrawElements(GL_TRIANGLE_STRIP, count, GL_UNSIGNED_INT, render_batch.indexes);
+    render_stats.draw_calls++;
+    render_batch.poly_count = 0;
+}
+
+static void gl_render_tilelist_batched( pvraddr_t tile_entry, gboolean set_depth )
+{
+    tileentryiter list;
+
+    FOREACH_TILEENTRY(list, tile_entry) {
+        struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[TILEENTRYITER_POLYADDR(list)];
+        if( poly != NULL ) {
+            do {
+                if( poly->mod_vertex_index != -1 ) {
+                    render_batch_flush(set_depth);
+                    gl_render_poly(poly, set_depth);
+                } else if( poly->vertex_count != 0 ) {
+                    if( render_batch.poly_count != 0 &&
+                            !render_batch_same_state(render_batch.polys[0], poly) ) {
+                        render_batch_flush(set_depth);
+                    }
+                    render_batch_add(poly);
+                }
+                poly = poly->next;
+            } while( list.strip_count-- > 0 );
+        }
+    }
+    render_batch_flush(set_depth);
+}
+#endif
+
 /**
  * Render the tilelist with depthbuffer updates only.
  */
@@ -491,25 +669,40 @@ void pvr2_scene_set_alpha_shader( float alphaRef )
  */
 void pvr2_scene_render( render_buffer_t buffer )
 {
-    /* Scene setup */
-    struct timeval start_tv, tex_tv, end_tv;
-    int i;
-    GLfloat viewMatrix[16];
-    uint32_t clip_bounds[4];
+    pvr2_scene_render_setup( buffer );
+    pvr2_scene_render_draw();
+}
 
+void pvr2_scene_render_setup( render_buffer_t buffer )
+{
+    struct timeval start_tv, tex_tv;
 
     gettimeofday(&start_tv, NULL);
-    display_driver->set_render_target(buffer);
+    /* Load textures before binding the target, as a texture miss may need to
+     * collect an earlier render-to-texture from the driver */
     pvr2_check_palette_changed();
     pvr2_scene_load_textures();
+    display_driver->set_render_target(buffer);
     currentTexId = -1;
+    render_alpha_ref = ((float)(MMIO_READ(PVR2, RENDER_ALPHA_REF)&0xFF)+1)/256.0;
 
     gettimeofday( &tex_tv, NULL );
     uint32_t ms = (tex_tv.tv_sec - start_tv.tv_sec) * 1000 +
     (tex_tv.tv_usec - start_tv.tv_usec)/1000;
     DEBUG( "Texture load in %dms", ms );
+}
 
-    float alphaRef = ((float)(MMIO_READ(PVR2, RENDER_ALPHA_REF)&0xFF)+1)/256.0;
+void pvr2_scene_render_draw( void )
+{
+    struct timeval start_tv, end_tv;
+    int i;
+    GLfloat viewMatrix[16];
+    uint32_t clip_bounds[4];
+    float alphaRef = render_alpha_ref;
+
+    gettimeofday( &start_tv, NULL );
+    memset( &render_stats, 0, sizeof(render_stats) );
+    render_forget_context();
     float nearz = pvr2_scene.bounds[4];
     float farz = pvr2_scene.bounds[5];
     if( nearz == farz ) {
@@ -582,6 +775,7 @@ void pvr2_scene_render( render_buffer_t buffer )
             }
         END_FOREACH_SEGMENT()
         glDepthMask( GL_TRUE );
+        render_forget_context();
         glStencilOp( GL_KEEP, GL_KEEP, GL_KEEP );
         glDisable( GL_SCISSOR_TEST );
         glClear( GL_DEPTH_BUFFER_BIT );
@@ -592,7 +786,7 @@ void pvr2_scene_render( render_buffer_t buffer )
     /* Render the opaque polygons */
     FOREACH_SEGMENT(segment)
         CLIP_TO_SEGMENT();
-        gl_render_tilelist(segment->opaque_ptr,TRUE);
+        gl_render_tilelist_batched(segment->opaque_ptr,TRUE);
     END_FOREACH_SEGMENT()
     glDisable( GL_STENCIL_TEST );
 
@@ -602,9 +796,10 @@ void pvr2_scene_render( render_buffer_t buffer )
     else
         pvr2_scene_set_alpha_fixed(alphaRef);
     glDepthFunc(GL_GEQUAL);
+    render_forget_context();
     FOREACH_SEGMENT(segment)
         CLIP_TO_SEGMENT();
-        gl_render_tilelist(segment->punchout_ptr, FALSE );
+        gl_render_tilelist_batched(segment->punchout_ptr, FALSE );
     END_FOREACH_SEGMENT()
     if( have_shaders )
         pvr2_scene_set_alpha_shader(0.0);
@@ -612,14 +807,14 @@ void pvr2_scene_render( render_buffer_t buffer )
         pvr2_scene_set_alpha_fixed(0.0);
 
     /* Render the translucent polygons */
+    render_sort_scene();
     FOREACH_SEGMENT(segment)
         if( IS_NONEMPTY_TILE_LIST(segment->trans_ptr) ) {
             CLIP_TO_SEGMENT();
-            if( pvr2_scene.sort_mode == SORT_NEVER || 
-                    (pvr2_scene.sort_mode == SORT_TILEFLAG && (segment->control&SEGMENT_SORT_TRANS))) {
-                gl_render_tilelist(segment->trans_ptr, TRUE);
+            if( IS_AUTOSORT_SEGMENT(segment) ) {
+                gl_render_autosort_tile(segment);
             } else {
-                render_autosort_tile(segment->trans_ptr, RENDER_NORMAL );
+                gl_render_tilelist(segment->trans_ptr, TRUE);
             }
         }
     END_FOREACH_SEGMENT()
@@ -635,7 +830,8 @@ void pvr2_scene_render( render_buffer_t buffer )
     pvr2_scene_finished();
 
     gettimeofday( &end_tv, NULL );
-    ms = (end_tv.tv_sec - tex_tv.tv_sec) * 1000 +
-    (end_tv.tv_usec - tex_tv.tv_usec)/1000;
-    DEBUG( "Scene render in %dms", ms );
+    uint32_t ms = (end_tv.tv_sec - start_tv.tv_sec) * 1000 +
+    (end_tv.tv_usec - start_tv.tv_usec)/1000;
+    DEBUG( "Scene render in %dms: %d draw calls, %d texture binds, %d context changes", ms,
+           render_stats.draw_calls, render_stats.texture_binds, render_stats.context_changes );
 }
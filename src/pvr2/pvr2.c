@@ -27,7 +27,10 @@
 #include "pvr2/pvr2.h"
 #include "pvr2/pvr2mmio.h"
 #include "pvr2/scene.h"
+#include "pvr2/swrender.h"
 #include "sh4/sh4.h"
+#include "sh4/mmu.h"
+#include "config.h"
 #define MMIO_IMPL
 #include "pvr2/pvr2mmio.h"
 
@@ -44,7 +47,6 @@ static int pvr2_load_state( FILE *f );
 static void pvr2_update_raster_posn( uint32_t nanosecs );
 static void pvr2_schedule_scanline_event( int eventid, int line, int minimum_lines, int line_time_ns );
 static render_buffer_t pvr2_get_render_buffer( frame_buffer_t frame );
-static render_buffer_t pvr2_next_render_buffer( );
 static render_buffer_t pvr2_frame_buffer_to_render_buffer( frame_buffer_t frame );
 static frame_buffer_t pvr2_render_buffer_to_frame_buffer( render_buffer_t frame );
 uint32_t pvr2_get_sync_status();
@@ -152,6 +154,8 @@ static void pvr2_init( void )
     render_buffer_count = 0;
     displayed_render_buffer = NULL;
     displayed_border_colour = 0;
+    pvr2_render_thread_set_enabled( lxdream_get_config_boolean_value(
+            lxdream_get_config_group(CONFIG_GROUP_GLOBAL), CONFIG_RENDER_THREAD ) );
 }
 
 static void pvr2_reset( void )
@@ -171,6 +175,7 @@ static void pvr2_reset( void )
     mmio_region_PVR2_write( YUV_CFG, 0 );
 
     pvr2_ta_init();
+    pvr2_render_thread_sync();
     texcache_flush();
     if( display_driver ) {
         display_driver->display_blank(0);
@@ -238,6 +243,7 @@ void pvr2_save_render_buffers( FILE *f )
 {
     int i;
     uint32_t has_frontbuffer;
+    pvr2_render_thread_sync();
     fwrite( &render_buffer_count, sizeof(render_buffer_count), 1, f );
     if( displayed_render_buffer != NULL ) {
         has_frontbuffer = 1;
@@ -266,6 +272,7 @@ gboolean pvr2_load_render_buffers( FILE *f )
         return FALSE;
     }
     fread( &has_frontbuffer, sizeof(has_frontbuffer), 1, f );
+    pvr2_render_thread_sync();
     for( i=0; i<render_buffer_count; i++ ) {
         display_driver->destroy_render_buffer(render_buffers[i]);
         render_buffers[i] = NULL;
@@ -362,6 +369,7 @@ int pvr2_get_frame_count()
 void pvr2_draw_frame()
 {
     if( display_driver != NULL && display_driver != &display_null_driver ) {
+        pvr2_render_thread_sync();
         if( displayed_render_buffer == NULL ) {
             display_driver->display_blank(displayed_border_colour);
         } else {
@@ -455,6 +463,7 @@ void pvr2_next_frame( void )
  */
 MMIO_REGION_WRITE_FN( PVR2, reg, val )
 {
+    ccn_storequeue_flush();
     reg &= 0xFFF;
     if( reg >= 0x200 && reg < 0x600 ) { /* Fog table */
         MMIO_WRITE( PVR2, reg, val );
@@ -478,16 +487,19 @@ MMIO_REGION_WRITE_FN( PVR2, reg, val )
             g_free( save_next_render_filename );
             save_next_render_filename = NULL;
         }
-        pvr2_scene_read();
-        render_buffer_t buffer = pvr2_next_render_buffer();
-        if( buffer != NULL ) {
-            pvr2_scene_render( buffer );
-            if( buffer->address < PVR2_RAM_BASE ) {
-                // Flush immediately - optimize this later. Otherwise this gets
-                // complicated very quickly trying to second-guess how it's
-                // going to be used as a texture.
-                pvr2_finish_render_buffer( buffer );
-                pvr2_render_buffer_copy_to_sh4( buffer );
+        if( !pvr2_render_thread_submit() ) {
+            pvr2_scene_read();
+            render_buffer_t buffer = pvr2_next_render_buffer();
+            if( buffer != NULL ) {
+                if( display_driver->capabilities.has_gl ) {
+                    pvr2_scene_render( buffer );
+                } else {
+                    pvr2_scene_render_sw( buffer );
+                }
+                if( buffer->address < PVR2_RAM_BASE ) {
+                    // Render to texture - the result needs to reach vram
+                    pvr2_finish_render_buffer( buffer );
+                }
             }
         }
         asic_event( EVENT_PVR_RENDER_DONE );
@@ -818,6 +830,7 @@ void pvr2_queue_gun_event( int xpos, int ypos )
 
 MMIO_REGION_READ_FN( PVR2, reg )
 {
+    ccn_storequeue_flush();
     reg &= 0xFFF;
     switch( reg ) {
     case DISP_SYNCSTAT:
@@ -854,6 +867,7 @@ void pvr2_set_base_address( uint32_t base )
 render_buffer_t pvr2_create_render_buffer( sh4addr_t addr, int width, int height, GLuint tex_id )
 {
     if( display_driver != NULL && display_driver->create_render_buffer != NULL ) {
+        pvr2_render_thread_sync();
         render_buffer_t buffer = display_driver->create_render_buffer(width,height,tex_id);
         buffer->address = addr;
         return buffer;
@@ -863,6 +877,7 @@ render_buffer_t pvr2_create_render_buffer( sh4addr_t addr, int width, int height
 
 void pvr2_destroy_render_buffer( render_buffer_t buffer )
 {
+    pvr2_render_thread_sync();
     if( !buffer->flushed )
         pvr2_render_buffer_copy_to_sh4( buffer );
      display_driver->destroy_render_buffer( buffer );
@@ -872,6 +887,7 @@ void pvr2_destroy_render_buffers( void )
 {
     if( display_driver ) {
         int i;
+        pvr2_render_thread_sync();
         for( i=0; i<render_buffer_count; i++ ) {
             if( render_buffers[i] != NULL ) {
                 pvr2_destroy_render_buffer(render_buffers[i]);
@@ -901,6 +917,7 @@ void pvr2_preserve_render_buffers( void )
      }
      saved_displayed_render_buffer = NULL;
 
+     pvr2_render_thread_sync();
      for( i=0, j=0; i<render_buffer_count; i++ ) {
          if( render_buffers[i]->address != -1 ) {
              saved_render_buffers[j] = pvr2_render_buffer_to_frame_buffer(render_buffers[i]);
@@ -934,9 +951,30 @@ void pvr2_restore_render_buffers( void )
 }
 
 
+/**
+ * Complete rendering to a texture buffer and get the result on its way to
+ * vram. If the driver can read back asynchronously, the transfer is started
+ * here and only collected when something actually touches that area of vram
+ * (see pvr2_render_buffer_invalidate) - in the meantime any cached textures
+ * over the buffer are dropped so that the next lookup goes back to vram.
+ * Otherwise the buffer is copied immediately.
+ */
 void pvr2_finish_render_buffer( render_buffer_t buffer )
 {
     display_driver->finish_render( buffer );
+    if( display_driver->start_read_render_buffer == NULL ) {
+        pvr2_render_buffer_copy_to_sh4( buffer );
+    } else {
+        int line_size = buffer->width * colour_formats[buffer->colour_format].bpp;
+        uint32_t start = buffer->address & 0x007FF000;
+        uint32_t end = (buffer->address & 0x007FFFFF) + buffer->rowstride * buffer->height;
+        uint32_t page;
+
+        display_driver->start_read_render_buffer( buffer, line_size, buffer->colour_format );
+        for( page = start; page < end && page < PVR2_RAM_SIZE; page += LXDREAM_PAGE_SIZE ) {
+            texcache_invalidate_page( page );
+        }
+    }
 }
 
 /**
@@ -975,6 +1013,8 @@ render_buffer_t pvr2_alloc_render_buffer( sh4addr_t render_addr, int width, int
     int i;
     render_buffer_t result = NULL;
 
+    pvr2_render_thread_sync();
+
     /* Check existing buffers for an available buffer */
     for( i=0; i<render_buffer_count; i++ ) {
         if( render_buffers[i]->width == width && render_buffers[i]->height == height ) {
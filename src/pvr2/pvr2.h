@@ -232,6 +232,12 @@ gboolean pvr2_render_buffer_invalidate( sh4addr_t addr, gboolean isWrite );
  */
 void pvr2_ta_write( unsigned char *buf, uint32_t length );
 
+/**
+ * Bulk equivalent of pvr2_ta_write for DMA transfers - vertex runs are parsed
+ * in place from the supplied buffer by type-specialized loops.
+ */
+void pvr2_ta_write_bulk( unsigned char *buf, uint32_t length );
+
 void FASTCALL pvr2_ta_write_burst( sh4addr_t addr, unsigned char *buf );
 
 /**
@@ -278,6 +284,20 @@ int pvr2_yuv_load_state( FILE *f );
  */
 void pvr2_scene_render( render_buffer_t buffer );
 
+/**
+ * First half of pvr2_scene_render(): load the scene's textures and bind the
+ * render buffer. This still reads VRAM and the PVR2 registers directly.
+ */
+void pvr2_scene_render_setup( render_buffer_t buffer );
+
+/**
+ * Second half of pvr2_scene_render(): draw the scene into the render buffer
+ * bound by pvr2_scene_render_setup(). Only reads pvr2_scene (and the VRAM
+ * image it points into), so this may run concurrently with the emulation
+ * once the scene has been snapshotted.
+ */
+void pvr2_scene_render_draw( void );
+
 /**
  * Perform the initial once-off GL setup, usually immediately after the GL
  * context is first bound.
@@ -288,13 +308,37 @@ void pvr2_shutdown_gl_context();
 
 void render_backplane( uint32_t *polygon, uint32_t width, uint32_t height, uint32_t mode );
 
-void render_autosort_tile( pvraddr_t tile_entry, int render_mode );
-
 struct polygon_struct;
+struct tile_segment;
 void gl_render_triangle( struct polygon_struct *poly, int index );
 
+typedef void (*sort_triangle_callback_t)( struct polygon_struct *poly, int index, void *data );
+
+/**
+ * Depth-sort the translucent triangle lists of all auto-sorted segments in
+ * the current scene. Tiles are sorted in parallel into a preallocated arena,
+ * ready to be rendered by render_sort_tile(). Must be called after
+ * pvr2_scene_read() and before any call to render_sort_tile() for the scene.
+ */
+void render_sort_scene( void );
+
+/**
+ * Call the callback for each of the segment's translucent triangles, in
+ * back-to-front order as determined by render_sort_scene(). Safe to call
+ * from multiple threads concurrently (no GL state is touched).
+ * @return FALSE if the segment wasn't sorted (because it has fewer than two
+ * triangles), in which case the caller should render the list as-is.
+ */
+gboolean render_sort_tile( const struct tile_segment *segment, sort_triangle_callback_t callback, void *data );
+
 void gl_render_tilelist( pvraddr_t tile_entry, gboolean set_depth );
 
+/**
+ * Allocate a render buffer for the scene read by the last pvr2_scene_read(),
+ * based on the current render settings.
+ */
+render_buffer_t pvr2_next_render_buffer( void );
+
 render_buffer_t pvr2_create_render_buffer( sh4addr_t addr, int width, int height, GLuint tex_id );
 
 void pvr2_finish_render_buffer( render_buffer_t buffer );
@@ -316,6 +360,36 @@ void pvr2_preserve_render_buffers( void );
  */
 void pvr2_restore_render_buffers( void );
 
+/****************************** Render thread ****************************/
+
+/**
+ * Enable or disable rendering on a separate thread. Takes effect from the
+ * next scene; disabling waits for any render in progress to complete.
+ * Only used if the display driver can hand its GL context between threads.
+ */
+void pvr2_render_thread_set_enabled( gboolean enabled );
+
+/**
+ * Render the scene defined in PVR2 ram on the render thread. Returns once
+ * the scene has been read and its textures loaded, leaving the draw running
+ * in the background.
+ * @return FALSE if the render thread isn't in use, in which case the caller
+ * needs to render the scene itself.
+ */
+gboolean pvr2_render_thread_submit( void );
+
+/**
+ * Wait for any render in progress to complete, and take the GL context back
+ * for the calling thread. Must be called before using the display driver
+ * from the emulation thread. Does nothing if no render is in progress.
+ */
+void pvr2_render_thread_sync( void );
+
+/**
+ * Stop the render thread, if it's running.
+ */
+void pvr2_render_thread_shutdown( void );
+
 /**
  * Structure to hold a complete unpacked vertex (excluding modifier
  * volume parameters - generate separate vertexes in that case).
@@ -379,6 +453,27 @@ void texcache_begin_scene( uint32_t palette_mode, uint32_t stride_width );
  */
 GLuint texcache_get_texture( uint32_t poly2_word, uint32_t texture_word );
 
+/**
+ * Decode the texture specified by the texture control word into 32-bit ARGB
+ * pixels in system memory (for the software renderer). Mip levels are stored
+ * consecutively, largest first.
+ * @return the number of mip levels decoded.
+ */
+int texcache_decode_texture_argb32( uint32_t *out, uint32_t texture_word, int width, int height );
+
+/**
+ * Return a serial number to record against textures decoded with
+ * texcache_decode_texture_argb32, for later use with texcache_is_modified.
+ */
+uint32_t texcache_get_serial( void );
+
+/**
+ * @return TRUE if the given texture may have changed since the serial was
+ * obtained - ie any page it occupies has been invalidated, or the palette
+ * or stride it depends on has changed, or the cache has been flushed.
+ */
+gboolean texcache_is_modified( uint32_t texture_word, int width, int height, uint32_t serial );
+
 render_buffer_t texcache_get_render_buffer( uint32_t texture_addr, int mode, int width, int height );
 
 void pvr2_check_palette_changed(void);
@@ -439,6 +534,7 @@ extern int pvr2_render_colour_format[8];
 #define SEGMENT_Y(c)        (((c) >> 8) & 0x3F)
 #define NO_POINTER          0x80000000
 #define IS_TILE_PTR(p)      ( ((p)&NO_POINTER) == 0 )
+#define IS_NONEMPTY_TILE_LIST(p) (IS_TILE_PTR(p) && ((*((uint32_t *)(pvr2_main_ram+(p))) >> 28) != 0x0F))
 #define IS_LAST_SEGMENT(s)  (((s)->control) & SEGMENT_END)
 
 struct tile_segment {
@@ -18,7 +18,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "sh4/sh4core.h"
+#include "sh4/mmu.h"
 #include "pvr2.h"
 #include "asic.h"
 #include "dream.h"
@@ -29,42 +33,50 @@ unsigned char pvr2_main_ram[8 MB];
 
 static int32_t FASTCALL pvr2_vram32_read_long( sh4addr_t addr )
 {
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, FALSE);
     return *((int32_t *)(pvr2_main_ram+(addr&0x007FFFFF)));
 }
 static int32_t FASTCALL pvr2_vram32_read_word( sh4addr_t addr )
 {
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, FALSE);
     return SIGNEXT16(*((int16_t *)(pvr2_main_ram+(addr&0x007FFFFF))));
 }
 static int32_t FASTCALL pvr2_vram32_read_byte( sh4addr_t addr )
 {
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, FALSE);
     return SIGNEXT8(*((int8_t *)(pvr2_main_ram+(addr&0x007FFFFF))));
 }
 static void FASTCALL pvr2_vram32_write_long( sh4addr_t addr, uint32_t val )
 {
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, TRUE);
     *(uint32_t *)(pvr2_main_ram + (addr&0x007FFFFF)) = val;
 }
 static void FASTCALL pvr2_vram32_write_word( sh4addr_t addr, uint32_t val )
 {
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, TRUE);
     *(uint16_t *)(pvr2_main_ram + (addr&0x007FFFFF)) = (uint16_t)val;
 }
 static void FASTCALL pvr2_vram32_write_byte( sh4addr_t addr, uint32_t val )
 {
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, TRUE);
     *(uint8_t *)(pvr2_main_ram + (addr&0x007FFFFF)) = (uint8_t)val;
 }
 static void FASTCALL pvr2_vram32_read_burst( unsigned char *dest, sh4addr_t addr )
 {
+    ccn_storequeue_flush();
     // Render buffers pretty much have to be (at least) 32-byte aligned
     pvr2_render_buffer_invalidate(addr, FALSE);
     memcpy( dest, (pvr2_main_ram + (addr&0x007FFFFF)), 32 );
 }
 static void FASTCALL pvr2_vram32_write_burst( sh4addr_t addr, unsigned char *src )
 {
+    ccn_storequeue_flush();
     // Render buffers pretty much have to be (at least) 32-byte aligned
     pvr2_render_buffer_invalidate(addr, TRUE);
     memcpy( (pvr2_main_ram + (addr&0x007FFFFF)), src, 32 );    
@@ -81,49 +93,58 @@ struct mem_region_fn mem_region_vram32 = { pvr2_vram32_read_long, pvr2_vram32_wr
 
 static int32_t FASTCALL pvr2_vram64_read_long( sh4addr_t addr )
 {
-    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, FALSE);
+    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     return *((int32_t *)(pvr2_main_ram+(addr&0x007FFFFF)));
 }
 static int32_t FASTCALL pvr2_vram64_read_word( sh4addr_t addr )
 {
-    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, FALSE);
+    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     return SIGNEXT16(*((int16_t *)(pvr2_main_ram+(addr&0x007FFFFF))));
 }
 static int32_t FASTCALL pvr2_vram64_read_byte( sh4addr_t addr )
 {
-    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
+    ccn_storequeue_flush();
     pvr2_render_buffer_invalidate(addr, FALSE);
+    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     return SIGNEXT8(*((int8_t *)(pvr2_main_ram+(addr&0x007FFFFF))));
 }
 static void FASTCALL pvr2_vram64_write_long( sh4addr_t addr, uint32_t val )
 {
+    ccn_storequeue_flush();
     texcache_invalidate_page(addr& 0x007FFFFF);
-    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     pvr2_render_buffer_invalidate(addr, TRUE);
+    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     *(uint32_t *)(pvr2_main_ram + (addr&0x007FFFFF)) = val;
 }
 static void FASTCALL pvr2_vram64_write_word( sh4addr_t addr, uint32_t val )
 {
+    ccn_storequeue_flush();
     texcache_invalidate_page(addr& 0x007FFFFF);
-    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     pvr2_render_buffer_invalidate(addr, TRUE);
+    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     *(uint16_t *)(pvr2_main_ram + (addr&0x007FFFFF)) = (uint16_t)val;
 }
 static void FASTCALL pvr2_vram64_write_byte( sh4addr_t addr, uint32_t val )
 {
+    ccn_storequeue_flush();
     texcache_invalidate_page(addr& 0x007FFFFF);
-    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     pvr2_render_buffer_invalidate(addr, TRUE);
+    addr = TRANSLATE_VIDEO_64BIT_ADDRESS(addr);
     *(uint8_t *)(pvr2_main_ram + (addr&0x007FFFFF)) = (uint8_t)val;
 }
 static void FASTCALL pvr2_vram64_read_burst( unsigned char *dest, sh4addr_t addr )
 {
+    ccn_storequeue_flush();
+    pvr2_render_buffer_invalidate(addr, FALSE);
     pvr2_vram64_read( dest, addr, 32 );
 }
 static void FASTCALL pvr2_vram64_write_burst( sh4addr_t addr, unsigned char *src )
 {
+    ccn_storequeue_flush();
     pvr2_vram64_write( addr, src, 32 );
 }
 
@@ -188,10 +209,12 @@ void pvr2_dma_write( sh4addr_t destaddr, unsigned char *src, uint32_t count )
 {
     int region;
 
+    ccn_storequeue_flush();
+
     switch( destaddr & 0x13800000 ) {
     case 0x10000000:
     case 0x12000000:
-        pvr2_ta_write( src, count );
+        pvr2_ta_write_bulk( src, count );
         break;
     case 0x11000000:
     case 0x11800000:
@@ -217,6 +240,102 @@ void pvr2_dma_write( sh4addr_t destaddr, unsigned char *src, uint32_t count )
     }
 }
 
+/************************ 64-bit interleave kernels ************************/
+
+/*
+ * 64-bit VRAM alternates 32-bit words between the two banks, so a linear
+ * run of words is split into evens (bank 0) and odds (bank 1) on write, and
+ * merged back on read. These do count 64-bit pairs at a time - callers deal
+ * with a leading or trailing odd word via vram64_write_words/read_words.
+ */
+static inline void vram64_split( uint32_t *bank0, uint32_t *bank1, const uint32_t *src, uint32_t count )
+{
+#ifdef __SSE2__
+    while( count >= 4 ) {
+        /* a0 a2 a1 a3 / b0 b2 b1 b3 */
+        __m128i a = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)src ), _MM_SHUFFLE(3,1,2,0) );
+        __m128i b = _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i *)(src+4) ), _MM_SHUFFLE(3,1,2,0) );
+        _mm_storeu_si128( (__m128i *)bank0, _mm_unpacklo_epi64( a, b ) );
+        _mm_storeu_si128( (__m128i *)bank1, _mm_unpackhi_epi64( a, b ) );
+        src += 8;
+        bank0 += 4;
+        bank1 += 4;
+        count -= 4;
+    }
+#endif
+    while( count-- > 0 ) {
+        *bank0++ = *src++;
+        *bank1++ = *src++;
+    }
+}
+
+static inline void vram64_merge( uint32_t *dest, const uint32_t *bank0, const uint32_t *bank1, uint32_t count )
+{
+#ifdef __SSE2__
+    while( count >= 4 ) {
+        __m128i a = _mm_loadu_si128( (const __m128i *)bank0 );
+        __m128i b = _mm_loadu_si128( (const __m128i *)bank1 );
+        _mm_storeu_si128( (__m128i *)dest, _mm_unpacklo_epi32( a, b ) );
+        _mm_storeu_si128( (__m128i *)(dest+4), _mm_unpackhi_epi32( a, b ) );
+        dest += 8;
+        bank0 += 4;
+        bank1 += 4;
+        count -= 4;
+    }
+#endif
+    while( count-- > 0 ) {
+        *dest++ = *bank0++;
+        *dest++ = *bank1++;
+    }
+}
+
+/**
+ * Write count words from src into the banks, starting with banks[bank_flag].
+ * The bank pointers are advanced past the written words.
+ * @return the bank_flag for the next word.
+ */
+static inline int vram64_write_words( uint32_t *banks[2], int bank_flag, const uint32_t *src, uint32_t count )
+{
+    uint32_t pairs;
+    if( bank_flag && count > 0 ) {
+        *banks[1]++ = *src++;
+        bank_flag = 0;
+        count--;
+    }
+    pairs = count >> 1;
+    vram64_split( banks[0], banks[1], src, pairs );
+    banks[0] += pairs;
+    banks[1] += pairs;
+    if( count & 1 ) {
+        *banks[0]++ = src[pairs<<1];
+        bank_flag = 1;
+    }
+    return bank_flag;
+}
+
+/**
+ * Read count words from the banks into dest, starting with banks[bank_flag].
+ * @return the bank_flag for the next word.
+ */
+static inline int vram64_read_words( uint32_t *dest, uint32_t *banks[2], int bank_flag, uint32_t count )
+{
+    uint32_t pairs;
+    if( bank_flag && count > 0 ) {
+        *dest++ = *banks[1]++;
+        bank_flag = 0;
+        count--;
+    }
+    pairs = count >> 1;
+    vram64_merge( dest, banks[0], banks[1], pairs );
+    banks[0] += pairs;
+    banks[1] += pairs;
+    if( count & 1 ) {
+        dest[pairs<<1] = *banks[0]++;
+        bank_flag = 1;
+    }
+    return bank_flag;
+}
+
 void pvr2_vram32_write( sh4addr_t destaddr, unsigned char *src, uint32_t length )
 {
     destaddr &= PVR2_RAM_MASK;
@@ -239,6 +358,7 @@ void pvr2_vram64_write( sh4addr_t destaddr, unsigned char *src, uint32_t length
     if( destaddr + length > 0x800000 ) {
         length = 0x800000 - destaddr;
     }
+    pvr2_render_buffer_invalidate( PVR2_RAM_BASE_INT + destaddr, TRUE );
 
     for( i=destaddr & 0xFFFFF000; i < destaddr + length; i+= LXDREAM_PAGE_SIZE ) {
         texcache_invalidate_page( i );
@@ -259,11 +379,9 @@ void pvr2_vram64_write( sh4addr_t destaddr, unsigned char *src, uint32_t length
     }
 
     dwsrc = (uint32_t *)src;
-    while( length >= 4 ) {
-        *banks[bank_flag]++ = *dwsrc++;
-        bank_flag = !bank_flag;
-        length -= 4;
-    }
+    bank_flag = vram64_write_words( banks, bank_flag, dwsrc, length>>2 );
+    dwsrc += length>>2;
+    length &= 0x03;
 
     /* Handle non-aligned end of source */
     if( length ) {
@@ -283,7 +401,7 @@ void pvr2_vram64_write( sh4addr_t destaddr, unsigned char *src, uint32_t length
 void pvr2_vram64_write_stride( sh4addr_t destaddr, unsigned char *src, uint32_t line_bytes,
                                uint32_t line_stride_bytes, uint32_t line_count )
 {
-    int i,j;
+    int i;
     uint32_t *banks[2];
     uint32_t *dwsrc = (uint32_t *)src;
     uint32_t line_gap = (line_stride_bytes - line_bytes) >> 3;
@@ -299,12 +417,10 @@ void pvr2_vram64_write_stride( sh4addr_t destaddr, unsigned char *src, uint32_t
     banks[1] = banks[0] + 0x100000;
 
     for( i=0; i<line_count; i++ ) {
-        for( j=0; j<line_bytes; j++ ) {
-            *banks[0]++ = *dwsrc++;
-            *banks[1]++ = *dwsrc++;
-        }
-        banks[0] += line_gap;
-        banks[1] += line_gap;
+        vram64_split( banks[0], banks[1], dwsrc, line_bytes );
+        dwsrc += line_bytes<<1;
+        banks[0] += line_bytes + line_gap;
+        banks[1] += line_bytes + line_gap;
     }
 }
 
@@ -324,7 +440,7 @@ void pvr2_vram64_read_stride( unsigned char *dest, uint32_t dest_line_bytes, sh4
     uint32_t src_line_gap = 0;
     uint32_t line_bytes;
     int src_line_gap_flag;
-    int i,j;
+    int i;
 
     srcaddr = srcaddr & 0x7FFFF8;
     if( src_line_bytes <= dest_line_bytes ) {
@@ -346,11 +462,8 @@ void pvr2_vram64_read_stride( unsigned char *dest, uint32_t dest_line_bytes, sh4
 
     dwdest = (uint32_t *)dest;
     for( i=0; i<line_count; i++ ) {
-        for( j=0; j<line_bytes; j++ ) {
-            *dwdest++ = *banks[bank_flag]++;
-            bank_flag = !bank_flag;
-        }
-        dwdest += dest_line_gap;
+        bank_flag = vram64_read_words( dwdest, banks, bank_flag, line_bytes );
+        dwdest += line_bytes + dest_line_gap;
         banks[0] += src_line_gap;
         banks[1] += src_line_gap;
         if( src_line_gap_flag ) {
@@ -596,9 +709,10 @@ static void pvr2_vram64_write_invert( sh4addr_t destaddr, unsigned char *src,
                                       uint32_t src_size, uint32_t line_size, 
                                       uint32_t dest_stride, uint32_t src_stride )
 {
-    int i,j;
+    int i;
     uint32_t *banks[2];
     uint32_t *dwsrc = (uint32_t *)(src + src_size - src_stride);
+    uint32_t line_pairs = (line_size + 7) >> 3;
     int32_t src_line_gap = ((int32_t)src_stride + line_size) >> 2; 
     int32_t dest_line_gap = ((int32_t)dest_stride - (int32_t)line_size) >> 3;
 
@@ -612,12 +726,10 @@ static void pvr2_vram64_write_invert( sh4addr_t destaddr, unsigned char *src,
     banks[1] = banks[0] + 0x100000;
 
     while( dwsrc >= (uint32_t *)src ) { 
-        for( j=0; j<line_size; j+=8 ) {
-            *banks[0]++ = *dwsrc++;
-            *banks[1]++ = *dwsrc++;
-        }
-        banks[0] += dest_line_gap;
-        banks[1] += dest_line_gap;
+        vram64_split( banks[0], banks[1], dwsrc, line_pairs );
+        dwsrc += line_pairs<<1;
+        banks[0] += line_pairs + dest_line_gap;
+        banks[1] += line_pairs + dest_line_gap;
         dwsrc -= src_line_gap;
     }    
 }
@@ -672,11 +784,9 @@ void pvr2_vram64_read( unsigned char *dest, sh4addr_t srcaddr, uint32_t length )
     }
 
     dwdest = (uint32_t *)dest;
-    while( length >= 4 ) {
-        *dwdest++ = *banks[bank_flag]++;
-        bank_flag = !bank_flag;
-        length -= 4;
-    }
+    bank_flag = vram64_read_words( dwdest, banks, bank_flag, length>>2 );
+    dwdest += length>>2;
+    length &= 0x03;
 
     /* Handle non-aligned end of source */
     if( length ) {
@@ -721,6 +831,15 @@ void pvr2_vram64_dump( sh4addr_t addr, uint32_t length, FILE *f )
 
 
 
+/**
+ * Readback arena for pvr2_render_buffer_copy_to_sh4 - grown as needed and
+ * reused across calls, rather than putting a framebuffer on the stack.
+ */
+static struct {
+    unsigned char *data;
+    uint32_t size;
+} readback_arena;
+
 /**
  * Flush the indicated render buffer back to PVR. Caller is responsible for
  * tracking whether there is actually anything in the buffer.
@@ -734,7 +853,15 @@ void pvr2_render_buffer_copy_to_sh4( render_buffer_t buffer )
 {
     int line_size = buffer->width * colour_formats[buffer->colour_format].bpp;
     int src_stride = line_size;
-    unsigned char target[buffer->size];
+    unsigned char *target;
+
+    pvr2_render_thread_sync();
+    if( buffer->size > readback_arena.size ) {
+        g_free( readback_arena.data );
+        readback_arena.size = buffer->size;
+        readback_arena.data = g_malloc( readback_arena.size );
+    }
+    target = readback_arena.data;
 
     display_driver->read_render_buffer( target, buffer, line_size, buffer->colour_format );
 
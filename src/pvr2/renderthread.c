@@ -0,0 +1,192 @@
+/**
+ * $Id$
+ *
+ * PVR2 render thread. When enabled, scenes are rendered on a dedicated
+ * thread which takes over the GL context for the duration of the render.
+ * The emulation thread is only held while the scene is read and its
+ * textures are loaded (both of which read live VRAM and registers); once
+ * the parts of VRAM that the draw still needs have been copied into a
+ * snapshot, emulation continues in parallel with the draw.
+ *
+ * Anything else that needs the GL context from the emulation thread
+ * (displaying a frame, reading back a render buffer, etc) calls
+ * pvr2_render_thread_sync() first, which waits for the draw to complete.
+ * In particular this means the guest only ever waits for the render when it
+ * actually touches the render target.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <pthread.h>
+#include "lxdream.h"
+#include "display.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/scene.h"
+
+typedef enum { RENDER_IDLE, RENDER_SETUP, RENDER_DRAW } render_state_t;
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t wait;
+    gboolean enabled;
+    gboolean started;
+    gboolean shutdown;
+    render_state_t state;
+    /* TRUE while the render thread has the GL context. Only accessed from the
+     * emulation thread. */
+    gboolean busy;
+    /* Copy of the scene's VRAM structures used by the draw */
+    unsigned char *vram;
+    pthread_t thread;
+} render_thread = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                    FALSE, FALSE, FALSE, RENDER_IDLE, FALSE, NULL };
+
+static void render_thread_set_state( render_state_t state )
+{
+    pthread_mutex_lock(&render_thread.mutex);
+    render_thread.state = state;
+    pthread_cond_broadcast(&render_thread.wait);
+    pthread_mutex_unlock(&render_thread.mutex);
+}
+
+/**
+ * Read the scene and load its textures. Render-to-texture scenes are
+ * rendered to completion here, as the texture cache has to be updated with
+ * the result before the guest continues.
+ * @return the buffer to draw into, or NULL if there's nothing left to draw.
+ */
+static render_buffer_t render_thread_setup( void )
+{
+    pvr2_scene_read();
+    render_buffer_t buffer = pvr2_next_render_buffer();
+    if( buffer != NULL ) {
+        pvr2_scene_render_setup( buffer );
+        if( buffer->address < PVR2_RAM_BASE ) {
+            pvr2_scene_render_draw();
+            pvr2_finish_render_buffer( buffer );
+            buffer = NULL;
+        } else {
+            pvr2_scene_snapshot( render_thread.vram );
+        }
+    }
+    return buffer;
+}
+
+static void *render_thread_main( void *arg )
+{
+    pthread_mutex_lock(&render_thread.mutex);
+    for(;;) {
+        while( !render_thread.shutdown && render_thread.state == RENDER_IDLE ) {
+            pthread_cond_wait(&render_thread.wait, &render_thread.mutex);
+        }
+        if( render_thread.shutdown ) {
+            break;
+        }
+        pthread_mutex_unlock(&render_thread.mutex);
+
+        display_driver->set_context_current( TRUE );
+        render_buffer_t buffer = render_thread_setup();
+        render_thread_set_state( RENDER_DRAW );
+        if( buffer != NULL ) {
+            pvr2_scene_render_draw();
+        }
+        display_driver->set_context_current( FALSE );
+
+        pthread_mutex_lock(&render_thread.mutex);
+        render_thread.state = RENDER_IDLE;
+        pthread_cond_broadcast(&render_thread.wait);
+    }
+    pthread_mutex_unlock(&render_thread.mutex);
+    return NULL;
+}
+
+static gboolean render_thread_start( void )
+{
+    if( display_driver == NULL || !display_driver->capabilities.has_gl ||
+            display_driver->set_context_current == NULL ) {
+        return FALSE;
+    }
+    if( render_thread.vram == NULL ) {
+        render_thread.vram = g_malloc( PVR2_RAM_SIZE );
+    }
+    render_thread.shutdown = FALSE;
+    render_thread.state = RENDER_IDLE;
+    if( pthread_create( &render_thread.thread, NULL, render_thread_main, NULL ) != 0 ) {
+        WARN( "Unable to create render thread, rendering on the emulation thread" );
+        render_thread.enabled = FALSE;
+        return FALSE;
+    }
+    render_thread.started = TRUE;
+    return TRUE;
+}
+
+void pvr2_render_thread_set_enabled( gboolean enabled )
+{
+    render_thread.enabled = enabled;
+    if( !enabled ) {
+        pvr2_render_thread_shutdown();
+    }
+}
+
+gboolean pvr2_render_thread_submit( void )
+{
+    if( !render_thread.enabled ) {
+        return FALSE;
+    }
+    pvr2_render_thread_sync();
+    if( !render_thread.started && !render_thread_start() ) {
+        return FALSE;
+    }
+
+    display_driver->set_context_current( FALSE );
+    render_thread.busy = TRUE;
+    pthread_mutex_lock(&render_thread.mutex);
+    render_thread.state = RENDER_SETUP;
+    pthread_cond_broadcast(&render_thread.wait);
+    while( render_thread.state == RENDER_SETUP ) {
+        pthread_cond_wait(&render_thread.wait, &render_thread.mutex);
+    }
+    pthread_mutex_unlock(&render_thread.mutex);
+    return TRUE;
+}
+
+void pvr2_render_thread_sync( void )
+{
+    if( !render_thread.busy || pthread_equal( pthread_self(), render_thread.thread ) ) {
+        /* Nothing in flight, or we're being called from the render itself */
+        return;
+    }
+    pthread_mutex_lock(&render_thread.mutex);
+    while( render_thread.state != RENDER_IDLE ) {
+        pthread_cond_wait(&render_thread.wait, &render_thread.mutex);
+    }
+    pthread_mutex_unlock(&render_thread.mutex);
+    display_driver->set_context_current( TRUE );
+    render_thread.busy = FALSE;
+}
+
+void pvr2_render_thread_shutdown( void )
+{
+    if( !render_thread.started ) {
+        return;
+    }
+    pvr2_render_thread_sync();
+    pthread_mutex_lock(&render_thread.mutex);
+    render_thread.shutdown = TRUE;
+    pthread_cond_broadcast(&render_thread.wait);
+    pthread_mutex_unlock(&render_thread.mutex);
+    pthread_join( render_thread.thread, NULL );
+    render_thread.started = FALSE;
+    g_free( render_thread.vram );
+    render_thread.vram = NULL;
+}
@@ -20,19 +20,13 @@
 #include <assert.h>
 #include "pvr2/pvr2.h"
 #include "pvr2/scene.h"
-#include "asic.h"
+#include "pvr2/rendsort.h"
+#include "workpool.h"
 
 #define MIN3( a,b,c ) ((a) < (b) ? ( (a) < (c) ? (a) : (c) ) : ((b) < (c) ? (b) : (c)) )
 #define MAX3( a,b,c ) ((a) > (b) ? ( (a) > (c) ? (a) : (c) ) : ((b) > (c) ? (b) : (c)) )
 #define EPSILON 0.0001
-
-struct sort_triangle {
-    struct polygon_struct *poly;
-    int triangle_num; // triangle number in the poly, from 0
-    /* plane equation */
-    float mx, my, mz, d;
-    float bounds[6]; /* x1,x2,y1,y2,z1,z2 */
-};
+#define SORT_STACK_SIZE 64 /* > log2(max triangles) */
 
 #define SENTINEL 0xDEADBEEF
 
@@ -42,14 +36,14 @@ struct sort_triangle {
  * triangles that have been culled out.
  */
 static int sort_count_triangles( pvraddr_t tile_entry ) {
-    uint32_t *tile_list = (uint32_t *)(pvr2_main_ram+tile_entry);
+    uint32_t *tile_list = (uint32_t *)(pvr2_scene.vram+tile_entry);
     int count = 0;
     while(1) {
         uint32_t entry = *tile_list++;
         if( entry >> 28 == 0x0F ) {
             break;
         } else if( entry >> 28 == 0x0E ) {
-            tile_list = (uint32_t *)(pvr2_main_ram+(entry&0x007FFFFF));
+            tile_list = (uint32_t *)(pvr2_scene.vram+(entry&0x007FFFFF));
         } else if( entry >> 29 == 0x04 ) { /* Triangle array */
             count += ((entry >> 25) & 0x0F)+1;
         } else if( entry >> 29 == 0x05 ) { /* Quad array */
@@ -103,7 +97,7 @@ static void sort_add_triangle( struct sort_triangle *triangle, struct polygon_st
  */
 int sort_extract_triangles( pvraddr_t tile_entry, struct sort_triangle *triangles )
 {
-    uint32_t *tile_list = (uint32_t *)(pvr2_main_ram+tile_entry);
+    uint32_t *tile_list = (uint32_t *)(pvr2_scene.vram+tile_entry);
     int strip_count;
     struct polygon_struct *poly;
     int count = 0, i;
@@ -114,7 +108,7 @@ int sort_extract_triangles( pvraddr_t tile_entry, struct sort_triangle *triangle
         case 0x0F:
             return count; // End-of-list
         case 0x0E:
-            tile_list = (uint32_t *)(pvr2_main_ram + (entry&0x007FFFFF));
+            tile_list = (uint32_t *)(pvr2_scene.vram + (entry&0x007FFFFF));
             break;
         case 0x08: case 0x09:
             strip_count = ((entry >> 25) & 0x0F)+1;
@@ -167,15 +161,7 @@ int sort_extract_triangles( pvraddr_t tile_entry, struct sort_triangle *triangle
 
 }
 
-void sort_render_triangles( struct sort_triangle **triangles, int num_triangles )
-{
-    int i;
-    for( i=0; i<num_triangles; i++ ) {
-        gl_render_triangle(triangles[i]->poly, triangles[i]->triangle_num);
-    }
-}
-
-static int sort_triangle_compare( const void *a, const void *b ) 
+int sort_triangle_compare( const void *a, const void *b ) 
 {
     const struct sort_triangle *tri1 = a;
     const struct sort_triangle *tri2 = b;
@@ -216,72 +202,226 @@ static int sort_triangle_compare( const void *a, const void *b )
 }
 
 /**
- * This is pretty much a standard merge sort (Unfortunately can't depend on
- * the system to provide one. Note we can't use quicksort here - the sort
- * must be stable to preserve the order of coplanar triangles.
+ * Sort the triangles back to front. This is a top-down merge sort (we can't
+ * use quicksort here - the sort must be stable to preserve the order of
+ * coplanar triangles), run iteratively from an explicit stack so that it
+ * needs no memory other than the caller-supplied scratch array. The merge
+ * tree (and so the result, as the comparison isn't a strict ordering) is
+ * the same as for the straightforward recursive implementation.
+ *
+ * Each level reads from one array and writes to the other. Leaves always
+ * read from the original array, which is still untouched in their range
+ * at that point.
+ *
+ * @param triangles array of triangles to sort in place.
+ * @param tmp scratch array, at least num_triangles long.
  */
-static void sort_triangles( struct sort_triangle **triangles, int num_triangles, struct sort_triangle **out )
+static void sort_triangles( struct sort_triangle **triangles, int num_triangles, struct sort_triangle **tmp )
 {
-    if( num_triangles > 2 ) {
-        int l = num_triangles>>1, r=num_triangles-l, i=0,j=0;
-        struct sort_triangle *left[l];
-        struct sort_triangle *right[r];
-        sort_triangles( triangles, l, left );
-        sort_triangles( triangles+l, r, right );
-        
-        /* Merge */
-        while(1) {
-            if( sort_triangle_compare(left[i], right[j]) <= 0 ) {
-                *out++ = left[i++];
-                if( i == l ) {
-                    memcpy( out, &right[j], (r-j)*sizeof(struct sort_triangle *) );        
-                    break;
-                }
-            } else {
-                *out++ = right[j++];
-                if( j == r ) {
-                    memcpy( out, &left[i], (l-i)*sizeof(struct sort_triangle *) );
-                    break;
-                }
-            }
+    struct {
+        int start, count;
+        gboolean to_tmp; /* result goes to tmp (else to triangles) */
+    } stack[SORT_STACK_SIZE];
+    int sp = 0;
+
+    if( num_triangles < 2 ) {
+        return;
+    }
+
+    /* Descend the left side of the tree to the first leaf, pushing each
+     * node's pending merge as we go. Node sizes are always > 2 on the stack
+     * (smaller nodes are leaves, sorted directly).
+     */
+    int start = 0, count = num_triangles;
+    gboolean to_tmp = FALSE;
+    for(;;) {
+        while( count > 2 ) {
+            assert( sp < SORT_STACK_SIZE );
+            stack[sp].start = start;
+            stack[sp].count = count;
+            stack[sp].to_tmp = to_tmp;
+            sp++;
+            count >>= 1;
+            to_tmp = !to_tmp;
         }
-    } else if( num_triangles == 2 ) {
-        if( sort_triangle_compare(triangles[0], triangles[1]) <= 0 ) {
-            out[0] = triangles[0];
-            out[1] = triangles[1];
+
+        /* Leaf */
+        struct sort_triangle **in = triangles + start;
+        struct sort_triangle **out = (to_tmp ? tmp : triangles) + start;
+        if( count == 1 ) {
+            out[0] = in[0];
+        } else if( sort_triangle_compare(in[0], in[1]) <= 0 ) {
+            out[0] = in[0];
+            out[1] = in[1];
         } else {
-            struct sort_triangle *tmp = triangles[0];
-            out[0] = triangles[1];
-            out[1] = tmp;
+            struct sort_triangle *t = in[0];
+            out[0] = in[1];
+            out[1] = t;
+        }
+
+        /* Merge every node whose right half we've just finished, then move
+         * on to the next pending right half */
+        for(;;) {
+            if( sp == 0 ) {
+                return;
+            }
+            struct sort_triangle **node_in;
+            int node_start = stack[sp-1].start, node_count = stack[sp-1].count;
+            int l = node_count>>1, r = node_count-l;
+            if( start + count < node_start + node_count ) {
+                /* Finished the left half - sort the right half next */
+                start = node_start + l;
+                count = r;
+                to_tmp = !stack[sp-1].to_tmp;
+                break;
+            }
+
+            /* Finished both halves - merge them */
+            sp--;
+            to_tmp = stack[sp].to_tmp;
+            node_in = (to_tmp ? triangles : tmp) + node_start;
+            struct sort_triangle **left = node_in, **right = node_in + l;
+            struct sort_triangle **out = (to_tmp ? tmp : triangles) + node_start;
+            int i=0, j=0;
+            while(1) {
+                if( sort_triangle_compare(left[i], right[j]) <= 0 ) {
+                    *out++ = left[i++];
+                    if( i == l ) {
+                        memcpy( out, &right[j], (r-j)*sizeof(struct sort_triangle *) );
+                        break;
+                    }
+                } else {
+                    *out++ = right[j++];
+                    if( j == r ) {
+                        memcpy( out, &left[i], (l-i)*sizeof(struct sort_triangle *) );
+                        break;
+                    }
+                }
+            }
+            start = node_start;
+            count = node_count;
         }
-    } else {
-        out[0] = triangles[0];
     }
-} 
+}
 
-void render_autosort_tile( pvraddr_t tile_entry, int render_mode ) 
+/**
+ * Extract and sort the triangles in the given tile list.
+ * @param triangles arena space for the triangles, max_triangles+1 long.
+ * @param order arena space for the sorted result, max_triangles long.
+ * @param tmp arena space for the sort, max_triangles long.
+ * @return the number of triangles in the result.
+ */
+static int sort_tile_triangles( pvraddr_t tile_entry, int max_triangles, struct sort_triangle *triangles,
+                                struct sort_triangle **order, struct sort_triangle **tmp )
 {
-    int num_triangles = sort_count_triangles(tile_entry);
-    if( num_triangles == 0 ) {
-        return; /* nothing to do */
-    } else if( num_triangles == 1 ) { /* Triangle can hardly overlap with itself */
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_GEQUAL);
-        gl_render_tilelist(tile_entry, FALSE);
-    } else { /* Ooh boy here we go... */
-        int i;
-        struct sort_triangle triangles[num_triangles+1];
-        struct sort_triangle *triangle_order[num_triangles+1];
-        triangles[num_triangles].poly = (void *)SENTINEL;
-        for( i=0; i<num_triangles; i++ ) {
-            triangle_order[i] = &triangles[i];
+    int i;
+    triangles[max_triangles].poly = (void *)SENTINEL;
+    int extracted_triangles = sort_extract_triangles(tile_entry, triangles);
+    assert( extracted_triangles <= max_triangles );
+    assert( triangles[max_triangles].poly == (void *)SENTINEL );
+    for( i=0; i<extracted_triangles; i++ ) {
+        order[i] = &triangles[i];
+    }
+    sort_triangles( order, extracted_triangles, tmp );
+    return extracted_triangles;
+}
+
+/**
+ * Translucent tile list to be sorted, and its location in the sort arena
+ */
+struct sort_job {
+    pvraddr_t tile_entry;
+    int offset;
+    int max_triangles;
+    int num_triangles; /* Number of sorted triangles (filled in by the sort) */
+};
+
+/**
+ * Preallocated storage for the scene's sorts, grown as needed and reused
+ * from scene to scene.
+ */
+static struct {
+    struct sort_triangle *triangles;
+    struct sort_triangle **order;
+    struct sort_triangle **tmp;
+    int size;
+    struct sort_job *jobs;
+    int job_count, job_size;
+    int *segment_job; /* Job for each segment, or -1 */
+    int segment_count, segment_size;
+} sort_arena;
+
+static void sort_run_job( void *data, int index )
+{
+    struct sort_job *job = &sort_arena.jobs[index];
+    job->num_triangles = sort_tile_triangles( job->tile_entry, job->max_triangles,
+            sort_arena.triangles + job->offset, sort_arena.order + job->offset,
+            sort_arena.tmp + job->offset );
+}
+
+void render_sort_scene( void )
+{
+    struct tile_segment *segment = pvr2_scene.segment_list;
+    int count = 0, total = 0, i;
+
+    do {
+        count++;
+    } while( !IS_LAST_SEGMENT(segment++) );
+
+    if( count > sort_arena.segment_size ) {
+        sort_arena.segment_job = g_realloc( sort_arena.segment_job, count * sizeof(int) );
+        sort_arena.segment_size = count;
+    }
+    sort_arena.segment_count = count;
+    sort_arena.job_count = 0;
+
+    for( i=0; i<count; i++ ) {
+        segment = &pvr2_scene.segment_list[i];
+        sort_arena.segment_job[i] = -1;
+        if( IS_NONEMPTY_TILE_LIST(segment->trans_ptr) && IS_AUTOSORT_SEGMENT(segment) ) {
+            int num_triangles = sort_count_triangles(segment->trans_ptr);
+            if( num_triangles > 1 ) { /* Triangle can hardly overlap with itself */
+                if( sort_arena.job_count == sort_arena.job_size ) {
+                    sort_arena.job_size = sort_arena.job_size == 0 ? 64 : sort_arena.job_size*2;
+                    sort_arena.jobs = g_realloc( sort_arena.jobs, sort_arena.job_size * sizeof(struct sort_job) );
+                }
+                struct sort_job *job = &sort_arena.jobs[sort_arena.job_count];
+                job->tile_entry = segment->trans_ptr;
+                job->offset = total;
+                job->max_triangles = num_triangles;
+                job->num_triangles = 0;
+                sort_arena.segment_job[i] = sort_arena.job_count++;
+                total += num_triangles + 1; /* Room for the sentinel */
+            }
         }
-        int extracted_triangles = sort_extract_triangles(tile_entry, triangles);
-        assert( extracted_triangles <= num_triangles );
-        sort_triangles( triangle_order, extracted_triangles, triangle_order );
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_GEQUAL);
-        sort_render_triangles(triangle_order, extracted_triangles);
-        assert( triangles[num_triangles].poly == (void *)SENTINEL );
     }
+
+    if( total > sort_arena.size ) {
+        g_free( sort_arena.triangles );
+        g_free( sort_arena.order );
+        g_free( sort_arena.tmp );
+        sort_arena.size = total + (total>>1);
+        sort_arena.triangles = g_malloc( sort_arena.size * sizeof(struct sort_triangle) );
+        sort_arena.order = g_malloc( sort_arena.size * sizeof(struct sort_triangle *) );
+        sort_arena.tmp = g_malloc( sort_arena.size * sizeof(struct sort_triangle *) );
+    }
+
+    workpool_run( sort_run_job, NULL, sort_arena.job_count );
+}
+
+gboolean render_sort_tile( const struct tile_segment *segment, sort_triangle_callback_t callback, void *data )
+{
+    int index = segment - pvr2_scene.segment_list;
+    int i;
+
+    assert( index >= 0 && index < sort_arena.segment_count );
+    if( sort_arena.segment_job[index] == -1 ) {
+        return FALSE;
+    }
+    struct sort_job *job = &sort_arena.jobs[sort_arena.segment_job[index]];
+    struct sort_triangle **order = sort_arena.order + job->offset;
+    for( i=0; i<job->num_triangles; i++ ) {
+        callback( order[i]->poly, order[i]->triangle_num, data );
+    }
+    return TRUE;
 }
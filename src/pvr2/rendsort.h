@@ -0,0 +1,56 @@
+/**
+ * $Id$
+ *
+ * PVR2 depth sort internals - the triangle extraction and comparison used
+ * by render_sort_scene(), exposed for the sort tests.
+ *
+ * Copyright (c) 2005 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_rendsort_H
+#define lxdream_rendsort_H 1
+
+#include "pvr2/pvr2.h"
+#include "pvr2/scene.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sort_triangle {
+    struct polygon_struct *poly;
+    int triangle_num; // triangle number in the poly, from 0
+    /* plane equation */
+    float mx, my, mz, d;
+    float bounds[6]; /* x1,x2,y1,y2,z1,z2 */
+};
+
+/**
+ * Extract the triangles from the tile list at the given pvr memory address
+ * into the triangles array, which must be large enough to hold them all.
+ * @return the number of triangles extracted.
+ */
+int sort_extract_triangles( pvraddr_t tile_entry, struct sort_triangle *triangles );
+
+/**
+ * Depth comparison between two triangles (struct sort_triangle *).
+ * @return < 0 if a should be drawn before b, > 0 if after, or 0 if they
+ * don't overlap.
+ */
+int sort_triangle_compare( const void *a, const void *b );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_rendsort_H */
@@ -25,6 +25,14 @@
 #include "pvr2/pvr2mmio.h"
 #include "pvr2/glutil.h"
 #include "pvr2/scene.h"
+#include "workpool.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #define U8TOFLOAT(n)  (((float)((n)+1))/256.0)
 #define POLY_IDX(addr) ( ((uint32_t *)addr) - ((uint32_t *)pvr2_scene.pvr2_pbuf))
@@ -66,6 +74,63 @@ struct pvr2_scene_struct pvr2_scene;
 static float scene_shadow_intensity = 0.0;
 static vertex_buffer_t vbuf = NULL;
 
+/**
+ * Vertex extraction parameters for a polygon, recorded when the polygon is
+ * first seen in pass 1 (indexed in parallel with poly_array). This lets pass
+ * 2 decode each polygon directly without walking the tile lists again.
+ */
+struct scene_poly_source {
+    int16_t vertex_length;
+    int8_t is_modified; /* shadow_mode_t */
+    int8_t is_quad;
+};
+static struct scene_poly_source *scene_poly_sources = NULL;
+
+/**
+ * The per-polygon passes are split into jobs of SCENE_JOB_POLYS consecutive
+ * polygons. Every polygon's output location (vertex index, sub-polygon
+ * indexes) is fixed before the jobs are run, so they never need to
+ * synchronize with each other, and the result is identical to processing
+ * the polygons in order.
+ */
+#define SCENE_JOB_POLYS 256
+#define MAX_SCENE_JOBS ((MAX_POLYGONS+SCENE_JOB_POLYS-1)/SCENE_JOB_POLYS)
+
+struct scene_job {
+    int first_poly, end_poly;
+    float zbounds[2]; /* Near (min) and far (max) z of the decoded vertexes */
+    int split_count; /* Number of sub-polygons required by backface culling */
+    int first_sub; /* Index in poly_array of the job's first sub-polygon */
+};
+static struct scene_job scene_jobs[MAX_SCENE_JOBS];
+static int scene_job_count = 0;
+
+float scene_fog_density;
+float scene_fog_table[128][2];
+
+/**
+ * Extents of VRAM (as offsets from pvr2_main_ram) read by the last
+ * pvr2_scene_read() for the segment list and the tile lists. Only used to
+ * bound the copy made by pvr2_scene_snapshot().
+ */
+struct scene_vram_span {
+    uint32_t start, end;
+};
+static struct scene_vram_span scene_segment_span;
+static struct scene_vram_span scene_list_span;
+
+static inline void scene_add_vram_span( struct scene_vram_span *span, uint32_t *start, uint32_t *end )
+{
+    uint32_t start_offset = ((unsigned char *)start) - pvr2_main_ram;
+    uint32_t end_offset = ((unsigned char *)end) - pvr2_main_ram;
+    if( start_offset < span->start ) {
+        span->start = start_offset;
+    }
+    if( end_offset > span->end ) {
+        span->end = end_offset;
+    }
+}
+
 static void vertex_buffer_map()
 {
     // Allow 8 vertexes for the background (4+4)
@@ -90,6 +155,7 @@ void pvr2_scene_init()
         pvr2_scene.vertex_array_size = 0;
         pvr2_scene.poly_array = g_malloc( MAX_POLY_BUFFER_SIZE );
         pvr2_scene.buf_to_poly_map = g_malloc0( BUF_POLY_MAP_SIZE );
+        scene_poly_sources = g_malloc( MAX_POLYGONS * sizeof(struct scene_poly_source) );
     }
 }
 
@@ -114,10 +180,13 @@ void pvr2_scene_shutdown()
     pvr2_scene.poly_array = NULL;
     g_free( pvr2_scene.buf_to_poly_map );
     pvr2_scene.buf_to_poly_map = NULL;
+    g_free( scene_poly_sources );
+    scene_poly_sources = NULL;
 }
 
 static struct polygon_struct *scene_add_polygon( pvraddr_t poly_idx, int vertex_count,
-                                                 shadow_mode_t is_modified )
+                                                 int vertex_length, shadow_mode_t is_modified,
+                                                 gboolean is_quad )
 {
     int vert_mul = is_modified != SHADOW_NONE ? 2 : 1;
 
@@ -128,7 +197,11 @@ static struct polygon_struct *scene_add_polygon( pvraddr_t poly_idx, int vertex_
         }
         return pvr2_scene.buf_to_poly_map[poly_idx];
     } else {
+        struct scene_poly_source *src = &scene_poly_sources[pvr2_scene.poly_count];
         struct polygon_struct *poly = &pvr2_scene.poly_array[pvr2_scene.poly_count++];
+        src->vertex_length = vertex_length;
+        src->is_modified = is_modified;
+        src->is_quad = is_quad;
         poly->context = &pvr2_scene.pvr2_pbuf[poly_idx];
         poly->vertex_count = vertex_count;
         poly->vertex_index = -1;
@@ -145,12 +218,14 @@ static struct polygon_struct *scene_add_polygon( pvraddr_t poly_idx, int vertex_
  * Given a starting polygon, break it at the specified triangle so that the
  * preceding triangles are retained, and the remainder are contained in a
  * new sub-polygon. Does not preserve winding.
+ * @param sub_idx Index in poly_array of the new sub-polygon
  */
-static struct polygon_struct *scene_split_subpolygon( struct polygon_struct *parent, int split_offset )
+static struct polygon_struct *scene_split_subpolygon( struct polygon_struct *parent, int split_offset,
+                                                      int sub_idx )
 {
     assert( split_offset > 0 && split_offset < (parent->vertex_count-2) );
-    assert( pvr2_scene.poly_count < MAX_POLYGONS );
-    struct polygon_struct *poly = &pvr2_scene.poly_array[pvr2_scene.poly_count++];
+    assert( sub_idx < MAX_POLYGONS );
+    struct polygon_struct *poly = &pvr2_scene.poly_array[sub_idx];
     poly->vertex_count = parent->vertex_count - split_offset;
     poly->vertex_index = parent->vertex_index + split_offset;
     if( parent->mod_vertex_index == -1 ) {
@@ -189,10 +264,11 @@ static float scene_get_palette_offset( uint32_t tex )
  * @param pvr2_data Pointer to raw pvr2 vertex data (in VRAM)
  * @param modify_offset Offset in 32-bit words to the tex/color data. 0 for
  *        the normal vertex, half the vertex length for the modified vertex.
+ * @param zbounds Near and far z bounds, updated to include the vertex
  */
-static void scene_decode_vertex( struct vertex_struct *vert, uint32_t poly1,
+void scene_decode_vertex( struct vertex_struct *vert, uint32_t poly1,
                                        uint32_t poly2, uint32_t tex, uint32_t *pvr2_data,
-                                       int modify_offset )
+                                       int modify_offset, float *zbounds )
 {
     gboolean force_alpha = !POLY2_ALPHA_ENABLE(poly2);
     union pvr2_data_type {
@@ -211,10 +287,10 @@ static void scene_decode_vertex( struct vertex_struct *vert, uint32_t poly1,
     } else if( z != 0 ) {
         z = 1/z;
     }
-    if( z > pvr2_scene.bounds[5] ) {
-        pvr2_scene.bounds[5] = z;
-    } else if( z < pvr2_scene.bounds[4] && z != 0 ) {
-        pvr2_scene.bounds[4] = z;
+    if( z > zbounds[1] ) {
+        zbounds[1] = z;
+    } else if( z < zbounds[0] && z != 0 ) {
+        zbounds[0] = z;
     }
     vert->z = z;
     data.ival += modify_offset;
@@ -269,6 +345,185 @@ static void scene_decode_vertex( struct vertex_struct *vert, uint32_t poly1,
     }
 }
 
+#ifdef __SSE2__
+/**
+ * Unpack the 4 BGRA colour words in bgra into 4 float RGBA vectors, giving
+ * exactly the same results as unpack_bgra()
+ */
+static inline void unpack_bgra4( __m128i bgra, __m128 rgba[4] )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128 scale = _mm_set1_ps(1.0/256.0);
+    __m128i lo = _mm_unpacklo_epi8(bgra, zero);
+    __m128i hi = _mm_unpackhi_epi8(bgra, zero);
+    __m128i c[4];
+    int i;
+
+    c[0] = _mm_unpacklo_epi16(lo, zero);
+    c[1] = _mm_unpackhi_epi16(lo, zero);
+    c[2] = _mm_unpacklo_epi16(hi, zero);
+    c[3] = _mm_unpackhi_epi16(hi, zero);
+    for( i=0; i<4; i++ ) {
+        /* BGRA => RGBA */
+        __m128i v = _mm_shuffle_epi32(c[i], _MM_SHUFFLE(3,0,1,2));
+        rgba[i] = _mm_mul_ps( _mm_cvtepi32_ps(_mm_add_epi32(v, one)), scale );
+    }
+}
+
+#define GATHER4(p,off) _mm_set_epi32((p)[3][off], (p)[2][off], (p)[1][off], (p)[0][off])
+
+/**
+ * Decode up to 4 vertexes, vertex_length words apart - equivalent to calling
+ * scene_decode_vertex() on each of them in turn.
+ * @param count number of vertexes to decode (1..4)
+ */
+static void scene_decode_vertex4( struct vertex_struct *vert, int count, uint32_t poly1,
+                                  uint32_t poly2, uint32_t tex, uint32_t *pvr2_data,
+                                  int vertex_length, int modify_offset, float *zbounds )
+{
+    uint32_t *p[4];
+    gboolean force_alpha = !POLY2_ALPHA_ENABLE(poly2);
+    int offset = 3 + modify_offset;
+    float tex_mode, r;
+    __m128 rgba[4], spec[4];
+    float z[4], u[4], v[4];
+    int i;
+
+    /* Unused lanes just repeat the last vertex */
+    for( i=0; i<4; i++ ) {
+        p[i] = pvr2_data + (i < count ? i : count-1) * vertex_length;
+    }
+
+    /* Convert z to 1/z, taking non-finite values to 0 and leaving 0 as is */
+    __m128i zbits = GATHER4(p,2);
+    __m128 zin = _mm_castsi128_ps(zbits);
+    __m128i exp_mask = _mm_set1_epi32(0x7F800000);
+    __m128 nonfinite = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(zbits, exp_mask), exp_mask));
+    __m128 is_zero = _mm_cmpeq_ps(zin, _mm_setzero_ps());
+    __m128 zout = _mm_div_ps(_mm_set1_ps(1.0f), zin);
+    zout = _mm_or_ps( _mm_and_ps(is_zero, zin), _mm_andnot_ps(is_zero, zout) );
+    zout = _mm_andnot_ps( nonfinite, zout );
+    _mm_storeu_ps( z, zout );
+
+    /* Update the z bounds (unused lanes are duplicates, so can be included).
+     * 0 doesn't count towards the near bound. The results are the same as
+     * scene_decode_vertex() gives except possibly for the sign of a 0 far
+     * bound, so fall back to doing it one at a time in that case. */
+    __m128 zmax = _mm_max_ps( zout, _mm_shuffle_ps(zout, zout, _MM_SHUFFLE(2,3,0,1)) );
+    zmax = _mm_max_ps( zmax, _mm_shuffle_ps(zmax, zmax, _MM_SHUFFLE(1,0,3,2)) );
+    __m128 zmin = _mm_cmpeq_ps( zout, _mm_setzero_ps() );
+    zmin = _mm_or_ps( _mm_andnot_ps(zmin, zout), _mm_and_ps(zmin, _mm_set1_ps(INFINITY)) );
+    zmin = _mm_min_ps( zmin, _mm_shuffle_ps(zmin, zmin, _MM_SHUFFLE(2,3,0,1)) );
+    zmin = _mm_min_ps( zmin, _mm_shuffle_ps(zmin, zmin, _MM_SHUFFLE(1,0,3,2)) );
+    float far = _mm_cvtss_f32(zmax), near = _mm_cvtss_f32(zmin);
+    if( far > zbounds[1] ) {
+        if( far != 0 ) {
+            zbounds[1] = far;
+        } else {
+            for( i=0; i<count; i++ ) {
+                if( z[i] > zbounds[1] ) {
+                    zbounds[1] = z[i];
+                }
+            }
+        }
+    }
+    if( near < zbounds[0] ) {
+        zbounds[0] = near;
+    }
+
+    if( POLY1_TEXTURED(poly1) ) {
+        if( POLY1_UV16(poly1) ) {
+            __m128i uv = GATHER4(p,offset);
+            _mm_storeu_ps( u, _mm_castsi128_ps(_mm_and_si128(uv, _mm_set1_epi32(0xFFFF0000))) );
+            _mm_storeu_ps( v, _mm_castsi128_ps(_mm_slli_epi32(uv, 16)) );
+            offset++;
+        } else {
+            _mm_storeu_ps( u, _mm_castsi128_ps(GATHER4(p,offset)) );
+            _mm_storeu_ps( v, _mm_castsi128_ps(GATHER4(p,offset+1)) );
+            offset += 2;
+        }
+        for( i=0; i<count; i++ ) {
+            vert[i].u = u[i];
+            vert[i].v = v[i];
+        }
+
+        switch( POLY2_TEX_BLEND(poly2) ) {
+        case 0:/* Convert replace => modulate by setting colour values to 1.0 */
+            rgba[0] = rgba[1] = rgba[2] = rgba[3] = _mm_set1_ps(1.0);
+            tex_mode = 0.0;
+            break;
+        case 2: /* Decal */
+            tex_mode = 1.0;
+            unpack_bgra4( GATHER4(p,offset), rgba );
+            break;
+        case 1:
+            force_alpha = TRUE;
+            /* fall-through */
+        default:
+            tex_mode = 0.0;
+            unpack_bgra4( GATHER4(p,offset), rgba );
+            break;
+        }
+        offset++;
+        r = scene_get_palette_offset(tex);
+    } else {
+        tex_mode = 2.0;
+        r = -1.0;
+        unpack_bgra4( GATHER4(p,offset), rgba );
+        offset++;
+    }
+
+    if( POLY1_SPECULAR(poly1) ) {
+        unpack_bgra4( GATHER4(p,offset), spec );
+    } else {
+        spec[0] = spec[1] = spec[2] = spec[3] = _mm_setzero_ps();
+    }
+
+    if( force_alpha ) {
+        const __m128 rgb_mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        const __m128 alpha_one = _mm_setr_ps(0.0, 0.0, 0.0, 1.0);
+        for( i=0; i<4; i++ ) {
+            rgba[i] = _mm_or_ps( _mm_and_ps(rgba[i], rgb_mask), alpha_one );
+        }
+    }
+
+    for( i=0; i<count; i++ ) {
+        vert[i].x = *(float *)&p[i][0];
+        vert[i].y = *(float *)&p[i][1];
+        vert[i].z = z[i];
+        vert[i].r = r;
+        vert[i].tex_mode = tex_mode;
+        _mm_storeu_ps( vert[i].rgba, rgba[i] );
+        _mm_storeu_ps( vert[i].offset_rgba, spec[i] );
+    }
+}
+#endif
+
+/**
+ * Decode count vertexes, vertex_length words apart, into consecutive vertex
+ * structures (see scene_decode_vertex()). Runs 4 vertexes at a time where
+ * possible.
+ */
+void scene_decode_vertexes( struct vertex_struct *vert, int count, uint32_t poly1,
+                                   uint32_t poly2, uint32_t tex, uint32_t *pvr2_data,
+                                   int vertex_length, int modify_offset, float *zbounds )
+{
+#ifdef __SSE2__
+    for( ; count > 0; count -= 4 ) {
+        scene_decode_vertex4( vert, MIN(count,4), poly1, poly2, tex, pvr2_data,
+                              vertex_length, modify_offset, zbounds );
+        vert += 4;
+        pvr2_data += 4*vertex_length;
+    }
+#else
+    for( ; count > 0; count-- ) {
+        scene_decode_vertex( vert++, poly1, poly2, tex, pvr2_data, modify_offset, zbounds );
+        pvr2_data += vertex_length;
+    }
+#endif
+}
+
 /**
  * Compute texture, colour, and z values for 1 or more result points by interpolating from
  * a set of 3 input points. The result point(s) must define their x,y.
@@ -276,7 +531,7 @@ static void scene_decode_vertex( struct vertex_struct *vert, uint32_t poly1,
 static void scene_compute_vertexes( struct vertex_struct *result,
                                     int result_count,
                                     struct vertex_struct *input,
-                                    gboolean is_solid_shaded )
+                                    gboolean is_solid_shaded, float *zbounds )
 {
     int i,j;
     float sx = input[2].x - input[1].x;
@@ -312,10 +567,10 @@ static void scene_compute_vertexes( struct vertex_struct *result,
                 (result[i].x - input[1].x) * ty) / detxy;
 
         float rz = input[1].z + (t*tz) + (s*sz);
-        if( rz > pvr2_scene.bounds[5] ) {
-            pvr2_scene.bounds[5] = rz;
-        } else if( rz < pvr2_scene.bounds[4] ) {
-            pvr2_scene.bounds[4] = rz;
+        if( rz > zbounds[1] ) {
+            zbounds[1] = rz;
+        } else if( rz < zbounds[0] ) {
+            zbounds[0] = rz;
         }
         result[i].z = rz;
         result[i].u = input[1].u + (t*tu) + (s*su);
@@ -341,7 +596,7 @@ static void scene_compute_vertexes( struct vertex_struct *result,
     }
 }
 
-static float scene_compute_lut_fog_vertex( float z, float fog_density, float fog_table[][2] )
+float scene_compute_lut_fog_vertex( float z, float fog_density, float fog_table[][2] )
 {
     union {
         uint32_t i;
@@ -356,109 +611,187 @@ static float scene_compute_lut_fog_vertex( float z, float fog_density, float fog
 }
 
 /**
- * Compute the fog coefficients for all polygons using lookup-table fog. It's 
- * a little more convenient to do this as a separate pass, since we don't have
- * to worry about computed vertexes.
+ * Compute the lookup-table fog values for count vertexes (as per
+ * scene_compute_lut_fog_vertex()), 4 at a time where possible.
  */
-static void scene_compute_lut_fog( )
+void scene_compute_lut_fog_vertexes( struct vertex_struct *vert, int count, float *fog,
+                                            float fog_density, float fog_table[][2] )
 {
-    int i,j;
+#ifdef __SSE2__
+    const __m128 density = _mm_set1_ps(fog_density);
+    const __m128 fog_min = _mm_set1_ps(1.0);
+    const __m128 fog_max = _mm_set1_ps(255.9999);
+    for( ; count >= 4; count -= 4 ) {
+        __m128 v = _mm_mul_ps( _mm_setr_ps(vert[0].z, vert[1].z, vert[2].z, vert[3].z), density );
+        /* Operand order matters here: NaNs pass through unclamped, as in the
+         * scalar version */
+        v = _mm_min_ps( fog_max, _mm_max_ps( fog_min, v ) );
+        __m128i bits = _mm_castps_si128(v);
+        __m128i index = _mm_or_si128( _mm_and_si128(_mm_srli_epi32(bits, 18), _mm_set1_epi32(0x0F)),
+                                      _mm_and_si128(_mm_srli_epi32(bits, 19), _mm_set1_epi32(0x70)) );
+#ifdef __AVX2__
+        _mm_storeu_ps( fog, _mm_i32gather_ps( &fog_table[0][0], index, 8 ) );
+#else
+        uint32_t idx[4];
+        _mm_storeu_si128( (__m128i *)idx, index );
+        fog[0] = fog_table[idx[0]][0];
+        fog[1] = fog_table[idx[1]][0];
+        fog[2] = fog_table[idx[2]][0];
+        fog[3] = fog_table[idx[3]][0];
+#endif
+        vert += 4;
+        fog += 4;
+    }
+#endif
+    for( ; count > 0; count-- ) {
+        *fog++ = scene_compute_lut_fog_vertex( (vert++)->z, fog_density, fog_table );
+    }
+}
 
-    float fog_density = parse_fog_density(MMIO_READ( PVR2, RENDER_FOGCOEFF ));
-    float fog_table[128][2];
-    
-    /* Parse fog table out into floating-point format */
+/**
+ * Parse the fog lookup table out into floating-point format, ready for
+ * scene_compute_lut_fog().
+ */
+void scene_init_lut_fog( )
+{
+    int i;
+
+    scene_fog_density = parse_fog_density(MMIO_READ( PVR2, RENDER_FOGCOEFF ));
     for( i=0; i<128; i++ ) {
         uint32_t ent = MMIO_READ( PVR2, RENDER_FOGTABLE + (i<<2) );
-        fog_table[i][0] = ((float)(((ent&0x0000FF00)>>8) + 1)) / 256.0;
-        fog_table[i][1] = ((float)((ent&0x000000FF) + 1)) / 256.0;
+        scene_fog_table[i][0] = ((float)(((ent&0x0000FF00)>>8) + 1)) / 256.0;
+        scene_fog_table[i][1] = ((float)((ent&0x000000FF) + 1)) / 256.0;
     }
-    
-    
-    for( i=0; i<pvr2_scene.poly_count; i++ ) {
-        int mode = POLY2_FOG_MODE(pvr2_scene.poly_array[i].context[1]);
-        uint32_t index = pvr2_scene.poly_array[i].vertex_index;
-        if( mode == PVR2_POLY_FOG_LOOKUP ) {
-            for( j=0; j<pvr2_scene.poly_array[i].vertex_count; j++ ) {
-                float fog = scene_compute_lut_fog_vertex( pvr2_scene.vertex_array[index+j].z, fog_density, fog_table );
-                if( display_driver->capabilities.has_sl )
-                    pvr2_scene.vertex_array[index+j].offset_rgba[3] = -fog;
-                else
-                    pvr2_scene.vertex_array[index+j].offset_rgba[3] = fog;
-            }
-        } else if( mode == PVR2_POLY_FOG_LOOKUP2 ) {
-            for( j=0; j<pvr2_scene.poly_array[i].vertex_count; j++ ) {
-                pvr2_scene.vertex_array[index+j].rgba[0] = pvr2_scene.fog_lut_colour[0];
-                pvr2_scene.vertex_array[index+j].rgba[1] = pvr2_scene.fog_lut_colour[1];
-                pvr2_scene.vertex_array[index+j].rgba[2] = pvr2_scene.fog_lut_colour[2];
-                pvr2_scene.vertex_array[index+j].rgba[3] = 
-                    scene_compute_lut_fog_vertex( pvr2_scene.vertex_array[index+j].z, fog_density, fog_table );
-                pvr2_scene.vertex_array[index+j].offset_rgba[3] = 0;
-            }
-        } else if( mode == PVR2_POLY_FOG_DISABLED ) {
-            for( j=0; j<pvr2_scene.poly_array[i].vertex_count; j++ ) {
-                pvr2_scene.vertex_array[index+j].offset_rgba[3] = 0;
+}
+
+/**
+ * Compute the fog coefficients for a polygon using lookup-table fog. It's 
+ * a little more convenient to do this as a separate pass, since we don't have
+ * to worry about computed vertexes.
+ */
+static void scene_compute_lut_fog( struct polygon_struct *poly )
+{
+    int j;
+    int mode = POLY2_FOG_MODE(poly->context[1]);
+    struct vertex_struct *vert = &pvr2_scene.vertex_array[poly->vertex_index];
+    float fog[MAX_POLY_VERTEXES];
+
+    if( mode == PVR2_POLY_FOG_LOOKUP ) {
+        scene_compute_lut_fog_vertexes( vert, poly->vertex_count, fog, scene_fog_density, scene_fog_table );
+        for( j=0; j<poly->vertex_count; j++ ) {
+            if( display_driver->capabilities.has_sl )
+                vert[j].offset_rgba[3] = -fog[j];
+            else
+                vert[j].offset_rgba[3] = fog[j];
+        }
+    } else if( mode == PVR2_POLY_FOG_LOOKUP2 ) {
+        scene_compute_lut_fog_vertexes( vert, poly->vertex_count, fog, scene_fog_density, scene_fog_table );
+        for( j=0; j<poly->vertex_count; j++ ) {
+            vert[j].rgba[0] = pvr2_scene.fog_lut_colour[0];
+            vert[j].rgba[1] = pvr2_scene.fog_lut_colour[1];
+            vert[j].rgba[2] = pvr2_scene.fog_lut_colour[2];
+            vert[j].rgba[3] = fog[j];
+            vert[j].offset_rgba[3] = 0;
+        }
+    } else if( mode == PVR2_POLY_FOG_DISABLED ) {
+        for( j=0; j<poly->vertex_count; j++ ) {
+            vert[j].offset_rgba[3] = 0;
+        }
+    }
+}
+
+/**
+ * @return TRUE if the triangle starting at vert faces the viewer.
+ */
+static inline gboolean scene_triangle_visible( struct vertex_struct *vert, gboolean ccw )
+{
+    float ux = vert[1].x - vert[0].x;
+    float uy = vert[1].y - vert[0].y;
+    float vx = vert[2].x - vert[0].x;
+    float vy = vert[2].y - vert[0].y;
+    float nz = (ux*vy) - (uy*vx);
+    return ccw ? nz > 0 : nz < 0;
+}
+
+/**
+ * Count the number of sub-polygons that scene_backface_cull() will need to
+ * allocate for the given polygon (ie the number of runs of visible triangles,
+ * less one)
+ */
+static int scene_backface_count_splits( struct polygon_struct *poly )
+{
+    uint32_t poly1 = poly->context[0];
+    if( POLY1_CULL_ENABLE(poly1) ) {
+        struct vertex_struct *vert = &pvr2_scene.vertex_array[poly->vertex_index];
+        unsigned tri_count = poly->vertex_count-2;
+        unsigned i;
+        gboolean ccw = (POLY1_CULL_MODE(poly1) == CULL_CCW);
+        int last_visible = -1, splits = 0;
+        for( i=0; i<tri_count; i++ ) {
+            if( scene_triangle_visible( &vert[i], ccw ) ) {
+                if( last_visible != -1 && last_visible != i-1 ) {
+                    splits++;
+                }
+                last_visible = i;
             }
+            ccw = !ccw;
         }
-    }    
+        return splits;
+    }
+    return 0;
 }
 
 /**
  * Manually cull back-facing polygons where we can - this actually saves
  * us a lot of time vs passing everything to GL to do it.
+ * @param sub_idx Index in poly_array of the first sub-polygon to be
+ *        allocated (if needed), as counted by scene_backface_count_splits()
+ * @return the number of sub-polygons allocated.
  */
-static void scene_backface_cull()
-{
-    unsigned poly_idx;
-    unsigned poly_count = pvr2_scene.poly_count; /* Note: we don't want to process any sub-polygons created here */
-    for( poly_idx = 0; poly_idx<poly_count; poly_idx++ ) {
-        uint32_t poly1 = pvr2_scene.poly_array[poly_idx].context[0];
-        if( POLY1_CULL_ENABLE(poly1) ) {
-            struct polygon_struct *poly = &pvr2_scene.poly_array[poly_idx];
-            unsigned vert_idx = poly->vertex_index;
-            unsigned tri_count = poly->vertex_count-2;
-            struct vertex_struct *vert = &pvr2_scene.vertex_array[vert_idx];
-            unsigned i;
-            gboolean ccw = (POLY1_CULL_MODE(poly1) == CULL_CCW);
-            int first_visible = -1, last_visible = -1;
-            for( i=0; i<tri_count; i++ ) {
-                float ux = vert[i+1].x - vert[i].x;
-                float uy = vert[i+1].y - vert[i].y;
-                float vx = vert[i+2].x - vert[i].x;
-                float vy = vert[i+2].y - vert[i].y;
-                float nz = (ux*vy) - (uy*vx);
-                if( ccw ? nz > 0 : nz < 0 ) {
-                    /* Surface is visible */
-                    if( first_visible == -1 ) {
-                        first_visible = i;
-                        /* Elide the initial hidden triangles (note we don't
-                         * need to care about winding anymore here) */
-                        poly->vertex_index += i;
-                        poly->vertex_count -= i;
-                        if( poly->mod_vertex_index != -1 )
-                            poly->mod_vertex_index += i;
-                    } else if( last_visible != i-1 ) {
-                        /* And... here we have to split the polygon. Allocate a new
-                         * sub-polygon to hold the vertex references */
-                        struct polygon_struct *sub = scene_split_subpolygon(poly, (i-first_visible));
-                        poly->vertex_count -= (i-first_visible-1) - last_visible;
-                        first_visible = i;
-                        poly = sub;
-                    }
-                    last_visible = i;
-                } /* Else culled */
-                /* Invert ccw flag for triangle strip processing */
-                ccw = !ccw;
-            }
-            if( last_visible == -1 ) {
-                /* No visible surfaces, so we can mark the whole polygon as being vertex-less */
-                poly->vertex_count = 0;
-            } else if( last_visible != tri_count-1 ) {
-                /* Remove final hidden tris */
-                poly->vertex_count -= (tri_count - 1 - last_visible);
-            }
+static int scene_backface_cull( struct polygon_struct *poly, int sub_idx )
+{
+    uint32_t poly1 = poly->context[0];
+    int splits = 0;
+    if( POLY1_CULL_ENABLE(poly1) ) {
+        unsigned vert_idx = poly->vertex_index;
+        unsigned tri_count = poly->vertex_count-2;
+        struct vertex_struct *vert = &pvr2_scene.vertex_array[vert_idx];
+        unsigned i;
+        gboolean ccw = (POLY1_CULL_MODE(poly1) == CULL_CCW);
+        int first_visible = -1, last_visible = -1;
+        for( i=0; i<tri_count; i++ ) {
+            if( scene_triangle_visible( &vert[i], ccw ) ) {
+                /* Surface is visible */
+                if( first_visible == -1 ) {
+                    first_visible = i;
+                    /* Elide the initial hidden triangles (note we don't
+                     * need to care about winding anymore here) */
+                    poly->vertex_index += i;
+                    poly->vertex_count -= i;
+                    if( poly->mod_vertex_index != -1 )
+                        poly->mod_vertex_index += i;
+                } else if( last_visible != i-1 ) {
+                    /* And... here we have to split the polygon. Allocate a new
+                     * sub-polygon to hold the vertex references */
+                    struct polygon_struct *sub = scene_split_subpolygon(poly, (i-first_visible), sub_idx + splits++);
+                    poly->vertex_count -= (i-first_visible-1) - last_visible;
+                    first_visible = i;
+                    poly = sub;
+                }
+                last_visible = i;
+            } /* Else culled */
+            /* Invert ccw flag for triangle strip processing */
+            ccw = !ccw;
+        }
+        if( last_visible == -1 ) {
+            /* No visible surfaces, so we can mark the whole polygon as being vertex-less */
+            poly->vertex_count = 0;
+        } else if( last_visible != tri_count-1 ) {
+            /* Remove final hidden tris */
+            poly->vertex_count -= (tri_count - 1 - last_visible);
         }
     }
+    return splits;
 }
 
 static void scene_add_cheap_shadow_vertexes( struct vertex_struct *src, struct vertex_struct *dest, int count )
@@ -486,101 +819,75 @@ static void scene_add_cheap_shadow_vertexes( struct vertex_struct *src, struct v
     }
 }
 
-static void scene_add_vertexes( pvraddr_t poly_idx, int vertex_length,
-                                shadow_mode_t is_modified )
+/**
+ * Decode the vertexes of a polygon into the vertex buffer at its assigned
+ * vertex_index (and mod_vertex_index if modified).
+ */
+static void scene_add_vertexes( struct polygon_struct *poly, int vertex_length,
+                                shadow_mode_t is_modified, float *zbounds )
 {
-    struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[poly_idx];
-    uint32_t *ptr = &pvr2_scene.pvr2_pbuf[poly_idx];
-    uint32_t *context = ptr;
-    unsigned int i;
-
-    if( poly->vertex_index == -1 ) {
-        ptr += (is_modified == SHADOW_FULL ? 5 : 3 );
-        poly->vertex_index = pvr2_scene.vertex_index;
-
-        assert( poly != NULL );
-        assert( pvr2_scene.vertex_index + poly->vertex_count <= pvr2_scene.vertex_count );
-        for( i=0; i<poly->vertex_count; i++ ) {
-            scene_decode_vertex( &pvr2_scene.vertex_array[pvr2_scene.vertex_index++], context[0], context[1], context[2], ptr, 0 );
-            ptr += vertex_length;
-        }
-        if( is_modified ) {
-            assert( pvr2_scene.vertex_index + poly->vertex_count <= pvr2_scene.vertex_count );
-            poly->mod_vertex_index = pvr2_scene.vertex_index;
-            if( is_modified == SHADOW_FULL ) {
-                int mod_offset = (vertex_length - 3)>>1;
-                ptr = &pvr2_scene.pvr2_pbuf[poly_idx] + 5;
-                for( i=0; i<poly->vertex_count; i++ ) {
-                    scene_decode_vertex( &pvr2_scene.vertex_array[pvr2_scene.vertex_index++], context[0], context[3], context[4], ptr, mod_offset );
-                    ptr += vertex_length;
-                }
-            } else {
-                scene_add_cheap_shadow_vertexes( &pvr2_scene.vertex_array[poly->vertex_index], 
-                        &pvr2_scene.vertex_array[poly->mod_vertex_index], poly->vertex_count );
-                pvr2_scene.vertex_index += poly->vertex_count;
-            }
+    uint32_t *context = poly->context;
+    uint32_t *ptr = context + (is_modified == SHADOW_FULL ? 5 : 3 );
+    struct vertex_struct *vert = &pvr2_scene.vertex_array[poly->vertex_index];
+
+    scene_decode_vertexes( vert, poly->vertex_count, context[0], context[1], context[2],
+                           ptr, vertex_length, 0, zbounds );
+    if( is_modified ) {
+        vert = &pvr2_scene.vertex_array[poly->mod_vertex_index];
+        if( is_modified == SHADOW_FULL ) {
+            int mod_offset = (vertex_length - 3)>>1;
+            scene_decode_vertexes( vert, poly->vertex_count, context[0], context[3], context[4],
+                                   context + 5, vertex_length, mod_offset, zbounds );
+        } else {
+            scene_add_cheap_shadow_vertexes( &pvr2_scene.vertex_array[poly->vertex_index], 
+                    vert, poly->vertex_count );
         }
     }
 }
 
-static void scene_add_quad_vertexes( pvraddr_t poly_idx, int vertex_length,
-                                     shadow_mode_t is_modified )
+static void scene_add_quad_vertexes( struct polygon_struct *poly, int vertex_length,
+                                     shadow_mode_t is_modified, float *zbounds )
 {
-    struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[poly_idx];
-    uint32_t *ptr = &pvr2_scene.pvr2_pbuf[poly_idx];
-    uint32_t *context = ptr;
-    unsigned int i;
-
-    if( poly->vertex_index == -1 ) {
-        // Construct it locally and copy to the vertex buffer, as the VBO is
-        // allowed to be horribly slow for reads (ie it could be direct-mapped
-        // vram).
-        struct vertex_struct quad[4];
-
-        assert( poly != NULL );
-        assert( pvr2_scene.vertex_index + poly->vertex_count <= pvr2_scene.vertex_count );
-        ptr += (is_modified == SHADOW_FULL ? 5 : 3 );
-        poly->vertex_index = pvr2_scene.vertex_index;
-        for( i=0; i<4; i++ ) {
-            scene_decode_vertex( &quad[i], context[0], context[1], context[2], ptr, 0 );
-            ptr += vertex_length;
-        }
-        scene_compute_vertexes( &quad[3], 1, &quad[0], !POLY1_GOURAUD_SHADED(context[0]) );
-        // Swap last two vertexes (quad arrangement => tri strip arrangement)
-        memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index], quad, sizeof(struct vertex_struct)*2 );
-        memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index+2], &quad[3], sizeof(struct vertex_struct) );
-        memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index+3], &quad[2], sizeof(struct vertex_struct) );
-        if( !POLY1_GOURAUD_SHADED(context[0]) ) {
-            memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index].rgba, &pvr2_scene.vertex_array[pvr2_scene.vertex_index+3].rgba, sizeof(float)*8 );
-            memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index+1].rgba, &pvr2_scene.vertex_array[pvr2_scene.vertex_index+3].rgba, sizeof(float)*8 );
-        }
-
-        pvr2_scene.vertex_index += 4;
+    uint32_t *context = poly->context;
+    uint32_t *ptr = context + (is_modified == SHADOW_FULL ? 5 : 3 );
+    struct vertex_struct *vert = &pvr2_scene.vertex_array[poly->vertex_index];
+
+    // Construct it locally and copy to the vertex buffer, as the VBO is
+    // allowed to be horribly slow for reads (ie it could be direct-mapped
+    // vram). Fields the decode doesn't write (w, and u/v if untextured)
+    // are cleared rather than copying stack garbage into the buffer.
+    struct vertex_struct quad[4];
+    memset( quad, 0, sizeof(quad) );
+
+    scene_decode_vertexes( quad, 4, context[0], context[1], context[2], ptr,
+                           vertex_length, 0, zbounds );
+    scene_compute_vertexes( &quad[3], 1, &quad[0], !POLY1_GOURAUD_SHADED(context[0]), zbounds );
+    // Swap last two vertexes (quad arrangement => tri strip arrangement)
+    memcpy( &vert[0], quad, sizeof(struct vertex_struct)*2 );
+    memcpy( &vert[2], &quad[3], sizeof(struct vertex_struct) );
+    memcpy( &vert[3], &quad[2], sizeof(struct vertex_struct) );
+    if( !POLY1_GOURAUD_SHADED(context[0]) ) {
+        memcpy( &vert[0].rgba, &vert[3].rgba, sizeof(float)*8 );
+        memcpy( &vert[1].rgba, &vert[3].rgba, sizeof(float)*8 );
+    }
 
-        if( is_modified ) {
-            assert( pvr2_scene.vertex_index + poly->vertex_count <= pvr2_scene.vertex_count );
-            poly->mod_vertex_index = pvr2_scene.vertex_index;
-            if( is_modified == SHADOW_FULL ) {
-                int mod_offset = (vertex_length - 3)>>1;
-                ptr = &pvr2_scene.pvr2_pbuf[poly_idx] + 5;
-                for( i=0; i<4; i++ ) {
-                    scene_decode_vertex( &quad[4], context[0], context[3], context[4], ptr, mod_offset );
-                    ptr += vertex_length;
-                }
-                scene_compute_vertexes( &quad[3], 1, &quad[0], !POLY1_GOURAUD_SHADED(context[0]) );
-                memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index], quad, sizeof(struct vertex_struct)*2 );
-                memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index+2], &quad[3], sizeof(struct vertex_struct) );
-                memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index+3], &quad[2], sizeof(struct vertex_struct) );
-                if( !POLY1_GOURAUD_SHADED(context[0]) ) {
-                    memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index].rgba, &pvr2_scene.vertex_array[pvr2_scene.vertex_index+3].rgba, sizeof(float)*8 );
-                    memcpy( &pvr2_scene.vertex_array[pvr2_scene.vertex_index+1].rgba, &pvr2_scene.vertex_array[pvr2_scene.vertex_index+3].rgba, sizeof(float)*8 );
-                }
-            } else {
-                scene_add_cheap_shadow_vertexes( &pvr2_scene.vertex_array[poly->vertex_index], 
-                        &pvr2_scene.vertex_array[poly->mod_vertex_index], poly->vertex_count );
-                pvr2_scene.vertex_index += poly->vertex_count;
+    if( is_modified ) {
+        vert = &pvr2_scene.vertex_array[poly->mod_vertex_index];
+        if( is_modified == SHADOW_FULL ) {
+            int mod_offset = (vertex_length - 3)>>1;
+            scene_decode_vertexes( quad, 4, context[0], context[3], context[4], context + 5,
+                                   vertex_length, mod_offset, zbounds );
+            scene_compute_vertexes( &quad[3], 1, &quad[0], !POLY1_GOURAUD_SHADED(context[0]), zbounds );
+            memcpy( &vert[0], quad, sizeof(struct vertex_struct)*2 );
+            memcpy( &vert[2], &quad[3], sizeof(struct vertex_struct) );
+            memcpy( &vert[3], &quad[2], sizeof(struct vertex_struct) );
+            if( !POLY1_GOURAUD_SHADED(context[0]) ) {
+                memcpy( &vert[0].rgba, &vert[3].rgba, sizeof(float)*8 );
+                memcpy( &vert[1].rgba, &vert[3].rgba, sizeof(float)*8 );
             }
-            pvr2_scene.vertex_index += 4;
+        } else {
+            scene_add_cheap_shadow_vertexes( &pvr2_scene.vertex_array[poly->vertex_index], 
+                    vert, 4 );
         }
     }
 }
@@ -588,12 +895,16 @@ static void scene_add_quad_vertexes( pvraddr_t poly_idx, int vertex_length,
 static void scene_extract_polygons( pvraddr_t tile_entry )
 {
     uint32_t *tile_list = (uint32_t *)(pvr2_main_ram+tile_entry);
+    uint32_t *block = tile_list;
     do {
         uint32_t entry = *tile_list++;
         if( entry >> 28 == 0x0F ) {
+            scene_add_vram_span( &scene_list_span, block, tile_list );
             break;
         } else if( entry >> 28 == 0x0E ) {
+            scene_add_vram_span( &scene_list_span, block, tile_list );
             tile_list = (uint32_t *)(pvr2_main_ram + (entry&0x007FFFFF));
+            block = tile_list;
         } else {
             pvraddr_t polyaddr = entry&0x000FFFFF;
             shadow_mode_t is_modified = (entry & 0x01000000) ? pvr2_scene.shadow_mode : SHADOW_NONE;
@@ -612,7 +923,7 @@ static void scene_extract_polygons( pvraddr_t tile_entry )
                 int i;
                 struct polygon_struct *last_poly = NULL;
                 for( i=0; i<strip_count; i++ ) {
-                    struct polygon_struct *poly = scene_add_polygon( polyaddr, 3, is_modified );
+                    struct polygon_struct *poly = scene_add_polygon( polyaddr, 3, vertex_length, is_modified, FALSE );
                     polyaddr += polygon_length;
                     if( last_poly != NULL && last_poly->next == NULL ) {
                         last_poly->next = poly;
@@ -626,7 +937,7 @@ static void scene_extract_polygons( pvraddr_t tile_entry )
                 int i;
                 struct polygon_struct *last_poly = NULL;
                 for( i=0; i<strip_count; i++ ) {
-                    struct polygon_struct *poly = scene_add_polygon( polyaddr, 4, is_modified );
+                    struct polygon_struct *poly = scene_add_polygon( polyaddr, 4, vertex_length, is_modified, TRUE );
                     polyaddr += polygon_length;
                     if( last_poly != NULL && last_poly->next == NULL ) {
                         last_poly->next = poly;
@@ -643,66 +954,103 @@ static void scene_extract_polygons( pvraddr_t tile_entry )
                     }
                 }
                 if( last != -1 ) {
-                    scene_add_polygon( polyaddr, last+3, is_modified );
+                    scene_add_polygon( polyaddr, last+3, vertex_length, is_modified, FALSE );
                 }
             }
         }
     } while( 1 );
 }
 
-static void scene_extract_vertexes( pvraddr_t tile_entry )
+/**
+ * Assign the vertex buffer locations for all polygons found in pass 1. Each
+ * polygon gets its vertexes followed by its modified vertexes (if any), in
+ * poly_array order (which is the order the polygons first appear in the
+ * tile lists).
+ */
+static void scene_assign_vertexes( void )
 {
-    uint32_t *tile_list = (uint32_t *)(pvr2_main_ram+tile_entry);
-    do {
-        uint32_t entry = *tile_list++;
-        if( entry >> 28 == 0x0F ) {
-            break;
-        } else if( entry >> 28 == 0x0E ) {
-            tile_list = (uint32_t *)(pvr2_main_ram + (entry&0x007FFFFF));
-        } else {
-            pvraddr_t polyaddr = entry&0x000FFFFF;
-            shadow_mode_t is_modified = (entry & 0x01000000) ? pvr2_scene.shadow_mode : SHADOW_NONE;
-            int vertex_length = (entry >> 21) & 0x07;
-            int context_length = 3;
-            if( is_modified == SHADOW_FULL ) {
-                context_length = 5;
-                vertex_length <<=1 ;
-            }
-            vertex_length += 3;
+    uint32_t vertex_index = 0;
+    int i;
 
-            if( (entry & 0xE0000000) == 0x80000000 ) {
-                /* Triangle(s) */
-                int strip_count = ((entry >> 25) & 0x0F)+1;
-                int polygon_length = 3 * vertex_length + context_length;
-                int i;
-                for( i=0; i<strip_count; i++ ) {
-                    scene_add_vertexes( polyaddr, vertex_length, is_modified );
-                    polyaddr += polygon_length;
-                }
-            } else if( (entry & 0xE0000000) == 0xA0000000 ) {
-                /* Sprite(s) */
-                int strip_count = ((entry >> 25) & 0x0F)+1;
-                int polygon_length = 4 * vertex_length + context_length;
-                int i;
-                for( i=0; i<strip_count; i++ ) {
-                    scene_add_quad_vertexes( polyaddr, vertex_length, is_modified );
-                    polyaddr += polygon_length;
-                }
-            } else {
-                /* Polygon */
-                int i, last = -1;
-                for( i=5; i>=0; i-- ) {
-                    if( entry & (0x40000000>>i) ) {
-                        last = i;
-                        break;
-                    }
-                }
-                if( last != -1 ) {
-                    scene_add_vertexes( polyaddr, vertex_length, is_modified );
-                }
-            }
+    for( i=0; i<pvr2_scene.poly_count; i++ ) {
+        struct polygon_struct *poly = &pvr2_scene.poly_array[i];
+        int count = scene_poly_sources[i].is_quad ? 4 : poly->vertex_count;
+        poly->vertex_index = vertex_index;
+        vertex_index += count;
+        if( scene_poly_sources[i].is_modified != SHADOW_NONE ) {
+            poly->mod_vertex_index = vertex_index;
+            vertex_index += count;
         }
-    } while( 1 );
+    }
+    assert( vertex_index <= pvr2_scene.vertex_count );
+    pvr2_scene.vertex_index = vertex_index;
+}
+
+/**
+ * Divide polygons [0..poly_count) into jobs
+ */
+static void scene_init_jobs( int poly_count )
+{
+    int i;
+    scene_job_count = (poly_count + SCENE_JOB_POLYS - 1) / SCENE_JOB_POLYS;
+    for( i=0; i<scene_job_count; i++ ) {
+        scene_jobs[i].first_poly = i * SCENE_JOB_POLYS;
+        scene_jobs[i].end_poly = MIN( poly_count, (i+1) * SCENE_JOB_POLYS );
+    }
+}
+
+/**
+ * Pass 2 job: decode the vertexes for the job's polygons
+ */
+static void scene_extract_vertexes( void *data, int index )
+{
+    struct scene_job *job = &scene_jobs[index];
+    int i;
+
+    job->zbounds[0] = pvr2_scene.bounds[4];
+    job->zbounds[1] = pvr2_scene.bounds[5];
+    for( i=job->first_poly; i<job->end_poly; i++ ) {
+        struct scene_poly_source *src = &scene_poly_sources[i];
+        if( src->is_quad ) {
+            scene_add_quad_vertexes( &pvr2_scene.poly_array[i], src->vertex_length,
+                    src->is_modified, job->zbounds );
+        } else {
+            scene_add_vertexes( &pvr2_scene.poly_array[i], src->vertex_length,
+                    src->is_modified, job->zbounds );
+        }
+    }
+}
+
+/**
+ * Fog job: compute the fog for the job's polygons, and count the
+ * sub-polygons that culling them will produce.
+ */
+static void scene_compute_fog( void *data, int index )
+{
+    struct scene_job *job = &scene_jobs[index];
+    int i;
+
+    job->split_count = 0;
+    for( i=job->first_poly; i<job->end_poly; i++ ) {
+        scene_compute_lut_fog( &pvr2_scene.poly_array[i] );
+        job->split_count += scene_backface_count_splits( &pvr2_scene.poly_array[i] );
+    }
+}
+
+/**
+ * Cull job: cull the job's polygons, allocating their sub-polygons
+ * consecutively from job->first_sub.
+ */
+static void scene_cull_polygons( void *data, int index )
+{
+    struct scene_job *job = &scene_jobs[index];
+    int sub_idx = job->first_sub;
+    int i;
+
+    for( i=job->first_poly; i<job->end_poly; i++ ) {
+        sub_idx += scene_backface_cull( &pvr2_scene.poly_array[i], sub_idx );
+    }
+    assert( sub_idx == job->first_sub + job->split_count );
 }
 
 static void scene_extract_background( void )
@@ -737,9 +1085,10 @@ static void scene_extract_background( void )
 
     struct vertex_struct base_vertexes[3];
     uint32_t *ptr = context + context_length;
+    memset( base_vertexes, 0, sizeof(base_vertexes) );
     for( i=0; i<3; i++ ) {
         scene_decode_vertex( &base_vertexes[i], context[0], context[1], context[2],
-                ptr, 0 );
+                ptr, 0, &pvr2_scene.bounds[4] );
         ptr += vertex_length;
     }
     struct vertex_struct *result_vertexes = &pvr2_scene.vertex_array[poly->vertex_index];
@@ -747,14 +1096,14 @@ static void scene_extract_background( void )
     result_vertexes[1].x = result_vertexes[3].x = pvr2_scene.buffer_width;
     result_vertexes[1].y = result_vertexes[2].x = 0;
     result_vertexes[2].y = result_vertexes[3].y  = pvr2_scene.buffer_height;
-    scene_compute_vertexes( result_vertexes, 4, base_vertexes, !POLY1_GOURAUD_SHADED(context[0]) );
+    scene_compute_vertexes( result_vertexes, 4, base_vertexes, !POLY1_GOURAUD_SHADED(context[0]), &pvr2_scene.bounds[4] );
 
     if( is_modified == SHADOW_FULL ) {
         int mod_offset = (vertex_length - 3)>>1;
         ptr = context + context_length;
         for( i=0; i<3; i++ ) {
             scene_decode_vertex( &base_vertexes[i], context[0], context[3], context[4],
-                    ptr, mod_offset );
+                    ptr, mod_offset, &pvr2_scene.bounds[4] );
             ptr += vertex_length;
         }
         result_vertexes = &pvr2_scene.vertex_array[poly->mod_vertex_index];
@@ -762,7 +1111,7 @@ static void scene_extract_background( void )
         result_vertexes[1].x = result_vertexes[3].x = pvr2_scene.buffer_width;
         result_vertexes[1].y = result_vertexes[2].x = 0;
         result_vertexes[2].y = result_vertexes[3].y  = pvr2_scene.buffer_height;
-        scene_compute_vertexes( result_vertexes, 4, base_vertexes, !POLY1_GOURAUD_SHADED(context[0]) );
+        scene_compute_vertexes( result_vertexes, 4, base_vertexes, !POLY1_GOURAUD_SHADED(context[0]), &pvr2_scene.bounds[4] );
     } else if( is_modified == SHADOW_CHEAP ) {
         scene_add_cheap_shadow_vertexes( &pvr2_scene.vertex_array[poly->vertex_index], 
                 &pvr2_scene.vertex_array[poly->mod_vertex_index], poly->vertex_count );
@@ -791,6 +1140,10 @@ uint32_t pvr2_scene_buffer_height()
  * polygon for certain until we've seen all tiles containing it. It also means we
  * can count the vertexes and allocate the appropriate size VBO.
  *
+ * Pass 2 and the fog/culling passes are run in parallel on the worker pool.
+ * The output locations of every polygon are assigned up-front in poly_array
+ * order, so the result is the same as running them serially.
+ *
  * FIXME: accesses into VRAM need to be bounds-checked properly
  */
 void pvr2_scene_read( void )
@@ -824,6 +1177,9 @@ void pvr2_scene_read( void )
     uint32_t shadow = MMIO_READ(PVR2,RENDER_SHADOW);
     pvr2_scene.segment_list = (struct tile_segment *)tilebuffer;
     pvr2_scene.pvr2_pbuf = (uint32_t *)(pvr2_main_ram + MMIO_READ(PVR2,RENDER_POLYBASE));
+    pvr2_scene.vram = pvr2_main_ram;
+    scene_list_span.start = PVR2_RAM_SIZE;
+    scene_list_span.end = 0;
     pvr2_scene.shadow_mode = shadow & 0x100 ? SHADOW_CHEAP : SHADOW_FULL;
     scene_shadow_intensity = U8TOFLOAT(shadow&0xFF);
 
@@ -862,27 +1218,41 @@ void pvr2_scene_read( void )
             segment++;
         }
     } while( (control & SEGMENT_END) == 0 );
+    scene_segment_span.start = PVR2_RAM_SIZE;
+    scene_segment_span.end = 0;
+    scene_add_vram_span( &scene_segment_span, tilebuffer, segment );
 
     pvr2_scene.buffer_width = (max_tile_x+1)<<5;
     pvr2_scene.buffer_height = (max_tile_y+1)<<5;
 
     // Pass 2: Extract vertex data
     vertex_buffer_map();
-    pvr2_scene.vertex_index = 0;
-    segment = tilebuffer;
-    do {
-        control = *segment++;
-        for( i=0; i<5; i++ ) {
-            if( (*segment & NO_POINTER) == 0 ) {
-                scene_extract_vertexes( *segment );
-            }
-            segment++;
+    scene_assign_vertexes();
+    scene_init_jobs( pvr2_scene.poly_count );
+    workpool_run( scene_extract_vertexes, NULL, scene_job_count );
+    for( i=0; i<scene_job_count; i++ ) {
+        /* Merge in job order so that ties resolve the same way as a serial pass */
+        if( scene_jobs[i].zbounds[1] > pvr2_scene.bounds[5] ) {
+            pvr2_scene.bounds[5] = scene_jobs[i].zbounds[1];
         }
-    } while( (control & SEGMENT_END) == 0 );
+        if( scene_jobs[i].zbounds[0] < pvr2_scene.bounds[4] ) {
+            pvr2_scene.bounds[4] = scene_jobs[i].zbounds[0];
+        }
+    }
 
     scene_extract_background();
-    scene_compute_lut_fog();
-    scene_backface_cull();
+
+    // Fog + backface culling. Sub-polygons created by culling are placed
+    // after all existing polygons, in the order of their parents
+    scene_init_lut_fog();
+    scene_init_jobs( pvr2_scene.poly_count );
+    workpool_run( scene_compute_fog, NULL, scene_job_count );
+    for( i=0; i<scene_job_count; i++ ) {
+        scene_jobs[i].first_sub = pvr2_scene.poly_count;
+        pvr2_scene.poly_count += scene_jobs[i].split_count;
+    }
+    assert( pvr2_scene.poly_count <= MAX_POLYGONS );
+    workpool_run( scene_cull_polygons, NULL, scene_job_count );
 
     vertex_buffer_unmap();
 }
@@ -892,6 +1262,45 @@ void pvr2_scene_finished( )
     vbuf->finished(vbuf);
 }
 
+static void scene_copy_vram_span( unsigned char *image, uint32_t start, uint32_t end )
+{
+    if( end > PVR2_RAM_SIZE ) {
+        end = PVR2_RAM_SIZE;
+    }
+    if( start < end ) {
+        memcpy( image + start, pvr2_main_ram + start, end - start );
+    }
+}
+
+/**
+ * The copy keeps every structure at the same offset it has in VRAM, so
+ * rebasing a pointer is just a matter of swapping the base. Polygon
+ * contexts are scattered through the parameter buffer, but in practice
+ * they're packed together, so we copy the one span that covers all of them.
+ */
+void pvr2_scene_snapshot( unsigned char *image )
+{
+    struct scene_vram_span context_span = { PVR2_RAM_SIZE, 0 };
+    int i;
+
+    for( i=0; i<pvr2_scene.poly_count; i++ ) {
+        uint32_t *context = pvr2_scene.poly_array[i].context;
+        /* Modified volumes in full shadow mode have the longest context, 5 words */
+        scene_add_vram_span( &context_span, context, context + 5 );
+    }
+    scene_copy_vram_span( image, scene_segment_span.start, scene_segment_span.end );
+    scene_copy_vram_span( image, scene_list_span.start, scene_list_span.end );
+    scene_copy_vram_span( image, context_span.start, context_span.end );
+
+    for( i=0; i<pvr2_scene.poly_count; i++ ) {
+        struct polygon_struct *poly = &pvr2_scene.poly_array[i];
+        poly->context = (uint32_t *)(image + (((unsigned char *)poly->context) - pvr2_main_ram));
+    }
+    pvr2_scene.segment_list = (struct tile_segment *)(image + (((unsigned char *)pvr2_scene.segment_list) - pvr2_main_ram));
+    pvr2_scene.pvr2_pbuf = (uint32_t *)(image + (((unsigned char *)pvr2_scene.pvr2_pbuf) - pvr2_main_ram));
+    pvr2_scene.vram = image;
+}
+
 /**
  * Dump the current scene to file in a (mostly) human readable form
  */
@@ -902,7 +1311,7 @@ void pvr2_scene_print( FILE *f )
     fprintf( f, "Polygons: %d\n", pvr2_scene.poly_count );
     for( i=0; i<pvr2_scene.poly_count; i++ ) {
         struct polygon_struct *poly = &pvr2_scene.poly_array[i];
-        fprintf( f, "  %08X ", (uint32_t)(((unsigned char *)poly->context) - pvr2_main_ram) );
+        fprintf( f, "  %08X ", (uint32_t)(((unsigned char *)poly->context) - pvr2_scene.vram) );
         switch( poly->vertex_count ) {
         case 3: fprintf( f, "Tri     " ); break;
         case 4: fprintf( f, "Quad    " ); break;
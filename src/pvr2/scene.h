@@ -57,6 +57,15 @@ void pvr2_scene_read(void);
 void pvr2_scene_finished(void);
 void pvr2_scene_shutdown();
 
+/**
+ * Copy the parts of VRAM that are still needed to render the scene after
+ * pvr2_scene_read() - the tile segments, tile lists and polygon contexts -
+ * into the given image (which must be PVR2_RAM_SIZE bytes), and point the
+ * scene at the copy. Once this returns, the guest is free to modify VRAM
+ * without affecting the render.
+ */
+void pvr2_scene_snapshot( unsigned char *image );
+
 uint32_t pvr2_scene_buffer_width();
 uint32_t pvr2_scene_buffer_height();
 
@@ -82,6 +91,11 @@ extern unsigned char *video_base;
  * 
  */
 #define MAX_POLYGONS (87382*2)
+
+/**
+ * Maximum vertexes in a single input polygon (6-triangle strip)
+ */
+#define MAX_POLY_VERTEXES 8
 #define MAX_POLY_BUFFER_SIZE (MAX_POLYGONS*sizeof(struct polygon_struct))
 #define BUF_POLY_MAP_SIZE (4 MB)
 
@@ -140,6 +154,10 @@ struct pvr2_scene_struct {
     /** Pointer to the start of the raw polygon buffer in PVR2 VRAM (32-bit).
      * Also only used during parsing */
     uint32_t *pvr2_pbuf;
+    /** Base of the VRAM image that segment_list, pvr2_pbuf and the polygon
+     * contexts point into, and that tile list links are resolved against.
+     * This is pvr2_main_ram unless the scene has been snapshotted */
+    unsigned char *vram;
     /** Current vertex index during parsing */
     uint32_t vertex_index;
 };
@@ -150,6 +168,48 @@ struct pvr2_scene_struct {
  */
 extern struct pvr2_scene_struct pvr2_scene;
 
+/**
+ * True if the translucent list of the given segment needs to be depth-sorted
+ * by the renderer (otherwise it's rendered in list order).
+ */
+#define IS_AUTOSORT_SEGMENT(segment) (pvr2_scene.sort_mode == SORT_ALWAYS || \
+        (pvr2_scene.sort_mode == SORT_TILEFLAG && ((segment)->control&SEGMENT_SORT_TRANS) == 0))
+
+/* Vertex decode internals, used by pvr2_scene_read() (and the scene tests) */
+
+/** Fog lookup table as parsed by scene_init_lut_fog() */
+extern float scene_fog_density;
+extern float scene_fog_table[128][2];
+
+/**
+ * Parse the fog lookup table out of the PVR2 registers into scene_fog_density
+ * and scene_fog_table.
+ */
+void scene_init_lut_fog( );
+
+/**
+ * Decode a single PVR2 vertex into the vertex structure, updating zbounds.
+ */
+void scene_decode_vertex( struct vertex_struct *vert, uint32_t poly1,
+                          uint32_t poly2, uint32_t tex, uint32_t *pvr2_data,
+                          int modify_offset, float *zbounds );
+
+/**
+ * Decode count vertexes, vertex_length words apart - equivalent to calling
+ * scene_decode_vertex() on each in turn.
+ */
+void scene_decode_vertexes( struct vertex_struct *vert, int count, uint32_t poly1,
+                            uint32_t poly2, uint32_t tex, uint32_t *pvr2_data,
+                            int vertex_length, int modify_offset, float *zbounds );
+
+/**
+ * Compute the lookup-table fog value for a single vertex z, and for count
+ * vertexes into fog[] respectively.
+ */
+float scene_compute_lut_fog_vertex( float z, float fog_density, float fog_table[][2] );
+void scene_compute_lut_fog_vertexes( struct vertex_struct *vert, int count, float *fog,
+                                     float fog_density, float fog_table[][2] );
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1232 @@
+/**
+ * $Id$
+ *
+ * Software PVR2 rendering engine, for use when no GL context is available.
+ *
+ * The renderer is tile-based like the PVR2 itself: the scene is split into
+ * 32x32 pixel tiles, each of which is rendered in isolation (into a small
+ * tile-local colour/depth/stencil buffer) by one of the worker threads,
+ * and then written out to the render buffer. The pass structure and
+ * fragment operations follow the GL renderer (glrender.c and the pvr2
+ * shader) as closely as practical, so that the two produce comparable
+ * output.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <sys/time.h>
+#include "display.h"
+#include "workpool.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/pvr2mmio.h"
+#include "pvr2/scene.h"
+#include "pvr2/tileiter.h"
+#include "pvr2/swrender.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SW_TILE_SIZE 32
+#define SW_TILE_PIXELS (SW_TILE_SIZE*SW_TILE_SIZE)
+#define SW_MAX_MIP_LEVELS 11
+/* Number of decoded textures to keep between scenes */
+#define SW_MAX_TEXTURES 512
+
+/* PVR2 depth compare modes (POLY1 bits 29-31) */
+#define DEPTH_NEVER    0
+#define DEPTH_LESS     1
+#define DEPTH_EQUAL    2
+#define DEPTH_LEQUAL   3
+#define DEPTH_GREATER  4
+#define DEPTH_NOTEQUAL 5
+#define DEPTH_GEQUAL   6
+#define DEPTH_ALWAYS   7
+
+/* PVR2 blend modes (POLY2 bits 29-31 and 26-28) */
+#define BLEND_ZERO           0
+#define BLEND_ONE            1
+#define BLEND_OTHER_COLOUR   2 /* DST_COLOR for src, SRC_COLOR for dest */
+#define BLEND_INV_OTHER      3
+#define BLEND_SRC_ALPHA      4
+#define BLEND_INV_SRC_ALPHA  5
+#define BLEND_DST_ALPHA      6
+#define BLEND_INV_DST_ALPHA  7
+
+#define WRAP_REPEAT 0
+#define WRAP_MIRROR 1
+#define WRAP_CLAMP  2
+
+#define NO_STENCIL_TEST -1
+
+/************************** 4-component float vectors ***********************/
+
+/* Colours are held in BGRA lane order throughout, matching the byte order
+ * of 32-bit pixels in memory.
+ */
+
+#ifdef __SSE2__
+typedef __m128 vec4f;
+
+static inline vec4f vec4_set( float b, float g, float r, float a ) { return _mm_setr_ps(b,g,r,a); }
+static inline vec4f vec4_splat( float f ) { return _mm_set1_ps(f); }
+static inline vec4f vec4_add( vec4f a, vec4f b ) { return _mm_add_ps(a,b); }
+static inline vec4f vec4_sub( vec4f a, vec4f b ) { return _mm_sub_ps(a,b); }
+static inline vec4f vec4_mul( vec4f a, vec4f b ) { return _mm_mul_ps(a,b); }
+static inline vec4f vec4_scale( vec4f a, float f ) { return _mm_mul_ps(a,_mm_set1_ps(f)); }
+static inline vec4f vec4_madd( vec4f a, vec4f b, vec4f c ) { return _mm_add_ps(_mm_mul_ps(a,b),c); }
+static inline float vec4_x( vec4f a ) { return _mm_cvtss_f32(a); }
+static inline float vec4_y( vec4f a ) { return _mm_cvtss_f32(_mm_shuffle_ps(a,a,_MM_SHUFFLE(1,1,1,1))); }
+static inline float vec4_z( vec4f a ) { return _mm_cvtss_f32(_mm_shuffle_ps(a,a,_MM_SHUFFLE(2,2,2,2))); }
+static inline float vec4_w( vec4f a ) { return _mm_cvtss_f32(_mm_shuffle_ps(a,a,_MM_SHUFFLE(3,3,3,3))); }
+static inline vec4f vec4_splat_w( vec4f a ) { return _mm_shuffle_ps(a,a,_MM_SHUFFLE(3,3,3,3)); }
+
+static inline vec4f vec4_clamp01( vec4f a )
+{
+    return _mm_min_ps( _mm_max_ps(a, _mm_setzero_ps()), _mm_set1_ps(1.0f) );
+}
+
+/** @return (a.bgr, b.a) */
+static inline vec4f vec4_merge_w( vec4f a, vec4f b )
+{
+    __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(0,0,0,-1));
+    return _mm_or_ps( _mm_andnot_ps(mask,a), _mm_and_ps(mask,b) );
+}
+
+/** Load an RGBA float quad (ie from a vertex) into BGRA lane order */
+static inline vec4f vec4_load_rgba( const float *rgba )
+{
+    __m128 v = _mm_loadu_ps(rgba);
+    return _mm_shuffle_ps(v,v,_MM_SHUFFLE(3,0,1,2));
+}
+
+static inline vec4f vec4_from_argb32( uint32_t pixel )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(pixel), zero);
+    p = _mm_unpacklo_epi16(p, zero);
+    return _mm_mul_ps(_mm_cvtepi32_ps(p), _mm_set1_ps(1.0f/255.0f));
+}
+
+static inline uint32_t vec4_to_argb32( vec4f a )
+{
+    __m128 c = _mm_add_ps( _mm_mul_ps(vec4_clamp01(a), _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f) );
+    __m128i p = _mm_cvttps_epi32(c);
+    p = _mm_packs_epi32(p,p);
+    p = _mm_packus_epi16(p,p);
+    return (uint32_t)_mm_cvtsi128_si32(p);
+}
+
+#else
+typedef struct { float v[4]; } vec4f;
+
+static inline vec4f vec4_set( float b, float g, float r, float a ) { vec4f x = {{b,g,r,a}}; return x; }
+static inline vec4f vec4_splat( float f ) { vec4f x = {{f,f,f,f}}; return x; }
+static inline vec4f vec4_add( vec4f a, vec4f b ) { int i; for( i=0; i<4; i++ ) a.v[i] += b.v[i]; return a; }
+static inline vec4f vec4_sub( vec4f a, vec4f b ) { int i; for( i=0; i<4; i++ ) a.v[i] -= b.v[i]; return a; }
+static inline vec4f vec4_mul( vec4f a, vec4f b ) { int i; for( i=0; i<4; i++ ) a.v[i] *= b.v[i]; return a; }
+static inline vec4f vec4_scale( vec4f a, float f ) { int i; for( i=0; i<4; i++ ) a.v[i] *= f; return a; }
+static inline vec4f vec4_madd( vec4f a, vec4f b, vec4f c ) { int i; for( i=0; i<4; i++ ) a.v[i] = a.v[i]*b.v[i]+c.v[i]; return a; }
+static inline float vec4_x( vec4f a ) { return a.v[0]; }
+static inline float vec4_y( vec4f a ) { return a.v[1]; }
+static inline float vec4_z( vec4f a ) { return a.v[2]; }
+static inline float vec4_w( vec4f a ) { return a.v[3]; }
+static inline vec4f vec4_splat_w( vec4f a ) { return vec4_splat(a.v[3]); }
+
+static inline vec4f vec4_clamp01( vec4f a )
+{
+    int i;
+    for( i=0; i<4; i++ ) {
+        if( a.v[i] < 0.0f ) a.v[i] = 0.0f;
+        else if( a.v[i] > 1.0f ) a.v[i] = 1.0f;
+    }
+    return a;
+}
+
+static inline vec4f vec4_merge_w( vec4f a, vec4f b ) { a.v[3] = b.v[3]; return a; }
+
+static inline vec4f vec4_load_rgba( const float *rgba ) { return vec4_set(rgba[2], rgba[1], rgba[0], rgba[3]); }
+
+static inline vec4f vec4_from_argb32( uint32_t pixel )
+{
+    return vec4_scale( vec4_set( pixel&0xFF, (pixel>>8)&0xFF, (pixel>>16)&0xFF, pixel>>24 ), 1.0f/255.0f );
+}
+
+static inline uint32_t vec4_to_argb32( vec4f a )
+{
+    uint32_t result = 0;
+    int i;
+    a = vec4_clamp01(a);
+    for( i=0; i<4; i++ ) {
+        result |= ((uint32_t)(a.v[i]*255.0f + 0.5f)) << (i<<3);
+    }
+    return result;
+}
+#endif
+
+static inline vec4f vec4_lerp( vec4f a, vec4f b, vec4f t )
+{
+    return vec4_madd( vec4_sub(b,a), t, a );
+}
+
+/******************************* Scene state ********************************/
+
+struct sw_texture {
+    uint32_t texture_word;
+    uint32_t size_bits; /* Texture size bits from the poly2 word */
+    int width, height;
+    int levels;
+    gboolean nearest;   /* Palette textures use nearest-neighbour sampling (as per the GL path) */
+    uint32_t *pixels;
+    uint32_t level_offset[SW_MAX_MIP_LEVELS];
+    uint32_t serial;    /* texcache serial at the last decode */
+    uint32_t scene;     /* Last scene to use the texture */
+    uint32_t tex_id;    /* Index+1 in that scene's texture list */
+};
+
+/**
+ * Sampler state for a single draw - a single mip level and wrap modes.
+ */
+struct sw_sampler {
+    const uint32_t *pixels;
+    int width, height;
+    int wrap_u, wrap_v;
+    gboolean nearest;
+};
+
+/**
+ * Per-polygon fragment state (the software equivalent of the GL state set up
+ * by render_set_context).
+ */
+struct sw_draw_state {
+    int depth_func;
+    gboolean depth_write;
+    int stencil;         /* Required value of stencil bit 1, or NO_STENCIL_TEST */
+    int src_blend, dst_blend;
+    gboolean flat_shade;
+    float alpha_ref;
+    struct sw_texture *texture;
+    int wrap_u, wrap_v;
+    vec4f fog_colour;     /* Fog colour for positive fog values */
+};
+
+/**
+ * Edge and attribute plane equations for a triangle, in tile-local coordinates.
+ * Attributes are stored premultiplied by q (1/w, or 1 if the triangle has no
+ * usable w), so they can be interpolated linearly in screen space.
+ */
+struct sw_triangle {
+    float ea[3], eb[3], ec[3];
+    gboolean topleft[3];
+    int x1, x2, y1, y2; /* Bounding box (tile-local, exclusive upper bounds) */
+    float da, db, dc;   /* depth plane */
+    vec4f uvq[3];       /* (u*q, v*q, q, -) base, dx, dy */
+    vec4f col[3];
+    vec4f off[3];
+    float lod_ratio;    /* texels per pixel (squared) */
+};
+
+/**
+ * Tile-local render target
+ */
+struct sw_tile {
+    vec4f colour[SW_TILE_PIXELS];
+    float depth[SW_TILE_PIXELS];
+    uint8_t stencil[SW_TILE_PIXELS];
+    int x, y;           /* Origin of the tile in the render buffer */
+    int width, height;  /* Size of the tile (smaller at the edges of the buffer) */
+    int scissor[4];     /* Current clip region (tile-local, x1,x2,y1,y2) */
+};
+
+static struct {
+    sw_render_buffer_t buffer;
+    int tiles_x, tiles_y;
+    int clip[4];
+    float alpha_ref;
+    vec4f fog_lut_colour;
+    vec4f fog_vert_colour;
+    /* Segment lists for each tile, in list order */
+    int segment_count, segment_alloc;
+    int *tile_first_segment;
+    int *segment_next;
+    int tile_alloc;
+    /* Textures used by the scene, indexed by tex_id-1 */
+    GPtrArray *textures;
+    /* Textures that need to be (re)decoded for the scene */
+    GPtrArray *decode_list;
+    /* All decoded textures, kept across scenes until invalidated */
+    GHashTable *texture_map;
+    uint32_t scene_count;
+} sw_scene;
+
+/******************************** Textures **********************************/
+
+static guint sw_texture_hash( gconstpointer key )
+{
+    const struct sw_texture *tex = key;
+    return tex->texture_word ^ (tex->size_bits * 0x9E3779B1);
+}
+
+static gboolean sw_texture_equal( gconstpointer a, gconstpointer b )
+{
+    const struct sw_texture *x = a, *y = b;
+    return x->texture_word == y->texture_word && x->size_bits == y->size_bits;
+}
+
+static void sw_texture_free( gpointer data )
+{
+    struct sw_texture *tex = data;
+    g_free( tex->pixels );
+    g_free( tex );
+}
+
+/**
+ * @return the tex_id (index+1) for the given texture, adding it to the scene's
+ * texture list if it isn't already present. Textures are decoded later (in
+ * parallel) by sw_decode_texture, if they aren't already in the cache.
+ */
+static uint32_t sw_get_texture( uint32_t poly2_word, uint32_t texture_word )
+{
+    struct sw_texture key, *tex;
+    key.texture_word = texture_word;
+    key.size_bits = poly2_word & 0x3F;
+    tex = g_hash_table_lookup( sw_scene.texture_map, &key );
+    if( tex == NULL ) {
+        tex = g_malloc0( sizeof(struct sw_texture) );
+        tex->texture_word = texture_word;
+        tex->size_bits = key.size_bits;
+        tex->width = POLY2_TEX_WIDTH(poly2_word);
+        tex->height = POLY2_TEX_HEIGHT(poly2_word);
+        if( PVR2_TEX_IS_MIPMAPPED(texture_word) ) {
+            tex->height = tex->width;
+        }
+        tex->nearest = PVR2_TEX_IS_PALETTE(texture_word);
+        g_hash_table_insert( sw_scene.texture_map, tex, tex );
+    }
+    if( tex->scene != sw_scene.scene_count ) {
+        tex->scene = sw_scene.scene_count;
+        g_ptr_array_add( sw_scene.textures, tex );
+        tex->tex_id = sw_scene.textures->len;
+    }
+    return tex->tex_id;
+}
+
+static void sw_decode_texture( void *data, int index )
+{
+    struct sw_texture *tex = g_ptr_array_index( (GPtrArray *)data, index );
+    int width = tex->width, height = tex->height;
+    int i;
+
+    if( tex->pixels == NULL ) {
+        tex->pixels = g_malloc( (((width*height)/3)*4 + 4) * sizeof(uint32_t) );
+    }
+    tex->levels = texcache_decode_texture_argb32( tex->pixels, tex->texture_word, width, height );
+    tex->level_offset[0] = 0;
+    for( i=1; i<tex->levels && i<SW_MAX_MIP_LEVELS; i++ ) {
+        tex->level_offset[i] = tex->level_offset[i-1] + width*height;
+        if( width > 1 ) width >>= 1;
+        if( height > 1 ) height >>= 1;
+    }
+}
+
+static gboolean sw_texture_is_unused( gpointer key, gpointer value, gpointer data )
+{
+    struct sw_texture *tex = value;
+    return tex->scene != sw_scene.scene_count;
+}
+
+/**
+ * Release the scene's texture list. If the cache has grown too large, also
+ * discard any textures that weren't used by the scene.
+ */
+static void sw_release_textures()
+{
+    g_ptr_array_set_size( sw_scene.textures, 0 );
+    if( g_hash_table_size( sw_scene.texture_map ) > SW_MAX_TEXTURES ) {
+        g_hash_table_foreach_remove( sw_scene.texture_map, sw_texture_is_unused, NULL );
+    }
+}
+
+/**
+ * Collect the set of textures used by the scene (assigning tex_ids as per
+ * pvr2_scene_load_textures), and decode any that are new or have been
+ * modified since they were last decoded.
+ */
+static void sw_scene_load_textures()
+{
+    uint32_t serial;
+    int i;
+
+    if( sw_scene.textures == NULL ) {
+        sw_scene.textures = g_ptr_array_new();
+        sw_scene.decode_list = g_ptr_array_new();
+        sw_scene.texture_map = g_hash_table_new_full( sw_texture_hash, sw_texture_equal,
+                                                      NULL, sw_texture_free );
+    }
+    sw_scene.scene_count++;
+
+    texcache_begin_scene( MMIO_READ( PVR2, RENDER_PALETTE ) & 0x03,
+                         (MMIO_READ( PVR2, RENDER_TEXSIZE ) & 0x003F) << 5 );
+
+    for( i=0; i < pvr2_scene.poly_count; i++ ) {
+        struct polygon_struct *poly = &pvr2_scene.poly_array[i];
+        if( POLY1_TEXTURED(poly->context[0]) ) {
+            poly->tex_id = sw_get_texture( poly->context[1], poly->context[2] );
+            if( poly->mod_vertex_index != -1 ) {
+                if( pvr2_scene.shadow_mode == SHADOW_FULL ) {
+                    poly->mod_tex_id = sw_get_texture( poly->context[3], poly->context[4] );
+                } else {
+                    poly->mod_tex_id = poly->tex_id;
+                }
+            }
+        } else {
+            poly->tex_id = 0;
+            poly->mod_tex_id = 0;
+        }
+    }
+
+    serial = texcache_get_serial();
+    g_ptr_array_set_size( sw_scene.decode_list, 0 );
+    for( i=0; i < sw_scene.textures->len; i++ ) {
+        struct sw_texture *tex = g_ptr_array_index( sw_scene.textures, i );
+        if( tex->pixels == NULL ||
+                texcache_is_modified( tex->texture_word, tex->width, tex->height, tex->serial ) ) {
+            tex->serial = serial;
+            g_ptr_array_add( sw_scene.decode_list, tex );
+        }
+    }
+    workpool_run( sw_decode_texture, sw_scene.decode_list, sw_scene.decode_list->len );
+}
+
+static inline int sw_wrap( int i, int size, int mode )
+{
+    switch( mode ) {
+    case WRAP_CLAMP:
+        return i < 0 ? 0 : (i >= size ? size-1 : i);
+    case WRAP_MIRROR:
+        i &= (size<<1)-1;
+        return i >= size ? (size<<1)-1-i : i;
+    default:
+        return i & (size-1);
+    }
+}
+
+static inline float sw_clamp_coord( float f )
+{
+    /* Keep the coordinate in a range that can safely be converted to int */
+    if( f > -1048576.0f && f < 1048576.0f ) {
+        return f;
+    }
+    return 0.0f;
+}
+
+/**
+ * Sample the texture at (u,v) - bilinear filtering, or nearest-neighbour
+ * for palette textures.
+ */
+static vec4f sw_texture_sample( const struct sw_sampler *s, float u, float v )
+{
+    float fu = sw_clamp_coord(u * s->width);
+    float fv = sw_clamp_coord(v * s->height);
+    if( s->nearest ) {
+        int iu = sw_wrap( (int)floorf(fu), s->width, s->wrap_u );
+        int iv = sw_wrap( (int)floorf(fv), s->height, s->wrap_v );
+        return vec4_from_argb32( s->pixels[iv*s->width + iu] );
+    } else {
+        fu -= 0.5f;
+        fv -= 0.5f;
+        float bu = floorf(fu), bv = floorf(fv);
+        int iu = (int)bu, iv = (int)bv;
+        int u0 = sw_wrap( iu, s->width, s->wrap_u ), u1 = sw_wrap( iu+1, s->width, s->wrap_u );
+        const uint32_t *row0 = s->pixels + sw_wrap( iv, s->height, s->wrap_v ) * s->width;
+        const uint32_t *row1 = s->pixels + sw_wrap( iv+1, s->height, s->wrap_v ) * s->width;
+        vec4f au = vec4_splat(fu - bu);
+        vec4f top = vec4_lerp( vec4_from_argb32(row0[u0]), vec4_from_argb32(row0[u1]), au );
+        vec4f bottom = vec4_lerp( vec4_from_argb32(row1[u0]), vec4_from_argb32(row1[u1]), au );
+        return vec4_lerp( top, bottom, vec4_splat(fv - bv) );
+    }
+}
+
+/**
+ * Select the mip level for a triangle, given its texel:pixel area ratio.
+ */
+static void sw_setup_sampler( struct sw_sampler *s, const struct sw_draw_state *state, float lod_ratio )
+{
+    struct sw_texture *tex = state->texture;
+    int level = 0;
+    if( tex->levels > 1 && lod_ratio > 1.0f ) {
+        /* lod = log2(sqrt(ratio)), rounded to nearest */
+        level = (int)(0.5f * log2f(lod_ratio) + 0.5f);
+        if( level >= tex->levels ) {
+            level = tex->levels-1;
+        }
+    }
+    s->pixels = tex->pixels + tex->level_offset[level];
+    s->width = tex->width >> level;
+    s->height = tex->height >> level;
+    if( s->width == 0 ) s->width = 1;
+    if( s->height == 0 ) s->height = 1;
+    s->wrap_u = state->wrap_u;
+    s->wrap_v = state->wrap_v;
+    s->nearest = tex->nearest;
+}
+
+/************************** Coverage and depth test *************************/
+
+/**
+ * @return bitmask of the 4 pixels (x..x+3, y) that are inside the triangle.
+ * px and py are the pixel centre of the first pixel.
+ */
+static inline int sw_coverage_mask( const struct sw_triangle *tri, float px, float py )
+{
+#ifdef __SSE2__
+    __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 result = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    int i;
+    for( i=0; i<3; i++ ) {
+        float e = tri->ea[i]*px + tri->eb[i]*py + tri->ec[i];
+        __m128 ev = _mm_add_ps( _mm_set1_ps(e), _mm_mul_ps( _mm_set1_ps(tri->ea[i]), offsets ) );
+        result = _mm_and_ps( result, tri->topleft[i] ? _mm_cmpge_ps(ev, zero) : _mm_cmpgt_ps(ev, zero) );
+    }
+    return _mm_movemask_ps(result);
+#else
+    int mask = 0, k, i;
+    for( k=0; k<4; k++ ) {
+        gboolean inside = TRUE;
+        for( i=0; i<3; i++ ) {
+            float e = tri->ea[i]*(px+k) + tri->eb[i]*py + tri->ec[i];
+            if( tri->topleft[i] ? e < 0 : e <= 0 ) {
+                inside = FALSE;
+            }
+        }
+        if( inside ) {
+            mask |= (1<<k);
+        }
+    }
+    return mask;
+#endif
+}
+
+/**
+ * @return bitmask of the 4 pixels for which the depth value d (+k*ddx) passes
+ * the depth test against the tile depth buffer.
+ */
+static inline int sw_depth_mask( int func, const float *zbuf, float d, float ddx )
+{
+#ifdef __SSE2__
+    __m128 dv = _mm_add_ps( _mm_set1_ps(d), _mm_mul_ps( _mm_set1_ps(ddx), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f) ) );
+    __m128 zv = _mm_load_ps( zbuf );
+    switch( func ) {
+    case DEPTH_NEVER: return 0;
+    case DEPTH_LESS: return _mm_movemask_ps( _mm_cmplt_ps(dv, zv) );
+    case DEPTH_EQUAL: return _mm_movemask_ps( _mm_cmpeq_ps(dv, zv) );
+    case DEPTH_LEQUAL: return _mm_movemask_ps( _mm_cmple_ps(dv, zv) );
+    case DEPTH_GREATER: return _mm_movemask_ps( _mm_cmpgt_ps(dv, zv) );
+    case DEPTH_NOTEQUAL: return _mm_movemask_ps( _mm_cmpneq_ps(dv, zv) );
+    case DEPTH_GEQUAL: return _mm_movemask_ps( _mm_cmpge_ps(dv, zv) );
+    default: return 0x0F;
+    }
+#else
+    int mask = 0, k;
+    for( k=0; k<4; k++ ) {
+        float dk = d + ddx*k;
+        gboolean pass;
+        switch( func ) {
+        case DEPTH_NEVER: pass = FALSE; break;
+        case DEPTH_LESS: pass = dk < zbuf[k]; break;
+        case DEPTH_EQUAL: pass = dk == zbuf[k]; break;
+        case DEPTH_LEQUAL: pass = dk <= zbuf[k]; break;
+        case DEPTH_GREATER: pass = dk > zbuf[k]; break;
+        case DEPTH_NOTEQUAL: pass = dk != zbuf[k]; break;
+        case DEPTH_GEQUAL: pass = dk >= zbuf[k]; break;
+        default: pass = TRUE; break;
+        }
+        if( pass ) {
+            mask |= (1<<k);
+        }
+    }
+    return mask;
+#endif
+}
+
+/***************************** Triangle setup *******************************/
+
+/**
+ * Compute the edge equations, bounding box and attribute planes for the
+ * triangle, relative to the tile.
+ * @return FALSE if the triangle doesn't cover any pixels in the tile's
+ * current scissor region.
+ */
+static gboolean sw_setup_triangle( struct sw_triangle *tri, const struct sw_tile *tile,
+                                   const struct vertex_struct *v, gboolean flat )
+{
+    float x[3], y[3], q[3], d[3];
+    int i;
+    gboolean perspective = TRUE;
+
+    for( i=0; i<3; i++ ) {
+        x[i] = v[i].x - tile->x;
+        y[i] = v[i].y - tile->y;
+        if( v[i].z > 0 && isfinite(v[i].z) ) {
+            d[i] = 1.0f/v[i].z;
+        } else {
+            d[i] = 0;
+            perspective = FALSE;
+        }
+    }
+
+    float area = (x[1]-x[0])*(y[2]-y[0]) - (x[2]-x[0])*(y[1]-y[0]);
+    if( area == 0 || !isfinite(area) ) {
+        return FALSE;
+    }
+
+    /* Bounding box, in pixels whose centres may be covered */
+    float minx = MIN(x[0],MIN(x[1],x[2])), maxx = MAX(x[0],MAX(x[1],x[2]));
+    float miny = MIN(y[0],MIN(y[1],y[2])), maxy = MAX(y[0],MAX(y[1],y[2]));
+    if( minx >= tile->scissor[1] || maxx <= tile->scissor[0] ||
+        miny >= tile->scissor[3] || maxy <= tile->scissor[2] ) {
+        return FALSE;
+    }
+    tri->x1 = MAX(tile->scissor[0], (int)ceilf(minx - 0.5f));
+    tri->x2 = MIN(tile->scissor[1], (int)floorf(maxx - 0.5f) + 1);
+    tri->y1 = MAX(tile->scissor[2], (int)ceilf(miny - 0.5f));
+    tri->y2 = MIN(tile->scissor[3], (int)floorf(maxy - 0.5f) + 1);
+    if( tri->x1 >= tri->x2 || tri->y1 >= tri->y2 ) {
+        return FALSE;
+    }
+
+    /* Edge i is opposite vertex i, oriented so that the inside is positive */
+    float sign = area < 0 ? -1.0f : 1.0f;
+    for( i=0; i<3; i++ ) {
+        int a = (i+1)%3, b = (i+2)%3;
+        tri->ea[i] = -(y[b]-y[a]) * sign;
+        tri->eb[i] = (x[b]-x[a]) * sign;
+        tri->ec[i] = ((y[b]-y[a])*x[a] - (x[b]-x[a])*y[a]) * sign;
+        tri->topleft[i] = tri->ea[i] > 0 || (tri->ea[i] == 0 && tri->eb[i] > 0);
+    }
+    area *= sign;
+    float inv_area = 1.0f/area;
+
+    /* Barycentric weights of vertexes 1 and 2 are e1/area and e2/area, so any
+     * attribute A = A0 + (A1-A0)*e1/area + (A2-A0)*e2/area */
+    float l1a = tri->ea[1]*inv_area, l1b = tri->eb[1]*inv_area, l1c = tri->ec[1]*inv_area;
+    float l2a = tri->ea[2]*inv_area, l2b = tri->eb[2]*inv_area, l2c = tri->ec[2]*inv_area;
+
+    tri->da = (d[1]-d[0])*l1a + (d[2]-d[0])*l2a;
+    tri->db = (d[1]-d[0])*l1b + (d[2]-d[0])*l2b;
+    tri->dc = d[0] + (d[1]-d[0])*l1c + (d[2]-d[0])*l2c;
+
+    for( i=0; i<3; i++ ) {
+        q[i] = perspective ? d[i] : 1.0f;
+    }
+
+#define SETUP_PLANE(plane, a0, a1, a2) do { \
+        vec4f d1 = vec4_sub(a1, a0), d2 = vec4_sub(a2, a0); \
+        plane[1] = vec4_add( vec4_scale(d1, l1a), vec4_scale(d2, l2a) ); \
+        plane[2] = vec4_add( vec4_scale(d1, l1b), vec4_scale(d2, l2b) ); \
+        plane[0] = vec4_add( a0, vec4_add( vec4_scale(d1, l1c), vec4_scale(d2, l2c) ) ); \
+    } while(0)
+
+    vec4f uvq0 = vec4_set( v[0].u*q[0], v[0].v*q[0], q[0], 0 );
+    vec4f uvq1 = vec4_set( v[1].u*q[1], v[1].v*q[1], q[1], 0 );
+    vec4f uvq2 = vec4_set( v[2].u*q[2], v[2].v*q[2], q[2], 0 );
+    SETUP_PLANE( tri->uvq, uvq0, uvq1, uvq2 );
+
+    if( flat ) {
+        /* GL flat shading uses the last vertex of each triangle */
+        tri->col[0] = vec4_load_rgba(v[2].rgba);
+        tri->off[0] = vec4_load_rgba(v[2].offset_rgba);
+    } else {
+        vec4f c0 = vec4_scale( vec4_load_rgba(v[0].rgba), q[0] );
+        vec4f c1 = vec4_scale( vec4_load_rgba(v[1].rgba), q[1] );
+        vec4f c2 = vec4_scale( vec4_load_rgba(v[2].rgba), q[2] );
+        SETUP_PLANE( tri->col, c0, c1, c2 );
+        c0 = vec4_scale( vec4_load_rgba(v[0].offset_rgba), q[0] );
+        c1 = vec4_scale( vec4_load_rgba(v[1].offset_rgba), q[1] );
+        c2 = vec4_scale( vec4_load_rgba(v[2].offset_rgba), q[2] );
+        SETUP_PLANE( tri->off, c0, c1, c2 );
+    }
+#undef SETUP_PLANE
+
+    /* Texel:pixel area ratio for mip selection (scaled by the texture size later) */
+    float tex_area = (v[1].u-v[0].u)*(v[2].v-v[0].v) - (v[2].u-v[0].u)*(v[1].v-v[0].v);
+    tri->lod_ratio = fabsf(tex_area) * inv_area;
+    return TRUE;
+}
+
+/*************************** Fragment processing ****************************/
+
+static inline vec4f sw_blend_factor( int mode, vec4f other, vec4f src, vec4f dst )
+{
+    switch( mode ) {
+    case BLEND_ZERO: return vec4_splat(0.0f);
+    case BLEND_ONE: return vec4_splat(1.0f);
+    case BLEND_OTHER_COLOUR: return other;
+    case BLEND_INV_OTHER: return vec4_sub( vec4_splat(1.0f), other );
+    case BLEND_SRC_ALPHA: return vec4_splat_w(src);
+    case BLEND_INV_SRC_ALPHA: return vec4_sub( vec4_splat(1.0f), vec4_splat_w(src) );
+    case BLEND_DST_ALPHA: return vec4_splat_w(dst);
+    default: return vec4_sub( vec4_splat(1.0f), vec4_splat_w(dst) );
+    }
+}
+
+/**
+ * Shade and blend a single fragment.
+ * @return TRUE if the fragment was written, or FALSE if it failed the alpha test.
+ */
+static inline gboolean sw_shade_fragment( struct sw_tile *tile, int idx, const struct sw_triangle *tri,
+                                          const struct sw_draw_state *state, const struct sw_sampler *sampler,
+                                          int tex_mode, float px, float py )
+{
+    vec4f uvq = vec4_add( tri->uvq[0], vec4_add( vec4_scale(tri->uvq[1], px), vec4_scale(tri->uvq[2], py) ) );
+    float inv_q = 1.0f/vec4_z(uvq);
+    vec4f col, off, result;
+
+    if( state->flat_shade ) {
+        col = tri->col[0];
+        off = tri->off[0];
+    } else {
+        col = vec4_scale( vec4_add( tri->col[0], vec4_add( vec4_scale(tri->col[1], px), vec4_scale(tri->col[2], py) ) ), inv_q );
+        off = vec4_scale( vec4_add( tri->off[0], vec4_add( vec4_scale(tri->off[1], px), vec4_scale(tri->off[2], py) ) ), inv_q );
+    }
+    vec4f off_rgb = vec4_merge_w( off, vec4_splat(0.0f) );
+
+    if( tex_mode == 0 ) { /* Modulate */
+        vec4f tex = sw_texture_sample( sampler, vec4_x(uvq)*inv_q, vec4_y(uvq)*inv_q );
+        result = vec4_madd( col, tex, off_rgb );
+    } else if( tex_mode == 1 ) { /* Decal */
+        vec4f tex = sw_texture_sample( sampler, vec4_x(uvq)*inv_q, vec4_y(uvq)*inv_q );
+        result = vec4_merge_w( vec4_add( vec4_lerp( col, tex, vec4_splat_w(tex) ), off_rgb ), col );
+    } else {
+        result = col;
+    }
+
+    if( vec4_w(result) < state->alpha_ref ) {
+        return FALSE;
+    }
+
+    float fog = vec4_w(off);
+    if( fog > 0 ) {
+        result = vec4_merge_w( vec4_lerp( result, state->fog_colour, vec4_splat(fog) ), result );
+    } else if( fog < 0 ) {
+        result = vec4_merge_w( vec4_lerp( result, sw_scene.fog_lut_colour, vec4_splat(-fog) ), result );
+    }
+
+    result = vec4_clamp01(result);
+    if( state->src_blend != BLEND_ONE || state->dst_blend != BLEND_ZERO ) {
+        vec4f dst = tile->colour[idx];
+        vec4f sf = sw_blend_factor( state->src_blend, dst, result, dst );
+        vec4f df = sw_blend_factor( state->dst_blend, result, result, dst );
+        result = vec4_clamp01( vec4_add( vec4_mul(result, sf), vec4_mul(dst, df) ) );
+    }
+    tile->colour[idx] = result;
+    return TRUE;
+}
+
+/**
+ * Rasterize a single triangle into the tile.
+ */
+static void sw_draw_triangle( struct sw_tile *tile, const struct vertex_struct *v,
+                              const struct sw_draw_state *state )
+{
+    struct sw_triangle tri;
+    struct sw_sampler sampler;
+    int x, y, k;
+
+    if( !sw_setup_triangle( &tri, tile, v, state->flat_shade ) ) {
+        return;
+    }
+
+    int tex_mode = v[0].tex_mode == 0 ? 0 : (v[0].tex_mode >= 1.5 ? 2 : 1);
+    if( tex_mode != 2 ) {
+        if( state->texture == NULL ) {
+            tex_mode = 2;
+        } else {
+            sw_setup_sampler( &sampler, state,
+                    tri.lod_ratio * state->texture->width * state->texture->height );
+        }
+    }
+
+    for( y=tri.y1; y<tri.y2; y++ ) {
+        float py = y + 0.5f;
+        for( x = tri.x1 & ~3; x < tri.x2; x += 4 ) {
+            float px = x + 0.5f;
+            int mask = sw_coverage_mask( &tri, px, py );
+            if( x < tri.x1 ) {
+                mask &= (0x0F << (tri.x1 - x));
+            }
+            if( x+4 > tri.x2 ) {
+                mask &= (0x0F >> (x + 4 - tri.x2));
+            }
+            if( mask == 0 ) {
+                continue;
+            }
+            int idx = y*SW_TILE_SIZE + x;
+            float d = tri.da*px + tri.db*py + tri.dc;
+            mask &= sw_depth_mask( state->depth_func, &tile->depth[idx], d, tri.da );
+            for( k=0; mask != 0; k++, mask >>= 1 ) {
+                if( (mask & 1) == 0 ) {
+                    continue;
+                }
+                if( state->stencil != NO_STENCIL_TEST && (tile->stencil[idx+k]&2) != state->stencil ) {
+                    continue;
+                }
+                if( sw_shade_fragment( tile, idx+k, &tri, state, &sampler, tex_mode, px+k, py ) &&
+                        state->depth_write ) {
+                    tile->depth[idx+k] = d + tri.da*k;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Rasterize a triangle into the depth buffer only.
+ */
+static void sw_draw_triangle_depth( struct sw_tile *tile, const struct vertex_struct *v,
+                                    int depth_func, gboolean depth_write )
+{
+    struct sw_triangle tri;
+    int x, y, k;
+
+    if( !depth_write || !sw_setup_triangle( &tri, tile, v, TRUE ) ) {
+        return;
+    }
+    for( y=tri.y1; y<tri.y2; y++ ) {
+        float py = y + 0.5f;
+        for( x = tri.x1 & ~3; x < tri.x2; x += 4 ) {
+            float px = x + 0.5f;
+            int mask = sw_coverage_mask( &tri, px, py );
+            if( x < tri.x1 ) mask &= (0x0F << (tri.x1 - x));
+            if( x+4 > tri.x2 ) mask &= (0x0F >> (x + 4 - tri.x2));
+            if( mask == 0 ) {
+                continue;
+            }
+            int idx = y*SW_TILE_SIZE + x;
+            float d = tri.da*px + tri.db*py + tri.dc;
+            mask &= sw_depth_mask( depth_func, &tile->depth[idx], d, tri.da );
+            for( k=0; mask != 0; k++, mask >>= 1 ) {
+                if( mask & 1 ) {
+                    tile->depth[idx+k] = d + tri.da*k;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Rasterize a modifier volume triangle - inverts stencil bit 0 for every
+ * covered pixel where the triangle is behind the depth buffer (ie
+ * the GL_LEQUAL depth test fails).
+ */
+static void sw_draw_triangle_modifier( struct sw_tile *tile, const struct vertex_struct *v )
+{
+    struct sw_triangle tri;
+    int x, y, k;
+
+    if( !sw_setup_triangle( &tri, tile, v, TRUE ) ) {
+        return;
+    }
+    for( y=tri.y1; y<tri.y2; y++ ) {
+        float py = y + 0.5f;
+        for( x = tri.x1 & ~3; x < tri.x2; x += 4 ) {
+            float px = x + 0.5f;
+            int mask = sw_coverage_mask( &tri, px, py );
+            if( x < tri.x1 ) mask &= (0x0F << (tri.x1 - x));
+            if( x+4 > tri.x2 ) mask &= (0x0F >> (x + 4 - tri.x2));
+            if( mask == 0 ) {
+                continue;
+            }
+            int idx = y*SW_TILE_SIZE + x;
+            float d = tri.da*px + tri.db*py + tri.dc;
+            mask &= ~sw_depth_mask( DEPTH_LEQUAL, &tile->depth[idx], d, tri.da );
+            for( k=0; k<4; k++ ) {
+                if( mask & (1<<k) ) {
+                    tile->stencil[idx+k] ^= 1;
+                }
+            }
+        }
+    }
+}
+
+/**************************** Polygon rendering *****************************/
+
+static void sw_set_tsp_state( struct sw_draw_state *state, uint32_t poly1, uint32_t poly2, uint32_t tex_id )
+{
+    state->flat_shade = !POLY1_GOURAUD_SHADED(poly1);
+    state->src_blend = poly2 >> 29;
+    state->dst_blend = (poly2 >> 26) & 0x07;
+    if( POLY1_TEXTURED(poly1) && tex_id != 0 ) {
+        state->texture = g_ptr_array_index( sw_scene.textures, tex_id-1 );
+        state->wrap_u = POLY2_TEX_CLAMP_U(poly2) ? WRAP_CLAMP :
+            (POLY2_TEX_MIRROR_U(poly2) ? WRAP_MIRROR : WRAP_REPEAT);
+        state->wrap_v = POLY2_TEX_CLAMP_V(poly2) ? WRAP_CLAMP :
+            (POLY2_TEX_MIRROR_V(poly2) ? WRAP_MIRROR : WRAP_REPEAT);
+    } else {
+        state->texture = NULL;
+    }
+    /* LUT fog values are positive here (the scene is built for a non-shader
+     * driver), so pick the fog colour by polygon mode as the fixed-function
+     * GL path does. */
+    if( POLY2_FOG_MODE(poly2) == PVR2_POLY_FOG_LOOKUP ) {
+        state->fog_colour = sw_scene.fog_lut_colour;
+    } else {
+        state->fog_colour = sw_scene.fog_vert_colour;
+    }
+}
+
+static void sw_draw_vertexes( struct sw_tile *tile, struct polygon_struct *poly, gboolean modified,
+                              const struct sw_draw_state *state )
+{
+    do {
+        struct vertex_struct *v = &pvr2_scene.vertex_array[modified ? poly->mod_vertex_index : poly->vertex_index];
+        int i;
+        for( i=0; i+2 < poly->vertex_count; i++ ) {
+            sw_draw_triangle( tile, &v[i], state );
+        }
+        poly = poly->sub_next;
+    } while( poly != NULL );
+}
+
+/**
+ * Render a polygon (equivalent to gl_render_poly)
+ * @param depth_func depth compare mode, or -1 to use the polygon's mode.
+ * @param depth_write depth write enable, or -1 to use the polygon's flag.
+ */
+static void sw_render_poly( struct sw_tile *tile, struct polygon_struct *poly, int depth_func,
+                            int depth_write, float alpha_ref )
+{
+    struct sw_draw_state state;
+
+    if( poly->vertex_count == 0 )
+        return; /* Culled */
+
+    state.depth_func = depth_func == -1 ? (poly->context[0] >> 29) : depth_func;
+    state.depth_write = depth_write == -1 ? POLY1_DEPTH_WRITE(poly->context[0]) : depth_write;
+    state.alpha_ref = alpha_ref;
+    sw_set_tsp_state( &state, poly->context[0], poly->context[1], poly->tex_id );
+    if( poly->mod_vertex_index == -1 ) {
+        state.stencil = NO_STENCIL_TEST;
+        sw_draw_vertexes( tile, poly, FALSE, &state );
+    } else {
+        state.stencil = 0;
+        sw_draw_vertexes( tile, poly, FALSE, &state );
+        if( pvr2_scene.shadow_mode == SHADOW_FULL ) {
+            sw_set_tsp_state( &state, poly->context[0], poly->context[3], poly->mod_tex_id );
+        }
+        state.stencil = 2;
+        sw_draw_vertexes( tile, poly, TRUE, &state );
+    }
+}
+
+static void sw_render_tilelist( struct sw_tile *tile, pvraddr_t tile_entry, int depth_func,
+                                int depth_write, float alpha_ref )
+{
+    tileentryiter list;
+
+    FOREACH_TILEENTRY(list, tile_entry) {
+        struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[TILEENTRYITER_POLYADDR(list)];
+        if( poly != NULL ) {
+            do {
+                sw_render_poly( tile, poly, depth_func, depth_write, alpha_ref );
+                poly = poly->next;
+            } while( list.strip_count-- > 0 );
+        }
+    }
+}
+
+static void sw_render_tilelist_depthonly( struct sw_tile *tile, pvraddr_t tile_entry )
+{
+    tileentryiter list;
+
+    FOREACH_TILEENTRY(list, tile_entry) {
+        struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[TILEENTRYITER_POLYADDR(list)];
+        if( poly != NULL ) {
+            do {
+                struct polygon_struct *sub = poly;
+                do {
+                    struct vertex_struct *v = &pvr2_scene.vertex_array[sub->vertex_index];
+                    int i;
+                    for( i=0; i+2 < sub->vertex_count; i++ ) {
+                        sw_draw_triangle_depth( tile, &v[i], poly->context[0] >> 29,
+                                POLY1_DEPTH_WRITE(poly->context[0]) );
+                    }
+                    sub = sub->sub_next;
+                } while( sub != NULL );
+                poly = poly->next;
+            } while( list.strip_count-- > 0 );
+        }
+    }
+}
+
+/**
+ * Apply the end-of-volume stencil update to the scissor region of the tile
+ * (see gl_render_modifier_polygon for the truth tables).
+ */
+static void sw_modifier_region_end( struct sw_tile *tile, uint32_t poly_type )
+{
+    int x, y;
+    for( y=tile->scissor[2]; y<tile->scissor[3]; y++ ) {
+        uint8_t *s = &tile->stencil[y*SW_TILE_SIZE];
+        for( x=tile->scissor[0]; x<tile->scissor[1]; x++ ) {
+            if( poly_type == PVR2_VOLUME_REGION0 ) {
+                s[x] = (s[x] == 2) ? 2 : 0;
+            } else {
+                s[x] = (s[x] == 2) ? 0 : 2;
+            }
+        }
+    }
+}
+
+static void sw_render_modifier_tilelist( struct sw_tile *tile, pvraddr_t tile_entry )
+{
+    tileentryiter list;
+
+    FOREACH_TILEENTRY(list, tile_entry ) {
+        struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[TILEENTRYITER_POLYADDR(list)];
+        if( poly != NULL ) {
+            do {
+                if( poly->vertex_count != 0 ) {
+                    struct polygon_struct *sub = poly;
+                    do {
+                        struct vertex_struct *v = &pvr2_scene.vertex_array[sub->vertex_index];
+                        int i;
+                        for( i=0; i+2 < sub->vertex_count; i++ ) {
+                            sw_draw_triangle_modifier( tile, &v[i] );
+                        }
+                        sub = sub->sub_next;
+                    } while( sub != NULL );
+
+                    uint32_t poly_type = POLY1_VOLUME_MODE(poly->context[0]);
+                    if( poly_type == PVR2_VOLUME_REGION0 || poly_type == PVR2_VOLUME_REGION1 ) {
+                        sw_modifier_region_end( tile, poly_type );
+                    }
+                }
+                poly = poly->next;
+            } while( list.strip_count-- > 0 );
+        }
+    }
+}
+
+static void sw_render_sorted_triangle( struct polygon_struct *poly, int index, void *data )
+{
+    struct sw_tile *tile = data;
+    struct sw_draw_state state;
+    state.depth_func = DEPTH_GEQUAL;
+    state.depth_write = FALSE;
+    state.alpha_ref = 0;
+    state.stencil = NO_STENCIL_TEST;
+    sw_set_tsp_state( &state, poly->context[0], poly->context[1], poly->tex_id );
+    sw_draw_triangle( tile, &pvr2_scene.vertex_array[poly->vertex_index + index], &state );
+}
+
+static void sw_render_bkgnd( struct sw_tile *tile, struct polygon_struct *poly )
+{
+    struct sw_draw_state state;
+    state.depth_func = DEPTH_ALWAYS;
+    state.depth_write = FALSE;
+    state.alpha_ref = 0;
+    state.stencil = NO_STENCIL_TEST;
+    sw_set_tsp_state( &state, poly->context[0], poly->context[1], poly->tex_id );
+    state.src_blend = BLEND_ONE;
+    state.dst_blend = BLEND_ZERO;
+    sw_draw_vertexes( tile, poly, FALSE, &state );
+}
+
+/****************************** Tile rendering ******************************/
+
+static void sw_tile_clear_depth( struct sw_tile *tile )
+{
+    int i;
+    for( i=0; i<SW_TILE_PIXELS; i++ ) {
+        tile->depth[i] = 0;
+    }
+}
+
+/**
+ * Write the tile out to the render buffer (which is stored bottom-up)
+ */
+static void sw_tile_write( struct sw_tile *tile )
+{
+    sw_render_buffer_t buffer = sw_scene.buffer;
+    int x, y;
+    for( y=0; y<tile->height; y++ ) {
+        uint32_t *out = buffer->pixels + (buffer->buffer.height - 1 - (tile->y + y)) * buffer->buffer.width + tile->x;
+        vec4f *in = &tile->colour[y*SW_TILE_SIZE];
+        for( x=0; x<tile->width; x++ ) {
+            out[x] = vec4_to_argb32(in[x]);
+        }
+    }
+}
+
+static void sw_render_tile( void *data, int index )
+{
+    struct sw_tile tile;
+    int tx = index % sw_scene.tiles_x;
+    int ty = index / sw_scene.tiles_x;
+    int i, seg;
+
+    tile.x = tx * SW_TILE_SIZE;
+    tile.y = ty * SW_TILE_SIZE;
+    tile.width = MIN(SW_TILE_SIZE, (int)sw_scene.buffer->buffer.width - tile.x);
+    tile.height = MIN(SW_TILE_SIZE, (int)sw_scene.buffer->buffer.height - tile.y);
+    tile.scissor[0] = 0;
+    tile.scissor[1] = tile.width;
+    tile.scissor[2] = 0;
+    tile.scissor[3] = tile.height;
+
+    for( i=0; i<SW_TILE_PIXELS; i++ ) {
+        tile.colour[i] = vec4_splat(0.0f);
+        tile.stencil[i] = 0;
+    }
+    sw_tile_clear_depth( &tile );
+
+    /* Render the background */
+    sw_render_bkgnd( &tile, pvr2_scene.bkgnd_poly );
+
+    seg = sw_scene.tile_first_segment[index];
+    if( seg != -1 ) {
+        struct tile_segment *segment;
+        int clipx1 = MAX(0, sw_scene.clip[0] - tile.x), clipx2 = MIN(tile.width, sw_scene.clip[1] - tile.x);
+        int clipy1 = MAX(0, sw_scene.clip[2] - tile.y), clipy2 = MIN(tile.height, sw_scene.clip[3] - tile.y);
+        if( clipx1 < clipx2 && clipy1 < clipy2 ) {
+            gboolean have_modifiers = FALSE;
+            tile.scissor[0] = clipx1;
+            tile.scissor[1] = clipx2;
+            tile.scissor[2] = clipy1;
+            tile.scissor[3] = clipy2;
+
+#define FOREACH_TILE_SEGMENT(segment) \
+            for( seg = sw_scene.tile_first_segment[index]; seg != -1 && (segment = &pvr2_scene.segment_list[seg]); seg = sw_scene.segment_next[seg] )
+
+            /* Build up the opaque stencil map */
+            FOREACH_TILE_SEGMENT(segment) {
+                if( IS_NONEMPTY_TILE_LIST(segment->opaquemod_ptr) ) {
+                    sw_render_tilelist_depthonly( &tile, segment->opaque_ptr );
+                    have_modifiers = TRUE;
+                }
+            }
+            if( have_modifiers ) {
+                FOREACH_TILE_SEGMENT(segment) {
+                    if( IS_NONEMPTY_TILE_LIST(segment->opaquemod_ptr) ) {
+                        sw_render_modifier_tilelist( &tile, segment->opaquemod_ptr );
+                    }
+                }
+                sw_tile_clear_depth( &tile );
+            }
+
+            /* Render the opaque polygons */
+            FOREACH_TILE_SEGMENT(segment) {
+                sw_render_tilelist( &tile, segment->opaque_ptr, -1, -1, 0 );
+            }
+
+            /* Render the punch-out polygons */
+            FOREACH_TILE_SEGMENT(segment) {
+                sw_render_tilelist( &tile, segment->punchout_ptr, DEPTH_GEQUAL, -1, sw_scene.alpha_ref );
+            }
+
+            /* Render the translucent polygons */
+            FOREACH_TILE_SEGMENT(segment) {
+                if( IS_NONEMPTY_TILE_LIST(segment->trans_ptr) ) {
+                    if( !IS_AUTOSORT_SEGMENT(segment) ) {
+                        sw_render_tilelist( &tile, segment->trans_ptr, -1, -1, 0 );
+                    } else if( !render_sort_tile( segment, sw_render_sorted_triangle, &tile ) ) {
+                        sw_render_tilelist( &tile, segment->trans_ptr, DEPTH_GEQUAL, FALSE, 0 );
+                    }
+                }
+            }
+#undef FOREACH_TILE_SEGMENT
+        }
+    }
+
+    sw_tile_write( &tile );
+}
+
+/**
+ * Build the per-tile segment lists from the scene's region array.
+ */
+static void sw_scene_build_tile_lists()
+{
+    struct tile_segment *segment = pvr2_scene.segment_list;
+    int tile_count = sw_scene.tiles_x * sw_scene.tiles_y;
+    int i, count = 0;
+
+    do {
+        count++;
+    } while( !IS_LAST_SEGMENT(segment++) );
+
+    if( tile_count > sw_scene.tile_alloc ) {
+        sw_scene.tile_first_segment = g_realloc( sw_scene.tile_first_segment, tile_count * sizeof(int) );
+        sw_scene.tile_alloc = tile_count;
+    }
+    if( count > sw_scene.segment_alloc ) {
+        sw_scene.segment_next = g_realloc( sw_scene.segment_next, count * sizeof(int) );
+        sw_scene.segment_alloc = count;
+    }
+    sw_scene.segment_count = count;
+
+    /* Build the lists back to front so that they end up in segment order */
+    for( i=0; i<tile_count; i++ ) {
+        sw_scene.tile_first_segment[i] = -1;
+    }
+    for( i=count-1; i>=0; i-- ) {
+        uint32_t control = pvr2_scene.segment_list[i].control;
+        int tx = SEGMENT_X(control), ty = SEGMENT_Y(control);
+        if( tx < sw_scene.tiles_x && ty < sw_scene.tiles_y ) {
+            int tile = ty*sw_scene.tiles_x + tx;
+            sw_scene.segment_next[i] = sw_scene.tile_first_segment[tile];
+            sw_scene.tile_first_segment[tile] = i;
+        }
+    }
+}
+
+void pvr2_scene_render_sw( render_buffer_t buffer )
+{
+    struct timeval start_tv, tex_tv, end_tv;
+    int i;
+
+    gettimeofday(&start_tv, NULL);
+    pvr2_check_palette_changed();
+    sw_scene_load_textures();
+
+    gettimeofday( &tex_tv, NULL );
+    uint32_t ms = (tex_tv.tv_sec - start_tv.tv_sec) * 1000 +
+    (tex_tv.tv_usec - start_tv.tv_usec)/1000;
+    DEBUG( "Texture load in %dms", ms );
+
+    sw_scene.buffer = (sw_render_buffer_t)buffer;
+    sw_scene.tiles_x = (buffer->width + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+    sw_scene.tiles_y = (buffer->height + SW_TILE_SIZE - 1) / SW_TILE_SIZE;
+    for( i=0; i<4; i++ ) {
+        sw_scene.clip[i] = (int)pvr2_scene.bounds[i];
+    }
+    sw_scene.alpha_ref = ((float)(MMIO_READ(PVR2, RENDER_ALPHA_REF)&0xFF)+1)/256.0;
+    sw_scene.fog_lut_colour = vec4_load_rgba( pvr2_scene.fog_lut_colour );
+    sw_scene.fog_vert_colour = vec4_load_rgba( pvr2_scene.fog_vert_colour );
+    sw_scene_build_tile_lists();
+    render_sort_scene();
+
+    workpool_run( sw_render_tile, NULL, sw_scene.tiles_x * sw_scene.tiles_y );
+
+    sw_release_textures();
+    pvr2_scene_finished();
+
+    gettimeofday( &end_tv, NULL );
+    ms = (end_tv.tv_sec - tex_tv.tv_sec) * 1000 +
+    (end_tv.tv_usec - tex_tv.tv_usec)/1000;
+    DEBUG( "Scene render in %dms", ms );
+}
@@ -0,0 +1,49 @@
+/**
+ * $Id$
+ *
+ * Software (non-GL) PVR2 rendering engine.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_swrender_H
+#define lxdream_swrender_H 1
+
+#include "display.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Render buffer used by display drivers without GL support. Pixels are
+ * 32-bit BGRA8888 (ie 0xAARRGGBB host words), stored bottom row first so
+ * that they can be read back in the same order as a GL render buffer.
+ */
+typedef struct sw_render_buffer {
+    struct render_buffer buffer;
+    uint32_t *pixels;
+} *sw_render_buffer_t;
+
+/**
+ * Render the current scene into the given software render buffer.
+ * The scene is divided into 32x32 tiles which are rendered in parallel
+ * on the worker pool.
+ */
+void pvr2_scene_render_sw( render_buffer_t buffer );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_swrender_H */
@@ -814,13 +814,18 @@ static void ta_fill_vertexes( ) {
     }
 }
 
-static void ta_parse_vertex( union ta_data *data ) {
+/**
+ * Parse the first (or only) block of a vertex of the given type. This is
+ * always inlined so that the bulk write path can specialize it for each
+ * vertex type - everything else should use ta_parse_vertex().
+ */
+static inline FORCEINLINE void ta_parse_vertex_type( union ta_data *data, int type ) {
     struct pvr2_ta_vertex *vertex = &ta_status.poly_vertex[ta_status.vertex_count];
     vertex->x = data[1].f;
     vertex->y = data[2].f;
     vertex->z = data[3].f;
 
-    switch( ta_status.current_vertex_type ) {
+    switch( type ) {
     case TA_VERTEX_PACKED:
         vertex->detail[0] = data[6].i;
         break;
@@ -937,10 +942,18 @@ static void ta_parse_vertex( union ta_data *data ) {
     ta_status.vertex_count++;
 }
 
-static void ta_parse_vertex_block2( union ta_data *data ) {
+static void ta_parse_vertex( union ta_data *data ) {
+    ta_parse_vertex_type( data, ta_status.current_vertex_type );
+}
+
+/**
+ * Parse the second block of a two-block vertex of the given type. As per
+ * ta_parse_vertex_type(), this is always inlined.
+ */
+static inline FORCEINLINE void ta_parse_vertex_block2_type( union ta_data *data, int type ) {
     struct pvr2_ta_vertex *vertex = &ta_status.poly_vertex[ta_status.vertex_count-1];
 
-    switch( ta_status.current_vertex_type ) {
+    switch( type ) {
     case TA_VERTEX_TEX_SPEC_FLOAT:
         vertex->detail[3] = parse_float_colour( data[4].f, data[5].f, data[6].f, data[7].f );
         /* Fallthrough */
@@ -1032,6 +1045,24 @@ static void ta_parse_vertex_block2( union ta_data *data ) {
     ta_status.state = STATE_IN_POLYGON;
 }
 
+static void ta_parse_vertex_block2( union ta_data *data ) {
+    ta_parse_vertex_block2_type( data, ta_status.current_vertex_type );
+}
+
+/**
+ * Complete the current polygon on receipt of the end-of-strip flag
+ */
+static void ta_end_polygon( ) {
+    if( ta_status.vertex_count < 3 ) {
+        ta_bad_input_error();
+    } else {
+        ta_commit_polygon();
+    }
+    ta_status.vertex_count = 0;
+    ta_status.poly_parity = 0;
+    ta_status.state = STATE_IN_LIST;
+}
+
 /**
  * Process 1 32-byte block of ta data
  */
@@ -1061,14 +1092,7 @@ void pvr2_ta_process_block( unsigned char *input ) {
 
     case STATE_EXPECT_END_VERTEX_BLOCK2:
         ta_parse_vertex_block2( data );
-        if( ta_status.vertex_count < 3 ) {
-            ta_bad_input_error();
-        } else {
-            ta_commit_polygon();
-        }
-        ta_status.vertex_count = 0;
-        ta_status.poly_parity = 0;
-        ta_status.state = STATE_IN_LIST;
+        ta_end_polygon();
         break;
     case STATE_IN_LIST:
     case STATE_IN_POLYGON:
@@ -1136,14 +1160,7 @@ void pvr2_ta_process_block( unsigned char *input ) {
                     ta_status.state = STATE_EXPECT_END_VERTEX_BLOCK2;
                 }
             } else if( TA_IS_END_VERTEX(data->i) ) {
-                if( ta_status.vertex_count < 3 ) {
-                    ta_bad_input_error();
-                } else {
-                    ta_commit_polygon();
-                }
-                ta_status.vertex_count = 0;
-                ta_status.poly_parity = 0;
-                ta_status.state = STATE_IN_LIST;
+                ta_end_polygon();
             } else if( ta_status.vertex_count == ta_status.max_vertex ) {
                 ta_split_polygon();
             }
@@ -1196,6 +1213,105 @@ void pvr2_ta_write( unsigned char *buf, uint32_t length )
     }
 }
 
+/**
+ * Parse a run of consecutive vertexes of a single known type, stopping at the
+ * first block that isn't a vertex. Each vertex is blocks*32 bytes long, and
+ * is read in place from the source buffer.
+ * @return pointer to the first unprocessed block.
+ */
+static inline FORCEINLINE unsigned char *ta_parse_vertex_run( unsigned char *buf, unsigned char *end, 
+                                                                    int type, int blocks )
+{
+    while( buf + (blocks<<5) <= end && TA_CMD(*(uint32_t *)buf) == TA_CMD_VERTEX ) {
+        union ta_data *data = (union ta_data *)buf;
+        ta_status.state = STATE_IN_POLYGON;
+        ta_parse_vertex_type( data, type );
+        if( blocks == 2 ) {
+            ta_parse_vertex_block2_type( data+8, type );
+        }
+        if( TA_IS_END_VERTEX(data[0].i) ) {
+            ta_end_polygon();
+        } else if( ta_status.vertex_count == ta_status.max_vertex ) {
+            ta_split_polygon();
+        }
+        buf += (blocks<<5);
+    }
+    return buf;
+}
+
+#define VERTEX_RUN(type,blocks) case type: return ta_parse_vertex_run( buf, end, type, blocks )
+
+/**
+ * Dispatch a run of vertexes to the parse loop for the current vertex type.
+ * @return pointer to the first unprocessed block, which will be buf if the
+ * current type has no specialized loop.
+ */
+static unsigned char *ta_write_vertex_run( unsigned char *buf, unsigned char *end )
+{
+    switch( ta_status.current_vertex_type ) {
+    VERTEX_RUN( TA_VERTEX_PACKED, 1 );
+    VERTEX_RUN( TA_VERTEX_FLOAT, 1 );
+    VERTEX_RUN( TA_VERTEX_INTENSITY, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_PACKED, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_SPEC_PACKED, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_PACKED, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_SPEC_PACKED, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_INTENSITY, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_SPEC_INTENSITY, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_INTENSITY, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_SPEC_INTENSITY, 1 );
+    VERTEX_RUN( TA_VERTEX_PACKED_MOD, 1 );
+    VERTEX_RUN( TA_VERTEX_INTENSITY_MOD, 1 );
+    VERTEX_RUN( TA_VERTEX_TEX_FLOAT, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_SPEC_FLOAT, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_FLOAT, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_SPEC_FLOAT, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_PACKED_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_SPEC_PACKED_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_PACKED_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_SPEC_PACKED_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_INTENSITY_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_SPEC_INTENSITY_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_INTENSITY_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_UV16_SPEC_INTENSITY_MOD, 2 );
+    VERTEX_RUN( TA_VERTEX_SPRITE, 2 );
+    VERTEX_RUN( TA_VERTEX_TEX_SPRITE, 2 );
+    VERTEX_RUN( TA_VERTEX_MOD_VOLUME, 2 );
+    default:
+        return buf;
+    }
+}
+
+/**
+ * Bulk version of pvr2_ta_write for DMA transfers. Produces exactly the same
+ * result, but runs of vertexes within a polygon context are parsed directly
+ * out of the source buffer by a loop specialized for the vertex type, rather
+ * than being dispatched through the state machine one block at a time.
+ * Context, clip and end-of-list blocks (and anything arriving in an
+ * unexpected state) still go through pvr2_ta_process_block.
+ */
+void pvr2_ta_write_bulk( unsigned char *buf, uint32_t length )
+{
+    unsigned char *end = buf + (length & ~0x1F);
+
+    if( ta_status.debug_output ) {
+        fwrite_dump32( (uint32_t *)buf, length, stderr );
+    }
+
+    while( buf < end ) {
+        if( (ta_status.state == STATE_IN_LIST || ta_status.state == STATE_IN_POLYGON) &&
+                TA_CMD(*(uint32_t *)buf) == TA_CMD_VERTEX ) {
+            unsigned char *next = ta_write_vertex_run( buf, end );
+            if( next != buf ) {
+                buf = next;
+                continue;
+            }
+        }
+        pvr2_ta_process_block( buf );
+        buf += 32;
+    }
+}
+
 void FASTCALL pvr2_ta_write_burst( sh4addr_t addr, unsigned char *data )
 {
     if( ta_status.debug_output ) {
@@ -64,6 +64,15 @@ static gboolean texcache_have_palette_shader;
 static gboolean texcache_palette_valid;
 static GLuint texcache_palette_texid;
 
+/* Modification serials for texture caches outside of GL (ie the software
+ * renderer) - each invalidation records the current serial against the
+ * affected page (or the palette, stride or whole cache). */
+static uint32_t texcache_serial = 1;
+static uint32_t texcache_page_serial[PVR2_RAM_PAGES];
+static uint32_t texcache_palette_serial;
+static uint32_t texcache_stride_serial;
+static uint32_t texcache_flush_serial;
+
 /**
  * Initialize the texture cache.
  */
@@ -114,6 +123,7 @@ void texcache_flush( )
     }
     texcache_free_ptr = 0;
     texcache_ref_counter = 0;
+    texcache_flush_serial = texcache_serial;
 }
 
 /**
@@ -230,6 +240,7 @@ static texcache_entry_index texcache_evict_lru( void )
 void texcache_invalidate_page( uint32_t texture_addr ) {
     uint32_t texture_page = texture_addr >> 12;
     texcache_entry_index idx = texcache_page_lookup[texture_page];
+    texcache_page_serial[texture_page] = texcache_serial;
     if( idx == EMPTY_ENTRY )
         return;
     assert( texcache_free_ptr >= 0 );
@@ -310,6 +321,7 @@ static void texcache_load_palette_texture( gboolean format_changed )
  */
 void texcache_invalidate_palette( )
 {
+    texcache_palette_serial = texcache_serial;
     if( texcache_have_palette_shader ) {
         texcache_palette_valid = FALSE;
     } else {
@@ -331,6 +343,7 @@ void texcache_invalidate_palette( )
 void texcache_invalidate_stride( )
 {
     int i;
+    texcache_stride_serial = texcache_serial;
     for( i=0; i<MAX_TEXTURES; i++ ) {
         if( texcache_active_list[i].texture_addr != -1 &&
                 PVR2_TEX_IS_STRIDE(texcache_active_list[i].tex_mode) ) {
@@ -690,6 +703,273 @@ static void texcache_load_texture( uint32_t texture_addr, int width, int height,
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, max_filter);
 }
 
+/**
+ * Expand 16-bit pixels in one of the PVR2 16-bit formats (0 = ARGB1555,
+ * 1 = RGB565, 2 = ARGB4444 - the same numbering as the palette mode) to
+ * 32-bit ARGB8888.
+ */
+static void decode_16_to_argb32( uint32_t *out, uint16_t *in, int count, int format )
+{
+    int i;
+    switch( format ) {
+    case 0:
+        for( i=0; i<count; i++ ) {
+            uint32_t v = in[i];
+            uint32_t rgb = ((v & 0x7C00) << 9) | ((v & 0x03E0) << 6) | ((v & 0x001F) << 3);
+            out[i] = ((v & 0x8000) ? 0xFF000000 : 0) | rgb | ((rgb >> 5) & 0x00070707);
+        }
+        break;
+    case 1:
+        for( i=0; i<count; i++ ) {
+            uint32_t v = in[i];
+            out[i] = 0xFF000000 | ((v & 0xF800) << 8) | ((v & 0xE000) << 3) |
+                ((v & 0x07E0) << 5) | ((v & 0x0600) >> 1) | ((v & 0x001F) << 3) | ((v & 0x001C) >> 2);
+        }
+        break;
+    default:
+        for( i=0; i<count; i++ ) {
+            uint32_t v = in[i];
+            out[i] = (((v & 0xF000) << 12) | ((v & 0x0F00) << 8) | ((v & 0x00F0) << 4) | (v & 0x000F)) * 0x11;
+        }
+        break;
+    }
+}
+
+static void decode_pal_to_argb32( uint32_t *out, uint32_t *pal )
+{
+    if( texcache_palette_mode == 3 ) {
+        *out = *pal;
+    } else {
+        uint16_t v = (uint16_t)*pal;
+        decode_16_to_argb32( out, &v, 1, texcache_palette_mode );
+    }
+}
+
+/**
+ * Swap the R and B channels of a buffer, ie convert yuv_decode()'s ABGR output
+ * to ARGB.
+ */
+static void swap_rb_32( uint32_t *buf, int count )
+{
+    int i;
+    for( i=0; i<count; i++ ) {
+        uint32_t v = buf[i];
+        buf[i] = (v & 0xFF00FF00) | ((v & 0x00FF0000) >> 16) | ((v & 0x000000FF) << 16);
+    }
+}
+
+/**
+ * Decode a single mip level (or the whole texture if not mipmapped)
+ * @param tmp scratch buffer of at least width*height*4 bytes
+ */
+static void texcache_decode_level_argb32( uint32_t *out, uint32_t texture_addr, int width, int height,
+                                          uint32_t mode, struct vq_codebook *codebook, unsigned char *tmp )
+{
+    int tex_format = mode & PVR2_TEX_FORMAT_MASK;
+    int count = width*height;
+    int i;
+
+    if( tex_format == PVR2_TEX_FORMAT_IDX8 ) {
+        int bank = (mode >> 25) &0x03;
+        uint32_t *palette = ((uint32_t *)mmio_region_PVR2PAL.mem) + (bank<<8);
+        pvr2_vram64_read_twiddled_8( tmp, texture_addr, width, height );
+        for( i=0; i<count; i++ ) {
+            decode_pal_to_argb32( &out[i], &palette[tmp[i]] );
+        }
+    } else if( tex_format == PVR2_TEX_FORMAT_IDX4 ) {
+        int bank = (mode >>21 ) & 0x3F;
+        uint32_t *palette = ((uint32_t *)mmio_region_PVR2PAL.mem) + (bank<<4);
+        pvr2_vram64_read_twiddled_4( tmp, texture_addr, width, height );
+        for( i=0; i<count; i+=2 ) {
+            decode_pal_to_argb32( &out[i], &palette[tmp[i>>1] & 0x0F] );
+            decode_pal_to_argb32( &out[i+1], &palette[tmp[i>>1] >> 4] );
+        }
+    } else if( tex_format == PVR2_TEX_FORMAT_YUV422 ) {
+        if( PVR2_TEX_IS_TWIDDLED(mode) ) {
+            pvr2_vram64_read_twiddled_16( tmp, texture_addr, width, height );
+        } else {
+            pvr2_vram64_read( tmp, texture_addr, count<<1 );
+        }
+        yuv_decode( out, (uint32_t *)tmp, width, height );
+        swap_rb_32( out, count );
+    } else if( PVR2_TEX_IS_COMPRESSED(mode) ) {
+        uint16_t *pixels = (uint16_t *)(tmp + count);
+        if( PVR2_TEX_IS_TWIDDLED(mode) ) {
+            pvr2_vram64_read_twiddled_8( tmp, texture_addr, width>>1, height>>1 );
+        } else {
+            pvr2_vram64_read( tmp, texture_addr, count>>2 );
+        }
+        vq_decode( pixels, tmp, width, height, codebook );
+        decode_16_to_argb32( out, pixels, count, tex_format >> 27 );
+    } else {
+        if( PVR2_TEX_IS_TWIDDLED(mode) ) {
+            pvr2_vram64_read_twiddled_16( tmp, texture_addr, width, height );
+        } else {
+            pvr2_vram64_read( tmp, texture_addr, count<<1 );
+        }
+        decode_16_to_argb32( out, (uint16_t *)tmp, count, tex_format >> 27 );
+    }
+}
+
+/**
+ * Decode a texture into 32-bit ARGB8888 pixels, for the software renderer.
+ * This follows the same layout rules as texcache_load_texture, but always
+ * outputs full colour (ie palettes are resolved using the palette mode from
+ * the last texcache_begin_scene call).
+ *
+ * @param out Output buffer. For mipmapped textures the levels are stored
+ * consecutively starting from the largest, so the buffer must have room for
+ * width*height*4/3+1 pixels.
+ * @return the number of levels decoded.
+ */
+int texcache_decode_texture_argb32( uint32_t *out, uint32_t texture_word, int width, int height )
+{
+    uint32_t texture_addr = (texture_word & 0x000FFFFF)<<3;
+    int tex_format = texture_word & PVR2_TEX_FORMAT_MASK;
+    struct vq_codebook codebook;
+    unsigned char *tmp;
+    int level, last_level = 0, mip_width = width, mip_height = height, src_bytes;
+
+    if( tex_format == PVR2_TEX_FORMAT_BUMPMAP ) {
+        WARN( "Bumpmap not supported" );
+        for( level=0; level < width*height; level++ ) {
+            out[level] = 0xFF000000;
+        }
+        return 1;
+    }
+
+    tmp = g_malloc( (width*height) << 2 );
+
+    if( PVR2_TEX_IS_STRIDE(texture_word) && tex_format != PVR2_TEX_FORMAT_IDX4 &&
+            tex_format != PVR2_TEX_FORMAT_IDX8 ) {
+        /* Stride textures cannot be mip-mapped, compressed, indexed or twiddled */
+        pvr2_vram64_read_stride( tmp, width<<1, texture_addr, texcache_stride_width<<1, height );
+        if( tex_format == PVR2_TEX_FORMAT_YUV422 ) {
+            yuv_decode( out, (uint32_t *)tmp, width, height );
+            swap_rb_32( out, width*height );
+        } else {
+            decode_16_to_argb32( out, (uint16_t *)tmp, width*height, tex_format >> 27 );
+        }
+        g_free(tmp);
+        return 1;
+    }
+
+    if( PVR2_TEX_IS_COMPRESSED(texture_word) ) {
+        uint16_t cb[VQ_CODEBOOK_SIZE];
+        pvr2_vram64_read( (unsigned char *)cb, texture_addr, VQ_CODEBOOK_SIZE );
+        texture_addr += VQ_CODEBOOK_SIZE;
+        vq_get_codebook( &codebook, cb );
+    }
+
+    if( PVR2_TEX_IS_MIPMAPPED(texture_word) ) {
+        uint32_t src_offset = 0;
+        mip_height = height = width;
+        while( (1<<last_level) < width ) {
+            last_level++;
+            src_offset += ((width>>last_level)*(width>>last_level));
+        }
+        if( width != 1 ) {
+            src_offset += 3;
+        }
+        if( PVR2_TEX_IS_COMPRESSED(texture_word) ) {
+            src_offset >>= 2;
+        } else if( tex_format == PVR2_TEX_FORMAT_IDX4 ) {
+            src_offset >>= 1;
+        } else if( tex_format != PVR2_TEX_FORMAT_IDX8 ) {
+            src_offset <<= 1;
+        }
+        texture_addr += src_offset;
+    }
+
+    src_bytes = mip_width * mip_height;
+    if( PVR2_TEX_IS_COMPRESSED(texture_word) ) {
+        src_bytes >>= 2;
+    } else if( tex_format == PVR2_TEX_FORMAT_IDX4 ) {
+        src_bytes >>= 1;
+    } else if( tex_format != PVR2_TEX_FORMAT_IDX8 ) {
+        src_bytes <<= 1;
+    }
+
+    for( level=0; level <= last_level; level++ ) {
+        if( level == last_level && level != 0 ) { /* 1x1 stored within a 2x2 */
+            uint32_t quad[4];
+            texcache_decode_level_argb32( quad, texture_addr, 2, 2, texture_word, &codebook, tmp );
+            *out = quad[3];
+        } else {
+            texcache_decode_level_argb32( out, texture_addr, mip_width, mip_height, texture_word, &codebook, tmp );
+            out += mip_width * mip_height;
+            if( mip_width > 2 ) {
+                mip_width >>= 1;
+                mip_height >>= 1;
+                src_bytes >>= 2;
+            }
+            texture_addr -= src_bytes;
+        }
+    }
+    g_free(tmp);
+    return last_level+1;
+}
+
+uint32_t texcache_get_serial( )
+{
+    return texcache_serial++;
+}
+
+/**
+ * @return an upper bound on the number of bytes of (64-bit) VRAM occupied by
+ * the given texture.
+ */
+static uint32_t texcache_texture_size( uint32_t texture_word, int width, int height )
+{
+    int tex_format = texture_word & PVR2_TEX_FORMAT_MASK;
+    uint32_t size;
+
+    if( PVR2_TEX_IS_STRIDE(texture_word) && tex_format != PVR2_TEX_FORMAT_IDX4 &&
+            tex_format != PVR2_TEX_FORMAT_IDX8 ) {
+        return (texcache_stride_width<<1) * height;
+    }
+    if( PVR2_TEX_IS_MIPMAPPED(texture_word) ) {
+        height = width;
+    }
+    size = width * height;
+    if( PVR2_TEX_IS_COMPRESSED(texture_word) ) {
+        size >>= 2;
+    } else if( tex_format == PVR2_TEX_FORMAT_IDX4 ) {
+        size >>= 1;
+    } else if( tex_format != PVR2_TEX_FORMAT_IDX8 ) {
+        size <<= 1;
+    }
+    if( PVR2_TEX_IS_MIPMAPPED(texture_word) ) {
+        size = (size*4)/3 + 8;
+    }
+    if( PVR2_TEX_IS_COMPRESSED(texture_word) ) {
+        size += VQ_CODEBOOK_SIZE;
+    }
+    return size;
+}
+
+gboolean texcache_is_modified( uint32_t texture_word, int width, int height, uint32_t serial )
+{
+    uint32_t texture_addr = (texture_word & 0x000FFFFF)<<3;
+    uint32_t page = texture_addr >> 12;
+    uint32_t last_page = (texture_addr + texcache_texture_size(texture_word, width, height) - 1) >> 12;
+
+    if( texcache_flush_serial > serial ||
+            (PVR2_TEX_IS_PALETTE(texture_word) && texcache_palette_serial > serial) ||
+            (PVR2_TEX_IS_STRIDE(texture_word) && texcache_stride_serial > serial) ) {
+        return TRUE;
+    }
+    if( last_page >= PVR2_RAM_PAGES ) {
+        last_page = PVR2_RAM_PAGES - 1;
+    }
+    for( ; page <= last_page; page++ ) {
+        if( texcache_page_serial[page] > serial ) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
 static int texcache_find_texture_slot( uint32_t poly2_masked_word, uint32_t texture_word )
 {
     uint32_t texture_addr = (texture_word & 0x000FFFFF)<<3;
@@ -763,11 +1043,16 @@ GLuint texcache_get_texture( uint32_t poly2_word, uint32_t texture_word )
     int slot = texcache_find_texture_slot( poly2_word, texture_lookup );
 
     if( slot == -1 ) {
+        uint32_t texture_addr = (texture_word & 0x000FFFFF)<<3;
+
+        /* Make sure a render-to-texture at this address has reached vram
+         * (this may invalidate pages, so must precede the slot allocation) */
+        pvr2_render_buffer_invalidate( PVR2_RAM_BASE_INT + texture_addr, FALSE );
+
         /* Not found - check the free list */
         slot = texcache_alloc_texture_slot( poly2_word, texture_lookup );
         
         /* Construct the GL texture */
-        uint32_t texture_addr = (texture_word & 0x000FFFFF)<<3;
         unsigned width = POLY2_TEX_WIDTH(poly2_word);
         unsigned height = POLY2_TEX_HEIGHT(poly2_word);
 
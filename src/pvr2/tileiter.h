@@ -89,7 +89,7 @@ static void tileiter_read( tileiter *it )
                 it->ptr = NULL;
                 return;
             } else {
-                it->ptr = (uint32_t *)(pvr2_main_ram + (entry&0x007FFFFF));
+                it->ptr = (uint32_t *)(pvr2_scene.vram + (entry&0x007FFFFF));
                 it->poly_addr = -1;
                 entry = *it->ptr;
             }
@@ -119,7 +119,7 @@ static void tileiter_read( tileiter *it )
 static inline void tileiter_init( tileiter *it, uint32_t segptr )
 {
     if( IS_TILE_PTR(segptr) ) {
-        it->ptr = (uint32_t *)(pvr2_main_ram + (segptr & 0x007FFFFF));
+        it->ptr = (uint32_t *)(pvr2_scene.vram + (segptr & 0x007FFFFF));
         tileiter_read(it);
     } else {
         it->ptr = 0;
@@ -162,7 +162,7 @@ static void tileentryiter_read( tileentryiter *it )
                 it->ptr = NULL;
                 return;
             } else if( tag == 0x0E ) {
-                it->ptr = (uint32_t *)(pvr2_main_ram + (entry&0x007FFFFF));
+                it->ptr = (uint32_t *)(pvr2_scene.vram + (entry&0x007FFFFF));
                 entry = *it->ptr;
             } else {
                 /* Illegal? Skip */
@@ -176,7 +176,7 @@ static void tileentryiter_read( tileentryiter *it )
 static void tileentryiter_init( tileentryiter *it, uint32_t segptr )
 {
     if( IS_TILE_PTR(segptr) ) {
-        it->ptr = (uint32_t *)(pvr2_main_ram + (segptr & 0x007FFFFF));
+        it->ptr = (uint32_t *)(pvr2_scene.vram + (segptr & 0x007FFFFF));
         tileentryiter_read(it);
     } else {
         it->ptr = 0;
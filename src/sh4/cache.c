@@ -25,6 +25,7 @@
 #include "sh4/sh4core.h"
 #include "sh4/sh4mmio.h"
 #include "sh4/mmu.h"
+#include "pvr2/pvr2.h"
 
 #define OCRAM_START (0x7C000000>>LXDREAM_PAGE_BITS)
 #define OCRAM_MID   (0x7E000000>>LXDREAM_PAGE_BITS)
@@ -47,6 +48,8 @@ struct cache_line ccn_ocache[OCACHE_ENTRY_COUNT];
 static unsigned char ccn_icache_data[ICACHE_ENTRY_COUNT*32];
 unsigned char ccn_ocache_data[OCACHE_ENTRY_COUNT*32];
 
+static void ccn_write_burst( sh4addr_t target, sh4ptr_t src );
+
 
 /*********************** General module requirements ********************/
 
@@ -193,7 +196,7 @@ sh4addr_t FASTCALL ccn_ocache_load_line( sh4addr_t addr )
     ccn_cache_map[addr>>5] = CACHE_VALID;
     if( oldstate == (CACHE_VALID|CACHE_DIRTY) ) {
         // Cache line is dirty - writeback. 
-        ext_address_space[old_addr>>12]->write_burst(old_addr, cache_data);
+        ccn_write_burst(old_addr, cache_data);
     }
     ext_address_space[addr>>12]->read_burst(cache_data, addr & 0x1FFFFFE0);
     return addr;
@@ -287,7 +290,7 @@ void FASTCALL ccn_ocache_purge( sh4addr_t addr )
     ccn_cache_map[addr>>5] &= ~CACHE_VALID;
     if( oldflags == (CACHE_VALID|CACHE_DIRTY) ) {
         unsigned char *cache_data = &ccn_ocache_data[addr & 0x3FE0];
-        ext_address_space[addr>>12]->write_burst(addr, cache_data);
+        ccn_write_burst(addr, cache_data);
     }
 }
 
@@ -297,7 +300,7 @@ void FASTCALL ccn_ocache_writeback( sh4addr_t addr )
     if( ccn_cache_map[addr>>5] == (CACHE_VALID|CACHE_DIRTY) ) {
         ccn_cache_map[addr>>5] &= ~CACHE_DIRTY;
         unsigned char *cache_data = &ccn_ocache_data[addr & 0x3FE0];
-        ext_address_space[addr>>12]->write_burst(addr, cache_data);
+        ccn_write_burst(addr, cache_data);
     }
 }
 
@@ -373,7 +376,7 @@ static void FASTCALL ccn_ocache_addr_write( sh4addr_t addr, uint32_t val )
         if( ccn_cache_map[tag>>5] == (CACHE_VALID|CACHE_DIRTY) ) {
             // Cache line is dirty - writeback. 
             unsigned char *cache_data = &ccn_ocache_data[entry];
-            ext_address_space[tag>>12]->write_burst(tag, cache_data);
+            ccn_write_burst(tag, cache_data);
         }
         line->tag = tag = (val & 0x1FFFFC00) | (addr & 0x3E0);
         ccn_cache_map[tag>>5] = val & 0x03;
@@ -523,6 +526,56 @@ int32_t FASTCALL ccn_storequeue_read_long( sh4addr_t addr )
     return sh4r.store_queue[(addr>>2)&0xF];
 }
 
+/**
+ * Store-queue bursts to the PVR2 area (TA, YUV and the VRAM DMA windows) are
+ * coalesced here and delivered to pvr2_dma_write as a single bulk write,
+ * rather than one write_burst call per PREF. The FIFO targets accept any
+ * address; the VRAM windows only coalesce strictly sequential bursts. As with
+ * the real FIFO, the data only has to arrive before anything that can
+ * observe it, so ccn_storequeue_flush() is called from the PVR2 and ASIC
+ * register handlers, the VRAM accessors, pvr2_dma_write, event dispatch and
+ * on leaving the SH4 core. Operand cache write-backs take the same path.
+ */
+#define SQ_COALESCE_SIZE 4096
+#define SQ_COALESCE_AREA(addr) (((addr) & 0x1C000000) == 0x10000000)
+#define SQ_COALESCE_IS_FIFO(addr) (((addr) & 0x01000000) == 0)
+#define SQ_COALESCE_TARGET(addr) ((addr) & 0x13800000)
+
+static struct {
+    sh4addr_t target;
+    uint32_t length;
+    unsigned char data[SQ_COALESCE_SIZE];
+} sq_coalesce;
+
+void ccn_storequeue_flush( void )
+{
+    uint32_t length = sq_coalesce.length;
+    if( length != 0 ) {
+        /* Clear first, as pvr2_dma_write flushes on entry */
+        sq_coalesce.length = 0;
+        pvr2_dma_write( sq_coalesce.target, sq_coalesce.data, length );
+    }
+}
+
+static void ccn_write_burst( sh4addr_t target, sh4ptr_t src )
+{
+    if( SQ_COALESCE_AREA(target) ) {
+        if( sq_coalesce.length != 0 &&
+                (sq_coalesce.length == SQ_COALESCE_SIZE ||
+                 SQ_COALESCE_TARGET(target) != SQ_COALESCE_TARGET(sq_coalesce.target) ||
+                 (!SQ_COALESCE_IS_FIFO(target) && target != sq_coalesce.target + sq_coalesce.length)) ) {
+            ccn_storequeue_flush();
+        }
+        if( sq_coalesce.length == 0 ) {
+            sq_coalesce.target = target;
+        }
+        memcpy( sq_coalesce.data + sq_coalesce.length, src, 32 );
+        sq_coalesce.length += 32;
+    } else {
+        ext_address_space[target>>12]->write_burst( target, src );
+    }
+}
+
 /**
  * Variant used when tlb is disabled - address will be the original prefetch
  * address (ie 0xE0001234). Due to the way the SQ addressing is done, it can't
@@ -534,7 +587,7 @@ void FASTCALL ccn_storequeue_prefetch( sh4addr_t addr )
     sh4ptr_t src = (sh4ptr_t)&sh4r.store_queue[queue];
     uint32_t hi = MMIO_READ( MMU, QACR0 + (queue>>1)) << 24;
     sh4addr_t target = (addr&0x03FFFFE0) | hi;
-    ext_address_space[target>>12]->write_burst( target, src );
+    ccn_write_burst( target, src );
 }
 
 /**
@@ -545,6 +598,5 @@ void FASTCALL ccn_storequeue_prefetch_tlb( sh4addr_t addr )
 {
     int queue = (addr&0x20)>>2;
     sh4ptr_t src = (sh4ptr_t)&sh4r.store_queue[queue];
-    ext_address_space[addr>>12]->write_burst( (addr & 0x1FFFFFE0), src );
+    ccn_write_burst( (addr & 0x1FFFFFE0), src );
 }
-
@@ -164,6 +164,22 @@ void DMAC_run_channel( uint32_t channel, uint32_t run_count )
 #endif
 }
 
+/**
+ * Update the channel registers after a memory-to-device run, raising the
+ * transfer-end interrupt if the count has been exhausted.
+ */
+static void DMAC_update_source( int channel, uint32_t control, uint32_t source, uint32_t count )
+{
+    MMIO_WRITE( DMAC, SAR0 + (channel<<4), source );
+    MMIO_WRITE( DMAC, DMATCR0 + (channel<<4), count );
+    if( count == 0 ) {
+        control |= CHCR_TE; 
+        if( IS_CHANNEL_IRQ_ENABLED(control) )
+            intc_raise_interrupt( INT_DMA_DMTE0 + channel );
+        MMIO_WRITE( DMAC, CHCR0 + (channel<<4), control );
+    }
+}
+
 /**
  * Fetch a block of data by DMA from memory to an external device (ie the
  * ASIC). The DMA channel must be configured for Mem=>dev or it will return
@@ -223,17 +239,41 @@ uint32_t DMAC_get_buffer( int channel, sh4ptr_t buf, uint32_t numBytes )
         return 0; /* Illegal */
     }
 
-    /* Update the channel registers */
-    count -= run_count;
-    MMIO_WRITE( DMAC, SAR0 + (channel<<4), source );
-    MMIO_WRITE( DMAC, DMATCR0 + (channel<<4), count );
-    if( count == 0 ) {
-        control |= CHCR_TE; 
-        if( IS_CHANNEL_IRQ_ENABLED(control) )
-            intc_raise_interrupt( INT_DMA_DMTE0 + channel );
-        MMIO_WRITE( DMAC, CHCR0 + (channel<<4), control );
+    DMAC_update_source( channel, control, source, count - run_count );
+    return run_count * size;
+}
+
+/**
+ * Claim up to numBytes from an incrementing memory-to-device transfer without
+ * copying it, so that the device can read the data directly from the source
+ * address. Channel registers are updated exactly as for DMAC_get_buffer.
+ *
+ * @return the number of bytes claimed, or 0 if the channel is not enabled or
+ * is not configured for an incrementing source (in which case the caller
+ * should use DMAC_get_buffer instead).
+ */
+uint32_t DMAC_get_source( int channel, uint32_t numBytes, uint32_t *srcaddr )
+{
+    uint32_t control = DMA_CONTROL(channel);
+    uint32_t source, count, run_count, size;
+
+    if( !IS_CHANNEL_ENABLED(control) || !IS_DMAC_ENABLED() ||
+        ((control >> 8) & 0x0F) != DMARES_MEMORY_TO_DEVICE ||
+        ((control >> 12) & 0x03) != 1 ) {
+        return 0;
     }
 
+    source = DMA_SOURCE(channel);
+    count = DMA_COUNT(channel);
+    if( count == 0 ) count = 0x01000000;
+
+    size = DMAC_xfer_size[ (control >> 4)&0x07 ];
+    run_count = numBytes / size;
+    if( run_count > count || run_count == 0 )
+        run_count = count;
+
+    *srcaddr = source;
+    DMAC_update_source( channel, control, source + run_count * size, count - run_count );
     return run_count * size;
 }
 
@@ -49,6 +49,14 @@ void DMAC_trigger( int dmac_trigger );
  */
 uint32_t DMAC_get_buffer( int channel, unsigned char *buf, uint32_t bytecount );
 
+/**
+ * Claim up to bytecount bytes of an incrementing memory-to-external-device
+ * transfer without copying, returning the source address in srcaddr. 
+ * @return Actual number of bytes claimed, or 0 if the channel isn't set up
+ * for an incrementing memory source.
+ */
+uint32_t DMAC_get_source( int channel, uint32_t bytecount, uint32_t *srcaddr );
+
 /**
  * execute an external-device-to-memory transfer. Copies data from the 
  * supplied buffer into memory up to a maximum of bytecount bytes. 
@@ -30,6 +30,10 @@
 /* An entry is a 1K entry if it's one of the mmu_utlb_1k_pages entries */
 #define IS_1K_PAGE_ENTRY(ent)  ( ((uintptr_t)(((struct utlb_1k_entry *)ent) - &mmu_utlb_1k_pages[0])) < UTLB_ENTRY_COUNT )
 
+/* Size of a complete page table (in host pages, as per mem_alloc_pages) */
+#define ADDRESS_SPACE_PAGES (sizeof(mem_region_fn_t) * 256)
+#define ADDRESS_SPACE_SIZE (ADDRESS_SPACE_PAGES * LXDREAM_PAGE_SIZE)
+
 /* Primary address space (used directly by SH4 cores) */
 mem_region_fn_t *sh4_address_space;
 mem_region_fn_t *sh4_user_address_space;
@@ -50,11 +54,32 @@ static uint32_t mmu_lrui;
 static uint32_t mmu_asid; // current asid
 static struct utlb_default_regions *mmu_user_storequeue_regions;
 
+/**
+ * Per-ASID address spaces. With the TLB enabled, each recently used ASID
+ * keeps its own pair of page tables (copied from the running tables when the
+ * ASID is first seen), so an ASID switch is just a change of table pointers.
+ * All live spaces are kept in sync with UTLB modifications; anything else
+ * that rewrites the tables wholesale just marks the other spaces stale.
+ */
+struct asid_space {
+    mem_region_fn_t *priv;
+    mem_region_fn_t *user;
+    int asid;        /* ASID the tables are built for, or -1 if stale */
+    uint32_t stamp;  /* for LRU replacement */
+};
+static struct asid_space mmu_asid_spaces[ASID_SPACE_MAX];
+static int mmu_asid_space_count = ASID_SPACE_DEFAULT;
+static struct asid_space *mmu_current_space;
+static uint32_t mmu_asid_space_clock;
+
 /* Structures for 1K page handling */
 static struct utlb_1k_entry mmu_utlb_1k_pages[UTLB_ENTRY_COUNT];
 static int mmu_utlb_1k_free_list[UTLB_ENTRY_COUNT];
 static int mmu_utlb_1k_free_index;
 
+/* Software TLB (see mmu.h) */
+struct mmu_stlb_entry mmu_stlb[MMU_STLB_ENTRY_COUNT];
+
 
 /* Function prototypes */
 static void mmu_invalidate_tlb();
@@ -74,6 +99,11 @@ static void mmu_utlb_1k_init();
 static struct utlb_1k_entry *mmu_utlb_1k_alloc();
 static void mmu_utlb_1k_free( struct utlb_1k_entry *entry );
 static int mmu_read_urc();
+static void mmu_stlb_flush();
+static void mmu_stlb_invalidate_entry( int entryNo );
+static void mmu_asid_space_select( struct asid_space *space );
+static void mmu_asid_space_invalidate_others();
+static void mmu_asid_space_set_cache_control( uint32_t ccr );
 
 static void FASTCALL tlb_miss_read( sh4addr_t addr, void *exc );
 static int32_t FASTCALL tlb_protected_read( sh4addr_t addr, void *exc );
@@ -117,9 +147,16 @@ void mmu_utlb_1k_init_vtable( struct utlb_1k_entry *entry )
                            
 void MMU_init()
 {
+    int i;
     sh4_ext_address_space = ext_address_space;
-    sh4_address_space = mem_alloc_pages( sizeof(mem_region_fn_t) * 256 );
-    sh4_user_address_space = mem_alloc_pages( sizeof(mem_region_fn_t) * 256 );
+    for( i=0; i<ASID_SPACE_MAX; i++ ) {
+        mmu_asid_spaces[i].priv = mmu_asid_spaces[i].user = NULL;
+        mmu_asid_spaces[i].asid = -1;
+    }
+    mmu_asid_spaces[0].priv = mem_alloc_pages( ADDRESS_SPACE_PAGES );
+    mmu_asid_spaces[0].user = mem_alloc_pages( ADDRESS_SPACE_PAGES );
+    mmu_asid_spaces[0].asid = 0;
+    mmu_asid_space_select( &mmu_asid_spaces[0] );
     mmu_user_storequeue_regions = &mmu_default_regions[DEFAULT_STOREQUEUE_REGIONS];
     
     mmu_set_tlb_enabled(0);
@@ -216,6 +253,7 @@ int MMU_load_state( FILE *f )
 void MMU_ldtlb()
 {
     int urc = mmu_read_urc();
+    mmu_stlb_invalidate_entry( urc );
     if( IS_TLB_ENABLED() && mmu_utlb[urc].flags & TLB_VALID )
         mmu_utlb_remove_entry( urc );
     mmu_utlb[urc].vpn = MMIO_READ(MMU, PTEH) & 0xFFFFFC00;
@@ -224,6 +262,7 @@ void MMU_ldtlb()
     mmu_utlb[urc].flags = MMIO_READ(MMU, PTEL) & 0x00001FF;
     mmu_utlb[urc].pcmcia = MMIO_READ(MMU, PTEA);
     mmu_utlb[urc].mask = get_tlb_size_mask(mmu_utlb[urc].flags);
+    mmu_stlb_invalidate_entry( urc );
     if( IS_TLB_ENABLED() && mmu_utlb[urc].flags & TLB_VALID )
         mmu_utlb_insert_entry( urc );
 }
@@ -296,7 +335,12 @@ MMIO_REGION_WRITE_FN( MMU, reg, val )
         }
         break;
     case CCR:
-        CCN_set_cache_control( val );
+        tmp = MMIO_READ( MMU, CCR );
+        if( (val ^ tmp) & (CCR_OIX|CCR_ORA|CCR_OCE) ) {
+            mmu_asid_space_set_cache_control( val );
+        } else {
+            CCN_set_cache_control( val );
+        }
         val &= 0x81A7;
         break;
     case MMUUNK1:
@@ -402,13 +446,171 @@ static void mmu_register_user_mem_region( uint32_t start, uint32_t end, mem_regi
     }
 }
 
+/**
+ * Make the given space's tables the active address space. Note that this
+ * doesn't change mmu_asid.
+ */
+static void mmu_asid_space_select( struct asid_space *space )
+{
+    mmu_current_space = space;
+    sh4_address_space = space->priv;
+    sh4_user_address_space = space->user;
+}
+
+/**
+ * Mark all spaces other than the current one as stale, for changes that
+ * aren't tracked per-space.
+ */
+static void mmu_asid_space_invalidate_others()
+{
+    int i;
+    for( i=0; i<mmu_asid_space_count; i++ ) {
+        if( &mmu_asid_spaces[i] != mmu_current_space ) {
+            mmu_asid_spaces[i].asid = -1;
+        }
+    }
+}
+
+/**
+ * Apply a change in the OCRAM configuration to all live spaces, finishing
+ * with the current space (which also takes care of the cache invalidates).
+ */
+static void mmu_asid_space_set_cache_control( uint32_t ccr )
+{
+    struct asid_space *current = mmu_current_space;
+    int i;
+
+    for( i=0; i<mmu_asid_space_count; i++ ) {
+        struct asid_space *space = &mmu_asid_spaces[i];
+        if( space != current && space->asid != -1 ) {
+            mmu_asid_space_select( space );
+            CCN_set_cache_control( ccr & ~(CCR_ICI|CCR_OCI) );
+        }
+    }
+    mmu_asid_space_select( current );
+    CCN_set_cache_control( ccr );
+}
+
+/**
+ * Set the number of per-ASID spaces that may be kept live at once (clamped to
+ * 1..ASID_SPACE_MAX). A count of 1 disables them entirely, so that every ASID
+ * switch remaps the current tables in place. Spaces beyond the new count are
+ * dropped, keeping the contents of the current space.
+ */
+void mmu_set_asid_space_count( int count )
+{
+    int i;
+
+    if( count < 1 ) {
+        count = 1;
+    } else if( count > ASID_SPACE_MAX ) {
+        count = ASID_SPACE_MAX;
+    }
+    if( mmu_current_space - mmu_asid_spaces >= count ) {
+        memcpy( mmu_asid_spaces[0].priv, mmu_current_space->priv, ADDRESS_SPACE_SIZE );
+        memcpy( mmu_asid_spaces[0].user, mmu_current_space->user, ADDRESS_SPACE_SIZE );
+        mmu_asid_spaces[0].stamp = mmu_current_space->stamp;
+        mmu_asid_space_select( &mmu_asid_spaces[0] );
+    }
+    mmu_current_space->asid = mmu_asid;
+    for( i=count; i<ASID_SPACE_MAX; i++ ) {
+        mmu_asid_spaces[i].asid = -1;
+    }
+    mmu_asid_space_count = count;
+}
+
+static struct asid_space *mmu_asid_space_lookup( uint32_t asid )
+{
+    int i;
+    for( i=0; i<mmu_asid_space_count; i++ ) {
+        if( mmu_asid_spaces[i].asid == asid ) {
+            return &mmu_asid_spaces[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Select the space to be rebuilt for a new ASID - the least recently used
+ * space, brought up to date with the current space if it's stale. On return
+ * the chosen space is current and mmu_asid is the ASID it's built for.
+ * While any 1K pages are mapped, the current space is always reused (as the
+ * 1K page structures aren't duplicated between spaces), as it is if only one
+ * space is allowed.
+ */
+static struct asid_space *mmu_asid_space_prepare()
+{
+    struct asid_space *space = NULL;
+    int i;
+
+    if( mmu_utlb_1k_free_index != 0 || mmu_asid_space_count == 1 ) {
+        return mmu_current_space;
+    }
+
+    for( i=0; i<mmu_asid_space_count; i++ ) {
+        struct asid_space *ent = &mmu_asid_spaces[i];
+        if( ent != mmu_current_space &&
+                (space == NULL || ent->asid == -1 || ent->stamp < space->stamp) ) {
+            space = ent;
+            if( ent->asid == -1 ) {
+                break;
+            }
+        }
+    }
+
+    if( space->priv == NULL ) {
+        space->priv = mem_alloc_pages( ADDRESS_SPACE_PAGES );
+        space->user = mem_alloc_pages( ADDRESS_SPACE_PAGES );
+    }
+    if( space->asid == -1 ) {
+        memcpy( space->priv, mmu_current_space->priv, ADDRESS_SPACE_SIZE );
+        memcpy( space->user, mmu_current_space->user, ADDRESS_SPACE_SIZE );
+        space->asid = mmu_asid;
+    }
+    mmu_asid_space_select( space );
+    mmu_asid = space->asid;
+    return space;
+}
+
+/**
+ * Apply a UTLB entry update to all live spaces, finishing with the current
+ * space.
+ */
+static void mmu_asid_space_update_entry( void (*fn)(int), int entry )
+{
+    struct asid_space *current = mmu_current_space;
+    uint32_t asid = mmu_asid;
+    int i;
+
+    if( mmu_utlb[entry].mask == MASK_1K || mmu_utlb_1k_free_index != 0 ) {
+        mmu_asid_space_invalidate_others();
+    } else {
+        for( i=0; i<mmu_asid_space_count; i++ ) {
+            struct asid_space *space = &mmu_asid_spaces[i];
+            if( space != current && space->asid != -1 ) {
+                mmu_asid_space_select( space );
+                mmu_asid = space->asid;
+                fn( entry );
+            }
+        }
+        mmu_asid_space_select( current );
+        mmu_asid = asid;
+    }
+    fn( entry );
+}
+
 static gboolean mmu_ext_page_remapped( sh4addr_t page, mem_region_fn_t fn, void *user_data )
 {
     unsigned int i;
+    mmu_stlb_flush();
     if( (MMIO_READ(MMU,MMUCR)) & MMUCR_AT ) {
         /* TLB on */
-        sh4_address_space[(page|0x80000000)>>12] = fn; /* Direct map to P1 and P2 */
-        sh4_address_space[(page|0xA0000000)>>12] = fn;
+        for( i=0; i<mmu_asid_space_count; i++ ) {
+            if( mmu_asid_spaces[i].asid != -1 ) {
+                mmu_asid_spaces[i].priv[(page|0x80000000)>>12] = fn; /* Direct map to P1 and P2 */
+                mmu_asid_spaces[i].priv[(page|0xA0000000)>>12] = fn;
+            }
+        }
         /* Scan UTLB and update any direct-referencing entries */
     } else {
         /* Direct map to U0, P0, P1, P2, P3 */
@@ -427,6 +629,10 @@ static void mmu_set_tlb_enabled( int tlb_on )
     mem_region_fn_t *ptr;
     int i;
     
+    mmu_stlb_flush();
+    mmu_asid_space_invalidate_others();
+    mmu_current_space->asid = mmu_asid;
+
     /* Reset the storequeue area */
 
     if( tlb_on ) {
@@ -465,6 +671,7 @@ static void mmu_set_storequeue_protected( int protected, int tlb_on )
     mem_region_fn_t nontlb_region;
     int i;
 
+    mmu_asid_space_invalidate_others();
     if( protected ) {
         mmu_user_storequeue_regions = &mmu_default_regions[DEFAULT_STOREQUEUE_SQMD_REGIONS];
         nontlb_region = &p4_region_storequeue_sqmd;
@@ -486,51 +693,78 @@ static void mmu_set_storequeue_protected( int protected, int tlb_on )
     
 }
 
-static void mmu_set_tlb_asid( uint32_t asid )
+/**
+ * Remap the current page tables from the current ASID to the given ASID, by
+ * unmapping the old ASID's private pages and mapping in the new ones.
+ */
+static void mmu_asid_space_remap( uint32_t asid )
 {
-    if( IS_TLB_ENABLED() ) {
-        /* Scan for pages that need to be remapped */
-        int i;
-        if( IS_SV_ENABLED() ) {
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == mmu_asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    // Matches old ASID - unmap out
-                    if( !mmu_utlb_unmap_pages( FALSE, TRUE, mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) ) )
-                        mmu_utlb_remap_pages( FALSE, TRUE, i );
-                }
+    /* Scan for pages that need to be remapped */
+    int i;
+    if( IS_SV_ENABLED() ) {
+        for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
+            if( mmu_utlb[i].asid == mmu_asid &&
+                    (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
+                // Matches old ASID - unmap out
+                if( !mmu_utlb_unmap_pages( FALSE, TRUE, mmu_utlb[i].vpn&mmu_utlb[i].mask,
+                        get_tlb_size_pages(mmu_utlb[i].flags) ) )
+                    mmu_utlb_remap_pages( FALSE, TRUE, i );
             }
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    // Matches new ASID - map in
-                    mmu_utlb_map_pages( NULL, mmu_utlb_pages[i].user_fn,
-                            mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) );
-                }
+        }
+        for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
+            if( mmu_utlb[i].asid == asid &&
+                    (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
+                // Matches new ASID - map in
+                mmu_utlb_map_pages( NULL, mmu_utlb_pages[i].user_fn,
+                        mmu_utlb[i].vpn&mmu_utlb[i].mask,
+                        get_tlb_size_pages(mmu_utlb[i].flags) );
             }
-        } else {
-            // Remap both Priv+user pages
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == mmu_asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    if( !mmu_utlb_unmap_pages( TRUE, TRUE, mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) ) )
-                        mmu_utlb_remap_pages( TRUE, TRUE, i );
-                }
+        }
+    } else {
+        // Remap both Priv+user pages
+        for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
+            if( mmu_utlb[i].asid == mmu_asid &&
+                    (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
+                if( !mmu_utlb_unmap_pages( TRUE, TRUE, mmu_utlb[i].vpn&mmu_utlb[i].mask,
+                        get_tlb_size_pages(mmu_utlb[i].flags) ) )
+                    mmu_utlb_remap_pages( TRUE, TRUE, i );
             }
-            for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
-                if( mmu_utlb[i].asid == asid &&
-                        (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
-                    mmu_utlb_map_pages( &mmu_utlb_pages[i].fn, mmu_utlb_pages[i].user_fn,
-                            mmu_utlb[i].vpn&mmu_utlb[i].mask,
-                            get_tlb_size_pages(mmu_utlb[i].flags) );
-                }
+        }
+        for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
+            if( mmu_utlb[i].asid == asid &&
+                    (mmu_utlb[i].flags & (TLB_VALID|TLB_SHARE)) == (TLB_VALID) ) {
+                mmu_utlb_map_pages( &mmu_utlb_pages[i].fn, mmu_utlb_pages[i].user_fn,
+                        mmu_utlb[i].vpn&mmu_utlb[i].mask,
+                        get_tlb_size_pages(mmu_utlb[i].flags) );
             }
         }
-        sh4_icache.page_vma = -1; // invalidate icache as asid has changed
     }
+}
+
+static void mmu_set_tlb_asid( uint32_t asid )
+{
+    if( IS_TLB_ENABLED() ) {
+        struct asid_space *space = mmu_asid_space_lookup( asid );
+        if( space == NULL ) {
+            /* Build a space for the new ASID, by switching to the least
+             * recently used space and remapping it in place */
+            space = mmu_asid_space_prepare();
+            mmu_asid_space_remap( asid );
+            space->asid = asid;
+        } else {
+            mmu_asid_space_select( space );
+        }
+        space->stamp = ++mmu_asid_space_clock;
+        /* Invalidate the icache as the asid has changed, unless it's
+         * pointing at an untranslated (P1/P2) region */
+        if( (sh4_icache.page_vma & 0xC0000000) != 0x80000000 ) {
+            sh4_icache.page_vma = -1;
+        }
+    } else {
+        mmu_current_space->asid = asid;
+    }
+    /* Software TLB entries are tagged with their ASID, so they remain valid
+     * across the switch (and are reused when switching back) */
     mmu_asid = asid;
 }
 
@@ -757,7 +991,7 @@ static gboolean mmu_utlb_unmap_pages( gboolean unmap_priv, gboolean unmap_user,
     return unmapping_ok;
 }
 
-static void mmu_utlb_insert_entry( int entry )
+static void mmu_utlb_insert_space_entry( int entry )
 {
     struct utlb_entry *ent = &mmu_utlb[entry];
     mem_region_fn_t page = &mmu_utlb_pages[entry].fn;
@@ -817,7 +1051,7 @@ static void mmu_utlb_insert_entry( int entry )
     }
 }
 
-static void mmu_utlb_remove_entry( int entry )
+static void mmu_utlb_remove_space_entry( int entry )
 {
     struct utlb_entry *ent = &mmu_utlb[entry];
     sh4addr_t start_addr = ent->vpn&ent->mask;
@@ -839,6 +1073,16 @@ static void mmu_utlb_remove_entry( int entry )
     }
 }
 
+static void mmu_utlb_insert_entry( int entry )
+{
+    mmu_asid_space_update_entry( mmu_utlb_insert_space_entry, entry );
+}
+
+static void mmu_utlb_remove_entry( int entry )
+{
+    mmu_asid_space_update_entry( mmu_utlb_remove_space_entry, entry );
+}
+
 static void mmu_utlb_register_all()
 {
     int i;
@@ -864,6 +1108,77 @@ static void mmu_invalidate_tlb()
     for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
         mmu_utlb[i].flags &= (~TLB_VALID);
     }
+    mmu_stlb_flush();
+}
+
+/******************************************************************************/
+/*                            Software TLB cache                              */
+/******************************************************************************/
+
+static void mmu_stlb_flush()
+{
+    int i;
+    for( i=0; i<MMU_STLB_ENTRY_COUNT; i++ ) {
+        mmu_stlb[i].vpn = MMU_STLB_INVALID;
+    }
+}
+
+/**
+ * Invalidate any software TLB slots that could hold a translation covered by
+ * the given UTLB entry. Called both before and after the entry is modified,
+ * as the new mapping may turn a cached single hit into a multi-hit.
+ */
+static void mmu_stlb_invalidate_entry( int entryNo )
+{
+    uint32_t mask = mmu_utlb[entryNo].mask & MASK_4K;
+    uint32_t pages = ((~mask)>>12) + 1;
+    sh4addr_t vpn = mmu_utlb[entryNo].vpn & mask;
+    uint32_t i;
+
+    if( pages >= MMU_STLB_ENTRY_COUNT ) {
+        mmu_stlb_flush();
+    } else {
+        for( i=0; i<pages; i++, vpn += 0x1000 ) {
+            mmu_stlb[MMU_STLB_INDEX(vpn)].vpn = MMU_STLB_INVALID;
+        }
+    }
+}
+
+/**
+ * Add the translation of addr by the given UTLB entry to the software TLB,
+ * if it is uniform across the 4K page (ie not a 1K page, not overlapped by
+ * any 1K page, and not remapped into P4).
+ * @return the new entry, or NULL if the translation can't be cached.
+ */
+static struct mmu_stlb_entry *mmu_stlb_fill( sh4vma_t addr, uint32_t tag, int entryNo )
+{
+    struct utlb_entry *ent = &mmu_utlb[entryNo];
+    struct mmu_stlb_entry *slot;
+    sh4addr_t ppn;
+    int i;
+
+    if( ent->mask == MASK_1K ) {
+        return NULL;
+    }
+    ppn = (ent->ppn & ent->mask) | (addr & (~ent->mask) & MASK_4K);
+    if( ppn >= 0x1C000000 ) {
+        return NULL;
+    }
+    for( i=0; i<UTLB_ENTRY_COUNT; i++ ) {
+        if( (mmu_utlb[i].flags & TLB_VALID) && mmu_utlb[i].mask == MASK_1K &&
+                (tag == MMU_STLB_TAG_SV || (mmu_utlb[i].flags & TLB_SHARE) || mmu_utlb[i].asid == tag) &&
+                ((mmu_utlb[i].vpn ^ addr) & MASK_4K) == 0 ) {
+            return NULL;
+        }
+    }
+
+    slot = &mmu_stlb[MMU_STLB_INDEX(addr)];
+    slot->vpn = addr & MASK_4K;
+    slot->tag = tag;
+    slot->ppn = ppn;
+    slot->fn = sh4_ext_address_space[ppn>>12];
+    slot->entryNo = entryNo;
+    return slot;
 }
 
 /******************************************************************************/
@@ -896,6 +1211,17 @@ int mmu_utlb_entry_for_vpn( uint32_t vpn )
 }
 
 
+/**
+ * Step URC as for a UTLB access.
+ */
+static inline void mmu_urc_increment()
+{
+    mmu_urc++;
+    if( mmu_urc == mmu_urb || mmu_urc == 0x40 ) {
+        mmu_urc = 0;
+    }
+}
+
 /**
  * Perform the actual utlb lookup w/ asid matching.
  * Possible utcomes are:
@@ -910,10 +1236,7 @@ static inline int mmu_utlb_lookup_vpn_asid( uint32_t vpn )
     int result = -1;
     unsigned int i;
 
-    mmu_urc++;
-    if( mmu_urc == mmu_urb || mmu_urc == 0x40 ) {
-        mmu_urc = 0;
-    }
+    mmu_urc_increment();
 
     for( i = 0; i < UTLB_ENTRY_COUNT; i++ ) {
         if( (mmu_utlb[i].flags & TLB_VALID) &&
@@ -942,10 +1265,7 @@ static inline int mmu_utlb_lookup_vpn( uint32_t vpn )
     int result = -1;
     unsigned int i;
 
-    mmu_urc++;
-    if( mmu_urc == mmu_urb || mmu_urc == 0x40 ) {
-        mmu_urc = 0;
-    }
+    mmu_urc_increment();
 
     for( i = 0; i < UTLB_ENTRY_COUNT; i++ ) {
         if( (mmu_utlb[i].flags & TLB_VALID) &&
@@ -960,6 +1280,35 @@ static inline int mmu_utlb_lookup_vpn( uint32_t vpn )
     return result;
 }
 
+/**
+ * Perform a utlb lookup through the software TLB, falling back to the full
+ * scan (and filling the software TLB) on a miss. URC is stepped either way.
+ * @param tag ASID to match (which must be the current ASID), or
+ * MMU_STLB_TAG_SV to match on vpn only.
+ * @param pent Set to the software TLB entry for the result, or NULL if the
+ * result could not be cached.
+ * @return the UTLB entry as per mmu_utlb_lookup_vpn_asid()
+ */
+static inline int mmu_utlb_lookup_cached( uint32_t vpn, uint32_t tag, struct mmu_stlb_entry **pent )
+{
+    struct mmu_stlb_entry *ent = mmu_stlb_lookup( vpn, tag );
+    int entryNo;
+
+    if( ent != NULL ) {
+        mmu_urc_increment();
+        *pent = ent;
+        return ent->entryNo;
+    }
+
+    if( tag == MMU_STLB_TAG_SV ) {
+        entryNo = mmu_utlb_lookup_vpn( vpn );
+    } else {
+        entryNo = mmu_utlb_lookup_vpn_asid( vpn );
+    }
+    *pent = (entryNo >= 0 ? mmu_stlb_fill( vpn, tag, entryNo ) : NULL);
+    return entryNo;
+}
+
 /**
  * Update the ITLB by replacing the LRU entry with the specified UTLB entry.
  * @return the number (0-3) of the replaced entry.
@@ -1059,7 +1408,8 @@ static inline int mmu_itlb_lookup_vpn( uint32_t vpn )
     }
 
     if( result == -1 ) {
-        int utlbEntry = mmu_utlb_lookup_vpn( vpn );
+        struct mmu_stlb_entry *ent;
+        int utlbEntry = mmu_utlb_lookup_cached( vpn, MMU_STLB_TAG_SV, &ent );
         if( utlbEntry < 0 ) {
             return utlbEntry;
         } else {
@@ -1246,12 +1596,9 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_read( sh4vma_t *paddr )
     }
 
     /* If we get this far, translation is required */
-    int entryNo;
-    if( ((mmucr & MMUCR_SV) == 0) || !IS_SH4_PRIVMODE() ) {
-        entryNo = mmu_utlb_lookup_vpn_asid( addr );
-    } else {
-        entryNo = mmu_utlb_lookup_vpn( addr );
-    }
+    struct mmu_stlb_entry *ent;
+    int entryNo = mmu_utlb_lookup_cached( addr,
+            ((mmucr & MMUCR_SV) == 0) || !IS_SH4_PRIVMODE() ? mmu_asid : MMU_STLB_TAG_SV, &ent );
 
     switch(entryNo) {
     case -1:
@@ -1269,6 +1616,10 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_read( sh4vma_t *paddr )
         }
 
         /* finally generate the target address */
+        if( ent != NULL ) {
+            *paddr = ent->ppn | (addr & 0xFFF);
+            return ent->fn;
+        }
         sh4addr_t pma = (mmu_utlb[entryNo].ppn & mmu_utlb[entryNo].mask) |
                 (addr & (~mmu_utlb[entryNo].mask));
         if( pma > 0x1C000000 ) { // Remap 1Cxx .. 1Fxx region to P4
@@ -1316,12 +1667,9 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_prefetch( sh4vma_t *paddr )
     }
 
     /* If we get this far, translation is required */
-    int entryNo;
-    if( ((mmucr & MMUCR_SV) == 0) || !IS_SH4_PRIVMODE() ) {
-        entryNo = mmu_utlb_lookup_vpn_asid( addr );
-    } else {
-        entryNo = mmu_utlb_lookup_vpn( addr );
-    }
+    struct mmu_stlb_entry *ent;
+    int entryNo = mmu_utlb_lookup_cached( addr,
+            ((mmucr & MMUCR_SV) == 0) || !IS_SH4_PRIVMODE() ? mmu_asid : MMU_STLB_TAG_SV, &ent );
 
     switch(entryNo) {
     case -1:
@@ -1337,6 +1685,10 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_prefetch( sh4vma_t *paddr )
         }
 
         /* finally generate the target address */
+        if( ent != NULL ) {
+            *paddr = ent->ppn | (addr & 0xFFF);
+            return ent->fn;
+        }
         sh4addr_t pma = (mmu_utlb[entryNo].ppn & mmu_utlb[entryNo].mask) |
                 (addr & (~mmu_utlb[entryNo].mask));
         if( pma > 0x1C000000 ) { // Remap 1Cxx .. 1Fxx region to P4
@@ -1382,12 +1734,9 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_write( sh4vma_t *paddr )
     }
 
     /* If we get this far, translation is required */
-    int entryNo;
-    if( ((mmucr & MMUCR_SV) == 0) || !IS_SH4_PRIVMODE() ) {
-        entryNo = mmu_utlb_lookup_vpn_asid( addr );
-    } else {
-        entryNo = mmu_utlb_lookup_vpn( addr );
-    }
+    struct mmu_stlb_entry *ent;
+    int entryNo = mmu_utlb_lookup_cached( addr,
+            ((mmucr & MMUCR_SV) == 0) || !IS_SH4_PRIVMODE() ? mmu_asid : MMU_STLB_TAG_SV, &ent );
 
     switch(entryNo) {
     case -1:
@@ -1410,6 +1759,10 @@ mem_region_fn_t FASTCALL mmu_get_region_for_vma_write( sh4vma_t *paddr )
         }
 
         /* finally generate the target address */
+        if( ent != NULL ) {
+            *paddr = ent->ppn | (addr & 0xFFF);
+            return ent->fn;
+        }
         sh4addr_t pma = (mmu_utlb[entryNo].ppn & mmu_utlb[entryNo].mask) |
                 (addr & (~mmu_utlb[entryNo].mask));
         if( pma > 0x1C000000 ) { // Remap 1Cxx .. 1Fxx region to P4
@@ -1531,6 +1884,7 @@ void FASTCALL mmu_utlb_addr_write( sh4addr_t addr, uint32_t val, void *exc )
             ent->flags = ent->flags & ~(TLB_DIRTY|TLB_VALID);
             ent->flags |= (val & TLB_VALID);
             ent->flags |= ((val & 0x200)>>7);
+            mmu_stlb_invalidate_entry( utlb );
             if( IS_TLB_ENABLED() && ((old_flags^ent->flags) & (TLB_VALID|TLB_DIRTY)) != 0 ) {
                 if( old_flags & TLB_VALID )
                     mmu_utlb_remove_entry( utlb );
@@ -1552,6 +1906,7 @@ void FASTCALL mmu_utlb_addr_write( sh4addr_t addr, uint32_t val, void *exc )
         }
     } else {
         struct utlb_entry *ent = &mmu_utlb[UTLB_ENTRY(addr)];
+        mmu_stlb_invalidate_entry( UTLB_ENTRY(addr) );
         if( IS_TLB_ENABLED() && ent->flags & TLB_VALID )
             mmu_utlb_remove_entry( UTLB_ENTRY(addr) );
         ent->vpn = (val & 0xFFFFFC00);
@@ -1559,6 +1914,7 @@ void FASTCALL mmu_utlb_addr_write( sh4addr_t addr, uint32_t val, void *exc )
         ent->flags = (ent->flags & ~(TLB_DIRTY|TLB_VALID));
         ent->flags |= (val & TLB_VALID);
         ent->flags |= ((val & 0x200)>>7);
+        mmu_stlb_invalidate_entry( UTLB_ENTRY(addr) );
         if( IS_TLB_ENABLED() && ent->flags & TLB_VALID )
             mmu_utlb_insert_entry( UTLB_ENTRY(addr) );
     }
@@ -1570,11 +1926,13 @@ void FASTCALL mmu_utlb_data_write( sh4addr_t addr, uint32_t val )
     if( UTLB_DATA2(addr) ) {
         ent->pcmcia = val & 0x0000000F;
     } else {
+        mmu_stlb_invalidate_entry( UTLB_ENTRY(addr) );
         if( IS_TLB_ENABLED() && ent->flags & TLB_VALID )
             mmu_utlb_remove_entry( UTLB_ENTRY(addr) );
         ent->ppn = (val & 0x1FFFFC00);
         ent->flags = (val & 0x000001FF);
         ent->mask = get_tlb_size_mask(val);
+        mmu_stlb_invalidate_entry( UTLB_ENTRY(addr) );
         if( IS_TLB_ENABLED() && ent->flags & TLB_VALID )
             mmu_utlb_insert_entry( UTLB_ENTRY(addr) );
     }
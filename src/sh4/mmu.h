@@ -100,6 +100,42 @@ struct utlb_1k_entry {
     unsigned char code[TLB_FUNC_SIZE*18];
 };
 
+/**
+ * Software TLB: a direct-mapped cache of recent UTLB translations, indexed by
+ * 4K virtual page and tagged with the ASID used for the match (or
+ * MMU_STLB_TAG_SV for single-virtual privileged lookups, which ignore the
+ * ASID). This lets the slow-path lookups skip the linear UTLB scan on a hit.
+ * Only translations that are uniform across the whole 4K page are cached (ie
+ * no 1K pages, and nothing that remaps into P4).
+ */
+#define MMU_STLB_ENTRY_COUNT 256
+#define MMU_STLB_INDEX(vma) (((vma)>>12)&(MMU_STLB_ENTRY_COUNT-1))
+#define MMU_STLB_TAG_SV 0x100
+#define MMU_STLB_INVALID 0x00000001 /* Never matches a page-aligned vpn */
+
+struct mmu_stlb_entry {
+    sh4addr_t vpn;      // 4K virtual page, or MMU_STLB_INVALID
+    uint32_t tag;       // ASID or MMU_STLB_TAG_SV
+    sh4addr_t ppn;      // 4K physical page
+    mem_region_fn_t fn; // Region for the physical page
+    int entryNo;        // Source UTLB entry
+};
+
+extern struct mmu_stlb_entry mmu_stlb[MMU_STLB_ENTRY_COUNT];
+
+/**
+ * Look up the software TLB for the given address + tag.
+ * @return the matching entry, or NULL on a miss.
+ */
+static inline struct mmu_stlb_entry *mmu_stlb_lookup( sh4vma_t vma, uint32_t tag )
+{
+    struct mmu_stlb_entry *ent = &mmu_stlb[MMU_STLB_INDEX(vma)];
+    if( ent->vpn == (vma & MASK_4K) && ent->tag == tag ) {
+        return ent;
+    }
+    return NULL;
+}
+
 struct utlb_default_regions {
     mem_region_fn_t tlb_miss;
     mem_region_fn_t tlb_prot;
@@ -111,6 +147,29 @@ struct utlb_default_regions {
  */
 mem_region_fn_t *mmu_set_ext_address_space( mem_region_fn_t *space );
 
+/* Maximum number of per-ASID address spaces kept live at once, and the
+ * default limit. Spaces are only allocated as ASIDs are seen, so a workload
+ * with few processes doesn't pay for the rest */
+#define ASID_SPACE_MAX 16
+#define ASID_SPACE_DEFAULT 8
+
+/** Set the number of per-ASID page tables kept live at once (1 to always
+ * remap the current tables in place on an ASID switch).
+ */
+void mmu_set_asid_space_count( int count );
+
+/** Find the UTLB entry mapped at the given address in the current page
+ * tables (as opposed to searching the UTLB itself).
+ * @return the entryNo if found, -1 if not found, and -2 for a multi-hit.
+ */
+int mmu_utlb_entry_for_vpn( uint32_t vpn );
+
+/* UTLB array access (P4 0xF6000000-0xF7FFFFFF) */
+int32_t FASTCALL mmu_utlb_addr_read( sh4addr_t addr );
+int32_t FASTCALL mmu_utlb_data_read( sh4addr_t addr );
+void FASTCALL mmu_utlb_addr_write( sh4addr_t addr, uint32_t val, void *exc );
+void FASTCALL mmu_utlb_data_write( sh4addr_t addr, uint32_t val );
+
 /* Address translation functions */
 sh4addr_t FASTCALL mmu_vma_to_phys_disasm( sh4vma_t vma );
 mem_region_fn_t FASTCALL mmu_get_region_for_vma_read( sh4vma_t *addr );
@@ -143,6 +202,9 @@ void FASTCALL ccn_storequeue_prefetch( sh4addr_t addr );
 /** TLB-enabled variant of the storequeue prefetch */
 void FASTCALL ccn_storequeue_prefetch_tlb( sh4addr_t addr );
 
+/** Deliver any storequeue bursts to the PVR2 that are still being coalesced */
+void ccn_storequeue_flush( void );
+
 /** Non-storequeue prefetch */
 void FASTCALL ccn_prefetch( sh4addr_t addr );
 
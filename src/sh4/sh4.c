@@ -33,6 +33,7 @@
 #include "sh4/sh4core.h"
 #include "sh4/sh4dasm.h"
 #include "sh4/sh4mmio.h"
+#include "sh4/sh4pdi.h"
 #include "sh4/sh4stat.h"
 #include "sh4/sh4trans.h"
 #include "xlat/xltcache.h"
@@ -172,7 +173,9 @@ void sh4_set_core( sh4core_t core )
             sh4_shadow_init();
         }
     } else {
+        /* The pre-decoded blocks weren't kept up to date while translating */
         sh4_use_translator = FALSE;
+        sh4_pdi_flush_cache();
     }
 #endif
 }
@@ -206,6 +209,8 @@ void sh4_poweron_reset(void)
     memset( &sh4r, 0, sizeof(sh4r) );
     if(	sh4_use_translator ) {
         xlat_flush_cache();
+    } else {
+        sh4_pdi_flush_cache();
     }
 
     /* Resume running if we were halted */
@@ -279,6 +284,11 @@ uint32_t sh4_run_slice( uint32_t nanosecs )
     } else {
         sh4_running = TRUE;
 
+        /* The pre-decoded interpreter is only set up once it's needed */
+        if( !sh4_use_translator ) {
+            sh4_pdi_init();
+        }
+
         /* Execute the core's real slice */
 #ifdef SH4_TRANSLATOR
         if( sh4_use_translator ) {
@@ -293,6 +303,7 @@ uint32_t sh4_run_slice( uint32_t nanosecs )
     
     /* And finish off the peripherals afterwards */
 
+    ccn_storequeue_flush();
     sh4_running = FALSE;
     sh4_starting = FALSE;
     sh4r.slice_cycle = nanosecs;
@@ -320,6 +331,7 @@ void sh4_core_exit( int exit_code )
             exit_code != CORE_EXIT_BREAKPOINT ) {
             sh4_finalize_instruction();
         }
+        ccn_storequeue_flush();
         // longjmp back into sh4_run_slice
         sh4_running = FALSE;
         longjmp(sh4_exit_jmp_buf, exit_code);
@@ -347,6 +359,8 @@ int sh4_load_state( FILE * f )
 {
     if(	sh4_use_translator ) {
         xlat_flush_cache();
+    } else {
+        sh4_pdi_flush_cache();
     }
     fread( &sh4r, offsetof(struct sh4_registers, xlat_sh4_mode), 1, f );
     sh4r.xlat_sh4_mode = (sh4r.sr & SR_MD) | (sh4r.fpscr & (FPSCR_SZ|FPSCR_PR));
@@ -693,6 +707,8 @@ gboolean sh4_has_page( sh4vma_t vma )
 }
 
 void sh4_handle_pending_events() {
+    /* Anything scheduled may look at the PVR2 state */
+    ccn_storequeue_flush();
     if( sh4r.event_types & PENDING_EVENT ) {
         event_execute();
     }
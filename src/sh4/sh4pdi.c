@@ -0,0 +1,290 @@
+/**
+ * $Id$
+ *
+ * SH4 pre-decoded interpreter - block cache and decoder. Blocks run from
+ * the PC to the first branch (or the end of the icache/LUT page), and are
+ * looked up by physical address through a LUT with the same layout as the
+ * translation cache's, so they can be invalidated by the same SMC hooks.
+ * Block storage is a simple arena which is flushed completely when full.
+ *
+ * Each LUT entry covered by a block (other than block starts) records the
+ * covering block that starts closest to it, so a write only invalidates the
+ * blocks that actually contain the written address: any other covering
+ * block must also cover the instruction before the owner's start, and so on
+ * back. Pages that keep being written to stop decoding new blocks until the
+ * next full flush, so the code that changes runs through
+ * sh4_execute_instruction instead.
+ *
+ * The interpreter itself (sh4_pdi_execute_block) lives in sh4core.in, as it
+ * shares the instruction actions and support macros with
+ * sh4_execute_instruction.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <glib.h>
+#include "dream.h"
+#include "syscall.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4pdi.h"
+
+#define PDI_LUT_PAGES 0x10000
+#define PDI_LUT_PAGE_ENTRIES 4096
+#define PDI_LUT_PAGE_BYTES 0x2000
+#define PDI_LUT_PAGE(addr) (((addr)>>13) & 0xFFFF)
+#define PDI_LUT_ENTRY(addr) (((addr)&0x1FFE) >> 1)
+
+/* Entries covered by a block, but not a block start, hold the owning block
+ * with the low bit set */
+#define PDI_ENTRY_OWNED(block) ((sh4_pdi_block_t)(((uintptr_t)(block))|1))
+#define PDI_ENTRY_BLOCK(ent) ((sh4_pdi_block_t)(((uintptr_t)(ent))&~((uintptr_t)1)))
+#define IS_ENTRY_POINT(ent) ((ent) != NULL && (((uintptr_t)(ent))&1) == 0)
+
+/* Number of invalidations after which a page is no longer pre-decoded */
+#define PDI_SMC_THRESHOLD 64
+
+/* Opcodes of the instructions which end a block (ie may change the PC) */
+static const uint16_t sh4_pdi_branch_ops[] = {
+    0xA000 /* BRA */, 0xB000 /* BSR */, 0x0023 /* BRAF */, 0x0003 /* BSRF */,
+    0x8900 /* BT */, 0x8B00 /* BF */, 0x8D00 /* BT/S */, 0x8F00 /* BF/S */,
+    0x402B /* JMP */, 0x400B /* JSR */, 0x000B /* RTS */, 0x002B /* RTE */,
+    0x001B /* SLEEP */, 0xC300 /* TRAPA */ };
+
+static struct {
+    gboolean enabled;
+    void *decode[0x10000];        /* Handler for each opcode */
+    uint8_t ends_block[0x10000];  /* TRUE if the opcode ends a block */
+    char *cache, *cache_ptr;
+    sh4_pdi_block_t *lut[PDI_LUT_PAGES];
+    uint8_t smc_count[PDI_LUT_PAGES]; /* Invalidations per LUT page */
+} sh4pdi;
+
+/**
+ * @return the index of the gendec rule for the opcode, exactly as the
+ * decode switch in sh4_execute_instruction would pick it (or
+ * THREADED_RULE_COUNT if there isn't one).
+ */
+static int sh4_pdi_decode_rule( uint32_t ir )
+{
+#define THREADED_DECODER 1
+#define THREADED_DECODED(rule) return (rule)
+#include "sh4/sh4pdi.def"
+#undef THREADED_DECODED
+#undef THREADED_DECODER
+    return THREADED_RULE_COUNT;
+}
+
+void sh4_pdi_set_handlers( void * const *handlers, int count )
+{
+    gboolean branch_rule[count];
+    uint32_t ir;
+    int i;
+
+    memset( branch_rule, 0, sizeof(branch_rule) );
+    for( i=0; i<sizeof(sh4_pdi_branch_ops)/sizeof(sh4_pdi_branch_ops[0]); i++ ) {
+        branch_rule[sh4_pdi_decode_rule(sh4_pdi_branch_ops[i])] = TRUE;
+    }
+    for( ir=0; ir<0x10000; ir++ ) {
+        int rule = sh4_pdi_decode_rule(ir);
+        sh4pdi.decode[ir] = handlers[rule];
+        sh4pdi.ends_block[ir] = branch_rule[rule];
+    }
+}
+
+void sh4_pdi_init( void )
+{
+    if( sh4pdi.cache == NULL ) {
+        sh4pdi.cache = g_malloc( SH4_PDI_CACHE_SIZE );
+        sh4pdi.cache_ptr = sh4pdi.cache;
+#ifdef SH4_PREDECODE
+        sh4_pdi_execute_block( NULL, 0 );
+        sh4pdi.enabled = TRUE;
+#endif
+    }
+}
+
+void sh4_pdi_set_enabled( gboolean enabled )
+{
+#ifdef SH4_PREDECODE
+    sh4pdi.enabled = enabled;
+#endif
+}
+
+gboolean sh4_pdi_is_enabled( void )
+{
+    return sh4pdi.enabled;
+}
+
+static void sh4_pdi_flush_lut_page( sh4_pdi_block_t *page )
+{
+    int i;
+    for( i=0; i<PDI_LUT_PAGE_ENTRIES; i++ ) {
+        if( IS_ENTRY_POINT(page[i]) ) {
+            page[i]->active = FALSE;
+        }
+    }
+    memset( page, 0, PDI_LUT_PAGE_ENTRIES * sizeof(sh4_pdi_block_t) );
+}
+
+void sh4_pdi_flush_cache( void )
+{
+    int i;
+    for( i=0; i<PDI_LUT_PAGES; i++ ) {
+        if( sh4pdi.lut[i] != NULL ) {
+            sh4_pdi_flush_lut_page( sh4pdi.lut[i] );
+        }
+    }
+    sh4pdi.cache_ptr = sh4pdi.cache;
+    memset( sh4pdi.smc_count, 0, sizeof(sh4pdi.smc_count) );
+}
+
+void FASTCALL sh4_pdi_flush_page( sh4addr_t address )
+{
+    sh4_pdi_block_t *page = sh4pdi.lut[PDI_LUT_PAGE(address)];
+    if( page != NULL ) {
+        sh4_pdi_flush_lut_page( page );
+    }
+}
+
+/**
+ * Remove a block from the LUT, leaving any entries that belong to other
+ * blocks.
+ */
+static void sh4_pdi_remove_block( sh4_pdi_block_t *page, sh4_pdi_block_t block )
+{
+    sh4_pdi_block_t *ent = &page[PDI_LUT_ENTRY(block->start)];
+    sh4_pdi_block_t owned = PDI_ENTRY_OWNED(block);
+    uint32_t i;
+
+    block->active = FALSE;
+    ent[0] = NULL;
+    for( i=1; i<block->count; i++ ) {
+        if( ent[i] == owned ) {
+            ent[i] = NULL;
+        }
+    }
+}
+
+/**
+ * Invalidate every block that covers the given LUT entry.
+ * @return TRUE if any blocks were invalidated.
+ */
+static gboolean sh4_pdi_invalidate_entry( sh4_pdi_block_t *page, uint32_t entry )
+{
+    sh4_pdi_block_t ent = page[entry];
+    gboolean found = FALSE;
+
+    while( ent != NULL ) {
+        sh4_pdi_block_t block = PDI_ENTRY_BLOCK(ent);
+        uint32_t start = PDI_LUT_ENTRY(block->start);
+        if( start + block->count <= entry ) {
+            break;
+        }
+        ent = start == 0 ? NULL : page[start-1];
+        sh4_pdi_remove_block( page, block );
+        found = TRUE;
+    }
+    return found;
+}
+
+void FASTCALL sh4_pdi_invalidate_block( sh4addr_t address, size_t bytes )
+{
+    sh4addr_t end = address + bytes;
+    while( address < end ) {
+        sh4_pdi_block_t *page = sh4pdi.lut[PDI_LUT_PAGE(address)];
+        sh4addr_t page_end = (address & ~(PDI_LUT_PAGE_BYTES-1)) + PDI_LUT_PAGE_BYTES;
+        if( page_end > end || page_end == 0 ) {
+            page_end = end;
+        }
+        if( page != NULL ) {
+            sh4addr_t addr;
+            gboolean found = FALSE;
+            for( addr = address & ~1; addr < page_end; addr += 2 ) {
+                if( page[PDI_LUT_ENTRY(addr)] != NULL ) {
+                    found = sh4_pdi_invalidate_entry( page, PDI_LUT_ENTRY(addr) ) || found;
+                }
+            }
+            if( found && sh4pdi.smc_count[PDI_LUT_PAGE(address)] < PDI_SMC_THRESHOLD ) {
+                sh4pdi.smc_count[PDI_LUT_PAGE(address)]++;
+            }
+        }
+        address = page_end;
+    }
+}
+
+/**
+ * Decode a new block starting at pc (which must be in the icache).
+ */
+static sh4_pdi_block_t sh4_pdi_decode_block( sh4vma_t pc, sh4addr_t phys )
+{
+    uint16_t *code = (uint16_t *)GET_ICACHE_PTR(pc);
+    uint32_t max = (GET_ICACHE_END() - pc) >> 1;
+    uint32_t count = 0, i;
+    size_t size;
+
+    /* Blocks stop at the end of the LUT page as well, so that invalidation
+     * never needs to look at more than one page */
+    if( max > (PDI_LUT_PAGE_BYTES - (phys & (PDI_LUT_PAGE_BYTES-1))) >> 1 ) {
+        max = (PDI_LUT_PAGE_BYTES - (phys & (PDI_LUT_PAGE_BYTES-1))) >> 1;
+    }
+    while( count < max && !sh4pdi.ends_block[code[count++]] );
+
+    size = sizeof(struct sh4_pdi_block) + count * sizeof(struct sh4_pdi_op);
+    if( sh4pdi.cache_ptr + size > sh4pdi.cache + SH4_PDI_CACHE_SIZE ) {
+        sh4_pdi_flush_cache();
+    }
+
+    sh4_pdi_block_t *page = sh4pdi.lut[PDI_LUT_PAGE(phys)];
+    if( page == NULL ) {
+        page = sh4pdi.lut[PDI_LUT_PAGE(phys)] = g_malloc0( PDI_LUT_PAGE_ENTRIES * sizeof(sh4_pdi_block_t) );
+    }
+
+    sh4_pdi_block_t block = (sh4_pdi_block_t)sh4pdi.cache_ptr;
+    sh4pdi.cache_ptr += size;
+    block->active = TRUE;
+    block->count = count;
+    block->start = phys;
+    for( i=0; i<count; i++ ) {
+        block->op[i].handler = sh4pdi.decode[code[i]];
+        block->op[i].ir = code[i];
+    }
+
+    /* Take ownership of covered entries from any block that starts further
+     * back, but leave other block starts (and the entries they own) alone */
+    sh4_pdi_block_t *ent = &page[PDI_LUT_ENTRY(phys)];
+    ent[0] = block;
+    for( i=1; i<count; i++ ) {
+        if( ent[i] == NULL || (!IS_ENTRY_POINT(ent[i]) && PDI_ENTRY_BLOCK(ent[i])->start < phys) ) {
+            ent[i] = PDI_ENTRY_OWNED(block);
+        }
+    }
+    return block;
+}
+
+sh4_pdi_block_t sh4_pdi_get_block( sh4vma_t pc )
+{
+    if( IS_SYSCALL(pc) || (pc & 1) || !IS_IN_ICACHE(pc) || sh4_icache.page == NULL ) {
+        return NULL;
+    }
+
+    sh4addr_t phys = GET_ICACHE_PHYS(pc);
+    sh4_pdi_block_t *page = sh4pdi.lut[PDI_LUT_PAGE(phys)];
+    if( page != NULL && IS_ENTRY_POINT(page[PDI_LUT_ENTRY(phys)]) ) {
+        return page[PDI_LUT_ENTRY(phys)];
+    }
+    if( sh4pdi.smc_count[PDI_LUT_PAGE(phys)] >= PDI_SMC_THRESHOLD ) {
+        return NULL;
+    }
+    return sh4_pdi_decode_block( pc, phys );
+}
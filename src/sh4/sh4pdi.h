@@ -0,0 +1,104 @@
+/**
+ * $Id$
+ *
+ * SH4 pre-decoded interpreter. Basic blocks are decoded once into arrays of
+ * (handler, opcode) pairs, which sh4_pdi_execute_block then runs with
+ * threaded (computed-goto) dispatch. The handlers are generated from the
+ * same actions as sh4_execute_instruction (by gendec --threaded), so the two
+ * interpreters behave identically.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_sh4pdi_H
+#define lxdream_sh4pdi_H 1
+
+#include <glib.h>
+#include "dream.h"
+#include "mem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Threaded dispatch needs the GCC labels-as-values extension */
+#ifdef __GNUC__
+#define SH4_PREDECODE 1
+#endif
+
+/** Size of the pre-decoded block cache */
+#define SH4_PDI_CACHE_SIZE (8*1024*1024)
+
+struct sh4_pdi_op {
+    void *handler;
+    uint32_t ir;
+};
+
+struct sh4_pdi_block {
+    int active;     /* Cleared when the block is invalidated */
+    uint32_t count; /* Number of instructions */
+    sh4addr_t start; /* Physical address of the first instruction */
+    struct sh4_pdi_op op[0];
+};
+typedef struct sh4_pdi_block *sh4_pdi_block_t;
+
+/**
+ * Initialize the pre-decoded block cache and the decode table.
+ */
+void sh4_pdi_init( void );
+
+/**
+ * Enable or disable the pre-decoded interpreter (it is enabled by default).
+ * When disabled, sh4_emulate_run_slice steps through sh4_execute_instruction.
+ */
+void sh4_pdi_set_enabled( gboolean enabled );
+gboolean sh4_pdi_is_enabled( void );
+
+/**
+ * Return the pre-decoded block starting at the current PC, decoding it if
+ * necessary. Returns NULL if the PC isn't in the current icache page (or
+ * isn't somewhere a block can start), in which case the caller should fall
+ * back to sh4_execute_instruction.
+ */
+sh4_pdi_block_t sh4_pdi_get_block( sh4vma_t pc );
+
+/**
+ * Execute the given block from its first instruction, stopping at the end of
+ * the block, when an event becomes due, when the block is invalidated or at
+ * the end of the timeslice. Has the same return value and timing behaviour as
+ * sh4_execute_instruction, ie slice_cycle is advanced for every instruction
+ * executed except the last.
+ * @return FALSE if the CPU halted, otherwise TRUE
+ */
+gboolean sh4_pdi_execute_block( sh4_pdi_block_t block, uint32_t nanosecs );
+
+/**
+ * Called by sh4_pdi_execute_block( NULL, 0 ) to hand over the handler address
+ * for each rule (which are only visible inside the interpreter function).
+ */
+void sh4_pdi_set_handlers( void * const *handlers, int count );
+
+/**
+ * Cache invalidation - these are called from the corresponding xlat cache
+ * functions, so the pre-decoded blocks see exactly the same SMC hooks as
+ * translated code.
+ */
+void FASTCALL sh4_pdi_invalidate_block( sh4addr_t address, size_t bytes );
+void FASTCALL sh4_pdi_flush_page( sh4addr_t address );
+void sh4_pdi_flush_cache( void );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_sh4pdi_H */
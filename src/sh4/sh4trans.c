@@ -310,6 +310,8 @@ static struct xlat_symbol xlat_symbol_table[] = {
     { "sh4_cpu_period", &sh4_cpu_period },
     { "sh4_address_space", NULL },
     { "sh4_user_address_space", NULL },
+    { "&sh4_address_space", &sh4_address_space },
+    { "&sh4_user_address_space", &sh4_user_address_space },
     { "sh4_translate_breakpoint_hit", sh4_translate_breakpoint_hit },
     { "sh4_translate_link_block", sh4_translate_link_block },
     { "sh4_write_fpscr", sh4_write_fpscr },
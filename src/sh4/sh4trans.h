@@ -114,9 +114,10 @@ void sh4_translate_set_callbacks( xlat_block_begin_callback_t begin, xlat_block_
 void sh4_translate_set_fastmem( gboolean flag );
 
 /**
- * Set the address spaces for the translated code.
+ * Set the address spaces for the translated code, as pointers to the
+ * (privileged and user) page table pointers, which may change at runtime.
  */
-void sh4_translate_set_address_space( struct mem_region_fn **priv, struct mem_region_fn **user );
+void sh4_translate_set_address_space( struct mem_region_fn ***priv, struct mem_region_fn ***user );
 
 /**
  * From within the translator, (typically called from MMU exception handling routines)
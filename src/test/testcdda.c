@@ -0,0 +1,387 @@
+/**
+ * $Id$
+ *
+ * CD-DA streaming test and benchmark. Plays audio from a fake disc through
+ * the stream and checks that the mixed output is exactly the source audio
+ * at unity gain, across repeats, pause/resume, seeks and restarts; that
+ * the reported position follows the audio; that the level and pan
+ * registers are applied; and that resampling to 48kHz tracks the source.
+ * With --benchmark, also plays a few seconds in real time against a disc
+ * with simulated read latency to check that the mixer never waits on the
+ * disc.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "gdrom/gdrom.h"
+#include "drivers/cdrom/cdrom.h"
+
+#define CDDA_FRAMES_PER_SECTOR (CDROM_MAX_SECTOR_SIZE/4)
+#define CDDA_REPEAT_FOREVER 0x0F
+#define AUDIO_SECTORS 2000
+#define DATA_LBA 3000
+#define MIX_CHUNK 512
+#define READ_LATENCY_US 3000  /* Simulated disc read time per request */
+
+/* Unity gain: left input hard left, right input hard right */
+#define REG_LEFT  0x0F0F
+#define REG_RIGHT 0x0F1F
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+static struct cdrom_disc test_disc;
+static int disc_latency = 0;
+static gboolean sine_wave = FALSE;
+
+static int16_t sample_at( cdrom_lba_t lba, int frame, int channel )
+{
+    if( sine_wave ) {
+        double t = (lba * CDDA_FRAMES_PER_SECTOR + frame) / 44100.0;
+        return (int16_t)(16000 * sin( t * (channel ? 330 : 440) * 2 * M_PI ));
+    } else {
+        return (int16_t)((lba * 7919 + frame * 31 + channel * 17) & 0xFFFF);
+    }
+}
+
+cdrom_track_t cdrom_disc_get_track_by_lba( cdrom_disc_t disc, cdrom_lba_t lba )
+{
+    if( lba < AUDIO_SECTORS ) {
+        return &disc->track[0];
+    } else if( lba >= DATA_LBA ) {
+        return &disc->track[1];
+    }
+    return NULL;
+}
+
+cdrom_error_t cdrom_disc_read_sectors( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count,
+                                       cdrom_read_mode_t mode, unsigned char *buf, size_t *length )
+{
+    int16_t *p = (int16_t *)buf;
+    int i, j;
+    if( lba + count > AUDIO_SECTORS || CDROM_READ_TYPE(mode) != CDROM_READ_CDDA ) {
+        return CDROM_ERROR_BADREAD;
+    }
+    if( disc_latency != 0 ) {
+        usleep( disc_latency );
+    }
+    for( i=0; i<count; i++ ) {
+        for( j=0; j<CDDA_FRAMES_PER_SECTOR; j++ ) {
+            *p++ = sample_at( lba+i, j, 0 );
+            *p++ = sample_at( lba+i, j, 1 );
+        }
+    }
+    *length = count * CDROM_MAX_SECTOR_SIZE;
+    return CDROM_ERROR_OK;
+}
+
+/**
+ * Wait for the reader to fill the ring (or finish), so that the mixer will
+ * never see an underrun in the functional tests.
+ */
+static void wait_for_reader()
+{
+    while( !gdrom_cdda_is_buffered() ) {
+        usleep( 100 );
+    }
+}
+
+/**
+ * Mix count frames at 44.1kHz, checking they match the source starting at
+ * lba/frame (wrapping from end back to start for repeats).
+ */
+static gboolean check_play( cdrom_lba_t *lba, int *frame, cdrom_lba_t start, cdrom_lba_t end, int count )
+{
+    int32_t buf[MIX_CHUNK][2];
+    int i;
+
+    while( count > 0 ) {
+        int n = MIN( count, MIX_CHUNK );
+        wait_for_reader();
+        memset( buf, 0, sizeof(buf) );
+        gdrom_cdda_mix( buf, n, 44100, REG_LEFT, REG_RIGHT );
+        for( i=0; i<n; i++ ) {
+            if( buf[i][0] != sample_at( *lba, *frame, 0 ) << 6 ||
+                    buf[i][1] != sample_at( *lba, *frame, 1 ) << 6 ) {
+                fprintf( stderr, "Output mismatch at %d:%d: %d,%d (expected %d,%d)\n", *lba, *frame,
+                         buf[i][0] >> 6, buf[i][1] >> 6, sample_at( *lba, *frame, 0 ), sample_at( *lba, *frame, 1 ) );
+                return FALSE;
+            }
+            if( ++*frame == CDDA_FRAMES_PER_SECTOR ) {
+                *frame = 0;
+                if( ++*lba == end ) {
+                    *lba = start;
+                }
+            }
+        }
+        count -= n;
+    }
+    return TRUE;
+}
+
+static gboolean check_position( cdrom_lba_t expect, int expect_status )
+{
+    cdrom_lba_t lba;
+    int status = gdrom_cdda_get_status( &lba );
+    if( status != expect_status || lba != expect ) {
+        fprintf( stderr, "Expected status %02X at %d, but was %02X at %d\n", expect_status, expect, status, lba );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_play()
+{
+    cdrom_lba_t lba = 100;
+    int frame = 0;
+
+    if( gdrom_cdda_play( &test_disc, 100, 50, 0 ) != CDROM_ERROR_OK ) {
+        fprintf( stderr, "Play failed\n" );
+        return FALSE;
+    }
+    if( !check_play( &lba, &frame, 100, 150, 10 * CDDA_FRAMES_PER_SECTOR + 200 ) ||
+            !check_position( 110, GDROM_AUDIO_PLAYING ) ||
+            !check_play( &lba, &frame, 100, 150, 40 * CDDA_FRAMES_PER_SECTOR - 202 ) ) {
+        return FALSE;
+    }
+    /* Last two frames are still to come */
+    if( !check_position( 149, GDROM_AUDIO_PLAYING ) ||
+            !check_play( &lba, &frame, 100, 150, 2 ) ) {
+        return FALSE;
+    }
+    int32_t buf[MIX_CHUNK][2];
+    memset( buf, 0, sizeof(buf) );
+    gdrom_cdda_mix( buf, MIX_CHUNK, 44100, REG_LEFT, REG_RIGHT );
+    if( buf[0][0] != 0 || !check_position( 149, GDROM_AUDIO_COMPLETED ) ) {
+        fprintf( stderr, "Expected playback to complete\n" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_repeat()
+{
+    cdrom_lba_t lba = 1990;
+    int frame = 0;
+    gdrom_cdda_play( &test_disc, 1990, 10, 2 );
+    if( !check_play( &lba, &frame, 1990, 2000, 30 * CDDA_FRAMES_PER_SECTOR - 1 ) ||
+            !check_position( 1999, GDROM_AUDIO_PLAYING ) ) {
+        return FALSE;
+    }
+    gdrom_cdda_play( &test_disc, 500, 3, CDDA_REPEAT_FOREVER );
+    lba = 500;
+    frame = 0;
+    return check_play( &lba, &frame, 500, 503, 100 * CDDA_FRAMES_PER_SECTOR ) &&
+            check_position( 500, GDROM_AUDIO_PLAYING );
+}
+
+static gboolean test_pause_seek()
+{
+    int32_t buf[MIX_CHUNK][2];
+    cdrom_lba_t lba = 200;
+    int frame = 0;
+
+    gdrom_cdda_play( &test_disc, 200, 100, 0 );
+    if( !check_play( &lba, &frame, 200, 300, 5000 ) ) {
+        return FALSE;
+    }
+    gdrom_cdda_pause();
+    memset( buf, 0, sizeof(buf) );
+    gdrom_cdda_mix( buf, MIX_CHUNK, 44100, REG_LEFT, REG_RIGHT );
+    if( buf[0][0] != 0 || !check_position( 208, GDROM_AUDIO_PAUSED ) ) {
+        fprintf( stderr, "Expected silence while paused\n" );
+        return FALSE;
+    }
+    gdrom_cdda_resume();
+    if( !check_play( &lba, &frame, 200, 300, 5000 ) ) {
+        return FALSE;
+    }
+
+    /* Seek pauses at the new position, and play continues from there */
+    gdrom_cdda_seek( &test_disc, 250 );
+    if( !check_position( 250, GDROM_AUDIO_PAUSED ) ) {
+        return FALSE;
+    }
+    gdrom_cdda_resume();
+    lba = 250;
+    frame = 0;
+    if( !check_play( &lba, &frame, 200, 300, 5000 ) ) {
+        return FALSE;
+    }
+
+    /* Restart while the reader is part way through reading something else -
+     * nothing stale should come out */
+    disc_latency = 2000;
+    gdrom_cdda_play( &test_disc, 600, 100, 0 );
+    usleep( 1000 );
+    gdrom_cdda_play( &test_disc, 1000, 100, 0 );
+    disc_latency = 0;
+    lba = 1000;
+    frame = 0;
+    if( !check_play( &lba, &frame, 1000, 1100, 5000 ) ) {
+        return FALSE;
+    }
+    gdrom_cdda_stop();
+    memset( buf, 0, sizeof(buf) );
+    gdrom_cdda_mix( buf, MIX_CHUNK, 44100, REG_LEFT, REG_RIGHT );
+    if( buf[0][0] != 0 || gdrom_cdda_get_status( NULL ) != GDROM_AUDIO_NO_STATUS ) {
+        fprintf( stderr, "Expected silence after stop\n" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_invalid()
+{
+    if( gdrom_cdda_play( &test_disc, DATA_LBA, 10, 0 ) == CDROM_ERROR_OK ||
+            gdrom_cdda_play( &test_disc, 2500, 10, 0 ) == CDROM_ERROR_OK ) {
+        fprintf( stderr, "Expected play of non-audio track to fail\n" );
+        return FALSE;
+    }
+    if( gdrom_cdda_resume() == CDROM_ERROR_OK ) {
+        fprintf( stderr, "Expected resume without pause to fail\n" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_volume()
+{
+    int32_t buf[MIX_CHUNK][2];
+    int32_t l = sample_at( 300, 1, 0 ), r = sample_at( 300, 1, 1 );
+    gboolean result = TRUE;
+
+    /* -6dB, centred: both inputs go to both sides */
+    gdrom_cdda_play( &test_disc, 300, 10, 0 );
+    wait_for_reader();
+    memset( buf, 0, sizeof(buf) );
+    gdrom_cdda_mix( buf, 2, 44100, 0x0D00, 0x0D00 );
+    if( buf[1][0] != buf[1][1] || abs( buf[1][0] - (((l + r) * 8211) >> 8) ) > 1 ) {
+        fprintf( stderr, "Bad mix for centred -6dB: %d,%d\n", buf[1][0], buf[1][1] );
+        result = FALSE;
+    }
+    /* Send level of 0 is off */
+    memset( buf, 0, sizeof(buf) );
+    gdrom_cdda_mix( buf, 2, 44100, 0x000F, 0x001F );
+    if( buf[0][0] != 0 || buf[0][1] != 0 ) {
+        fprintf( stderr, "Expected silence at level 0\n" );
+        result = FALSE;
+    }
+    /* Swapped pan */
+    memset( buf, 0, sizeof(buf) );
+    gdrom_cdda_mix( buf, 1, 44100, REG_RIGHT, REG_LEFT );
+    if( buf[0][0] != sample_at( 300, 4, 1 ) << 6 || buf[0][1] != sample_at( 300, 4, 0 ) << 6 ) {
+        fprintf( stderr, "Bad mix for swapped channels\n" );
+        result = FALSE;
+    }
+    gdrom_cdda_stop();
+    return result;
+}
+
+static gboolean test_resample()
+{
+    static int32_t buf[48000+MIX_CHUNK][2];
+    double max_error = 0;
+    int i, done = 0;
+
+    sine_wave = TRUE;
+    gdrom_cdda_play( &test_disc, 0, 100, 0 );
+    memset( buf, 0, sizeof(buf) );
+    while( done < 48000 ) {
+        wait_for_reader();
+        gdrom_cdda_mix( buf + done, MIX_CHUNK, 48000, REG_LEFT, REG_RIGHT );
+        done += MIX_CHUNK;
+    }
+    for( i=0; i<48000 - MIX_CHUNK; i++ ) {
+        double t = i / 48000.0;
+        double err = fabs( buf[i][0] / 64.0 - 16000 * sin( t * 440 * 2 * M_PI ) );
+        if( err > max_error ) {
+            max_error = err;
+        }
+    }
+    gdrom_cdda_stop();
+    sine_wave = FALSE;
+    printf( "Resample to 48kHz: max error %.1f\n", max_error );
+    if( max_error > 16 ) {
+        fprintf( stderr, "Resampling error too high\n" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static uint32_t elapsed_us( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+/**
+ * Play 2 seconds in real time, in 10ms slices, with a slow disc.
+ */
+static void benchmark()
+{
+    int32_t buf[441][2];
+    struct timeval start;
+    uint32_t mix_us = 0, underruns = gdrom_cdda_get_underruns();
+    int i;
+
+    disc_latency = READ_LATENCY_US;
+    gdrom_cdda_play( &test_disc, 0, AUDIO_SECTORS, 0 );
+    usleep( 100000 ); /* Give the reader a head start, as the drive would have */
+    for( i=0; i<200; i++ ) {
+        gettimeofday( &start, NULL );
+        gdrom_cdda_mix( buf, 441, 44100, REG_LEFT, REG_RIGHT );
+        uint32_t us = elapsed_us( &start );
+        mix_us += us;
+        if( us < 10000 ) {
+            usleep( 10000 - us );
+        }
+    }
+    printf( "Real-time play: %d underruns, %.2fus per 10ms slice (disc latency %dus per read)\n",
+            gdrom_cdda_get_underruns() - underruns, mix_us / 200.0, READ_LATENCY_US );
+    gdrom_cdda_stop();
+    disc_latency = 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+
+    memset( &test_disc, 0, sizeof(test_disc) );
+    test_disc.track[0].trackno = 1;
+    test_disc.track[0].lba = 0;
+    test_disc.track[1].trackno = 2;
+    test_disc.track[1].lba = DATA_LBA;
+    test_disc.track[1].flags = TRACK_FLAG_DATA;
+    test_disc.track_count = 2;
+    test_disc.leadout = DATA_LBA + 1000;
+
+    result = test_play() && result;
+    result = test_repeat() && result;
+    result = test_pause_seek() && result;
+    result = test_invalid() && result;
+    result = test_volume() && result;
+    result = test_resample() && result;
+    if( argc > 1 && strcmp( argv[1], "--benchmark" ) == 0 ) {
+        benchmark();
+    }
+    return result ? 0 : 1;
+}
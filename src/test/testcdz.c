@@ -0,0 +1,328 @@
+/**
+ * $Id$
+ *
+ * Compressed disc image test and benchmark. Writes a two-track disc (audio
+ * plus a partly-compressible data track) out as a CDZ image, reads it back
+ * and checks every sector against the original. With --benchmark, uses a
+ * larger disc and compares compression time, random seek latency and
+ * sequential throughput against the uncompressed image.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "drivers/cdrom/cdimpl.h"
+
+#define TEST_AUDIO_SECTORS 300
+#define TEST_DATA_SECTORS 1200   /* More than the decompressed hunk cache holds */
+#define BENCH_AUDIO_SECTORS 1500
+#define BENCH_DATA_SECTORS 12000
+#define DATA_LBA (audio_sectors + 11400)
+#define RANDOM_READS 20000
+
+extern struct cdrom_disc_factory cdz_disc_factory;
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+int cd_build_address( unsigned char inout[], int sectortype, unsigned address ) { return 0; }
+int do_encode_L2( unsigned char *inout, int sectortype, unsigned address ) { return 0; }
+cdrom_error_t cdrom_disc_read_sectors( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count, cdrom_read_mode_t mode,
+                                       unsigned char *buf, size_t *length ) { return CDROM_ERROR_NODISC; }
+gchar *get_filename_at( const gchar *at, const gchar *filename )
+{
+    return g_strdup_printf( "%s/%s", at, filename );
+}
+
+static int audio_sectors = TEST_AUDIO_SECTORS;
+static int data_sectors = TEST_DATA_SECTORS;
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+static void fill_audio( unsigned char *buf, cdrom_lba_t lba )
+{
+    int16_t *p = (int16_t *)buf;
+    int i;
+    for( i=0; i<2352/4; i++ ) {
+        double t = (lba * (2352/4) + i) / 44100.0;
+        p[i*2] = (int16_t)(8000 * sin( t * 440 * 2 * M_PI ) + (test_rand() & 0x3F));
+        p[i*2+1] = (int16_t)(8000 * sin( t * 660 * 2 * M_PI ) + (test_rand() & 0x3F));
+    }
+}
+
+/**
+ * Every fourth run of 64 sectors is random (and so gets stored rather than
+ * compressed), the rest is text-like and compresses well.
+ */
+static void fill_data( unsigned char *buf, cdrom_lba_t lba )
+{
+    int i;
+    if( (lba / 64) % 4 == 3 ) {
+        for( i=0; i<2048; i++ )
+            buf[i] = test_rand();
+    } else {
+        for( i=0; i<2048; i+=32 ) {
+            snprintf( (char *)buf + i, 32, "SECTOR %08d OFFSET %04d ...", lba, i );
+        }
+    }
+}
+
+static sector_source_t create_track( sector_mode_t mode, cdrom_count_t sectors,
+                                     void (*fill)(unsigned char *, cdrom_lba_t) )
+{
+    unsigned char buf[2352];
+    sector_source_t source = tmpfile_sector_source_new( mode );
+    FILE *f = file_sector_source_get_file( source );
+    cdrom_lba_t lba;
+
+    for( lba=0; lba<sectors; lba++ ) {
+        fill( buf, lba );
+        if( fwrite( buf, CDROM_SECTOR_SIZE(mode), 1, f ) != 1 ) {
+            fprintf( stderr, "Unable to write test image\n" );
+            exit(2);
+        }
+    }
+    fflush( f );
+    source->size = sectors;
+    sector_source_ref( source );
+    return source;
+}
+
+static void create_disc( cdrom_disc_t disc )
+{
+    memset( disc, 0, sizeof(struct cdrom_disc) );
+    disc->track[0].trackno = 1;
+    disc->track[0].sessionno = 1;
+    disc->track[0].lba = 0;
+    disc->track[0].flags = 0;
+    disc->track[0].source = create_track( SECTOR_CDDA, audio_sectors, fill_audio );
+    disc->track[1].trackno = 2;
+    disc->track[1].sessionno = 2;
+    disc->track[1].lba = DATA_LBA;
+    disc->track[1].flags = TRACK_FLAG_DATA;
+    disc->track[1].source = create_track( SECTOR_MODE1, data_sectors, fill_data );
+    disc->track_count = 2;
+    disc->session_count = 2;
+    disc->disc_type = CDROM_DISC_GDROM;
+    disc->leadout = DATA_LBA + data_sectors;
+    strcpy( disc->mcn, "0123456789012" );
+}
+
+static gboolean open_cdz( cdrom_disc_t disc, const char *filename )
+{
+    ERROR err;
+    memset( disc, 0, sizeof(struct cdrom_disc) );
+    disc->base_source = file_sector_source_new_filename( filename, SECTOR_UNKNOWN, 0, FILE_SECTOR_FULL_FILE );
+    if( disc->base_source == NULL ) {
+        fprintf( stderr, "Unable to open %s\n", filename );
+        return FALSE;
+    }
+    sector_source_ref( disc->base_source );
+    if( !cdz_disc_factory.is_valid_file( file_sector_source_get_file( disc->base_source ) ) ) {
+        fprintf( stderr, "CDZ image not recognized\n" );
+        return FALSE;
+    }
+    if( !cdz_disc_factory.read_toc( disc, &err ) ) {
+        fprintf( stderr, "Unable to read CDZ image: %s\n", err.msg );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void close_disc( cdrom_disc_t disc )
+{
+    int i;
+    for( i=0; i<disc->track_count; i++ ) {
+        sector_source_unref( disc->track[i].source );
+    }
+    sector_source_unref( disc->base_source );
+}
+
+static gboolean test_toc( cdrom_disc_t raw, cdrom_disc_t cdz )
+{
+    int i;
+    if( cdz->track_count != raw->track_count || cdz->session_count != raw->session_count ||
+            cdz->disc_type != raw->disc_type || cdz->leadout != raw->leadout ||
+            strcmp( cdz->mcn, raw->mcn ) != 0 ) {
+        fprintf( stderr, "Disc TOC mismatch\n" );
+        return FALSE;
+    }
+    for( i=0; i<raw->track_count; i++ ) {
+        if( cdz->track[i].trackno != raw->track[i].trackno || cdz->track[i].sessionno != raw->track[i].sessionno ||
+                cdz->track[i].lba != raw->track[i].lba || cdz->track[i].flags != raw->track[i].flags ||
+                cdz->track[i].source->mode != raw->track[i].source->mode ||
+                cdz->track[i].source->size != raw->track[i].source->size ) {
+            fprintf( stderr, "Track %d mismatch\n", i+1 );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean compare_read( sector_source_t raw, sector_source_t cdz, cdrom_lba_t lba, cdrom_count_t count )
+{
+    static unsigned char expect[2352*40], buf[2352*40];
+    size_t size = count * CDROM_SECTOR_SIZE(raw->mode);
+    if( sector_source_read( raw, lba, count, expect ) != CDROM_ERROR_OK ||
+            sector_source_read( cdz, lba, count, buf ) != CDROM_ERROR_OK ) {
+        fprintf( stderr, "Read failed at %d+%d\n", lba, count );
+        return FALSE;
+    }
+    if( memcmp( buf, expect, size ) != 0 ) {
+        fprintf( stderr, "Data mismatch at %d+%d\n", lba, count );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_read( cdrom_disc_t raw, cdrom_disc_t cdz )
+{
+    int i, n;
+    for( i=0; i<raw->track_count; i++ ) {
+        sector_source_t source = raw->track[i].source;
+        cdrom_lba_t lba;
+        /* Sequential, in odd-sized reads */
+        for( lba=0; lba<source->size; lba += 7 ) {
+            cdrom_count_t count = source->size - lba < 7 ? source->size - lba : 7;
+            if( !compare_read( source, cdz->track[i].source, lba, count ) )
+                return FALSE;
+        }
+        for( n=0; n<2000; n++ ) {
+            cdrom_count_t count = (test_rand() % 40) + 1;
+            lba = test_rand() % (source->size - count);
+            if( !compare_read( source, cdz->track[i].source, lba, count ) )
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean test_invalid( const char *filename, off_t size )
+{
+    struct cdrom_disc disc;
+    ERROR err;
+    gboolean result = TRUE;
+
+    /* Truncate the hunk index at the end of the image, which should be caught by the reader */
+    if( truncate( filename, size - 1 ) != 0 ) {
+        return FALSE;
+    }
+    memset( &disc, 0, sizeof(disc) );
+    disc.base_source = file_sector_source_new_filename( filename, SECTOR_UNKNOWN, 0, FILE_SECTOR_FULL_FILE );
+    sector_source_ref( disc.base_source );
+    if( cdz_disc_factory.read_toc( &disc, &err ) ) {
+        fprintf( stderr, "Expected corrupt image to fail\n" );
+        result = FALSE;
+    }
+    sector_source_unref( disc.base_source );
+    return result;
+}
+
+static uint32_t elapsed_us( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+static void benchmark_source( const char *name, sector_source_t source )
+{
+    unsigned char buf[2048];
+    struct timeval start;
+    uint32_t sum = 0, us;
+    cdrom_lba_t lba;
+    int n;
+
+    gettimeofday( &start, NULL );
+    for( lba=0; lba<source->size; lba++ ) {
+        sector_source_read( source, lba, 1, buf );
+        sum += buf[lba&2047];
+    }
+    us = elapsed_us(&start);
+    printf( "%-4s sequential: %6dms (%5.0f MB/s)\n", name, us/1000,
+            us == 0 ? 0.0 : (source->size * 2048.0) / us );
+
+    test_seed = 0x5EED;
+    gettimeofday( &start, NULL );
+    for( n=0; n<RANDOM_READS; n++ ) {
+        lba = test_rand() % source->size;
+        sector_source_read( source, lba, 1, buf );
+        sum += buf[lba&2047];
+    }
+    us = elapsed_us(&start);
+    printf( "%-4s random seek: %5.1fus per read (%08X)\n", name, (double)us / RANDOM_READS, sum );
+}
+
+int main( int argc, char *argv[] )
+{
+    struct cdrom_disc raw, cdz;
+    struct stat st;
+    gboolean result = TRUE, bench = argc > 1 && strcmp( argv[1], "--benchmark" ) == 0;
+    char filename[] = "/tmp/testcdz-XXXXXX";
+    ERROR err;
+    int fd = mkstemp( filename );
+
+    if( bench ) {
+        audio_sectors = BENCH_AUDIO_SECTORS;
+        data_sectors = BENCH_DATA_SECTORS;
+    }
+    if( fd == -1 ) {
+        fprintf( stderr, "Unable to create temporary file\n" );
+        return 2;
+    }
+    close( fd );
+
+    create_disc( &raw );
+    struct timeval start;
+    gettimeofday( &start, NULL );
+    if( !cdrom_disc_write_compressed( &raw, filename, &err ) ) {
+        fprintf( stderr, "Unable to write CDZ image: %s\n", err.msg );
+        unlink( filename );
+        return 1;
+    }
+    stat( filename, &st );
+    if( bench ) {
+        uint64_t raw_size = audio_sectors * 2352 + data_sectors * 2048;
+        printf( "Compressed %lld bytes to %lld (%.1f%%) in %dms\n", (long long)raw_size, (long long)st.st_size,
+                st.st_size * 100.0 / raw_size, elapsed_us(&start)/1000 );
+    }
+
+    if( !open_cdz( &cdz, filename ) ) {
+        unlink( filename );
+        return 1;
+    }
+    result = test_toc( &raw, &cdz ) && result;
+    result = test_read( &raw, &cdz ) && result;
+
+    if( bench ) {
+        benchmark_source( "raw", raw.track[1].source );
+        benchmark_source( "cdz", cdz.track[1].source );
+    }
+
+    close_disc( &cdz );
+    result = test_invalid( filename, st.st_size ) && result;
+    close_disc( &raw );
+    unlink( filename );
+    return result ? 0 : 1;
+}
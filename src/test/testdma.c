@@ -0,0 +1,321 @@
+/**
+ * $Id$
+ *
+ * DMA engine test and benchmark. Checks that dma_copy/dma_write resolve
+ * source and destination spans correctly across region boundaries, that
+ * timed channels move their data in bandwidth-sized steps, and compares
+ * large transfers against the old copy-through-a-buffer approach.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "dma.h"
+#include "eventq.h"
+#include "mem.h"
+#include "mmio.h"
+#include "pvr2/pvr2.h"
+
+#define MAIN_RAM_BASE  0x0C000000
+#define MAIN_RAM_SIZE  (16*1024*1024)
+#define AUDIO_RAM_BASE 0x00800000
+#define AUDIO_RAM_SIZE (2*1024*1024)
+#define SPLIT_BASE     0x00700000 /* Two pages, not contiguous on the host */
+#define VRAM64_BASE    0x04000000
+#define VRAM_SIZE      (8*1024*1024)
+#define TA_BASE        0x10000000
+#define ITERATIONS 20
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+static unsigned char *main_ram, *audio_ram, *vram, *split_pages;
+static unsigned char *page_map[0x20000];
+
+static int xlat_invalidate_count, ta_write_count;
+static unsigned char *ta_write_src;
+static uint32_t ta_write_length;
+
+static event_func_t event_callbacks[MAX_EVENT_ID];
+static uint32_t event_times[MAX_EVENT_ID];
+
+/******************************* Fake event queue ***************************/
+
+void register_event_callback( int eventid, event_func_t func )
+{
+    event_callbacks[eventid] = func;
+}
+
+void event_schedule( int eventid, uint32_t nanosecs )
+{
+    event_times[eventid] = nanosecs;
+}
+
+void event_cancel( int eventid )
+{
+    event_times[eventid] = NOT_SCHEDULED;
+}
+
+/****************************** Fake memory map *****************************/
+
+sh4ptr_t mem_get_region( uint32_t addr )
+{
+    sh4ptr_t page = page_map[ (addr & 0x1FFFFFFF) >> 12 ];
+    if( page == NULL ) {
+        return NULL;
+    }
+    return page + (addr & 0xFFF);
+}
+
+void FASTCALL xlat_invalidate_block( sh4addr_t address, size_t bytes )
+{
+    xlat_invalidate_count++;
+}
+
+gboolean pvr2_render_buffer_invalidate( sh4addr_t addr, gboolean isWrite )
+{
+    return FALSE;
+}
+
+void pvr2_dma_write( sh4addr_t destaddr, unsigned char *src, uint32_t count )
+{
+    ta_write_count++;
+    ta_write_src = src;
+    ta_write_length = count;
+}
+
+/* Plain linear stand-ins for the 64-bit VRAM accessors */
+void pvr2_vram64_write( sh4addr_t destaddr, unsigned char *src, uint32_t length )
+{
+    memcpy( vram + (destaddr & 0x7FFFFF), src, length );
+}
+
+void pvr2_vram64_read( unsigned char *dest, sh4addr_t srcaddr, uint32_t length )
+{
+    memcpy( dest, vram + (srcaddr & 0x7FFFFF), length );
+}
+
+static void map_region( uint32_t base, unsigned char *mem, uint32_t size )
+{
+    uint32_t i;
+    for( i=0; i<size; i+= LXDREAM_PAGE_SIZE ) {
+        page_map[(base+i)>>12] = mem + i;
+    }
+}
+
+static void init_memory()
+{
+    int i;
+    main_ram = g_malloc( MAIN_RAM_SIZE );
+    audio_ram = g_malloc0( AUDIO_RAM_SIZE );
+    vram = g_malloc( VRAM_SIZE );
+    split_pages = g_malloc0( LXDREAM_PAGE_SIZE * 3 );
+    for( i=0; i<MAIN_RAM_SIZE; i++ ) {
+        main_ram[i] = (i * 7) ^ (i >> 11);
+    }
+    for( i=0; i<VRAM_SIZE; i++ ) {
+        vram[i] = (i * 13) ^ (i >> 9);
+    }
+    map_region( MAIN_RAM_BASE, main_ram, MAIN_RAM_SIZE );
+    map_region( AUDIO_RAM_BASE, audio_ram, AUDIO_RAM_SIZE );
+    page_map[SPLIT_BASE>>12] = split_pages + 2*LXDREAM_PAGE_SIZE;
+    page_map[(SPLIT_BASE>>12)+1] = split_pages;
+}
+
+/********************************* Tests ************************************/
+
+static gboolean test_copy()
+{
+    gboolean result = TRUE;
+
+    /* Main RAM to audio RAM, should invalidate once for the whole transfer */
+    xlat_invalidate_count = 0;
+    dma_copy( AUDIO_RAM_BASE + 0x100, MAIN_RAM_BASE + 0x1234, AUDIO_RAM_SIZE - 0x100 );
+    if( memcmp( audio_ram + 0x100, main_ram + 0x1234, AUDIO_RAM_SIZE - 0x100 ) != 0 ) {
+        fprintf( stderr, "Main RAM => audio RAM copy mismatch\n" );
+        result = FALSE;
+    }
+    if( xlat_invalidate_count != 1 ) {
+        fprintf( stderr, "Expected 1 invalidation, got %d\n", xlat_invalidate_count );
+        result = FALSE;
+    }
+
+    /* Destination crossing from one host block to another */
+    dma_copy( SPLIT_BASE + 0x800, MAIN_RAM_BASE + 0x10000, LXDREAM_PAGE_SIZE );
+    if( memcmp( split_pages + 2*LXDREAM_PAGE_SIZE + 0x800, main_ram + 0x10000, 0x800 ) != 0 ||
+        memcmp( split_pages, main_ram + 0x10800, 0x800 ) != 0 ) {
+        fprintf( stderr, "Split destination copy mismatch\n" );
+        result = FALSE;
+    }
+
+    /* Source crossing from one host block to another */
+    dma_copy( AUDIO_RAM_BASE, SPLIT_BASE + 0x400, LXDREAM_PAGE_SIZE );
+    if( memcmp( audio_ram, split_pages + 2*LXDREAM_PAGE_SIZE + 0x400, 0xC00 ) != 0 ||
+        memcmp( audio_ram + 0xC00, split_pages, 0x400 ) != 0 ) {
+        fprintf( stderr, "Split source copy mismatch\n" );
+        result = FALSE;
+    }
+
+    /* 64-bit VRAM to main RAM */
+    dma_copy( MAIN_RAM_BASE + 0x100000, VRAM64_BASE + 0x40, 0x20000 );
+    if( memcmp( main_ram + 0x100000, vram + 0x40, 0x20000 ) != 0 ) {
+        fprintf( stderr, "VRAM64 => main RAM copy mismatch\n" );
+        result = FALSE;
+    }
+
+    /* The upper half of the 64-bit area mirrors the lower half */
+    memset( main_ram + 0x100000, 0, 0x1000 );
+    dma_copy( MAIN_RAM_BASE + 0x100000, VRAM64_BASE + VRAM_SIZE + 0x80, 0x1000 );
+    if( memcmp( main_ram + 0x100000, vram + 0x80, 0x1000 ) != 0 ) {
+        fprintf( stderr, "VRAM64 mirror => main RAM copy mismatch\n" );
+        result = FALSE;
+    }
+
+    /* Main RAM to the TA should be a single write straight from RAM */
+    ta_write_count = 0;
+    dma_copy( TA_BASE, MAIN_RAM_BASE + 0x200000, 0x10000 );
+    if( ta_write_count != 1 || ta_write_src != main_ram + 0x200000 || ta_write_length != 0x10000 ) {
+        fprintf( stderr, "Main RAM => TA was not a single direct write (%d writes)\n", ta_write_count );
+        result = FALSE;
+    }
+
+    /* Host buffer to RAM, ending in unmapped space */
+    memset( audio_ram, 0, AUDIO_RAM_SIZE );
+    dma_write( AUDIO_RAM_BASE + AUDIO_RAM_SIZE - 0x100, main_ram, 0x200 );
+    if( memcmp( audio_ram + AUDIO_RAM_SIZE - 0x100, main_ram, 0x100 ) != 0 ) {
+        fprintf( stderr, "Host => audio RAM write mismatch\n" );
+        result = FALSE;
+    }
+    return result;
+}
+
+static int complete_count;
+
+static void count_complete( struct dma_channel *channel )
+{
+    complete_count++;
+}
+
+static gboolean test_timed()
+{
+    struct dma_channel channel = { 1, 10000000, NULL, count_complete };
+    gboolean result = TRUE;
+    int steps = 0;
+
+    dma_channel_init( &channel );
+    memset( audio_ram, 0, AUDIO_RAM_SIZE );
+
+    /* Instant mode completes immediately */
+    complete_count = 0;
+    dma_set_timed( FALSE );
+    dma_channel_start( &channel, AUDIO_RAM_BASE, MAIN_RAM_BASE, 4500 );
+    if( complete_count != 1 || dma_channel_is_active(&channel) ||
+        memcmp( audio_ram, main_ram, 4500 ) != 0 ) {
+        fprintf( stderr, "Instant transfer did not complete\n" );
+        result = FALSE;
+    }
+
+    /* 10MB/s should move 1000 bytes per 100us step */
+    memset( audio_ram, 0, AUDIO_RAM_SIZE );
+    complete_count = 0;
+    event_times[1] = NOT_SCHEDULED;
+    dma_set_timed( TRUE );
+    dma_channel_start( &channel, AUDIO_RAM_BASE, MAIN_RAM_BASE + 0x100, 4500 );
+    while( event_times[1] != NOT_SCHEDULED && steps < 10 ) {
+        uint32_t expected = steps < 4 ? 100000 : 50000;
+        uint32_t moved = steps * 1000;
+        if( event_times[1] != expected ) {
+            fprintf( stderr, "Step %d scheduled for %dns, expected %dns\n", steps, event_times[1], expected );
+            result = FALSE;
+        }
+        if( audio_ram[moved] != 0 || (moved != 0 && audio_ram[moved-1] != main_ram[0x100 + moved - 1]) ) {
+            fprintf( stderr, "Step %d has not moved exactly %d bytes\n", steps, moved );
+            result = FALSE;
+        }
+        event_times[1] = NOT_SCHEDULED;
+        steps++;
+        event_callbacks[1]( 1 );
+    }
+    if( steps != 5 || complete_count != 1 || dma_channel_is_active(&channel) ||
+        memcmp( audio_ram, main_ram + 0x100, 4500 ) != 0 ) {
+        fprintf( stderr, "Timed transfer completed incorrectly (%d steps)\n", steps );
+        result = FALSE;
+    }
+
+    /* Cancelled transfers don't complete */
+    complete_count = 0;
+    dma_channel_start( &channel, AUDIO_RAM_BASE, MAIN_RAM_BASE, 4500 );
+    dma_channel_cancel( &channel );
+    if( event_times[1] != NOT_SCHEDULED || complete_count != 0 || dma_channel_is_active(&channel) ) {
+        fprintf( stderr, "Cancelled transfer is still active\n" );
+        result = FALSE;
+    }
+    dma_set_timed( FALSE );
+    return result;
+}
+
+/******************************* Benchmark **********************************/
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+/**
+ * The old transfer method - copy into a temporary buffer and back out again
+ */
+static void buffered_copy( sh4addr_t destaddr, sh4addr_t srcaddr, uint32_t length )
+{
+    unsigned char *buf = g_malloc( length );
+    memcpy( buf, mem_get_region(srcaddr), length );
+    memcpy( mem_get_region(destaddr), buf, length );
+    g_free( buf );
+}
+
+static void benchmark( const char *name, sh4addr_t destaddr, sh4addr_t srcaddr, uint32_t length )
+{
+    struct timeval start;
+    uint32_t buffered, direct;
+    int i;
+
+    gettimeofday( &start, NULL );
+    for( i=0; i<ITERATIONS; i++ ) {
+        buffered_copy( destaddr, srcaddr, length );
+    }
+    buffered = elapsed_ms(&start);
+
+    gettimeofday( &start, NULL );
+    for( i=0; i<ITERATIONS; i++ ) {
+        dma_copy( destaddr, srcaddr, length );
+    }
+    direct = elapsed_ms(&start);
+    printf( "%-22s %5dKB x %d: buffered %5dms, direct %5dms\n", name, length>>10, 
+            ITERATIONS, buffered, direct );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result;
+
+    init_memory();
+    result = test_copy();
+    result = test_timed() && result;
+    benchmark( "Main RAM => audio RAM", AUDIO_RAM_BASE, MAIN_RAM_BASE, AUDIO_RAM_SIZE );
+    benchmark( "Main RAM => main RAM", MAIN_RAM_BASE + MAIN_RAM_SIZE/2, MAIN_RAM_BASE, MAIN_RAM_SIZE/2 );
+    return result ? 0 : 1;
+}
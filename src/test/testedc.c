@@ -0,0 +1,247 @@
+/**
+ * $Id$
+ *
+ * L2 EDC/ECC encoder test and benchmark. Checks that do_encode_L2 produces
+ * exactly the same sectors as the original table-driven cdrkit encoder for
+ * each of the data sector modes, and compares their throughput.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "drivers/cdrom/defs.h"
+#include "drivers/cdrom/ecc.h"
+#include "drivers/cdrom/edc_crctable.h"
+#include "drivers/cdrom/edc_l2sq.h"
+
+#define BENCH_SECTORS 20000
+#define SYNCPATTERN "\000\377\377\377\377\377\377\377\377\377\377"
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+/************************ Reference encoder *************************/
+
+/* The original cdrkit implementations of the EDC and P/Q parity */
+static unsigned int ref_build_edc( unsigned char inout[], int from, int upto )
+{
+    unsigned char *p = inout+from;
+    unsigned int result = 0;
+    int i;
+
+    for( i=from; i<=upto; i++ ) {
+        result = EDC_crctable[(result ^ *p++) & 0xffL] ^ (result >> 8);
+    }
+    return result;
+}
+
+static void ref_encode_L2_Q( unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P + L2_Q] )
+{
+    unsigned char *dps = inout, *dp;
+    unsigned char *Q = inout + 4 + L2_RAW + 4 + 8 + L2_P;
+    int i, j;
+
+    for( j = 0; j < 26; j++ ) {
+        unsigned short a = 0, b = 0;
+        dp = dps;
+        for( i = 0; i < 43; i++ ) {
+            a ^= L2sq[i][*dp++];
+            b ^= L2sq[i][*dp];
+            dp += 2*44-1;
+            if( dp >= &inout[(4 + L2_RAW + 4 + 8 + L2_P)] ) {
+                dp -= (4 + L2_RAW + 4 + 8 + L2_P);
+            }
+        }
+        Q[0] = a >> 8;
+        Q[26*2] = a;
+        Q[1] = b >> 8;
+        Q[26*2+1] = b;
+        Q += 2;
+        dps += 2*43;
+    }
+}
+
+static void ref_encode_L2_P( unsigned char inout[4 + L2_RAW + 4 + 8 + L2_P] )
+{
+    unsigned char *dp;
+    unsigned char *P = inout + 4 + L2_RAW + 4 + 8;
+    int i, j;
+
+    for( j = 0; j < 43; j++ ) {
+        unsigned short a = 0, b = 0;
+        dp = inout;
+        for( i = 19; i < 43; i++ ) {
+            a ^= L2sq[i][*dp++];
+            b ^= L2sq[i][*dp];
+            dp += 2*43 -1;
+        }
+        P[0] = a >> 8;
+        P[43*2] = a;
+        P[1] = b >> 8;
+        P[43*2+1] = b;
+        P += 2;
+        inout += 2;
+    }
+}
+
+static void ref_store_edc( unsigned char *p, unsigned int edc )
+{
+    p[0] = edc;
+    p[1] = edc >> 8;
+    p[2] = edc >> 16;
+    p[3] = edc >> 24;
+}
+
+static void ref_encode_L2( unsigned char inout[2352], int sectortype, unsigned address )
+{
+    memcpy( inout, SYNCPATTERN, sizeof(SYNCPATTERN) );
+    switch( sectortype ) {
+    case MODE_1:
+        cd_build_address( inout, sectortype, address );
+        ref_store_edc( inout+2064, ref_build_edc( inout, 0, 16+2048-1 ) );
+        memset( inout+2064+4, 0, 8 );
+        ref_encode_L2_P( inout+12 );
+        ref_encode_L2_Q( inout+12 );
+        break;
+    case MODE_2_FORM_1:
+        ref_store_edc( inout+2072, ref_build_edc( inout, 16, 16+8+2048-1 ) );
+        memset( inout+12, 0, 4 );
+        ref_encode_L2_P( inout+12 );
+        ref_encode_L2_Q( inout+12 );
+        cd_build_address( inout, sectortype, address );
+        break;
+    case MODE_2_FORM_2:
+        cd_build_address( inout, sectortype, address );
+        ref_store_edc( inout+2348, ref_build_edc( inout, 16, 16+8+2324-1 ) );
+        break;
+    }
+}
+
+/************************ Tests *************************/
+
+static void fill_sector( unsigned char *buf, int sectortype )
+{
+    int i;
+    memset( buf, 0, 2352 );
+    for( i=16; i<2352; i++ ) {
+        buf[i] = test_rand();
+    }
+    if( sectortype == MODE_2_FORM_1 || sectortype == MODE_2_FORM_2 ) {
+        /* Subheader is repeated */
+        memcpy( buf+20, buf+16, 4 );
+    }
+}
+
+static gboolean test_encode( int sectortype, const char *name )
+{
+    unsigned char data[2352], expect[2352], buf[2352];
+    int n;
+
+    for( n=0; n<2000; n++ ) {
+        unsigned address = test_rand() % 360000;
+        fill_sector( data, sectortype );
+        /* Mostly random sectors, but also the all-zeroes and all-ones extremes */
+        if( n == 0 ) {
+            memset( data+16, 0, 2352-16 );
+        } else if( n == 1 ) {
+            memset( data+16, 0xFF, 2352-16 );
+        }
+        memcpy( expect, data, 2352 );
+        memcpy( buf, data, 2352 );
+        ref_encode_L2( expect, sectortype, address );
+        do_encode_L2( buf, sectortype, address );
+        if( memcmp( buf, expect, 2352 ) != 0 ) {
+            int i;
+            for( i=0; i<2352 && buf[i] == expect[i]; i++ );
+            fprintf( stderr, "%s: sector mismatch at byte %d (address %d)\n", name, i, address );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean test_edc( void )
+{
+    unsigned char buf[2352];
+    int from, upto;
+
+    fill_sector( buf, MODE_1 );
+    for( from=0; from<16; from++ ) {
+        for( upto=from; upto<from+100; upto++ ) {
+            if( build_edc( buf, from, upto ) != ref_build_edc( buf, from, upto ) ) {
+                fprintf( stderr, "EDC mismatch for %d..%d\n", from, upto );
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+static void benchmark( int sectortype, const char *name )
+{
+    static unsigned char sectors[64][2352];
+    struct timeval start;
+    uint32_t ref_ms, ms;
+    int i;
+
+    for( i=0; i<64; i++ ) {
+        fill_sector( sectors[i], sectortype );
+    }
+
+    gettimeofday( &start, NULL );
+    for( i=0; i<BENCH_SECTORS; i++ ) {
+        ref_encode_L2( sectors[i&63], sectortype, i );
+    }
+    ref_ms = elapsed_ms(&start);
+
+    gettimeofday( &start, NULL );
+    for( i=0; i<BENCH_SECTORS; i++ ) {
+        do_encode_L2( sectors[i&63], sectortype, i );
+    }
+    ms = elapsed_ms(&start);
+
+    printf( "%-13s original: %5dms (%6.0f sectors/s)  new: %5dms (%6.0f sectors/s)\n", name,
+            ref_ms, ref_ms == 0 ? 0.0 : BENCH_SECTORS * 1000.0 / ref_ms,
+            ms, ms == 0 ? 0.0 : BENCH_SECTORS * 1000.0 / ms );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+
+    result = test_edc() && result;
+    result = test_encode( MODE_1, "Mode 1" ) && result;
+    result = test_encode( MODE_2_FORM_1, "Mode 2 Form 1" ) && result;
+    result = test_encode( MODE_2_FORM_2, "Mode 2 Form 2" ) && result;
+
+    benchmark( MODE_1, "Mode 1" );
+    benchmark( MODE_2_FORM_1, "Mode 2 Form 1" );
+    benchmark( MODE_2_FORM_2, "Mode 2 Form 2" );
+    return result ? 0 : 1;
+}
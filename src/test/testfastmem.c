@@ -0,0 +1,205 @@
+/**
+ * $Id$
+ *
+ * Fastmem window test and benchmark. Checks that mapped regions appear at
+ * every mirror in each of P0-P3 (sharing memory with the region itself),
+ * that everything else in the window faults through to the registered
+ * handler, and compares direct window reads against the region function
+ * calls.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "dream.h"
+#include "mem.h"
+
+#define RAM_BASE 0x0C000000
+#define RAM_SIZE (16*1024*1024)
+#define ROM_SIZE (2*1024*1024)
+#define ACCESSES 20000000
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+void fwrite_string( const char *s, FILE *f ) { }
+int fread_string( char *s, int maxlen, FILE *f ) { return 0; }
+int fwrite_gzip( void *p, size_t size, size_t num, FILE *f ) { return 0; }
+int fread_gzip( void *p, size_t size, size_t num, FILE *f ) { return 0; }
+
+static unsigned char ram[RAM_SIZE] MEM_REGION_ALIGNED;
+static unsigned char rom[ROM_SIZE] MEM_REGION_ALIGNED;
+
+static int32_t FASTCALL ram_read_long( sh4addr_t addr )
+{
+    return *((int32_t *)(ram + (addr&0x00FFFFFF)));
+}
+static int32_t FASTCALL rom_read_long( sh4addr_t addr )
+{
+    return *((int32_t *)(rom + (addr&0x001FFFFF)));
+}
+
+static struct mem_region_fn ram_fn = { ram_read_long, unmapped_write_long,
+        ram_read_long, unmapped_write_long, ram_read_long, unmapped_write_long,
+        unmapped_read_burst, unmapped_write_burst };
+static struct mem_region_fn rom_fn = { rom_read_long, unmapped_write_long,
+        rom_read_long, unmapped_write_long, rom_read_long, unmapped_write_long,
+        unmapped_read_burst, unmapped_write_burst };
+
+static sigjmp_buf fault_env;
+static int fault_count;
+
+static gboolean test_fault_handler( uintptr_t *pc )
+{
+    fault_count++;
+    siglongjmp( fault_env, 1 );
+    return FALSE;
+}
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+static gboolean test_mirrors()
+{
+    static const uint32_t areas[] = { 0x00000000, 0x20000000, 0x40000000, 0x60000000,
+            0x80000000, 0xA0000000, 0xC0000000 };
+    gboolean result = TRUE;
+    int i, m, n;
+
+    for( i=0; i<sizeof(areas)/sizeof(areas[0]); i++ ) {
+        for( m=0; m<4; m++ ) {
+            for( n=0; n<64; n++ ) {
+                uint32_t offset = (test_rand() % RAM_SIZE) & ~3;
+                uint32_t addr = areas[i] + RAM_BASE + (m<<24) + offset;
+                *((uint32_t *)(ram + offset)) = test_rand();
+                if( *((uint32_t *)(mem_fastmem_base + addr)) != *((uint32_t *)(ram + offset)) ) {
+                    fprintf( stderr, "Mirror mismatch at %08X\n", addr );
+                    result = FALSE;
+                    break;
+                }
+            }
+        }
+        if( *((uint32_t *)(mem_fastmem_base + areas[i] + 0x100)) != *((uint32_t *)(rom + 0x100)) ) {
+            fprintf( stderr, "ROM mismatch in area %08X\n", areas[i] );
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+/**
+ * Touch the given window address, returning TRUE if it faulted
+ */
+static gboolean test_access( uint32_t addr, gboolean write )
+{
+    volatile uint32_t *p = (volatile uint32_t *)(mem_fastmem_base + addr);
+    int count = fault_count;
+    if( sigsetjmp( fault_env, 1 ) == 0 ) {
+        if( write ) {
+            *p = 0;
+        } else {
+            (void)*p;
+        }
+    }
+    return fault_count != count;
+}
+
+static gboolean test_faults()
+{
+    gboolean result = TRUE;
+    if( test_access( 0x8C000000, FALSE ) ) {
+        fprintf( stderr, "Unexpected fault reading RAM\n" );
+        result = FALSE;
+    }
+    if( !test_access( 0x8C000000, TRUE ) ) {
+        fprintf( stderr, "Expected fault writing RAM (window is read-only)\n" );
+        result = FALSE;
+    }
+    if( !test_access( 0xA05F6800, FALSE ) ) {
+        fprintf( stderr, "Expected fault reading unmapped page\n" );
+        result = FALSE;
+    }
+    if( !test_access( 0xFF000000, FALSE ) ) {
+        fprintf( stderr, "Expected fault reading P4\n" );
+        result = FALSE;
+    }
+    return result;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+static void benchmark()
+{
+    static uint32_t addrs[4096];
+    struct timeval start;
+    uint32_t sum = 0;
+    int i;
+
+    for( i=0; i<4096; i++ ) {
+        addrs[i] = 0x8C000000 + ((test_rand() % RAM_SIZE) & ~3);
+    }
+
+    gettimeofday( &start, NULL );
+    for( i=0; i<ACCESSES; i++ ) {
+        uint32_t addr = addrs[i&4095];
+        sum += ext_address_space[(addr&0x1FFFFFFF)>>12]->read_long(addr);
+    }
+    printf( "Region functions: %5dms (%08X)\n", elapsed_ms(&start), sum );
+
+    sum = 0;
+    gettimeofday( &start, NULL );
+    for( i=0; i<ACCESSES; i++ ) {
+        uint32_t addr = addrs[i&4095];
+        sum += *((volatile int32_t *)(mem_fastmem_base + addr));
+    }
+    printf( "Fastmem window:   %5dms (%08X)\n", elapsed_ms(&start), sum );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+    int i;
+
+    mem_init();
+    mem_map_region( rom, 0x00000000, ROM_SIZE, "ROM", &rom_fn, MEM_FLAG_ROM, ROM_SIZE, 0 );
+    mem_map_region( ram, RAM_BASE, RAM_SIZE, "RAM", &ram_fn, MEM_FLAG_RAM, 0x01000000, 0x0F000000 );
+    for( i=0; i<ROM_SIZE; i+=4 ) {
+        *((uint32_t *)(rom + i)) = test_rand();
+    }
+
+    if( !mem_fastmem_init() ) {
+        printf( "Fastmem not available, skipping\n" );
+        return 0;
+    }
+    mem_fastmem_set_fault_handler( test_fault_handler );
+    mem_fastmem_map_region( "ROM" );
+    mem_fastmem_map_region( "RAM" );
+
+    result = test_mirrors() && result;
+    result = test_faults() && result;
+    benchmark();
+    return result ? 0 : 1;
+}
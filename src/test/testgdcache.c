@@ -0,0 +1,236 @@
+/**
+ * $Id$
+ *
+ * GD-Rom sector cache test and benchmark. Checks that reads through the
+ * cache return exactly what the disc returns for sequential and random
+ * access, mode changes, disc changes and reads past the end of the disc,
+ * and compares a sequential read stream with and without read-ahead
+ * against a disc with simulated per-sector latency.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "gdrom/gdrom.h"
+#include "drivers/cdrom/cdrom.h"
+
+#define DISC_SECTORS 20000
+#define BENCH_SECTORS 4000
+#define SECTOR_LATENCY_US 100 /* Simulated disc read time per sector */
+#define GUEST_WORK_US 100     /* Simulated guest processing time per sector */
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+static int disc_latency = 0;
+static int disc_reads = 0;  /* Sectors read by the emulation thread */
+static pthread_t main_thread;
+
+static struct cdrom_disc *disc_a = (struct cdrom_disc *)0x1000;
+static struct cdrom_disc *disc_b = (struct cdrom_disc *)0x2000;
+
+static void spin_us( int us )
+{
+    struct timeval start, now;
+    gettimeofday( &start, NULL );
+    do {
+        gettimeofday( &now, NULL );
+    } while( (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_usec - start.tv_usec) < us );
+}
+
+static uint32_t sector_length( cdrom_read_mode_t mode )
+{
+    return mode == CDROM_READ_RAW ? 2352 : 2048;
+}
+
+static void fill_sector( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_read_mode_t mode, unsigned char *buf )
+{
+    uint32_t *p = (uint32_t *)buf;
+    int i;
+    for( i=0; i<sector_length(mode)/4; i++ ) {
+        p[i] = (lba * 0x9E3779B1) ^ (mode << 16) ^ (uint32_t)(uintptr_t)disc ^ i;
+    }
+}
+
+cdrom_error_t cdrom_disc_read_sectors( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count,
+                                       cdrom_read_mode_t mode, unsigned char *buf, size_t *length )
+{
+    int i;
+    if( lba + count > DISC_SECTORS ) {
+        return CDROM_ERROR_BADREAD;
+    }
+    if( pthread_equal( pthread_self(), main_thread ) ) {
+        disc_reads += count;
+    }
+    for( i=0; i<count; i++ ) {
+        if( disc_latency != 0 ) {
+            usleep( disc_latency ); /* Blocked on I/O, not using the CPU */
+        }
+        fill_sector( disc, lba+i, mode, buf + i*sector_length(mode) );
+    }
+    *length = count * sector_length(mode);
+    return CDROM_ERROR_OK;
+}
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+static gboolean check_read( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count, cdrom_read_mode_t mode )
+{
+    static unsigned char buf[2352*32], expect[2352];
+    size_t length;
+    int i;
+
+    if( gdrom_cache_read( disc, lba, count, mode, buf, &length ) != CDROM_ERROR_OK ) {
+        fprintf( stderr, "Read failed at %d+%d\n", lba, count );
+        return FALSE;
+    }
+    if( length != count * sector_length(mode) ) {
+        fprintf( stderr, "Bad length at %d+%d: %d\n", lba, count, (int)length );
+        return FALSE;
+    }
+    for( i=0; i<count; i++ ) {
+        fill_sector( disc, lba+i, mode, expect );
+        if( memcmp( buf + i*sector_length(mode), expect, sector_length(mode) ) != 0 ) {
+            fprintf( stderr, "Data mismatch at %d (mode %04X)\n", lba+i, mode );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean test_sequential()
+{
+    cdrom_lba_t lba;
+    for( lba = 1000; lba < 5000; lba++ ) {
+        if( !check_read( disc_a, lba, 1, CDROM_READ_DATA|CDROM_READ_MODE1 ) )
+            return FALSE;
+    }
+    for( lba = 5000; lba < 9000; lba += 32 ) {
+        if( !check_read( disc_a, lba, 32, CDROM_READ_RAW ) )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_random()
+{
+    static const cdrom_read_mode_t modes[] = { CDROM_READ_DATA|CDROM_READ_MODE1, CDROM_READ_RAW };
+    int n;
+    for( n=0; n<5000; n++ ) {
+        cdrom_count_t count = (test_rand() % 32) + 1;
+        cdrom_lba_t lba = test_rand() % (DISC_SECTORS - count);
+        int runs = test_rand() % 4;
+        cdrom_read_mode_t mode = modes[test_rand() & 1];
+        do {
+            if( !check_read( disc_a, lba, count, mode ) )
+                return FALSE;
+            lba += count;
+        } while( runs-- > 0 && lba + count < DISC_SECTORS );
+    }
+    return TRUE;
+}
+
+static gboolean test_disc_change()
+{
+    cdrom_lba_t lba;
+    for( lba = 100; lba < 200; lba++ ) {
+        if( !check_read( disc_a, lba, 1, CDROM_READ_DATA|CDROM_READ_MODE1 ) )
+            return FALSE;
+    }
+    gdrom_cache_flush();
+    for( lba = 200; lba < 300; lba++ ) {
+        if( !check_read( disc_b, lba, 1, CDROM_READ_DATA|CDROM_READ_MODE1 ) )
+            return FALSE;
+    }
+    /* And without an explicit flush */
+    for( lba = 300; lba < 400; lba++ ) {
+        if( !check_read( disc_a, lba, 1, CDROM_READ_DATA|CDROM_READ_MODE1 ) )
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_end_of_disc()
+{
+    unsigned char buf[2048*4];
+    size_t length;
+    cdrom_lba_t lba;
+    for( lba = DISC_SECTORS - 100; lba < DISC_SECTORS; lba++ ) {
+        if( !check_read( disc_a, lba, 1, CDROM_READ_DATA|CDROM_READ_MODE1 ) )
+            return FALSE;
+    }
+    if( gdrom_cache_read( disc_a, DISC_SECTORS - 2, 4, CDROM_READ_DATA|CDROM_READ_MODE1, buf, &length ) == CDROM_ERROR_OK ) {
+        fprintf( stderr, "Expected read past end of disc to fail\n" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+static void benchmark()
+{
+    unsigned char buf[2048];
+    struct timeval start;
+    size_t length;
+    cdrom_lba_t lba;
+
+    disc_latency = SECTOR_LATENCY_US;
+    gettimeofday( &start, NULL );
+    for( lba=0; lba<BENCH_SECTORS; lba++ ) {
+        cdrom_disc_read_sectors( disc_a, lba, 1, CDROM_READ_DATA|CDROM_READ_MODE1, buf, &length );
+        spin_us( GUEST_WORK_US );
+    }
+    printf( "Direct:     %5dms\n", elapsed_ms(&start) );
+
+    gdrom_cache_flush();
+    disc_reads = 0;
+    gettimeofday( &start, NULL );
+    for( lba=0; lba<BENCH_SECTORS; lba++ ) {
+        gdrom_cache_read( disc_a, lba, 1, CDROM_READ_DATA|CDROM_READ_MODE1, buf, &length );
+        spin_us( GUEST_WORK_US );
+    }
+    printf( "Read-ahead: %5dms (%d of %d sectors read on demand)\n", elapsed_ms(&start),
+            disc_reads, BENCH_SECTORS );
+    disc_latency = 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+
+    main_thread = pthread_self();
+    result = test_sequential() && result;
+    result = test_random() && result;
+    result = test_disc_change() && result;
+    result = test_end_of_disc() && result;
+    gdrom_cache_flush();
+    benchmark();
+    return result ? 0 : 1;
+}
@@ -0,0 +1,608 @@
+/**
+ * $Id$
+ *
+ * Disc index test and benchmark. Builds an index over a directory of fake
+ * disc images, and checks that lookups and opens match the images, that
+ * unchanged images are never reparsed, that changed, new and removed images
+ * are picked up by an incremental update, and that a corrupt index
+ * (including track data outside the image) is discarded. Then compares a cold scan (parsing every image, with simulated
+ * per-image I/O latency) against a warm scan from the index.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "lxpaths.h"
+#include "bootstrap.h"
+#include "workpool.h"
+#include "gdindex.h"
+#include "gdrom/gdrom.h"
+#include "drivers/cdrom/cdimpl.h"
+
+#define IMAGE_COUNT 2000
+#define PARSE_LATENCY_US 200 /* Simulated time to seek to and parse an image trailer */
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+const char *get_user_data_path() { return "/tmp"; }
+gchar *get_absolute_path( const gchar *path ) { return g_strdup(path); }
+gchar *get_filename_at( const gchar *at, const gchar *filename ) { return g_strdup_printf( "%s/%s", at, filename ); }
+int cd_build_address( unsigned char inout[], int sectortype, unsigned address ) { return 0; }
+int do_encode_L2( unsigned char *inout, int sectortype, unsigned address ) { return 0; }
+
+static int parse_count = 0;
+static int layout_count = 0;
+static int parse_latency = 0;
+static gchar *image_dir = NULL;
+static gchar *index_filename = NULL;
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+/************************ Fake disc images *************************/
+
+/*
+ * Images are a text description of the TOC and bootstrap, padded out with
+ * junk. "Direct" images are ones that cdrom_disc_get_layout accepts (like
+ * CDI and NRG), the others (like GDI) always have to be parsed.
+ */
+struct test_image {
+    gchar *path;
+    gboolean is_disc;
+    gboolean direct;
+    int track_count;
+    char title[32];
+    char product_id[11];
+    int padding;
+};
+
+static struct test_image images[IMAGE_COUNT];
+
+#define TRACK_MODE(i) ((i) == 1 ? SECTOR_CDDA : SECTOR_MODE1)
+
+/**
+ * Byte offset of a track within an image - the tracks are laid out back to
+ * back after a 4K header.
+ */
+static int track_offset( int track )
+{
+    int i, offset = 4096;
+    for( i=0; i<track; i++ ) {
+        offset += (900 + i) * CDROM_SECTOR_SIZE(TRACK_MODE(i));
+    }
+    return offset;
+}
+
+static void write_image( struct test_image *image )
+{
+    FILE *f = fopen( image->path, "w" );
+    int i;
+
+    if( f == NULL ) {
+        fprintf( stderr, "Unable to write %s\n", image->path );
+        exit(2);
+    }
+    if( image->is_disc ) {
+        fprintf( f, "TESTIMG %d %d %s %s\n", image->direct, image->track_count, image->product_id, image->title );
+        for( i=0; i<image->track_count; i++ ) {
+            /* lba count mode flags offset */
+            fprintf( f, "%d %d %d %d %d\n", i * 1000 + (i == 2 ? 45000 : 0), 900 + i,
+                     TRACK_MODE(i), i == 1 ? 0 : TRACK_FLAG_DATA, track_offset(i) );
+        }
+        /* The (sparse) track data, so the offsets lie within the image */
+        fflush( f );
+        if( ftruncate( fileno(f), track_offset(image->track_count) + image->padding ) != 0 ) {
+            fprintf( stderr, "Unable to write %s\n", image->path );
+            exit(2);
+        }
+    } else {
+        fprintf( f, "Not a disc image\n" );
+        for( i=0; i<image->padding; i++ ) {
+            fputc( 'x', f );
+        }
+    }
+    fclose( f );
+}
+
+static void create_image( int n, const char *title )
+{
+    struct test_image *image = &images[n];
+    image->path = g_strdup_printf( "%s/image%04d.img", image_dir, n );
+    image->is_disc = (n % 50) != 49;
+    image->direct = (n % 5) != 4;
+    image->track_count = 1 + (n % 3);
+    snprintf( image->title, sizeof(image->title), "%s_%04d", title, n );
+    snprintf( image->product_id, sizeof(image->product_id), "T-%05dN", n );
+    image->padding = test_rand() % 4096;
+    write_image( image );
+}
+
+/**
+ * Private data for a fake disc - the track offsets stand in for the real
+ * file sources that cdrom_disc_get_layout would examine.
+ */
+struct test_disc_data {
+    gboolean direct;
+    char title[32];
+    uint64_t offset[CDROM_MAX_TRACKS];
+};
+
+static void destroy_disc( sector_source_t source )
+{
+    cdrom_disc_t disc = (cdrom_disc_t)source;
+    int i;
+    for( i=0; i<disc->track_count; i++ ) {
+        sector_source_unref( disc->track[i].source );
+    }
+    g_free( disc->impl_data );
+    g_free( (char *)disc->name );
+    g_free( disc );
+}
+
+static cdrom_disc_t new_disc( const char *filename )
+{
+    cdrom_disc_t disc = g_malloc0( sizeof(struct cdrom_disc) );
+    sector_source_init( &disc->source, DISC_SECTOR_SOURCE, SECTOR_UNKNOWN, 0, NULL, destroy_disc );
+    disc->name = g_strdup(filename);
+    disc->impl_data = g_malloc0( sizeof(struct test_disc_data) );
+    return disc;
+}
+
+cdrom_disc_t cdrom_disc_open( const char *filename, ERROR *err )
+{
+    char magic[8], product_id[11];
+    int direct, count, i;
+    struct test_disc_data *data;
+    cdrom_disc_t disc;
+    FILE *f;
+
+    __sync_fetch_and_add( &parse_count, 1 );
+    if( parse_latency != 0 ) {
+        usleep( parse_latency );
+    }
+    f = fopen( filename, "r" );
+    if( f == NULL ) {
+        SET_ERROR( err, LX_ERR_FILE_NOOPEN, "Unable to open %s", filename );
+        return NULL;
+    }
+    disc = new_disc( filename );
+    data = (struct test_disc_data *)disc->impl_data;
+    if( fscanf( f, "%7s %d %d %10s %31s", magic, &direct, &count, product_id, data->title ) != 5 ||
+            strcmp( magic, "TESTIMG" ) != 0 ) {
+        fclose( f );
+        cdrom_disc_unref( disc );
+        SET_ERROR( err, LX_ERR_FILE_UNKNOWN, "Unrecognized file %s", filename );
+        return NULL;
+    }
+    data->direct = direct;
+    for( i=0; i<count; i++ ) {
+        int lba, size, mode, flags, offset;
+        if( fscanf( f, "%d %d %d %d %d", &lba, &size, &mode, &flags, &offset ) != 5 ) {
+            break;
+        }
+        disc->track[i].trackno = i+1;
+        disc->track[i].sessionno = i+1;
+        disc->track[i].lba = lba;
+        disc->track[i].flags = flags;
+        disc->track[i].source = null_sector_source_new( mode, size );
+        sector_source_ref( disc->track[i].source );
+        data->offset[i] = offset;
+        disc->track_count++;
+    }
+    fclose( f );
+    disc->session_count = disc->track_count;
+    disc->disc_type = CDROM_DISC_XA;
+    disc->leadout = disc->track[count-1].lba + disc->track[count-1].source->size;
+    snprintf( disc->mcn, sizeof(disc->mcn), "%s", product_id );
+    return disc;
+}
+
+gboolean cdrom_disc_get_layout( cdrom_disc_t disc, struct cdrom_disc_layout *layout )
+{
+    struct test_disc_data *data = (struct test_disc_data *)disc->impl_data;
+    int i;
+    if( !data->direct ) {
+        return FALSE;
+    }
+    for( i=0; i<disc->track_count; i++ ) {
+        layout->track[i].offset = data->offset[i];
+    }
+    return TRUE;
+}
+
+cdrom_disc_t cdrom_disc_open_layout( const char *filename, const struct cdrom_disc_layout *layout, ERROR *err )
+{
+    cdrom_disc_t disc = new_disc( filename );
+    struct test_disc_data *data = (struct test_disc_data *)disc->impl_data;
+    int i;
+
+    __sync_fetch_and_add( &layout_count, 1 );
+    data->direct = TRUE;
+    disc->disc_type = layout->disc_type;
+    memcpy( disc->mcn, layout->mcn, sizeof(disc->mcn) );
+    disc->session_count = layout->session_count;
+    disc->leadout = layout->leadout;
+    for( i=0; i<layout->track_count; i++ ) {
+        disc->track[i].trackno = layout->track[i].trackno;
+        disc->track[i].sessionno = layout->track[i].sessionno;
+        disc->track[i].lba = layout->track[i].lba;
+        disc->track[i].flags = layout->track[i].flags;
+        disc->track[i].source = null_sector_source_new( layout->track[i].mode, layout->track[i].sector_count );
+        sector_source_ref( disc->track[i].source );
+        data->offset[i] = layout->track[i].offset;
+    }
+    disc->track_count = layout->track_count;
+    return disc;
+}
+
+cdrom_track_t gdrom_disc_get_boot_track( cdrom_disc_t disc )
+{
+    int i;
+    for( i=disc->track_count-1; i>=0; i-- ) {
+        if( disc->track[i].flags & TRACK_FLAG_DATA ) {
+            return &disc->track[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Only used to read the bootstrap, which carries the product ID (also
+ * stored as the disc mcn) and title.
+ */
+cdrom_error_t cdrom_disc_read_sectors( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count,
+                                       cdrom_read_mode_t mode, unsigned char *buf, size_t *length )
+{
+    struct test_disc_data *data = (struct test_disc_data *)disc->impl_data;
+    dc_bootstrap_head_t boot = (dc_bootstrap_head_t)buf;
+
+    memset( buf, ' ', 2048 );
+    memcpy( boot->magic, BOOTSTRAP_MAGIC, BOOTSTRAP_MAGIC_SIZE );
+    memcpy( boot->product_id, disc->mcn, strlen(disc->mcn) );
+    memcpy( boot->product_name, data->title, strlen(data->title) );
+    *length = 2048;
+    return CDROM_ERROR_OK;
+}
+
+/************************ Tests *************************/
+
+static gboolean check_info( struct test_image *image )
+{
+    struct gdrom_index_info info;
+    gboolean found = gdrom_index_lookup( image->path, &info );
+
+    if( found != image->is_disc ) {
+        fprintf( stderr, "%s: expected %s in index\n", image->path, image->is_disc ? "to be" : "not to be" );
+        return FALSE;
+    }
+    if( found && (strcmp( info.title, image->title ) != 0 || strcmp( info.product_id, image->product_id ) != 0 ||
+            info.track_count != image->track_count || info.session_count != image->track_count ||
+            info.boot_track != (image->track_count == 2 ? 1 : image->track_count) ) ) {
+        fprintf( stderr, "%s: index mismatch (got '%s' '%s' %d tracks, boot %d)\n", image->path,
+                 info.product_id, info.title, info.track_count, info.boot_track );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean check_all( const char *what )
+{
+    int i;
+    for( i=0; i<IMAGE_COUNT; i++ ) {
+        if( !check_info( &images[i] ) ) {
+            fprintf( stderr, "Failed after %s\n", what );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static GList *image_list( void )
+{
+    GList *list = NULL;
+    int i;
+    for( i=IMAGE_COUNT-1; i>=0; i-- ) {
+        list = g_list_prepend( list, images[i].path );
+    }
+    return list;
+}
+
+static int count_discs( void )
+{
+    int i, count = 0;
+    for( i=0; i<IMAGE_COUNT; i++ ) {
+        if( images[i].is_disc )
+            count++;
+    }
+    return count;
+}
+
+/**
+ * Number of records in the index file (which is always rewritten in full by
+ * an update).
+ */
+static int index_record_count( void )
+{
+    struct gdrom_index_header header;
+    FILE *f = fopen( index_filename, "r" );
+    int count = -1;
+
+    if( f != NULL ) {
+        if( fread( &header, sizeof(header), 1, f ) == 1 ) {
+            count = header.record_count;
+        }
+        fclose( f );
+    }
+    return count;
+}
+
+static gboolean test_build( GList *list )
+{
+    int n;
+
+    parse_count = 0;
+    n = gdrom_index_update( list );
+    if( n != count_discs() || parse_count != IMAGE_COUNT ) {
+        fprintf( stderr, "Initial update indexed %d (expected %d), parsed %d\n", n, count_discs(), parse_count );
+        return FALSE;
+    }
+    if( !check_all( "initial update" ) )
+        return FALSE;
+
+    /* Nothing has changed, so only the non-images should be reparsed */
+    parse_count = 0;
+    n = gdrom_index_update( list );
+    if( n != 0 || parse_count != IMAGE_COUNT - count_discs() ) {
+        fprintf( stderr, "Repeat update indexed %d, parsed %d\n", n, parse_count );
+        return FALSE;
+    }
+
+    /* Reload from disk */
+    gdrom_index_init( index_filename );
+    return check_all( "reload" );
+}
+
+static gboolean test_incremental( GList *list )
+{
+    struct timeval times[2];
+    int n;
+
+    /* Change one image's contents and size, touch another */
+    strcpy( images[10].title, "CHANGED_TITLE" );
+    images[10].padding += 10;
+    write_image( &images[10] );
+    gettimeofday( &times[0], NULL );
+    times[0].tv_sec -= 1000;
+    times[1] = times[0];
+    utimes( images[20].path, times );
+    /* And remove another */
+    unlink( images[30].path );
+    images[30].is_disc = FALSE;
+
+    parse_count = 0;
+    n = gdrom_index_update( list );
+    if( n != 2 || parse_count != 2 + IMAGE_COUNT - count_discs() - 1 ) {
+        fprintf( stderr, "Incremental update indexed %d, parsed %d\n", n, parse_count );
+        return FALSE;
+    }
+    if( index_record_count() != count_discs() ) {
+        fprintf( stderr, "Expected %d records after removal, got %d\n", count_discs(), index_record_count() );
+        return FALSE;
+    }
+    return check_all( "incremental update" );
+}
+
+static gboolean check_toc( struct test_image *image, cdrom_disc_t disc )
+{
+    int i;
+    if( disc->track_count != image->track_count ) {
+        fprintf( stderr, "%s: opened with %d tracks, expected %d\n", image->path, disc->track_count, image->track_count );
+        return FALSE;
+    }
+    for( i=0; i<disc->track_count; i++ ) {
+        struct test_disc_data *data = (struct test_disc_data *)disc->impl_data;
+        int lba = i * 1000 + (i == 2 ? 45000 : 0);
+        if( disc->track[i].lba != lba || disc->track[i].source->size != 900 + i ||
+                data->offset[i] != track_offset(i) || disc->track[i].source->mode != TRACK_MODE(i) ) {
+            fprintf( stderr, "%s: track %d mismatch\n", image->path, i+1 );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean test_open( void )
+{
+    struct test_image *extra = &images[30];
+    cdrom_disc_t disc;
+    ERROR err;
+    int i;
+
+    /* Direct images open from the layout, the others are still parsed */
+    for( i=0; i<20; i++ ) {
+        struct test_image *image = &images[i];
+        if( !image->is_disc )
+            continue;
+        parse_count = layout_count = 0;
+        disc = gdrom_index_open_disc( image->path, &err );
+        if( disc == NULL || !check_toc( image, disc ) ) {
+            return FALSE;
+        }
+        cdrom_disc_unref( disc );
+        if( parse_count != (image->direct ? 0 : 1) || layout_count != (image->direct ? 1 : 0) ) {
+            fprintf( stderr, "%s: opened with %d parses, %d layouts\n", image->path, parse_count, layout_count );
+            return FALSE;
+        }
+    }
+
+    /* A new image gets indexed when opened, and opens direct from then on */
+    extra->is_disc = TRUE;
+    write_image( extra );
+    parse_count = layout_count = 0;
+    disc = gdrom_index_open_disc( extra->path, &err );
+    if( disc == NULL || !check_toc( extra, disc ) || parse_count != 1 || !check_info( extra ) ) {
+        fprintf( stderr, "New image not indexed on open\n" );
+        return FALSE;
+    }
+    cdrom_disc_unref( disc );
+    disc = gdrom_index_open_disc( extra->path, &err );
+    if( disc == NULL || parse_count != 1 || layout_count != 1 ) {
+        fprintf( stderr, "New image not opened from the index\n" );
+        return FALSE;
+    }
+    cdrom_disc_unref( disc );
+    return TRUE;
+}
+
+/**
+ * Overwrite part of the index file, and check that the index is then
+ * rejected and rebuilt in full.
+ */
+static gboolean check_corrupt( GList *list, const char *what, long posn, const void *data, size_t size )
+{
+    struct gdrom_index_info info;
+    FILE *f = fopen( index_filename, "r+" );
+
+    fseek( f, posn, SEEK_SET );
+    fwrite( data, size, 1, f );
+    fclose( f );
+    gdrom_index_init( index_filename );
+    if( gdrom_index_lookup( images[0].path, &info ) ) {
+        fprintf( stderr, "Corrupt index (%s) was accepted\n", what );
+        return FALSE;
+    }
+    parse_count = 0;
+    if( gdrom_index_update( list ) != count_discs() ) {
+        fprintf( stderr, "Corrupt index (%s) was not rebuilt\n", what );
+        return FALSE;
+    }
+    return check_all( what );
+}
+
+static gboolean test_corrupt( GList *list )
+{
+    uint32_t count = 0xFFFFFFF;
+    uint8_t mode = SECTOR_CDDA_SUBCHANNEL + 1;
+    const struct gdrom_index_header *header;
+    const struct gdrom_index_record *records;
+    gchar *data;
+    gsize length;
+    uint64_t offset;
+    long track;
+    int i;
+
+    if( !check_corrupt( list, "record count", offsetof(struct gdrom_index_header, record_count),
+            &count, sizeof(count) ) ) {
+        return FALSE;
+    }
+
+    /* Bad track mode or offset in a direct record */
+    if( !g_file_get_contents( index_filename, &data, &length, NULL ) ) {
+        fprintf( stderr, "Unable to read %s\n", index_filename );
+        return FALSE;
+    }
+    header = (const struct gdrom_index_header *)data;
+    records = (const struct gdrom_index_record *)(header+1);
+    for( i=0; !(records[i].flags & GDROM_INDEX_DIRECT); i++ );
+    track = sizeof(struct gdrom_index_header) + header->record_count * sizeof(struct gdrom_index_record) +
+            records[i].first_track * sizeof(struct gdrom_index_track);
+    offset = records[i].size - 2048;
+    g_free( data );
+    return check_corrupt( list, "track mode", track + offsetof(struct gdrom_index_track, mode), &mode, sizeof(mode) ) &&
+        check_corrupt( list, "track offset", track + offsetof(struct gdrom_index_track, offset), &offset, sizeof(offset) );
+}
+
+static uint32_t elapsed_us( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+static void benchmark( GList *list )
+{
+    struct gdrom_index_info info;
+    struct timeval start;
+    uint32_t cold_us, warm_us;
+    int i, found = 0;
+
+    unlink( index_filename );
+    gdrom_index_init( index_filename );
+    parse_latency = PARSE_LATENCY_US;
+
+    /* Cold: every image has to be opened and parsed, as it was before the index */
+    gettimeofday( &start, NULL );
+    gdrom_index_update( list );
+    cold_us = elapsed_us(&start);
+
+    /* Warm: a fresh process loading the index and looking up every image */
+    gdrom_index_init( index_filename );
+    gettimeofday( &start, NULL );
+    gdrom_index_update( list );
+    for( i=0; i<IMAGE_COUNT; i++ ) {
+        if( gdrom_index_lookup( images[i].path, &info ) )
+            found++;
+    }
+    warm_us = elapsed_us(&start);
+    parse_latency = 0;
+
+    printf( "%d images (%d threads) cold scan: %6dms  warm scan: %5dms (%d found)\n", IMAGE_COUNT,
+            workpool_get_thread_count(), cold_us / 1000, warm_us / 1000, found );
+}
+
+int main( int argc, char *argv[] )
+{
+    char dirname[] = "/tmp/testgdindex-XXXXXX";
+    gboolean result = TRUE;
+    gchar *cmd;
+    GList *list;
+    int i;
+
+    if( mkdtemp( dirname ) == NULL ) {
+        fprintf( stderr, "Unable to create temporary directory\n" );
+        return 2;
+    }
+    image_dir = dirname;
+    for( i=0; i<IMAGE_COUNT; i++ ) {
+        create_image( i, "GAME" );
+    }
+    list = image_list();
+    workpool_init( 8 );
+
+    index_filename = g_strdup_printf( "%s/discindex", dirname );
+    gdrom_index_init( index_filename );
+
+    result = test_build( list ) && result;
+    result = test_incremental( list ) && result;
+    result = test_open() && result;
+    result = test_corrupt( list ) && result;
+    benchmark( list );
+
+    workpool_shutdown();
+    g_list_free( list );
+    g_free( index_filename );
+    cmd = g_strdup_printf( "rm -rf %s", dirname );
+    system( cmd );
+    g_free( cmd );
+    return result ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+/**
+ * $Id$
+ *
+ * GD-Rom drive timing model test and loading-time benchmark. Checks the
+ * basic properties of the model (CAV transfer rate, seek curve, read-ahead
+ * buffer, adaptive acceleration), then runs some synthetic loading
+ * patterns through each timing mode and reports the emulated load times.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "lxdream.h"
+#include "gdrom/gdrom.h"
+
+#define GD_FAD 45150           /* Start of the high-density area */
+#define DMA_BLOCK 32           /* Sectors per DMA block, as ide.c reads them */
+#define MS 1000000ULL
+#define MAX_FAD 549150         /* Outer edge of the disc */
+#define DRIVE_BUFFER 64        /* Sectors held in the drive buffer */
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand( void )
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+/**
+ * Read count sectors from fad in DMA-sized blocks, with the guest waiting
+ * for each block and then spending process_ns on it.
+ * @return the emulated time after the read.
+ */
+static uint64_t guest_read( uint32_t fad, uint32_t count, uint64_t now, uint64_t process_ns )
+{
+    while( count > 0 ) {
+        uint32_t block = count < DMA_BLOCK ? count : DMA_BLOCK;
+        now += gdrom_timing_read( fad, block, now ) + process_ns;
+        fad += block;
+        count -= block;
+    }
+    return now;
+}
+
+static gboolean check_range( const char *what, double value, double low, double high )
+{
+    if( value < low || value > high ) {
+        fprintf( stderr, "%s: %.3f not in [%.3f, %.3f]\n", what, value, low, high );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_max( void )
+{
+    int i;
+    gdrom_timing_set_mode( GDROM_TIMING_MAX );
+    gdrom_timing_reset();
+    for( i=0; i<1000; i++ ) {
+        if( gdrom_timing_read( test_rand() % MAX_FAD, 1 + test_rand() % 64, i * MS ) != 0 ) {
+            fprintf( stderr, "Max mode read was delayed\n" );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean test_realistic( void )
+{
+    gboolean result = TRUE;
+    uint64_t start, now;
+    uint32_t seek_short, seek_long, delay;
+
+    gdrom_timing_set_mode( GDROM_TIMING_REALISTIC );
+
+    /* Sequential transfer rate at the inner and outer edges of the GD area */
+    gdrom_timing_reset();
+    start = gdrom_timing_read( GD_FAD, 1, 0 );
+    now = guest_read( GD_FAD + 1, 4096, start, 0 );
+    result = check_range( "Inner rate (x)", 4096 / ((now - start) / 1e9) / 75, 5.0, 8.0 ) && result;
+
+    gdrom_timing_reset();
+    start = gdrom_timing_read( MAX_FAD - 5000, 1, 0 );
+    now = guest_read( MAX_FAD - 4999, 4096, start, 0 );
+    result = check_range( "Outer rate (x)", 4096 / ((now - start) / 1e9) / 75, 11.0, 12.1 ) && result;
+
+    /* Seek time grows with distance, up to a full stroke */
+    gdrom_timing_reset();
+    gdrom_timing_read( GD_FAD, 1, 0 );
+    seek_short = gdrom_timing_read( GD_FAD + 2000, 1, 10 * MS );
+    gdrom_timing_reset();
+    gdrom_timing_read( GD_FAD, 1, 0 );
+    seek_long = gdrom_timing_read( MAX_FAD, 1, 10 * MS );
+    if( seek_short >= seek_long ) {
+        fprintf( stderr, "Short seek (%dus) is not faster than a long one (%dus)\n", seek_short/1000, seek_long/1000 );
+        result = FALSE;
+    }
+    gdrom_timing_reset();
+    seek_long = gdrom_timing_read( MAX_FAD - 1, 1, 0 );
+    result = check_range( "Full stroke (ms)", seek_long / 1e6, 150.0, 250.0 ) && result;
+
+    /* An idle drive reads ahead into its buffer */
+    gdrom_timing_reset();
+    now = gdrom_timing_read( GD_FAD, 16, 0 );
+    now += 500 * MS;
+    delay = gdrom_timing_read( GD_FAD + 16, 32, now );
+    if( delay != 0 ) {
+        fprintf( stderr, "Buffered read was delayed by %dus\n", delay/1000 );
+        result = FALSE;
+    }
+    /* ...but only as far as the buffer goes */
+    delay = gdrom_timing_read( GD_FAD + 16 + DRIVE_BUFFER + 32, 32, now );
+    if( delay == 0 ) {
+        fprintf( stderr, "Read past the end of the buffer was not delayed\n" );
+        result = FALSE;
+    }
+    /* Re-reading recently read data is free */
+    now += delay;
+    delay = gdrom_timing_read( GD_FAD + 16 + DRIVE_BUFFER + 40, 8, now );
+    if( delay != 0 ) {
+        fprintf( stderr, "Re-read of buffered data was delayed by %dus\n", delay/1000 );
+        result = FALSE;
+    }
+    return result;
+}
+
+static gboolean test_adaptive( void )
+{
+    gboolean result = TRUE;
+    uint32_t realistic[100], delay;
+    uint64_t now;
+    int i;
+
+    /* A bulk sequential read runs at full speed after the first few blocks */
+    gdrom_timing_set_mode( GDROM_TIMING_ADAPTIVE );
+    gdrom_timing_reset();
+    now = 0;
+    for( i=0; i<64; i++ ) {
+        delay = gdrom_timing_read( GD_FAD + i * DMA_BLOCK, DMA_BLOCK, now );
+        if( i == 0 && delay == 0 ) {
+            fprintf( stderr, "Adaptive mode didn't delay the initial seek\n" );
+            result = FALSE;
+        } else if( i >= 3 && delay != 0 ) {
+            fprintf( stderr, "Adaptive mode delayed block %d of a sequential read\n", i );
+            result = FALSE;
+            break;
+        }
+        now += delay;
+    }
+
+    /* Scattered small reads are timed exactly as in realistic mode */
+    gdrom_timing_set_mode( GDROM_TIMING_REALISTIC );
+    gdrom_timing_reset();
+    test_seed = 0x5EED;
+    for( i=0, now=0; i<100; i++ ) {
+        realistic[i] = gdrom_timing_read( GD_FAD + test_rand() % 400000, 1 + test_rand() % 8, now );
+        now += realistic[i] + MS;
+    }
+    gdrom_timing_set_mode( GDROM_TIMING_ADAPTIVE );
+    gdrom_timing_reset();
+    test_seed = 0x5EED;
+    for( i=0, now=0; i<100; i++ ) {
+        delay = gdrom_timing_read( GD_FAD + test_rand() % 400000, 1 + test_rand() % 8, now );
+        if( delay != realistic[i] ) {
+            fprintf( stderr, "Adaptive random read %d took %dus, expected %dus\n", i, delay/1000, realistic[i]/1000 );
+            result = FALSE;
+            break;
+        }
+        now += delay + MS;
+    }
+    return result;
+}
+
+/************************ Loading-time benchmark *************************/
+
+/* Boot: IP.BIN, then a 2MB 1ST_READ.BIN elsewhere on the disc */
+static uint64_t load_boot( void )
+{
+    uint64_t now = guest_read( GD_FAD, 16, 0, 100000 );
+    return guest_read( GD_FAD + 5000, 1024, now, 50000 );
+}
+
+/* Level load: directory reads followed by 40 files of 16KB-1MB scattered
+ * across the disc */
+static uint64_t load_level( void )
+{
+    uint64_t now = 0;
+    int i;
+    test_seed = 0x1EE7;
+    for( i=0; i<40; i++ ) {
+        uint32_t fad = GD_FAD + test_rand() % 450000;
+        uint32_t size = 8 + test_rand() % 504;
+        now = guest_read( GD_FAD + 20, 1, now, 20000 );
+        now = guest_read( fad, size, now, 200000 );
+    }
+    return now;
+}
+
+/* Streaming: a movie read 64KB every 100ms for 10 seconds */
+static uint64_t load_stream( void )
+{
+    uint64_t now = 0, wait = 0;
+    int i;
+    for( i=0; i<100; i++ ) {
+        uint64_t after = guest_read( GD_FAD + 200000 + i*32, 32, now, 0 );
+        wait += after - now;
+        now += 100 * MS;
+    }
+    return wait;
+}
+
+static uint32_t elapsed_us( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+static void benchmark( void )
+{
+    struct timeval start;
+    uint32_t us;
+    int mode, i;
+
+    printf( "Emulated load time:   boot      level     stream wait\n" );
+    for( mode = GDROM_TIMING_MAX; mode <= GDROM_TIMING_ADAPTIVE; mode++ ) {
+        gdrom_timing_set_mode( mode );
+        gdrom_timing_reset();
+        uint64_t boot = load_boot();
+        gdrom_timing_reset();
+        uint64_t level = load_level();
+        gdrom_timing_reset();
+        uint64_t stream = load_stream();
+        printf( "  %-10s %9.1fms %9.1fms %9.1fms\n", gdrom_timing_get_mode_name(mode),
+                boot / 1e6, level / 1e6, stream / 1e6 );
+    }
+
+    gdrom_timing_set_mode( GDROM_TIMING_ADAPTIVE );
+    gdrom_timing_reset();
+    gettimeofday( &start, NULL );
+    for( i=0; i<1000; i++ ) {
+        load_level();
+    }
+    us = elapsed_us(&start);
+    printf( "Model cost: %.1fns per read\n", us * 1000.0 / (1000 * 40 * 2 * 9) );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+    result = test_max() && result;
+    result = test_realistic() && result;
+    result = test_adaptive() && result;
+    benchmark();
+    return result ? 0 : 1;
+}
@@ -0,0 +1,227 @@
+/**
+ * $Id$
+ *
+ * Disc-read trace test. Records a synthetic trace (crossing several
+ * buffer flushes), replays it against a fake disc to check the reads and
+ * summary match, and measures the per-read cost of recording.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "gdrom/gdrom.h"
+#include "drivers/cdrom/cdrom.h"
+
+#define TRACE_HEADER_SIZE 16 /* magic, version and record size */
+#define TRACE_READS 5000
+#define DISC_SECTORS 1000
+#define BENCH_READS 1000000
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+static uint64_t emulated_time = 0;
+uint64_t dreamcast_get_emulated_time( void ) { return emulated_time; }
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand( void )
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+/* Reads seen by the fake disc, to compare against the trace */
+static struct {
+    cdrom_lba_t lba;
+    cdrom_count_t count;
+    cdrom_read_mode_t mode;
+} disc_reads[TRACE_READS];
+static int disc_read_count = 0;
+static struct cdrom_disc test_disc;
+
+cdrom_error_t cdrom_disc_read_sectors( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count, cdrom_read_mode_t mode,
+                                       unsigned char *buf, size_t *length )
+{
+    if( disc_read_count < TRACE_READS ) {
+        disc_reads[disc_read_count].lba = lba;
+        disc_reads[disc_read_count].count = count;
+        disc_reads[disc_read_count].mode = mode;
+    }
+    disc_read_count++;
+    if( lba + count > DISC_SECTORS ) {
+        return CDROM_ERROR_BADREAD;
+    }
+    memset( buf, lba, count * 2048 );
+    *length = count * 2048;
+    return CDROM_ERROR_OK;
+}
+
+static gboolean test_record_replay( const char *filename )
+{
+    struct gdrom_trace_stats stats;
+    unsigned char cmd[12];
+    uint64_t recorded_ns = 0, sectors = 0, bytes = 0, last_time = 0;
+    int commands = 0, bad_reads = 0;
+    struct stat st;
+    ERROR err;
+    int i;
+
+    if( !gdrom_trace_start( filename, &err ) ) {
+        fprintf( stderr, "Unable to start trace: %s\n", err.msg );
+        return FALSE;
+    }
+    emulated_time = 1000000;
+    for( i=0; i<TRACE_READS; i++ ) {
+        cdrom_lba_t lba = test_rand() % (DISC_SECTORS + 50);
+        cdrom_count_t count = 1 + test_rand() % 32;
+        uint32_t host_ns = test_rand() % 100000;
+        if( (i % 10) == 0 ) {
+            memset( cmd, 0, sizeof(cmd) );
+            cmd[0] = 0x30;
+            cmd[2] = (lba+150) >> 16; cmd[3] = (lba+150) >> 8; cmd[4] = lba+150;
+            cmd[10] = count;
+            gdrom_trace_command( cmd );
+            commands++;
+        }
+        gdrom_trace_read( lba, count, CDROM_READ_MODE2_FORM1|CDROM_READ_DATA, 0, host_ns );
+        if( lba + count > DISC_SECTORS ) {
+            bad_reads++;
+        } else {
+            bytes += count * 2048;
+        }
+        last_time = emulated_time;
+        recorded_ns += host_ns;
+        sectors += count;
+        emulated_time += 1000 + test_rand() % 100000;
+    }
+    gdrom_trace_stop();
+    if( gdrom_trace_is_active() ) {
+        fprintf( stderr, "Trace still active after stop\n" );
+        return FALSE;
+    }
+
+    if( stat( filename, &st ) != 0 ||
+            st.st_size != TRACE_HEADER_SIZE + (TRACE_READS + commands) * sizeof(struct gdrom_trace_record) ) {
+        fprintf( stderr, "Unexpected trace size %d (expected %d records)\n", (int)st.st_size, TRACE_READS + commands );
+        return FALSE;
+    }
+
+    disc_read_count = 0;
+    if( !gdrom_trace_replay( filename, &test_disc, &stats, &err ) ) {
+        fprintf( stderr, "Replay failed: %s\n", err.msg );
+        return FALSE;
+    }
+    if( stats.reads != TRACE_READS || stats.commands != commands || stats.errors != bad_reads ||
+            stats.sectors != sectors || stats.bytes != bytes || stats.recorded_ns != recorded_ns ||
+            disc_read_count != TRACE_READS ) {
+        fprintf( stderr, "Replay stats mismatch: %d reads, %d commands, %d errors, %d sectors\n",
+                 stats.reads, stats.commands, stats.errors, (int)stats.sectors );
+        return FALSE;
+    }
+    if( stats.emulated_ns != last_time - 1000000 ) {
+        fprintf( stderr, "Replay emulated time is wrong\n" );
+        return FALSE;
+    }
+    if( stats.replay_median_ns > stats.replay_p99_ns || stats.replay_p99_ns > stats.replay_max_ns ) {
+        fprintf( stderr, "Replay latency percentiles out of order\n" );
+        return FALSE;
+    }
+
+    /* Check the reads were issued exactly as recorded */
+    test_seed = 0x5EED;
+    for( i=0; i<TRACE_READS; i++ ) {
+        cdrom_lba_t lba = test_rand() % (DISC_SECTORS + 50);
+        cdrom_count_t count = 1 + test_rand() % 32;
+        test_rand(); test_rand();
+        if( disc_reads[i].lba != lba || disc_reads[i].count != count ||
+                disc_reads[i].mode != (CDROM_READ_MODE2_FORM1|CDROM_READ_DATA) ) {
+            fprintf( stderr, "Replayed read %d was %d+%d, expected %d+%d\n", i,
+                     disc_reads[i].lba, disc_reads[i].count, lba, count );
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static gboolean test_invalid( const char *filename )
+{
+    struct gdrom_trace_stats stats;
+    ERROR err;
+    FILE *f;
+
+    if( gdrom_trace_replay( "/nonexistent/trace", &test_disc, &stats, &err ) ) {
+        fprintf( stderr, "Replay of missing file succeeded\n" );
+        return FALSE;
+    }
+    f = fopen( filename, "wb" );
+    fprintf( f, "LXDIDX\r\n...not a trace..." );
+    fclose( f );
+    if( gdrom_trace_replay( filename, &test_disc, &stats, &err ) ) {
+        fprintf( stderr, "Replay of invalid file succeeded\n" );
+        return FALSE;
+    }
+    if( gdrom_trace_start( "/nonexistent/trace", &err ) || gdrom_trace_is_active() ) {
+        fprintf( stderr, "Trace to unwritable file succeeded\n" );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static uint32_t elapsed_us( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+static void benchmark( const char *filename )
+{
+    struct timeval start;
+    uint32_t us;
+    ERROR err;
+    int i;
+
+    gdrom_trace_start( filename, &err );
+    gettimeofday( &start, NULL );
+    for( i=0; i<BENCH_READS; i++ ) {
+        emulated_time += 1000;
+        gdrom_trace_read( i, 1, CDROM_READ_MODE2_FORM1|CDROM_READ_DATA, 0, 500 );
+    }
+    gdrom_trace_stop();
+    us = elapsed_us(&start);
+    printf( "Recorded %d reads in %dms (%.1fns per read)\n", BENCH_READS, us/1000, us * 1000.0 / BENCH_READS );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+    char filename[] = "/tmp/testgdtrace-XXXXXX";
+    int fd = mkstemp( filename );
+    if( fd == -1 ) {
+        fprintf( stderr, "Unable to create temporary file\n" );
+        return 2;
+    }
+    close( fd );
+
+    result = test_record_replay( filename ) && result;
+    result = test_invalid( filename ) && result;
+    benchmark( filename );
+    unlink( filename );
+    return result ? 0 : 1;
+}
@@ -0,0 +1,453 @@
+/**
+ * $Id$
+ *
+ * GL draw batching test. Renders tile lists mixing depth modes, depth write,
+ * textures, blend modes, modifier volumes and polygon chains as the opaque
+ * and punch-through lists of a scene (which are drawn batched), and directly
+ * through the unbatched gl_render_tilelist(), against a stub GL which tracks
+ * the relevant state. Checks that every triangle is drawn in the same order
+ * with the same state either way.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "display.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/pvr2mmio.h"
+#include "pvr2/glutil.h"
+#include "pvr2/scene.h"
+#include "pvr2/shaders.h"
+
+#define MAX_TRIANGLES 256
+
+/* Polygon context words */
+#define DEPTH(mode)      ((mode)<<29)
+#define DEPTH_LESS       1
+#define DEPTH_LEQUAL     3
+#define DEPTH_GREATER    4
+#define DEPTH_GEQUAL     6
+#define DEPTH_ALWAYS     7
+#define NO_DEPTH_WRITE   0x04000000
+#define TEXTURED         0x02000000
+#define GOURAUD          0x00800000
+#define OPAQUE_POLY2     0x20800000 /* ONE, ZERO, fog disabled */
+#define BLEND_POLY2      0x94800000 /* SRC_ALPHA, INV_SRC_ALPHA, fog disabled */
+
+unsigned char pvr2_main_ram[8 MB];
+struct pvr2_scene_struct pvr2_scene;
+struct mmio_region mmio_region_PVR2;
+static struct display_driver test_driver; /* No stencil buffer */
+display_driver_t display_driver = &test_driver;
+
+/**
+ * Counters reported by the last pvr2_scene_render_draw()
+ */
+static struct {
+    int draw_calls;
+    int texture_binds;
+    int context_changes;
+} scene_stats;
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... )
+{
+    char buf[256];
+    va_list args;
+
+    if( level == EMIT_DEBUG && strncmp( msg, "Scene render", 12 ) == 0 ) {
+        va_start( args, msg );
+        vsnprintf( buf, sizeof(buf), msg, args );
+        va_end( args );
+        if( sscanf( buf, "%*[^:]: %d draw calls, %d texture binds, %d context changes",
+                    &scene_stats.draw_calls, &scene_stats.texture_binds,
+                    &scene_stats.context_changes ) != 3 ) {
+            fprintf( stderr, "Unable to parse scene stats: %s\n", buf );
+        }
+    }
+}
+void defineOrthoMatrix( GLfloat *matrix, GLfloat width, GLfloat height, GLfloat znear, GLfloat zfar ) { }
+void pvr2_check_palette_changed( void ) { }
+void pvr2_destroy_render_buffers( void ) { }
+void pvr2_scene_finished( void ) { }
+void render_sort_scene( void ) { }
+gboolean render_sort_tile( const struct tile_segment *segment, sort_triangle_callback_t callback, void *data ) { return FALSE; }
+void texcache_begin_scene( uint32_t palette_mode, uint32_t stride_width ) { }
+GLuint texcache_get_texture( uint32_t poly2_word, uint32_t texture_word ) { return 0; }
+void texcache_gl_init( void ) { }
+void texcache_gl_shutdown( void ) { }
+void glsl_clear_shader( void ) { }
+void glsl_use_pvr2_shader( void ) { }
+void glsl_set_pvr2_shader_alpha_ref( GLfloat value ) { }
+void glsl_set_pvr2_shader_fog_colour1( GLfloat *value ) { }
+void glsl_set_pvr2_shader_fog_colour2( GLfloat *value ) { }
+void glsl_set_pvr2_shader_in_colour_pointer( GLfloat *ptr, GLint stride ) { }
+void glsl_set_pvr2_shader_in_colour2_pointer( GLfloat *ptr, GLint stride ) { }
+void glsl_set_pvr2_shader_in_texcoord_pointer( GLfloat *ptr, GLint stride ) { }
+void glsl_set_pvr2_shader_in_vertex_vec3_pointer( GLfloat *ptr, GLint stride ) { }
+void glsl_set_pvr2_shader_palette_texture( GLint value ) { }
+void glsl_set_pvr2_shader_primary_texture( GLint value ) { }
+void glsl_set_pvr2_shader_view_matrix( GLfloat *value ) { }
+
+/******************************** Stub GL ***********************************/
+
+/**
+ * The GL state which affects how a triangle is drawn (as far as the
+ * tile list renderers are concerned).
+ */
+struct gl_state {
+    GLenum depth_func;
+    GLboolean depth_mask;
+    GLenum src_blend, dst_blend;
+    GLuint texture;
+    GLenum shade_model;
+    GLboolean stencil_test;
+    GLenum stencil_func;
+    GLint stencil_ref;
+};
+
+static struct gl_state gl_state;
+
+static struct triangle_record {
+    GLuint vertex[3];
+    struct gl_state state;
+} triangles[MAX_TRIANGLES];
+static int triangle_count = 0;
+static int draw_calls = 0;
+
+static void record_triangle( GLuint a, GLuint b, GLuint c )
+{
+    if( a == b || b == c || a == c ) {
+        return; /* Degenerate (ie joining two strips) */
+    }
+    if( triangle_count < MAX_TRIANGLES ) {
+        struct triangle_record *tri = &triangles[triangle_count];
+        tri->vertex[0] = a;
+        tri->vertex[1] = b;
+        tri->vertex[2] = c;
+        tri->state = gl_state;
+        if( !gl_state.stencil_test ) {
+            /* The stencil function is irrelevant while the test is off */
+            tri->state.stencil_func = 0;
+            tri->state.stencil_ref = 0;
+        }
+    }
+    triangle_count++;
+}
+
+void glDrawArrays( GLenum mode, GLint first, GLsizei count )
+{
+    int i;
+    draw_calls++;
+    for( i=0; i+2 < count; i++ ) {
+        record_triangle( first+i, first+i+1, first+i+2 );
+    }
+}
+
+void glDrawElements( GLenum mode, GLsizei count, GLenum type, const GLvoid *indices )
+{
+    const GLuint *index = indices;
+    int i;
+    draw_calls++;
+    for( i=0; i+2 < count; i++ ) {
+        record_triangle( index[i], index[i+1], index[i+2] );
+    }
+}
+
+void glDepthFunc( GLenum func ) { gl_state.depth_func = func; }
+void glDepthMask( GLboolean flag ) { gl_state.depth_mask = flag; }
+void glBlendFunc( GLenum sfactor, GLenum dfactor ) { gl_state.src_blend = sfactor; gl_state.dst_blend = dfactor; }
+void glBindTexture( GLenum target, GLuint texture ) { gl_state.texture = texture; }
+void glShadeModel( GLenum mode ) { gl_state.shade_model = mode; }
+void glStencilFunc( GLenum func, GLint ref, GLuint mask ) { gl_state.stencil_func = func; gl_state.stencil_ref = ref; }
+
+void glEnable( GLenum cap )
+{
+    if( cap == GL_STENCIL_TEST ) {
+        gl_state.stencil_test = GL_TRUE;
+    }
+}
+
+void glDisable( GLenum cap )
+{
+    if( cap == GL_STENCIL_TEST ) {
+        gl_state.stencil_test = GL_FALSE;
+    }
+}
+
+void glAlphaFunc( GLenum func, GLclampf ref ) { }
+void glBegin( GLenum mode ) { }
+void glClear( GLbitfield mask ) { }
+void glClearColor( GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha ) { }
+void glClearDepth( GLclampd depth ) { }
+void glClearStencil( GLint s ) { }
+void glColorMask( GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha ) { }
+void glColorPointer( GLint size, GLenum type, GLsizei stride, const GLvoid *ptr ) { }
+void glDisableClientState( GLenum cap ) { }
+void glEnableClientState( GLenum cap ) { }
+void glEnd( void ) { }
+void glFogCoordPointerEXT( GLenum type, GLsizei stride, const GLvoid *pointer ) { }
+void glFogf( GLenum pname, GLfloat param ) { }
+void glFogfv( GLenum pname, const GLfloat *params ) { }
+void glFogi( GLenum pname, GLint param ) { }
+void glHint( GLenum target, GLenum mode ) { }
+void glLoadIdentity( void ) { }
+void glLoadMatrixf( const GLfloat *m ) { }
+void glMatrixMode( GLenum mode ) { }
+void glScissor( GLint x, GLint y, GLsizei width, GLsizei height ) { }
+void glSecondaryColorPointerEXT( GLint size, GLenum type, GLsizei stride, const GLvoid *pointer ) { }
+void glStencilMask( GLuint mask ) { }
+void glStencilOp( GLenum fail, GLenum zfail, GLenum zpass ) { }
+void glTexCoordPointer( GLint size, GLenum type, GLsizei stride, const GLvoid *ptr ) { }
+void glTexEnvi( GLenum target, GLenum pname, GLint param ) { }
+void glVertex3f( GLfloat x, GLfloat y, GLfloat z ) { }
+void glVertexPointer( GLint size, GLenum type, GLsizei stride, const GLvoid *ptr ) { }
+
+/******************************* Test scene *********************************/
+
+#define MAX_POLYS 32
+
+static struct polygon_struct polys[MAX_POLYS];
+static struct polygon_struct *poly_map[MAX_POLYS];
+static uint32_t contexts[MAX_POLYS][5];
+static int poly_count = 0, vertex_count = 0;
+static uint32_t *list_end = (uint32_t *)pvr2_main_ram;
+
+/**
+ * Add a polygon with the given state and number of vertexes (0 for a culled
+ * polygon).
+ */
+static struct polygon_struct *add_poly( uint32_t poly1, uint32_t poly2, uint32_t tex_id, int vertexes )
+{
+    struct polygon_struct *poly = &polys[poly_count];
+    contexts[poly_count][0] = poly1;
+    contexts[poly_count][1] = poly2;
+    contexts[poly_count][2] = 0;
+    contexts[poly_count][3] = BLEND_POLY2;
+    contexts[poly_count][4] = 0;
+    poly->context = contexts[poly_count];
+    poly->tex_id = tex_id;
+    poly->mod_tex_id = tex_id + 1;
+    poly->vertex_count = vertexes;
+    poly->vertex_index = vertex_count;
+    poly->mod_vertex_index = -1;
+    poly->next = poly->sub_next = NULL;
+    poly_map[poly_count] = poly;
+    vertex_count += vertexes;
+    poly_count++;
+    return poly;
+}
+
+/**
+ * Add a polygon (and a tile list entry for it)
+ */
+static struct polygon_struct *add_entry( uint32_t poly1, uint32_t poly2, uint32_t tex_id, int vertexes )
+{
+    *list_end++ = 0x20000000 | poly_count;
+    return add_poly( poly1, poly2, tex_id, vertexes );
+}
+
+static uint32_t build_mixed_list( void )
+{
+    uint32_t list = ((unsigned char *)list_end) - pvr2_main_ram;
+    uint32_t gequal = DEPTH(DEPTH_GEQUAL)|TEXTURED|GOURAUD;
+    struct polygon_struct *poly;
+    int i;
+
+    add_entry( gequal, OPAQUE_POLY2, 1, 4 );
+    add_entry( gequal, OPAQUE_POLY2, 1, 3 );
+    add_entry( DEPTH(DEPTH_GREATER)|TEXTURED|GOURAUD, OPAQUE_POLY2, 1, 5 );
+    /* Same state as the first two, but must still be drawn after the GREATER polygon */
+    add_entry( gequal, OPAQUE_POLY2, 1, 3 );
+    add_entry( DEPTH(DEPTH_ALWAYS)|NO_DEPTH_WRITE|TEXTURED, OPAQUE_POLY2, 2, 4 );
+    add_entry( DEPTH(DEPTH_ALWAYS)|NO_DEPTH_WRITE|TEXTURED, OPAQUE_POLY2, 2, 0 );
+    add_entry( DEPTH(DEPTH_ALWAYS)|NO_DEPTH_WRITE|TEXTURED, OPAQUE_POLY2, 2, 3 );
+    add_entry( DEPTH(DEPTH_ALWAYS)|TEXTURED, OPAQUE_POLY2, 2, 3 );
+    /* Modifier volume in the middle of a run */
+    add_entry( gequal, OPAQUE_POLY2, 1, 3 );
+    poly = add_entry( gequal, OPAQUE_POLY2, 1, 4 );
+    poly->mod_vertex_index = vertex_count;
+    vertex_count += 4;
+    add_entry( gequal, OPAQUE_POLY2, 1, 3 );
+    /* Polygon split into sub-polygons */
+    poly = add_entry( DEPTH(DEPTH_LEQUAL)|GOURAUD, OPAQUE_POLY2, 0, 3 );
+    poly->sub_next = add_poly( DEPTH(DEPTH_LEQUAL)|GOURAUD, OPAQUE_POLY2, 0, 4 );
+    add_entry( DEPTH(DEPTH_LEQUAL)|GOURAUD, OPAQUE_POLY2, 0, 3 );
+    /* Triangle array of 3 */
+    *list_end++ = 0x80000000 | (2 << 25) | poly_count;
+    for( i=0; i<3; i++ ) {
+        poly = add_poly( DEPTH(DEPTH_LESS), OPAQUE_POLY2, 3, 3 );
+        if( i != 0 ) {
+            polys[poly_count-2].next = poly;
+        }
+    }
+    /* Differs only in blend mode */
+    add_entry( DEPTH(DEPTH_LESS), BLEND_POLY2, 3, 3 );
+    add_entry( DEPTH(DEPTH_LESS), OPAQUE_POLY2, 3, 4 );
+    *list_end++ = 0xF0000000;
+    return list;
+}
+
+static uint32_t build_uniform_list( int count )
+{
+    uint32_t list = ((unsigned char *)list_end) - pvr2_main_ram;
+    int i;
+    for( i=0; i<count; i++ ) {
+        add_entry( DEPTH(DEPTH_GEQUAL)|GOURAUD, OPAQUE_POLY2, 1, 3 );
+    }
+    *list_end++ = 0xF0000000;
+    return list;
+}
+
+/**
+ * Set up a scene of a single 32x32 tile, with an empty (culled) background
+ * polygon.
+ */
+static struct tile_segment segment;
+static struct vertex_struct vertexes[1];
+
+static void init_scene( void )
+{
+    struct polygon_struct *bkgnd = add_poly( DEPTH(DEPTH_ALWAYS), OPAQUE_POLY2, 0, 0 );
+
+    segment.control = SEGMENT_END;
+    segment.opaque_ptr = segment.opaquemod_ptr = segment.trans_ptr =
+        segment.transmod_ptr = segment.punchout_ptr = NO_POINTER;
+    pvr2_scene.vram = pvr2_main_ram;
+    pvr2_scene.buf_to_poly_map = poly_map;
+    pvr2_scene.poly_array = polys;
+    pvr2_scene.poly_count = poly_count;
+    pvr2_scene.bkgnd_poly = bkgnd;
+    pvr2_scene.vertex_array = vertexes;
+    pvr2_scene.segment_list = &segment;
+    pvr2_scene.sort_mode = SORT_NEVER;
+    pvr2_scene.buffer_width = pvr2_scene.buffer_height = 32;
+    pvr2_scene.bounds[1] = pvr2_scene.bounds[3] = 32;
+    pvr2_scene.bounds[4] = 1;
+    pvr2_scene.bounds[5] = 2;
+}
+
+/**
+ * Draw the scene with the given tile lists. The background always costs one
+ * (empty) draw call, which isn't counted.
+ */
+static void render_scene( uint32_t opaque, uint32_t punchout, uint32_t trans )
+{
+    segment.opaque_ptr = opaque;
+    segment.punchout_ptr = punchout;
+    segment.trans_ptr = trans;
+    triangle_count = 0;
+    pvr2_scene_render_draw();
+    draw_calls--;
+}
+
+/*********************************** Tests **********************************/
+
+static struct triangle_record expected[MAX_TRIANGLES];
+static int expected_count;
+
+/**
+ * Render the list unbatched, and as the opaque (or punch-through) list of a
+ * scene, and compare the triangles drawn. The stub GL state is never reset,
+ * so it always reflects what the renderer has actually set.
+ */
+static gboolean test_batching( const char *what, uint32_t list, gboolean set_depth )
+{
+    int unbatched_calls;
+    int i;
+
+    triangle_count = draw_calls = 0;
+    if( !set_depth ) {
+        glDepthFunc( GL_GEQUAL ); /* As for the punch-through pass */
+    }
+    gl_render_tilelist( list, set_depth );
+    memcpy( expected, triangles, sizeof(triangles) );
+    expected_count = triangle_count;
+    unbatched_calls = draw_calls;
+
+    draw_calls = 0;
+    if( set_depth ) {
+        render_scene( list, NO_POINTER, NO_POINTER );
+    } else {
+        render_scene( NO_POINTER, list, NO_POINTER );
+    }
+    if( triangle_count != expected_count ) {
+        fprintf( stderr, "%s: batched path drew %d triangles, expected %d\n", what,
+                 triangle_count, expected_count );
+        return FALSE;
+    }
+    for( i=0; i<triangle_count && i<MAX_TRIANGLES; i++ ) {
+        if( memcmp( &triangles[i], &expected[i], sizeof(struct triangle_record) ) != 0 ) {
+            fprintf( stderr, "%s: triangle %d (%d,%d,%d) differs, expected (%d,%d,%d)\n", what, i,
+                     triangles[i].vertex[0], triangles[i].vertex[1], triangles[i].vertex[2],
+                     expected[i].vertex[0], expected[i].vertex[1], expected[i].vertex[2] );
+            return FALSE;
+        }
+    }
+#ifndef HAVE_GLES2
+    if( draw_calls >= unbatched_calls ) {
+        fprintf( stderr, "%s: batched path made %d draw calls, unbatched %d\n", what,
+                 draw_calls, unbatched_calls );
+        return FALSE;
+    }
+#endif
+    return TRUE;
+}
+
+/**
+ * A list of polygons which all have the same state should only count one
+ * change each of the base and TSP context, whichever path draws it (plus
+ * one for the background's TSP context).
+ */
+static gboolean test_context_changes( uint32_t list )
+{
+    gboolean result = TRUE;
+
+    render_scene( NO_POINTER, NO_POINTER, list );
+    if( scene_stats.context_changes != 3 ) {
+        fprintf( stderr, "Unbatched uniform list counted %d context changes, expected 3\n",
+                 scene_stats.context_changes );
+        result = FALSE;
+    }
+    render_scene( list, NO_POINTER, NO_POINTER );
+    if( scene_stats.context_changes != 3 ) {
+        fprintf( stderr, "Batched uniform list counted %d context changes, expected 3\n",
+                 scene_stats.context_changes );
+        result = FALSE;
+    }
+    return result;
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+    uint32_t mixed, uniform;
+
+    mixed = build_mixed_list();
+    uniform = build_uniform_list( 8 );
+    init_scene();
+
+    pvr2_scene.shadow_mode = SHADOW_CHEAP;
+    result = test_batching( "Opaque list", mixed, TRUE ) && result;
+    result = test_batching( "Punch-through list", mixed, FALSE ) && result;
+    pvr2_scene.shadow_mode = SHADOW_FULL;
+    result = test_batching( "Opaque list (full shadows)", mixed, TRUE ) && result;
+    result = test_batching( "Uniform list", uniform, TRUE ) && result;
+    result = test_context_changes( uniform ) && result;
+
+    return result ? 0 : 1;
+}
@@ -0,0 +1,362 @@
+/**
+ * $Id$
+ *
+ * ISO9660 path index test and benchmark. Builds an index over a small
+ * synthetic filesystem (multi-sector directories, nested and looped
+ * directories), checks lookups against it, and compares the disc reads
+ * and time for repeated lookups against walking the directory tree from
+ * the disc each time.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "drivers/cdrom/cdrom.h"
+#include "drivers/cdrom/isoindex.h"
+
+#define TRACK_LBA 45000
+#define DISC_SECTORS 256
+#define ROOT_LBA (TRACK_LBA + 20)
+#define DATA_LBA (TRACK_LBA + 30)
+#define LEVEL1_LBA (TRACK_LBA + 31)
+#define LEVEL2_LBA (TRACK_LBA + 32)
+#define FILE_LBA (TRACK_LBA + 40)
+#define ROOT_FILES 60           /* Enough to need a second directory sector */
+#define BENCH_LOOKUPS 100000
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+static unsigned char disc_data[DISC_SECTORS][ISO_SECTOR_SIZE];
+static int disc_reads = 0;
+static int disc_sectors_read = 0;
+static gboolean disc_fail = FALSE;
+static cdrom_lba_t disc_fail_lba = 0;
+static struct cdrom_disc test_disc;
+
+cdrom_error_t cdrom_disc_read_sectors( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count, cdrom_read_mode_t mode,
+                                       unsigned char *buf, size_t *length )
+{
+    if( disc_fail || lba < TRACK_LBA || lba + count > TRACK_LBA + DISC_SECTORS ||
+            (disc_fail_lba >= lba && disc_fail_lba < lba + count) ) {
+        return CDROM_ERROR_BADREAD;
+    }
+    memcpy( buf, disc_data[lba - TRACK_LBA], count * ISO_SECTOR_SIZE );
+    disc_reads++;
+    disc_sectors_read += count;
+    *length = count * ISO_SECTOR_SIZE;
+    return CDROM_ERROR_OK;
+}
+
+/************************ Filesystem builder *************************/
+
+static void write_le32( unsigned char *p, uint32_t val )
+{
+    p[0] = val; p[1] = val >> 8; p[2] = val >> 16; p[3] = val >> 24;
+}
+
+static void write_be32( unsigned char *p, uint32_t val )
+{
+    p[0] = val >> 24; p[1] = val >> 16; p[2] = val >> 8; p[3] = val;
+}
+
+static uint32_t read_le32( const unsigned char *p )
+{
+    return p[0] | (p[1]<<8) | (p[2]<<16) | ((uint32_t)p[3]<<24);
+}
+
+static int write_record( unsigned char *p, const char *name, int name_len, cdrom_lba_t lba, uint32_t size, int flags )
+{
+    int len = ISO_DR_NAME + name_len + ((name_len & 1) ? 0 : 1);
+    memset( p, 0, len );
+    p[ISO_DR_LENGTH] = len;
+    write_le32( p + ISO_DR_EXTENT, lba );
+    write_be32( p + ISO_DR_EXTENT + 4, lba );
+    write_le32( p + ISO_DR_SIZE, size );
+    write_be32( p + ISO_DR_SIZE + 4, size );
+    p[ISO_DR_FLAGS] = flags;
+    p[ISO_DR_NAME_LENGTH] = name_len;
+    memcpy( p + ISO_DR_NAME, name, name_len );
+    return len;
+}
+
+/**
+ * Directory writer - records are packed into sectors, never crossing a
+ * sector boundary.
+ */
+struct dir_writer {
+    cdrom_lba_t lba;
+    int sector;
+    int offset;
+};
+
+static void dir_begin( struct dir_writer *dir, cdrom_lba_t lba, cdrom_lba_t parent, int sectors )
+{
+    dir->lba = lba;
+    dir->sector = 0;
+    dir->offset = 0;
+    dir->offset += write_record( disc_data[lba - TRACK_LBA], "\0", 1, lba, sectors * ISO_SECTOR_SIZE, ISO_FLAG_DIRECTORY );
+    dir->offset += write_record( disc_data[lba - TRACK_LBA] + dir->offset, "\1", 1, parent, ISO_SECTOR_SIZE, ISO_FLAG_DIRECTORY );
+}
+
+static void dir_add( struct dir_writer *dir, const char *name, cdrom_lba_t lba, uint32_t size, int flags )
+{
+    int len = ISO_DR_NAME + strlen(name) + 1;
+    if( dir->offset + len > ISO_SECTOR_SIZE ) {
+        dir->sector++;
+        dir->offset = 0;
+    }
+    dir->offset += write_record( disc_data[dir->lba - TRACK_LBA + dir->sector] + dir->offset,
+                                 name, strlen(name), lba, size, flags );
+}
+
+static void build_filesystem( void )
+{
+    unsigned char *pvd = disc_data[ISO_PVD_SECTOR];
+    struct dir_writer dir;
+    char name[32];
+    int i;
+
+    memset( disc_data, 0, sizeof(disc_data) );
+    pvd[0] = 1;
+    memcpy( pvd+1, "CD001", 5 );
+    pvd[6] = 1;
+    write_record( pvd + ISO_ROOT_RECORD, "\0", 1, ROOT_LBA, 2 * ISO_SECTOR_SIZE, ISO_FLAG_DIRECTORY );
+
+    dir_begin( &dir, ROOT_LBA, ROOT_LBA, 2 );
+    dir_add( &dir, "1ST_READ.BIN;1", FILE_LBA, 123456, 0 );
+    dir_add( &dir, "IP.BIN;1", TRACK_LBA, 32768, 0 );
+    dir_add( &dir, "DATA", DATA_LBA, ISO_SECTOR_SIZE, ISO_FLAG_DIRECTORY );
+    for( i=0; i<ROOT_FILES; i++ ) {
+        snprintf( name, sizeof(name), "FILE%04d.DAT;1", i );
+        dir_add( &dir, name, FILE_LBA + 100 + i, i * 1000, 0 );
+    }
+    /* A directory pointing back at the root, which must not loop */
+    dir_add( &dir, "LOOP", ROOT_LBA, 2 * ISO_SECTOR_SIZE, ISO_FLAG_DIRECTORY );
+    dir_add( &dir, "NOEXT.;1", FILE_LBA + 1, 10, 0 );
+    if( dir.sector != 1 ) {
+        fprintf( stderr, "Root directory should take 2 sectors\n" );
+        exit(2);
+    }
+
+    dir_begin( &dir, DATA_LBA, ROOT_LBA, 1 );
+    dir_add( &dir, "LEVEL1", LEVEL1_LBA, ISO_SECTOR_SIZE, ISO_FLAG_DIRECTORY );
+    dir_add( &dir, "movie.sfd;1", FILE_LBA + 2, 50000000, 0 );
+    dir_begin( &dir, LEVEL1_LBA, DATA_LBA, 1 );
+    dir_add( &dir, "LEVEL2", LEVEL2_LBA, ISO_SECTOR_SIZE, ISO_FLAG_DIRECTORY );
+    dir_begin( &dir, LEVEL2_LBA, LEVEL1_LBA, 1 );
+    dir_add( &dir, "DEEP.BIN;1", FILE_LBA + 3, 777, 0 );
+}
+
+/************************ Reference lookup *************************/
+
+/**
+ * Resolve the path by reading each directory along it from the disc, as a
+ * filesystem without an index does.
+ */
+static gboolean walk_lookup( const char *path, cdrom_lba_t *lba, uint32_t *size )
+{
+    unsigned char pvd[ISO_SECTOR_SIZE], buf[4*ISO_SECTOR_SIZE];
+    size_t length;
+    cdrom_lba_t dir_lba;
+    uint32_t dir_size;
+    gchar **parts = g_strsplit_set( path+1, "/", -1 );
+    gboolean found = FALSE;
+    int i;
+
+    if( cdrom_disc_read_sectors( &test_disc, TRACK_LBA + ISO_PVD_SECTOR, 1, 0, pvd, &length ) != CDROM_ERROR_OK ) {
+        g_strfreev( parts );
+        return FALSE;
+    }
+    dir_lba = read_le32( pvd + ISO_ROOT_RECORD + ISO_DR_EXTENT );
+    dir_size = read_le32( pvd + ISO_ROOT_RECORD + ISO_DR_SIZE );
+    for( i=0; parts[i] != NULL; i++ ) {
+        int count = (dir_size + ISO_SECTOR_SIZE - 1) / ISO_SECTOR_SIZE, sector;
+        size_t part_len = strlen(parts[i]);
+        found = FALSE;
+        cdrom_disc_read_sectors( &test_disc, dir_lba, count, 0, buf, &length );
+        for( sector=0; sector<count && !found; sector++ ) {
+            unsigned char *p = buf + sector * ISO_SECTOR_SIZE;
+            while( p < buf + (sector+1) * ISO_SECTOR_SIZE && p[0] != 0 ) {
+                if( p[ISO_DR_NAME_LENGTH] >= part_len &&
+                        g_ascii_strncasecmp( (char *)p + ISO_DR_NAME, parts[i], part_len ) == 0 &&
+                        (p[ISO_DR_NAME_LENGTH] == part_len || p[ISO_DR_NAME + part_len] == ';') ) {
+                    dir_lba = read_le32( p + ISO_DR_EXTENT );
+                    dir_size = read_le32( p + ISO_DR_SIZE );
+                    found = TRUE;
+                    break;
+                }
+                p += p[0];
+            }
+        }
+        if( !found )
+            break;
+    }
+    g_strfreev( parts );
+    *lba = dir_lba;
+    *size = dir_size;
+    return found;
+}
+
+/************************ Tests *************************/
+
+static gboolean check_lookup( iso_path_index_t index, const char *path, gboolean expect_found,
+                              cdrom_lba_t expect_lba, uint32_t expect_size )
+{
+    cdrom_lba_t lba = 0;
+    uint32_t size = 0;
+    gboolean found = iso_path_index_lookup( index, path, &lba, &size );
+    if( found != expect_found || (found && (lba != expect_lba || size != expect_size)) ) {
+        fprintf( stderr, "Lookup '%s': got %s %d/%d, expected %s %d/%d\n", path,
+                 found ? "found" : "not found", lba, size,
+                 expect_found ? "found" : "not found", expect_lba, expect_size );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean test_lookup( void )
+{
+    ERROR err;
+    gboolean result = TRUE;
+    char name[32];
+    int i;
+
+    disc_reads = 0;
+    iso_path_index_t index = iso_path_index_new( &test_disc, TRACK_LBA, &err );
+    if( index == NULL ) {
+        fprintf( stderr, "Unable to build index: %s\n", err.msg );
+        return FALSE;
+    }
+    /* PVD plus one read per directory (root, DATA, LEVEL1, LEVEL2) */
+    if( disc_reads != 5 ) {
+        fprintf( stderr, "Expected 5 reads to build the index, but got %d\n", disc_reads );
+        result = FALSE;
+    }
+    if( iso_path_index_size( index ) != ROOT_FILES + 5 ) {
+        fprintf( stderr, "Expected %d files, but got %d\n", ROOT_FILES + 5, iso_path_index_size(index) );
+        result = FALSE;
+    }
+
+    disc_reads = 0;
+    result = check_lookup( index, "/1ST_READ.BIN", TRUE, FILE_LBA, 123456 ) && result;
+    result = check_lookup( index, "/1st_read.bin", TRUE, FILE_LBA, 123456 ) && result;
+    result = check_lookup( index, "1ST_READ.BIN;1", TRUE, FILE_LBA, 123456 ) && result;
+    result = check_lookup( index, "/IP.BIN", TRUE, TRACK_LBA, 32768 ) && result;
+    result = check_lookup( index, "/NOEXT", TRUE, FILE_LBA + 1, 10 ) && result;
+    result = check_lookup( index, "/DATA/MOVIE.SFD", TRUE, FILE_LBA + 2, 50000000 ) && result;
+    result = check_lookup( index, "/DATA/LEVEL1/LEVEL2/DEEP.BIN", TRUE, FILE_LBA + 3, 777 ) && result;
+    result = check_lookup( index, "//data//level1/LEVEL2/deep.bin", TRUE, FILE_LBA + 3, 777 ) && result;
+    for( i=0; i<ROOT_FILES; i++ ) {
+        snprintf( name, sizeof(name), "/FILE%04d.DAT", i );
+        result = check_lookup( index, name, TRUE, FILE_LBA + 100 + i, i * 1000 ) && result;
+    }
+    result = check_lookup( index, "/NOPE.BIN", FALSE, 0, 0 ) && result;
+    result = check_lookup( index, "/DATA", FALSE, 0, 0 ) && result;
+    result = check_lookup( index, "/DEEP.BIN", FALSE, 0, 0 ) && result;
+    result = check_lookup( index, "/LOOP/1ST_READ.BIN", FALSE, 0, 0 ) && result;
+    if( disc_reads != 0 ) {
+        fprintf( stderr, "Lookups should not read the disc\n" );
+        result = FALSE;
+    }
+    iso_path_index_destroy( index );
+    return result;
+}
+
+static gboolean test_invalid( void )
+{
+    ERROR err;
+    gboolean result = TRUE;
+
+    /* Not an ISO filesystem */
+    disc_data[ISO_PVD_SECTOR][1] = 'X';
+    if( iso_path_index_new( &test_disc, TRACK_LBA, &err ) != NULL ) {
+        fprintf( stderr, "Expected invalid filesystem to fail\n" );
+        result = FALSE;
+    }
+    disc_data[ISO_PVD_SECTOR][1] = 'C';
+
+    /* Read error */
+    disc_fail = TRUE;
+    if( iso_path_index_new( &test_disc, TRACK_LBA, &err ) != NULL ) {
+        fprintf( stderr, "Expected read error to fail\n" );
+        result = FALSE;
+    }
+    disc_fail = FALSE;
+
+    /* Unreadable subdirectory */
+    disc_fail_lba = LEVEL2_LBA;
+    if( iso_path_index_new( &test_disc, TRACK_LBA, &err ) != NULL ) {
+        fprintf( stderr, "Expected unreadable directory to fail\n" );
+        result = FALSE;
+    }
+    disc_fail_lba = 0;
+    return result;
+}
+
+static uint32_t elapsed_us( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+static void benchmark( void )
+{
+    const char *paths[] = { "/1ST_READ.BIN", "/DATA/LEVEL1/LEVEL2/DEEP.BIN", "/FILE0059.DAT", "/DATA/MOVIE.SFD" };
+    struct timeval start;
+    uint32_t walk_us, index_us, sum = 0;
+    int walk_sectors, index_sectors;
+    cdrom_lba_t lba;
+    uint32_t size;
+    ERROR err;
+    int i;
+
+    disc_sectors_read = 0;
+    gettimeofday( &start, NULL );
+    for( i=0; i<BENCH_LOOKUPS; i++ ) {
+        walk_lookup( paths[i&3], &lba, &size );
+        sum += lba;
+    }
+    walk_us = elapsed_us(&start);
+    walk_sectors = disc_sectors_read;
+
+    disc_sectors_read = 0;
+    gettimeofday( &start, NULL );
+    iso_path_index_t index = iso_path_index_new( &test_disc, TRACK_LBA, &err );
+    for( i=0; i<BENCH_LOOKUPS; i++ ) {
+        iso_path_index_lookup( index, paths[i&3], &lba, &size );
+        sum -= lba;
+    }
+    index_us = elapsed_us(&start);
+    index_sectors = disc_sectors_read;
+    iso_path_index_destroy( index );
+
+    printf( "%d lookups: directory walk %5dms (%d sectors read)  index %5dms (%d sectors read) %s\n",
+            BENCH_LOOKUPS, walk_us/1000, walk_sectors, index_us/1000, index_sectors, sum == 0 ? "" : "MISMATCH" );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+
+    build_filesystem();
+    result = test_lookup() && result;
+    result = test_invalid() && result;
+    benchmark();
+    return result ? 0 : 1;
+}
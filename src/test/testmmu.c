@@ -0,0 +1,400 @@
+/**
+ * $Id$
+ *
+ * MMU software TLB test and benchmark. Runs a WinCE-style workload (several
+ * processes sharing the UTLB under different ASIDs, frequent context
+ * switches and TLB refills) through the interpreter's address translation,
+ * checking every result against a plain scan of the UTLB, and reports the
+ * time taken with and without the software TLB. Also checks that the page
+ * tables are correct across ASID switches, and reports the cost of a switch
+ * with per-ASID address spaces against remapping a single space in place.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "mem.h"
+#include "sh4/sh4.h"
+#include "sh4/sh4core.h"
+#include "sh4/sh4mmio.h"
+#include "sh4/mmu.h"
+
+#define PROCESS_COUNT 3
+#define IDLE_PROCESS_COUNT 3 /* Processes with no private pages */
+#define PRIVATE_PAGES 18
+#define SHARED_PAGES 8
+#define ACCESSES 2000000
+#define SWITCH_INTERVAL 2000
+#define REFILL_INTERVAL 5000
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+/* Stubs for the rest of the SH4 core */
+struct sh4_registers sh4r;
+struct sh4_icache_struct sh4_icache;
+unsigned char dc_main_ram[4096];
+unsigned char dc_boot_rom[4096];
+mem_region_fn_t *ext_address_space;
+struct mem_region_fn mem_region_unmapped;
+struct mem_region_fn p4_region_icache_addr, p4_region_icache_data;
+struct mem_region_fn p4_region_ocache_addr, p4_region_ocache_data;
+struct mmio_region mmio_region_MMU, mmio_region_PMM, mmio_region_UBC, mmio_region_BSC,
+    mmio_region_DMAC, mmio_region_CPG, mmio_region_RTC, mmio_region_INTC, mmio_region_TMU,
+    mmio_region_SCI, mmio_region_SCIF;
+
+void *mem_alloc_pages( int n ) { return calloc( n, LXDREAM_PAGE_SIZE ); }
+sh4ptr_t mem_get_region( uint32_t addr ) { return NULL; }
+void mem_unprotect( void *ptr, uint32_t size ) { }
+void register_mem_page_remapped_hook( mem_page_remapped_hook_t fn, void *user_data ) { }
+void xlat_flush_cache() { }
+void sh4_core_exit( int exit_code ) { }
+void CCN_set_cache_control( int reg ) { }
+void PMM_write_control( int ctr, uint32_t val ) { }
+void FASTCALL ccn_storequeue_write_long( sh4addr_t addr, uint32_t val ) { }
+int32_t FASTCALL ccn_storequeue_read_long( sh4addr_t addr ) { return 0; }
+void FASTCALL ccn_storequeue_prefetch( sh4addr_t addr ) { }
+int32_t FASTCALL unmapped_read_long( sh4addr_t addr ) { return 0; }
+void FASTCALL unmapped_write_long( sh4addr_t addr, uint32_t val ) { }
+void FASTCALL unmapped_read_burst( unsigned char *dest, sh4addr_t addr ) { }
+void FASTCALL unmapped_write_burst( sh4addr_t addr, unsigned char *src ) { }
+void FASTCALL unmapped_prefetch( sh4addr_t addr ) { }
+#ifdef SH4_TRANSLATOR
+void mmu_utlb_init_vtable( struct utlb_entry *ent, struct utlb_page_entry *page, gboolean writable ) { }
+void mmu_utlb_init_storequeue_vtable( struct utlb_entry *ent, struct utlb_page_entry *page ) { }
+void mmu_utlb_1k_init_vtable( struct utlb_1k_entry *entry ) { }
+#endif
+
+static int exception_count = 0;
+void FASTCALL sh4_raise_exception( int code ) { exception_count++; }
+void FASTCALL sh4_raise_tlb_exception( int code, sh4vma_t vpn ) { exception_count++; }
+void FASTCALL sh4_raise_tlb_multihit( sh4vma_t vpn ) { exception_count++; }
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+#define FAKE_REGION(page) ((mem_region_fn_t)(uintptr_t)(((page)+1)<<4))
+
+/**
+ * Copy of the UTLB, as read back through the UTLB address/data arrays, for
+ * the reference lookup.
+ */
+static struct utlb_entry utlb[UTLB_ENTRY_COUNT];
+
+static uint32_t tlb_size_mask( uint32_t flags )
+{
+    switch( flags & TLB_SIZE_MASK ) {
+    case TLB_SIZE_1K: return MASK_1K;
+    case TLB_SIZE_4K: return MASK_4K;
+    case TLB_SIZE_64K: return MASK_64K;
+    default: return MASK_1M;
+    }
+}
+
+static void utlb_read( int entry )
+{
+    uint32_t addr = mmu_utlb_addr_read( 0xF6000000 | (entry<<8) );
+    uint32_t data = mmu_utlb_data_read( 0xF7000000 | (entry<<8) );
+    utlb[entry].vpn = addr & 0xFFFFFC00;
+    utlb[entry].asid = addr & 0xFF;
+    utlb[entry].ppn = data & 0x1FFFFC00;
+    utlb[entry].flags = data & 0x1FF;
+    utlb[entry].mask = tlb_size_mask( data );
+}
+
+static void utlb_write( int entry, uint32_t vpn, uint32_t asid, uint32_t ppn, uint32_t flags )
+{
+    /* Invalidate the entry first so the old mapping is removed intact */
+    mmu_utlb_addr_write( 0xF6000000 | (entry<<8), vpn | asid, NULL );
+    mmu_utlb_data_write( 0xF7000000 | (entry<<8), ppn | (flags & ~TLB_VALID) );
+    mmu_utlb_addr_write( 0xF6000000 | (entry<<8), vpn | asid | TLB_VALID | ((flags&TLB_DIRTY)<<7), NULL );
+    utlb_read( entry );
+}
+
+static void set_asid( uint32_t asid )
+{
+    mmio_region_MMU_write( PTEH, asid );
+}
+
+static uint32_t get_asid()
+{
+    return MMIO_READ( MMU, PTEH ) & 0xFF;
+}
+
+/**
+ * Load the UTLB with the WinCE-style layout: shared kernel pages, plus a
+ * private set of pages at the same virtual addresses for each process.
+ */
+static void setup_utlb()
+{
+    uint32_t flags = TLB_VALID|TLB_SIZE_4K|TLB_USERMODE|TLB_WRITABLE|TLB_DIRTY;
+    int i, p, entry = 0;
+    for( i=0; i<SHARED_PAGES; i++ ) {
+        utlb_write( entry++, 0x7C000000 + (i<<12), 0, 0x0C800000 + (i<<12), flags|TLB_SHARE );
+    }
+    for( p=0; p<PROCESS_COUNT; p++ ) {
+        for( i=0; i<PRIVATE_PAGES; i++ ) {
+            utlb_write( entry++, 0x00010000 + (i<<12), p+1, 0x0C000000 + (((p*PRIVATE_PAGES)+i)<<12), flags );
+        }
+    }
+    /* Fill the rest with 64K shared mappings */
+    for( i=0; entry<UTLB_ENTRY_COUNT; i++ ) {
+        utlb_write( entry++, 0x40000000 + (i<<16), 0, 0x0C400000 + (i<<16),
+                TLB_VALID|TLB_SIZE_64K|TLB_USERMODE|TLB_DIRTY|TLB_SHARE );
+    }
+}
+
+static sh4vma_t random_address()
+{
+    uint32_t r = test_rand();
+    switch( r % 8 ) {
+    case 0: case 1: return 0x7C000000 + ((r>>3)%(SHARED_PAGES<<12));
+    case 2: return 0x40000000 + ((r>>3)%((UTLB_ENTRY_COUNT-SHARED_PAGES-PROCESS_COUNT*PRIVATE_PAGES)<<16));
+    default: return 0x00010000 + ((r>>3)%(PRIVATE_PAGES<<12));
+    }
+}
+
+/**
+ * Reference lookup: the original linear scan of the UTLB.
+ * @return the entryNo if found, -1 if not found, and -2 for a multi-hit.
+ */
+static int reference_lookup_vpn_asid( uint32_t vpn )
+{
+    uint32_t asid = get_asid();
+    int result = -1;
+    unsigned int i;
+
+    for( i = 0; i < UTLB_ENTRY_COUNT; i++ ) {
+        if( (utlb[i].flags & TLB_VALID) &&
+                ((utlb[i].flags & TLB_SHARE) || asid == utlb[i].asid) &&
+                ((utlb[i].vpn ^ vpn) & utlb[i].mask) == 0 ) {
+            if( result != -1 ) {
+                return -2;
+            }
+            result = i;
+        }
+    }
+    return result;
+}
+
+/**
+ * Reference translation, on top of the linear scan.
+ */
+static mem_region_fn_t FASTCALL reference_get_region_for_vma_read( sh4vma_t *paddr )
+{
+    sh4vma_t addr = *paddr;
+    int entryNo = reference_lookup_vpn_asid( addr );
+    if( entryNo < 0 || (utlb[entryNo].flags & TLB_USERMODE) == 0 ) {
+        return NULL;
+    }
+    sh4addr_t pma = (utlb[entryNo].ppn & utlb[entryNo].mask) |
+            (addr & (~utlb[entryNo].mask));
+    *paddr = pma;
+    return ext_address_space[pma>>12];
+}
+
+/**
+ * Replace a random private page with a new physical page, as the OS would on
+ * a TLB refill.
+ */
+static void refill_random_page()
+{
+    int entry = SHARED_PAGES + (test_rand() % (PROCESS_COUNT*PRIVATE_PAGES));
+    uint32_t ppn = 0x0C000000 + ((test_rand() & 0x3FF)<<12);
+    uint32_t pteh = MMIO_READ( MMU, PTEH );
+    MMIO_WRITE( MMU, PTEH, utlb[entry].vpn | utlb[entry].asid );
+    MMIO_WRITE( MMU, PTEL, ppn | utlb[entry].flags );
+    MMIO_WRITE( MMU, PTEA, 0 );
+    mmu_urc = entry;
+    MMU_ldtlb();
+    MMIO_WRITE( MMU, PTEH, pteh );
+    utlb_read( entry );
+}
+
+/**
+ * Check the active page tables against the UTLB for every mapped page. All
+ * the test pages are user-accessible, so the user table should match the
+ * privileged one.
+ */
+static gboolean check_page_tables()
+{
+    sh4vma_t addr;
+    uint32_t urc = mmu_urc;
+    gboolean result = TRUE;
+
+    for( addr = 0; addr < 0x80000000; addr += 0x1000 ) {
+        mem_region_fn_t priv;
+        int entryNo, expect;
+        if( addr == 0x00010000 + (PRIVATE_PAGES<<12) ) {
+            addr = 0x40000000;
+        } else if( addr == 0x40100000 ) {
+            addr = 0x7C000000;
+        } else if( addr == 0x7C000000 + (SHARED_PAGES<<12) ) {
+            break;
+        }
+        priv = sh4_address_space[addr>>12];
+        expect = reference_lookup_vpn_asid( addr );
+        entryNo = mmu_utlb_entry_for_vpn( addr );
+        if( entryNo != expect || sh4_user_address_space[addr>>12] != priv ||
+                (expect == -1 && priv != &mem_region_tlb_miss) ) {
+            fprintf( stderr, "Page table mismatch for %08X in ASID %d\n", addr, get_asid() );
+            result = FALSE;
+            break;
+        }
+    }
+    mmu_urc = urc;
+    return result;
+}
+
+static gboolean test_translation()
+{
+    int i, errors = 0;
+    for( i=0; i<ACCESSES/10; i++ ) {
+        sh4vma_t vma = random_address(), addr = vma, expect_addr = vma;
+        mem_region_fn_t fn, expect_fn;
+        if( i % SWITCH_INTERVAL == 0 ) {
+            set_asid( (test_rand() % (PROCESS_COUNT+IDLE_PROCESS_COUNT)) + 1 );
+            if( !check_page_tables() ) {
+                errors++;
+            }
+        }
+        if( i % REFILL_INTERVAL == 0 ) {
+            refill_random_page();
+            if( !check_page_tables() ) {
+                errors++;
+            }
+        }
+        expect_fn = reference_get_region_for_vma_read( &expect_addr );
+        fn = mmu_get_region_for_vma_read( &addr );
+        if( fn != expect_fn || (fn != NULL && addr != expect_addr) ) {
+            if( errors++ < 10 ) {
+                fprintf( stderr, "Translation mismatch for %08X: got %08X, expected %08X\n",
+                        vma, addr, expect_addr );
+            }
+        }
+    }
+    return errors == 0;
+}
+
+static gboolean test_multihit()
+{
+    int errors = 0;
+
+    /* A 1K page overlapping a cached 4K page must produce a multi-hit */
+    sh4vma_t addr = 0x7C000400;
+    if( mmu_get_region_for_vma_read(&addr) == NULL ) {
+        fprintf( stderr, "Shared page translation failed\n" );
+        errors++;
+    }
+    utlb_write( UTLB_ENTRY_COUNT-1, 0x7C000400, 0, 0x0CF00000, TLB_VALID|TLB_SIZE_1K|TLB_USERMODE|TLB_SHARE );
+    exception_count = 0;
+    addr = 0x7C000400;
+    if( mmu_get_region_for_vma_read(&addr) != NULL || exception_count != 1 ) {
+        fprintf( stderr, "Expected multi-hit after overlapping write\n" );
+        errors++;
+    }
+    /* ...and go back to the single hit when it's removed again */
+    mmu_utlb_addr_write( 0xF6000000 | ((UTLB_ENTRY_COUNT-1)<<8), 0x7C000400, NULL );
+    utlb_read( UTLB_ENTRY_COUNT-1 );
+    addr = 0x7C000400;
+    if( mmu_get_region_for_vma_read(&addr) == NULL || addr != 0x0C800400 ) {
+        fprintf( stderr, "Shared page translation failed after removing overlap\n" );
+        errors++;
+    }
+    return errors == 0;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+static void benchmark( const char *name, mem_region_fn_t (FASTCALL *translate)(sh4vma_t *) )
+{
+    struct timeval start;
+    uint32_t sum = 0;
+    int i;
+
+    setup_utlb();
+    test_seed = 0x5EED;
+    gettimeofday( &start, NULL );
+    for( i=0; i<ACCESSES; i++ ) {
+        sh4vma_t addr = random_address();
+        if( i % SWITCH_INTERVAL == 0 ) {
+            set_asid( (test_rand() % PROCESS_COUNT) + 1 );
+        }
+        if( i % REFILL_INTERVAL == 0 ) {
+            refill_random_page();
+        }
+        if( translate(&addr) != NULL ) {
+            sum += addr;
+        }
+    }
+    printf( "%-20s %5dms (%08X)\n", name, elapsed_ms(&start), sum );
+}
+
+static void benchmark_switch( const char *name, int processes, int spaces )
+{
+    struct timeval start;
+    int i;
+
+    mmu_set_asid_space_count( spaces );
+    setup_utlb();
+    gettimeofday( &start, NULL );
+    for( i=0; i<ACCESSES; i++ ) {
+        set_asid( (i % processes) + 1 );
+    }
+    printf( "ASID switch (%d ASIDs, %s): %5dms\n", processes, name, elapsed_ms(&start) );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result;
+    int i;
+
+    ext_address_space = calloc( 0x20000, sizeof(mem_region_fn_t) );
+    for( i=0; i<0x20000; i++ ) {
+        ext_address_space[i] = FAKE_REGION(i);
+    }
+    mmio_region_MMU.mem = calloc( 1, LXDREAM_PAGE_SIZE );
+    MMU_init();
+    mmio_region_MMU_write( MMUCR, MMUCR_AT );
+    sh4r.sr = 0; /* User mode */
+    setup_utlb();
+
+    /* Time the ASID switches first, as the 1K page in the multi-hit test
+     * forces the in-place remap from then on */
+    benchmark_switch( "remap", PROCESS_COUNT, 1 );
+    benchmark_switch( "spaces", PROCESS_COUNT, ASID_SPACE_DEFAULT );
+    benchmark_switch( "remap", PROCESS_COUNT+IDLE_PROCESS_COUNT, 1 );
+    benchmark_switch( "spaces", PROCESS_COUNT+IDLE_PROCESS_COUNT, ASID_SPACE_DEFAULT );
+    /* Check with fewer spaces than ASIDs, so that spaces get recycled */
+    mmu_set_asid_space_count( PROCESS_COUNT );
+    result = test_translation();
+    mmu_set_asid_space_count( ASID_SPACE_DEFAULT );
+    result = test_translation() && result;
+    result = test_multihit() && result;
+    benchmark( "UTLB scan:", reference_get_region_for_vma_read );
+    benchmark( "Software TLB:", mmu_get_region_for_vma_read );
+    return result ? 0 : 1;
+}
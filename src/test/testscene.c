@@ -0,0 +1,513 @@
+/**
+ * $Id$
+ *
+ * Scene vertex decode test and benchmark. Checks that the batched (SIMD)
+ * vertex decode and fog lookup produce exactly the same results as the
+ * per-vertex versions, and reports the time taken by each as well as for a
+ * full pvr2_scene_read() over the same generated scene. Also checks that a
+ * snapshotted scene is unaffected by later changes to VRAM, and that the
+ * parallel scene read gives exactly the same result as the serial one.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "display.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/pvr2mmio.h"
+#include "pvr2/scene.h"
+#include "workpool.h"
+
+#define SCENE_POLYS 8000
+#define TILES_X 20
+#define TILES_Y 15
+#define POLYBASE 0
+#define TILEBASE 0x600000
+#define LISTBASE 0x680000
+#define ITERATIONS 50
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+unsigned char pvr2_main_ram[8*1024*1024];
+static char pvr2_mmio[0x1000];
+struct mmio_region mmio_region_PVR2;
+
+/****************************** Fake display *******************************/
+
+static struct vertex_struct *test_vertexes = NULL;
+
+static void *test_vbuf_map( vertex_buffer_t buf, uint32_t size )
+{
+    return test_vertexes;
+}
+
+static void *test_vbuf_unmap( vertex_buffer_t buf )
+{
+    return test_vertexes;
+}
+
+static void test_vbuf_finished( vertex_buffer_t buf ) { }
+static void test_vbuf_destroy( vertex_buffer_t buf ) { }
+
+static struct vertex_buffer test_vbuf = { test_vbuf_map, test_vbuf_unmap, test_vbuf_finished, test_vbuf_destroy };
+
+static vertex_buffer_t test_create_vertex_buffer( )
+{
+    return &test_vbuf;
+}
+
+static struct display_driver test_driver;
+display_driver_t display_driver = &test_driver;
+
+/***************************** Scene generator *****************************/
+
+static uint32_t rand_state = 1;
+static uint32_t test_rand()
+{
+    rand_state = rand_state * 1103515245 + 12345;
+    return rand_state >> 8;
+}
+
+static float test_randf( float lo, float hi )
+{
+    return lo + (hi-lo) * (test_rand() & 0xFFFF) / 65536.0f;
+}
+
+#define MMIO_SET( r, v ) *((uint32_t *)(pvr2_mmio + (r))) = (v)
+#define RAMW(addr) (((uint32_t *)pvr2_main_ram)[addr])
+#define RAMF(addr) (((float *)pvr2_main_ram)[addr])
+
+struct test_poly {
+    uint32_t addr; /* in words */
+    int type; /* 0 = triangle, 1 = sprite, 2 = strip */
+    int vertex_count;
+    int vertex_length; /* tile entry vertex length field */
+    gboolean is_modified;
+    uint32_t *context;
+    uint32_t *vertexes; /* first vertex (normal) */
+    int vertex_stride; /* actual vertex length in words */
+} test_polys[SCENE_POLYS];
+
+static float bench_sink = 0;
+
+/**
+ * Build a random scene in the style of a typical game frame - a few
+ * thousand polygons with a mix of vertex formats, each referenced from a
+ * few tiles. Vertex values are random but well-formed (screen-space x,y and
+ * positive 1/w, with the occasional 0).
+ */
+static void build_scene( uint32_t seed, gboolean cheap_shadow )
+{
+    uint32_t addr = POLYBASE/4;
+    uint32_t list = LISTBASE/4;
+    uint32_t *tiles = (uint32_t *)(pvr2_main_ram + TILEBASE);
+    int i, j, k;
+
+    rand_state = seed;
+    memset( pvr2_main_ram, 0, sizeof(pvr2_main_ram) );
+    mmio_region_PVR2.mem = pvr2_mmio;
+    MMIO_SET( RENDER_POLYBASE, POLYBASE );
+    MMIO_SET( RENDER_TILEBASE, TILEBASE );
+    MMIO_SET( RENDER_HCLIP, 639<<16 );
+    MMIO_SET( RENDER_VCLIP, 479<<16 );
+    MMIO_SET( RENDER_SHADOW, (cheap_shadow ? 0x100 : 0) | 0x80 );
+    MMIO_SET( RENDER_OBJCFG, 0x00200000 );
+    MMIO_SET( RENDER_FOGCOEFF, 0xFF07 );
+    *((float *)(pvr2_mmio + RENDER_FARCLIP)) = 0.2f;
+    for( i=0; i<128; i++ ) {
+        MMIO_SET( RENDER_FOGTABLE + (i<<2), test_rand() & 0xFFFF );
+    }
+
+    for( i=0; i<SCENE_POLYS; i++ ) {
+        struct test_poly *poly = &test_polys[i];
+        int vertex_length, context_length = 3;
+        poly->type = test_rand() % 3;
+        poly->vertex_count = poly->type == 0 ? 3 : poly->type == 1 ? 4 : 3 + test_rand() % 6;
+        poly->vertex_length = test_rand() % 4;
+        poly->is_modified = (test_rand() % 4) == 0;
+        vertex_length = poly->vertex_length;
+        if( poly->is_modified && !cheap_shadow ) {
+            vertex_length <<= 1;
+            context_length = 5;
+        }
+        vertex_length += 3;
+        poly->addr = addr;
+        poly->context = &RAMW(addr);
+        poly->vertexes = &RAMW(addr + context_length);
+        poly->vertex_stride = vertex_length;
+        for( j=0; j<5; j++ ) {
+            RAMW(addr+j) = test_rand();
+        }
+        for( j=0; j<poly->vertex_count; j++ ) {
+            uint32_t vert = addr + context_length + j*vertex_length;
+            RAMF(vert) = test_randf( 0, 640 );
+            RAMF(vert+1) = test_randf( 0, 480 );
+            RAMF(vert+2) = (test_rand() % 8) == 0 ? 0 : test_randf( 0.01, 100 );
+            for( k=3; k<vertex_length; k++ ) {
+                RAMW(vert+k) = test_rand();
+            }
+        }
+        addr += context_length + poly->vertex_count*vertex_length;
+    }
+
+    /* Background plane */
+    for( j=0; j<3+3*3; j++ ) {
+        RAMW(addr+j) = test_rand();
+    }
+    for( j=0; j<3; j++ ) {
+        RAMF(addr+3+j*3) = test_randf( 0, 640 );
+        RAMF(addr+4+j*3) = test_randf( 0, 480 );
+        RAMF(addr+5+j*3) = test_randf( 0.1, 10 );
+    }
+    MMIO_SET( RENDER_BGPLANE, (addr<<3) );
+
+    for( i=0; i<TILES_X*TILES_Y; i++ ) {
+        tiles[i*6] = ((i/TILES_X)<<8) | ((i%TILES_X)<<2) | (i == TILES_X*TILES_Y-1 ? SEGMENT_END : 0);
+        for( j=0; j<5; j++ ) {
+            int count = test_rand() % 40;
+            tiles[i*6+1+j] = list<<2;
+            for( k=0; k<count; k++ ) {
+                struct test_poly *poly = &test_polys[test_rand() % SCENE_POLYS];
+                uint32_t entry = poly->addr | (poly->vertex_length<<21) | (poly->is_modified ? 0x01000000 : 0);
+                if( poly->type == 0 ) {
+                    entry |= 0x80000000;
+                } else if( poly->type == 1 ) {
+                    entry |= 0xA0000000;
+                } else {
+                    entry |= (0x40000000 >> (poly->vertex_count-3));
+                }
+                RAMW(list++) = entry;
+            }
+            RAMW(list++) = 0xF0000000;
+        }
+    }
+}
+
+/*********************************** Tests **********************************/
+
+/**
+ * Decode every polygon in the scene both ways and check the results match
+ * exactly. Both output buffers are pre-filled with the same junk, as some
+ * fields (eg w) are never written by the decode.
+ */
+static gboolean test_decode( struct vertex_struct *a, struct vertex_struct *b )
+{
+    int i, j, errors = 0;
+    float fog_a[MAX_POLY_VERTEXES], fog_b[MAX_POLY_VERTEXES];
+
+    scene_init_lut_fog();
+    for( i=0; i<SCENE_POLYS; i++ ) {
+        struct test_poly *poly = &test_polys[i];
+        uint32_t *context = poly->context;
+        float zbounds_a[2] = { 1.0, 1.0 }, zbounds_b[2] = { 1.0, 1.0 };
+
+        memset( a, 0x55, MAX_POLY_VERTEXES * sizeof(struct vertex_struct) );
+        memset( b, 0x55, MAX_POLY_VERTEXES * sizeof(struct vertex_struct) );
+        for( j=0; j<poly->vertex_count; j++ ) {
+            scene_decode_vertex( &a[j], context[0], context[1], context[2],
+                                 poly->vertexes + j*poly->vertex_stride, 0, zbounds_a );
+        }
+        scene_decode_vertexes( b, poly->vertex_count, context[0], context[1], context[2],
+                               poly->vertexes, poly->vertex_stride, 0, zbounds_b );
+        if( memcmp( a, b, poly->vertex_count * sizeof(struct vertex_struct) ) != 0 ||
+                memcmp( zbounds_a, zbounds_b, sizeof(zbounds_a) ) != 0 ) {
+            fprintf( stderr, "Vertex decode mismatch in polygon %d (%08X %08X)\n", i, context[0], context[1] );
+            errors++;
+        }
+
+        for( j=0; j<poly->vertex_count; j++ ) {
+            fog_a[j] = scene_compute_lut_fog_vertex( a[j].z, scene_fog_density, scene_fog_table );
+        }
+        scene_compute_lut_fog_vertexes( a, poly->vertex_count, fog_b, scene_fog_density, scene_fog_table );
+        if( memcmp( fog_a, fog_b, poly->vertex_count * sizeof(float) ) != 0 ) {
+            fprintf( stderr, "Fog mismatch in polygon %d\n", i );
+            errors++;
+        }
+    }
+    return errors == 0;
+}
+
+/**
+ * Walk every tile list in the scene through pvr2_scene.vram, summing the
+ * polygon contexts that the entries map to.
+ */
+static uint32_t scene_checksum( void )
+{
+    struct tile_segment *segment = pvr2_scene.segment_list;
+    uint32_t sum = 0;
+    int i;
+
+    do {
+        uint32_t *ptr = &segment->opaque_ptr;
+        for( i=0; i<5; i++ ) {
+            if( (ptr[i] & NO_POINTER) == 0 ) {
+                uint32_t *list = (uint32_t *)(pvr2_scene.vram + (ptr[i] & 0x007FFFFF));
+                for(;;) {
+                    uint32_t entry = *list++;
+                    if( entry >> 28 == 0x0F ) {
+                        break;
+                    } else if( entry >> 28 == 0x0E ) {
+                        list = (uint32_t *)(pvr2_scene.vram + (entry&0x007FFFFF));
+                    } else {
+                        struct polygon_struct *poly = pvr2_scene.buf_to_poly_map[entry&0x000FFFFF];
+                        if( poly != NULL ) {
+                            sum = sum*31 + poly->context[0] + poly->context[1] + poly->context[2];
+                        }
+                    }
+                }
+            }
+        }
+    } while( ((segment++)->control & SEGMENT_END) == 0 );
+    return sum;
+}
+
+static gboolean test_snapshot( void )
+{
+    unsigned char *image = g_malloc0( PVR2_RAM_SIZE );
+    unsigned char *saved = g_malloc( PVR2_RAM_SIZE );
+    gboolean result = TRUE;
+
+    pvr2_scene_read();
+    uint32_t expected = scene_checksum();
+    pvr2_scene_snapshot( image );
+    memcpy( saved, pvr2_main_ram, PVR2_RAM_SIZE );
+    memset( pvr2_main_ram, 0xFF, PVR2_RAM_SIZE );
+    if( scene_checksum() != expected ) {
+        fprintf( stderr, "Snapshot scene differs from original\n" );
+        result = FALSE;
+    }
+    memcpy( pvr2_main_ram, saved, PVR2_RAM_SIZE );
+
+    /* The next read must start cleanly from the snapshotted state */
+    pvr2_scene_read();
+    if( scene_checksum() != expected || pvr2_scene.vram != pvr2_main_ram ) {
+        fprintf( stderr, "Scene read after snapshot differs from original\n" );
+        result = FALSE;
+    }
+    g_free( saved );
+    g_free( image );
+    return result;
+}
+
+/**
+ * Copy of the scene output from a serial pvr2_scene_read(), to compare the
+ * parallel reads against.
+ */
+static struct {
+    struct polygon_struct *polys;
+    struct vertex_struct *vertexes;
+    uint32_t poly_count, vertex_count;
+    float bounds[6];
+    float fog_lut_colour[4], fog_vert_colour[4];
+} reference;
+
+/**
+ * Read the scene using the given number of worker threads (0 for the
+ * default). The vertex buffer is cleared first so that any vertex the read
+ * fails to write shows up as a difference.
+ */
+static void scene_read_threads( int threads )
+{
+    workpool_shutdown();
+    workpool_init( threads );
+    memset( test_vertexes, 0, MAX_VERTEX_BUFFER_SIZE );
+    pvr2_scene_read();
+}
+
+static void save_reference( void )
+{
+    scene_read_threads( 1 );
+    reference.poly_count = pvr2_scene.poly_count;
+    reference.vertex_count = pvr2_scene.vertex_count;
+    reference.polys = g_realloc( reference.polys, pvr2_scene.poly_count * sizeof(struct polygon_struct) );
+    memcpy( reference.polys, pvr2_scene.poly_array, pvr2_scene.poly_count * sizeof(struct polygon_struct) );
+    reference.vertexes = g_realloc( reference.vertexes, pvr2_scene.vertex_count * sizeof(struct vertex_struct) );
+    memcpy( reference.vertexes, test_vertexes, pvr2_scene.vertex_count * sizeof(struct vertex_struct) );
+    memcpy( reference.bounds, pvr2_scene.bounds, sizeof(reference.bounds) );
+    memcpy( reference.fog_lut_colour, pvr2_scene.fog_lut_colour, sizeof(reference.fog_lut_colour) );
+    memcpy( reference.fog_vert_colour, pvr2_scene.fog_vert_colour, sizeof(reference.fog_vert_colour) );
+}
+
+/**
+ * Check the current scene against the serial reference. Polygons are
+ * compared field by field, as the structure padding isn't meaningful.
+ */
+static gboolean scene_matches_reference( const char *what )
+{
+    int i;
+
+    if( pvr2_scene.poly_count != reference.poly_count ||
+            pvr2_scene.vertex_count != reference.vertex_count ) {
+        fprintf( stderr, "%s: scene has %d polygons/%d vertexes, expected %d/%d\n", what,
+                 pvr2_scene.poly_count, pvr2_scene.vertex_count,
+                 reference.poly_count, reference.vertex_count );
+        return FALSE;
+    }
+    for( i=0; i<reference.poly_count; i++ ) {
+        struct polygon_struct *a = &reference.polys[i], *b = &pvr2_scene.poly_array[i];
+        if( a->context != b->context || a->vertex_count != b->vertex_count ||
+                a->tex_id != b->tex_id || a->vertex_index != b->vertex_index ||
+                a->mod_tex_id != b->mod_tex_id || a->mod_vertex_index != b->mod_vertex_index ||
+                a->next != b->next || a->sub_next != b->sub_next ) {
+            fprintf( stderr, "%s: polygon %d differs\n", what, i );
+            return FALSE;
+        }
+    }
+    for( i=0; i<reference.vertex_count; i++ ) {
+        if( memcmp( &reference.vertexes[i], &test_vertexes[i], sizeof(struct vertex_struct) ) != 0 ) {
+            fprintf( stderr, "%s: vertex %d differs\n", what, i );
+            return FALSE;
+        }
+    }
+    if( memcmp( reference.bounds, pvr2_scene.bounds, sizeof(reference.bounds) ) != 0 ||
+            memcmp( reference.fog_lut_colour, pvr2_scene.fog_lut_colour, sizeof(reference.fog_lut_colour) ) != 0 ||
+            memcmp( reference.fog_vert_colour, pvr2_scene.fog_vert_colour, sizeof(reference.fog_vert_colour) ) != 0 ) {
+        fprintf( stderr, "%s: scene bounds or fog colours differ\n", what );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * Read the scene with a range of worker counts, and check that every one
+ * produces exactly the same polygons, vertexes (including the computed fog
+ * colours) and bounds as the serial read.
+ */
+static gboolean test_parallel_read( void )
+{
+    static const int thread_counts[] = { 2, 3, 4, 7, 0 };
+    gboolean result = TRUE;
+    char what[32];
+    int i;
+
+    save_reference();
+    for( i=0; i<sizeof(thread_counts)/sizeof(thread_counts[0]); i++ ) {
+        scene_read_threads( thread_counts[i] );
+        snprintf( what, sizeof(what), "%d thread read", workpool_get_thread_count() );
+        if( !scene_matches_reference( what ) ) {
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+static void benchmark_decode( struct vertex_struct *out )
+{
+    struct timeval start;
+    float zbounds[2] = { 1.0, 1.0 };
+    float fog[MAX_POLY_VERTEXES];
+    int i, j, n;
+
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        for( i=0; i<SCENE_POLYS; i++ ) {
+            struct test_poly *poly = &test_polys[i];
+            for( j=0; j<poly->vertex_count; j++ ) {
+                scene_decode_vertex( &out[j], poly->context[0], poly->context[1], poly->context[2],
+                                     poly->vertexes + j*poly->vertex_stride, 0, zbounds );
+                fog[j] = scene_compute_lut_fog_vertex( out[j].z, scene_fog_density, scene_fog_table );
+            }
+            bench_sink += fog[0] + out[0].rgba[0];
+        }
+    }
+    printf( "Per-vertex decode + fog:   %5dms\n", elapsed_ms(&start) );
+
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        for( i=0; i<SCENE_POLYS; i++ ) {
+            struct test_poly *poly = &test_polys[i];
+            scene_decode_vertexes( out, poly->vertex_count, poly->context[0], poly->context[1],
+                                   poly->context[2], poly->vertexes, poly->vertex_stride, 0, zbounds );
+            scene_compute_lut_fog_vertexes( out, poly->vertex_count, fog, scene_fog_density, scene_fog_table );
+            bench_sink += fog[0] + out[0].rgba[0];
+        }
+    }
+    printf( "Batched decode + fog:      %5dms\n", elapsed_ms(&start) );
+}
+
+/**
+ * Time pvr2_scene_read() with the given number of threads. The timing is
+ * only reported if the scene that was read is identical to the serial
+ * reference (saved by test_parallel_read).
+ */
+static gboolean benchmark_scene_read( int threads )
+{
+    struct timeval start;
+    uint32_t ms;
+    char what[32];
+    int n;
+
+    scene_read_threads( threads );
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        pvr2_scene_read();
+    }
+    ms = elapsed_ms(&start);
+    snprintf( what, sizeof(what), "%d thread benchmark", workpool_get_thread_count() );
+    if( !scene_matches_reference( what ) ) {
+        return FALSE;
+    }
+    printf( "Scene read (%2d threads):   %5dms\n", workpool_get_thread_count(), ms );
+    return TRUE;
+}
+
+int main( int argc, char *argv[] )
+{
+    struct vertex_struct out_a[MAX_POLY_VERTEXES], out_b[MAX_POLY_VERTEXES];
+    gboolean result = TRUE;
+    int shadow;
+
+    test_driver.create_vertex_buffer = test_create_vertex_buffer;
+    test_vertexes = g_malloc( MAX_VERTEX_BUFFER_SIZE );
+
+    for( shadow = 0; shadow < 2; shadow++ ) {
+        build_scene( shadow+1, shadow );
+        pvr2_scene_read();
+        printf( "%s shadow scene: %d polygons, %d vertexes\n", shadow ? "Cheap" : "Full",
+                pvr2_scene.poly_count, pvr2_scene.vertex_count );
+        if( !test_decode( out_a, out_b ) ) {
+            result = FALSE;
+        }
+        if( !test_snapshot() ) {
+            result = FALSE;
+        }
+        if( !test_parallel_read() ) {
+            result = FALSE;
+        }
+        benchmark_decode( out_a );
+        if( !benchmark_scene_read( 1 ) || !benchmark_scene_read( 0 ) ) {
+            result = FALSE;
+        }
+    }
+    workpool_shutdown();
+    g_free( reference.polys );
+    g_free( reference.vertexes );
+    g_free( test_vertexes );
+    if( bench_sink == 0 ) {
+        printf( "\n" ); /* Keep the benchmark results live */
+    }
+
+    return result ? 0 : 1;
+}
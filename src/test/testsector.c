@@ -0,0 +1,379 @@
+/**
+ * $Id$
+ *
+ * File sector source test and benchmark. Checks that the mmap and pread
+ * paths return the same data (including offset sub-sources, zero-fill past
+ * the end of the file, and concurrent readers), checks the raw sector
+ * cache, and compares sequential and random sector throughput against the
+ * original fseek/fread loop.
+ *
+ * The tests run on a generated 8MB image. The benchmark is optional: pass
+ * --benchmark to run it on a generated 128MB image, or the name of a real
+ * image file (eg a GD-ROM high-density track) to run it on that instead.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "drivers/cdrom/sector.h"
+
+#define TEST_IMAGE_SECTORS 4096   /* 8MB at 2048 bytes/sector */
+#define BENCH_IMAGE_SECTORS 65536 /* 128MB */
+#define RANDOM_READS 200000
+#define THREADS 4
+
+int cd_build_address( unsigned char inout[], int sectortype, unsigned address ) { return 0; }
+static int encode_count = 0;
+int do_encode_L2( unsigned char *inout, int sectortype, unsigned address )
+{
+    encode_count++;
+    memset( inout, address, 16 );
+    return 0;
+}
+cdrom_error_t cdrom_disc_read_sectors( cdrom_disc_t disc, cdrom_lba_t lba, cdrom_count_t count, cdrom_read_mode_t mode,
+                                       unsigned char *buf, size_t *length ) { return CDROM_ERROR_NODISC; }
+gchar *get_filename_at( const gchar *at, const gchar *filename )
+{
+    return g_strdup_printf( "%s/%s", at, filename );
+}
+
+static int image_sectors = TEST_IMAGE_SECTORS;
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+static void fill_sector( unsigned char *buf, cdrom_lba_t lba )
+{
+    uint32_t *p = (uint32_t *)buf;
+    int i;
+    for( i=0; i<2048/4; i++ ) {
+        p[i] = (lba * 0x9E3779B1) ^ i;
+    }
+}
+
+static gboolean check_sector( const unsigned char *buf, cdrom_lba_t lba )
+{
+    unsigned char expect[2048];
+    fill_sector( expect, lba );
+    return memcmp( buf, expect, 2048 ) == 0;
+}
+
+/**
+ * Generate the test image in a new temporary file, and return its name
+ */
+static gchar *create_image()
+{
+    unsigned char buf[2048*64];
+    gchar *filename = g_strdup( "/tmp/testsector-XXXXXX" );
+    int fd = mkstemp( filename );
+    cdrom_lba_t lba;
+    int i;
+
+    for( lba=0; lba<image_sectors; lba += 64 ) {
+        for( i=0; i<64; i++ ) {
+            fill_sector( &buf[2048*i], lba+i );
+        }
+        if( fd == -1 || write( fd, buf, sizeof(buf) ) != sizeof(buf) ) {
+            fprintf( stderr, "Unable to write test image\n" );
+            exit(2);
+        }
+    }
+    close( fd );
+    return filename;
+}
+
+/**
+ * Open the image, either mapped or read through pread
+ */
+static sector_source_t open_image( const char *filename, gboolean map )
+{
+    sector_source_t source;
+    file_sector_source_set_map_enabled( map );
+    source = file_sector_source_new_filename( filename, SECTOR_MODE1, 0, FILE_SECTOR_FULL_FILE );
+    file_sector_source_set_map_enabled( TRUE );
+    if( source == NULL ) {
+        fprintf( stderr, "Unable to open %s\n", filename );
+        exit(2);
+    }
+    sector_source_ref( source );
+    return source;
+}
+
+static gboolean test_read( sector_source_t source, const char *name )
+{
+    unsigned char buf[2048*16];
+    int n, i;
+
+    for( n=0; n<5000; n++ ) {
+        cdrom_count_t count = (test_rand() % 16) + 1;
+        cdrom_lba_t lba = test_rand() % (image_sectors - count);
+        if( sector_source_read( source, lba, count, buf ) != CDROM_ERROR_OK ) {
+            fprintf( stderr, "%s: read failed at %d+%d\n", name, lba, count );
+            return FALSE;
+        }
+        for( i=0; i<count; i++ ) {
+            if( !check_sector( &buf[2048*i], lba+i ) ) {
+                fprintf( stderr, "%s: data mismatch at %d\n", name, lba+i );
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * Check a sub-source that starts part-way through the file and runs past
+ * the end of it.
+ */
+static gboolean test_subsource( sector_source_t base, const char *name )
+{
+    unsigned char buf[2048*4], zero[2048*2];
+    gboolean result = TRUE;
+    sector_source_t source = file_sector_source_new_source( base, SECTOR_MODE1,
+            (uint64_t)2048*(image_sectors-2), 4 );
+    sector_source_ref( source );
+
+    memset( buf, 0xFF, sizeof(buf) );
+    memset( zero, 0, sizeof(zero) );
+    if( sector_source_read( source, 0, 4, buf ) != CDROM_ERROR_OK ||
+            !check_sector( buf, image_sectors-2 ) || !check_sector( buf+2048, image_sectors-1 ) ||
+            memcmp( buf+4096, zero, sizeof(zero) ) != 0 ) {
+        fprintf( stderr, "%s: bad sub-source read\n", name );
+        result = FALSE;
+    }
+    sector_source_unref( source );
+    return result;
+}
+
+struct thread_args {
+    sector_source_t source;
+    uint32_t seed;
+    gboolean result;
+};
+
+static void *test_thread( void *arg )
+{
+    struct thread_args *args = (struct thread_args *)arg;
+    unsigned char buf[2048*4];
+    int n, i;
+
+    args->result = TRUE;
+    for( n=0; n<20000; n++ ) {
+        args->seed = args->seed * 1103515245 + 12345;
+        cdrom_lba_t lba = (args->seed >> 8) % (image_sectors - 4);
+        sector_source_read( args->source, lba, 4, buf );
+        for( i=0; i<4; i++ ) {
+            if( !check_sector( &buf[2048*i], lba+i ) ) {
+                args->result = FALSE;
+                return NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+static gboolean test_threads( sector_source_t source, const char *name )
+{
+    struct thread_args args[THREADS];
+    pthread_t threads[THREADS];
+    gboolean result = TRUE;
+    int i;
+
+    for( i=0; i<THREADS; i++ ) {
+        args[i].source = source;
+        args[i].seed = test_rand();
+        pthread_create( &threads[i], NULL, test_thread, &args[i] );
+    }
+    for( i=0; i<THREADS; i++ ) {
+        pthread_join( threads[i], NULL );
+        if( !args[i].result ) {
+            fprintf( stderr, "%s: data mismatch in thread %d\n", name, i );
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+/**
+ * Check that raw reads from a data-only source are cached when enabled, and
+ * that the cache doesn't outlive the source.
+ */
+static gboolean test_raw_cache()
+{
+    unsigned char first[2352], buf[2352];
+    gboolean result = TRUE;
+    size_t length;
+    int i, count;
+
+    sector_source_set_raw_cache_enabled( TRUE );
+    for( i=0; i<2; i++ ) {
+        sector_source_t source = mem_sector_source_new( SECTOR_MODE1, 16 );
+        sector_source_ref( source );
+        fill_sector( mem_sector_source_get_buffer(source) + 5*2048, 5+i );
+        count = encode_count;
+        sector_source_read_sectors( source, 5, 1, CDROM_READ_RAW, first, &length );
+        sector_source_read_sectors( source, 5, 1, CDROM_READ_RAW, buf, &length );
+        if( encode_count != count + 1 || memcmp( first, buf, 2352 ) != 0 || !check_sector( buf+16, 5+i ) ) {
+            fprintf( stderr, "Raw sector cache: bad read from source %d\n", i );
+            result = FALSE;
+        }
+        sector_source_unref( source );
+    }
+
+    sector_source_set_raw_cache_enabled( FALSE );
+    sector_source_t source = mem_sector_source_new( SECTOR_MODE1, 16 );
+    sector_source_ref( source );
+    count = encode_count;
+    sector_source_read_sectors( source, 5, 1, CDROM_READ_RAW, buf, &length );
+    sector_source_read_sectors( source, 5, 1, CDROM_READ_RAW, buf, &length );
+    if( encode_count != count + 2 ) {
+        fprintf( stderr, "Raw sector cache: still caching when disabled\n" );
+        result = FALSE;
+    }
+    sector_source_unref( source );
+    return result;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+/**
+ * The original file read, used as the baseline
+ */
+static void fread_sector( FILE *f, cdrom_lba_t lba, unsigned char *buf )
+{
+    fseek( f, lba * 2048, SEEK_SET );
+    if( fread( buf, 1, 2048, f ) != 2048 ) {
+        memset( buf, 0, 2048 );
+    }
+}
+
+static void benchmark_source( const char *name, FILE *f, sector_source_t source, cdrom_count_t sectors )
+{
+    unsigned char buf[2048];
+    struct timeval start;
+    uint32_t sum = 0, ms;
+    cdrom_lba_t lba;
+    int n;
+
+    gettimeofday( &start, NULL );
+    for( lba=0; lba<sectors; lba++ ) {
+        if( source == NULL )
+            fread_sector( f, lba, buf );
+        else
+            sector_source_read( source, lba, 1, buf );
+        sum += buf[lba&2047];
+    }
+    ms = elapsed_ms(&start);
+    printf( "%-12s sequential: %5dms (%5.0f MB/s)\n", name, ms,
+            ms == 0 ? 0.0 : (sectors * 2048.0) / (ms * 1000.0) );
+
+    test_seed = 0x5EED;
+    gettimeofday( &start, NULL );
+    for( n=0; n<RANDOM_READS; n++ ) {
+        lba = test_rand() % sectors;
+        if( source == NULL )
+            fread_sector( f, lba, buf );
+        else
+            sector_source_read( source, lba, 1, buf );
+        sum += buf[lba&2047];
+    }
+    ms = elapsed_ms(&start);
+    printf( "%-12s random:     %5dms (%5.0fK sectors/s) (%08X)\n", name, ms,
+            ms == 0 ? 0.0 : (double)RANDOM_READS / ms, sum );
+}
+
+static void benchmark( const char *filename )
+{
+    FILE *f = fopen( filename, "r" );
+    sector_source_t mapped = open_image( filename, TRUE );
+    sector_source_t unmapped = open_image( filename, FALSE );
+    if( f == NULL ) {
+        fprintf( stderr, "Unable to open %s\n", filename );
+        exit(2);
+    }
+
+    printf( "Benchmarking %d sectors\n", mapped->size );
+    benchmark_source( "fseek+fread", f, NULL, mapped->size );
+    benchmark_source( "pread", f, unmapped, mapped->size );
+    benchmark_source( "mmap", f, mapped, mapped->size );
+    sector_source_unref( mapped );
+    sector_source_unref( unmapped );
+    fclose( f );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+
+    if( argc > 1 ) {
+        if( strcmp( argv[1], "--benchmark" ) != 0 ) {
+            benchmark( argv[1] );
+        } else {
+            image_sectors = BENCH_IMAGE_SECTORS;
+            gchar *filename = create_image();
+            benchmark( filename );
+            unlink( filename );
+            g_free( filename );
+        }
+        return 0;
+    }
+
+    gchar *filename = create_image();
+    sector_source_t image = open_image( filename, FALSE );
+    sector_source_t mapped = open_image( filename, TRUE );
+    if( file_sector_source_get_data( mapped, 0, 1 ) == NULL ) {
+        fprintf( stderr, "Image file was not mapped\n" );
+        result = FALSE;
+    }
+
+    result = test_read( image, "pread" ) && result;
+    result = test_read( mapped, "mmap" ) && result;
+    result = test_subsource( image, "pread" ) && result;
+    result = test_subsource( mapped, "mmap" ) && result;
+    result = test_threads( image, "pread" ) && result;
+    result = test_threads( mapped, "mmap" ) && result;
+    result = test_raw_cache() && result;
+
+    const unsigned char *data = file_sector_source_get_data( mapped, 1234, 2 );
+    if( data == NULL || !check_sector( data, 1234 ) ||
+            !check_sector( data + 2048, 1235 ) ) {
+        fprintf( stderr, "Bad direct mapping\n" );
+        result = FALSE;
+    }
+    if( file_sector_source_get_data( image, 0, 1 ) != NULL ||
+            file_sector_source_get_data( mapped, image_sectors-1, 2 ) != NULL ) {
+        fprintf( stderr, "Direct mapping should have failed\n" );
+        result = FALSE;
+    }
+
+    sector_source_unref( mapped );
+    sector_source_unref( image );
+    unlink( filename );
+    g_free( filename );
+    return result ? 0 : 1;
+}
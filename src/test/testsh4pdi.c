@@ -0,0 +1,387 @@
+/**
+ * $Id$
+ *
+ * Pre-decoded SH4 interpreter test and benchmark. Runs a small SH4 program
+ * (integer and FPU loops, a subroutine call, delay slots and optionally
+ * self-modifying code) through sh4_emulate_run_slice with and without the
+ * pre-decoded interpreter, checks that the final CPU state, memory and
+ * event timing are identical, and reports MIPS for each. Also checks that
+ * writes only invalidate the blocks that cover them.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "sh4/sh4core.h"
+#include "sh4/sh4mmio.h"
+#include "sh4/sh4pdi.h"
+
+#define RAM_VMA 0x8C010000
+#define RAM_PHYS 0x0C010000
+#define RAM_SIZE 0x10000
+#define DATA_OFFSET 0x8000
+#define OUTPUT_OFFSET 0xC000
+#define SCRATCH_OFFSET 0xC010
+#define PATCH_OFFSET 0x28
+#define SLICE_NS 1000000
+#define EVENT_PERIOD 7919
+
+/* Sums a 64-word table into r1 (in r2 out to @r9), mixes the outer counter
+ * through MUL.L and the FPU, patches the immediate of the MOV at 0x28 via
+ * @r8, calls a subroutine from a delay slot branch, and sleeps when r5
+ * reaches 0. */
+static const uint16_t test_program[] = {
+    0xE740, /* 00 outer: mov #64, r7 */
+    0x6643, /* 02 mov r4, r6 */
+    0x6266, /* 04 inner: mov.l @r6+, r2 */
+    0x312C, /* 06 add r2, r1 */
+    0x221A, /* 08 xor r1, r2 */
+    0x2922, /* 0A mov.l r2, @r9 */
+    0x4710, /* 0C dt r7 */
+    0x8BF9, /* 0E bf inner */
+    0x7001, /* 10 add #1, r0 */
+    0x0017, /* 12 mul.l r1, r0 */
+    0x031A, /* 14 sts macl, r3 */
+    0x435A, /* 16 lds r3, fpul */
+    0xF02D, /* 18 float fpul, fr0 */
+    0xF100, /* 1A fadd fr0, fr1 */
+    0xF13D, /* 1C ftrc fr1, fpul */
+    0x6E03, /* 1E mov r0, r14 */
+    0x2EC9, /* 20 and r12, r14 */
+    0x2EDB, /* 22 or r13, r14 */
+    0x28E1, /* 24 mov.w r14, @r8 */
+    0x0A5A, /* 26 sts fpul, r10 */
+    0xEB00, /* 28 mov #0, r11 (patched) */
+    0x3FBC, /* 2A add r11, r15 */
+    0xB004, /* 2C bsr sub */
+    0x7F01, /* 2E add #1, r15 */
+    0x4510, /* 30 dt r5 */
+    0x8FE5, /* 32 bf/s outer */
+    0x0009, /* 34 nop */
+    0x001B, /* 36 sleep */
+    0x3A0C, /* 38 sub: add r0, r10 */
+    0x000B, /* 3A rts */
+    0x0009, /* 3C nop */
+};
+
+struct sh4_registers sh4r;
+struct sh4_icache_struct sh4_icache;
+struct dreamcast_module sh4_module;
+struct mmio_region mmio_region_CPG;
+struct breakpoint_struct sh4_breakpoints[MAX_BREAKPOINTS];
+int sh4_breakpoint_count = 0;
+uint32_t sh4_cpu_period = 5;
+
+static unsigned char test_ram[RAM_SIZE];
+static char cpg_mem[4096];
+static uint32_t event_hash;
+static int event_count;
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+void sh4_core_exit( int exit_code ) { fprintf( stderr, "Unexpected core exit %d\n", exit_code ); abort(); }
+void FASTCALL sh4_raise_exception( int code ) { fprintf( stderr, "Unexpected exception %03X at %08X\n", code, sh4r.pc ); abort(); }
+void FASTCALL sh4_raise_trap( int trap ) { sh4_raise_exception( EXC_TRAP ); }
+void MMU_ldtlb() { }
+void FASTCALL sh4_fsca( uint32_t angle, float *fr ) { }
+void FASTCALL sh4_ftrv( float *fv ) { }
+void syscall_invoke( uint32_t val ) { }
+void TMU_run_slice( uint32_t nanos ) { }
+void SCIF_run_slice( uint32_t nanos ) { }
+
+void FASTCALL sh4_switch_fr_banks( void )
+{
+    int i;
+    for( i=0; i<16; i++ ) {
+        float tmp = sh4r.fr[0][i];
+        sh4r.fr[0][i] = sh4r.fr[1][i];
+        sh4r.fr[1][i] = tmp;
+    }
+}
+
+void FASTCALL sh4_write_sr( uint32_t newval )
+{
+    sh4r.sr = newval & SR_MASK;
+    sh4r.t = (newval&SR_T) ? 1 : 0;
+    sh4r.s = (newval&SR_S) ? 1 : 0;
+    sh4r.m = (newval&SR_M) ? 1 : 0;
+    sh4r.q = (newval&SR_Q) ? 1 : 0;
+}
+
+uint32_t FASTCALL sh4_read_sr( void )
+{
+    sh4r.sr &= SR_MQSTMASK;
+    if( sh4r.t ) sh4r.sr |= SR_T;
+    if( sh4r.s ) sh4r.sr |= SR_S;
+    if( sh4r.m ) sh4r.sr |= SR_M;
+    if( sh4r.q ) sh4r.sr |= SR_Q;
+    return sh4r.sr;
+}
+
+void FASTCALL sh4_write_fpscr( uint32_t newval )
+{
+    if( (sh4r.fpscr ^ newval) & FPSCR_FR ) {
+        sh4_switch_fr_banks();
+    }
+    sh4r.fpscr = newval & FPSCR_MASK;
+}
+
+/* Record where each event was taken, so the two runs can be compared */
+void sh4_handle_pending_events()
+{
+    event_hash = (event_hash * 31) + (sh4r.slice_cycle ^ sh4r.pc);
+    event_count++;
+    sh4r.event_pending += EVENT_PERIOD;
+}
+
+/* Flat RAM, with writes invalidating the pre-decoded blocks the same way
+ * sdram.c invalidates translated code */
+static unsigned char *test_ram_ptr( sh4addr_t addr, int size )
+{
+    if( addr < RAM_PHYS || addr + size > RAM_PHYS + RAM_SIZE ) {
+        fprintf( stderr, "Access to %08X outside test RAM\n", addr );
+        abort();
+    }
+    return test_ram + (addr - RAM_PHYS);
+}
+static int32_t FASTCALL test_read_long( sh4addr_t addr ) { return *(int32_t *)test_ram_ptr(addr,4); }
+static int32_t FASTCALL test_read_word( sh4addr_t addr ) { return *(int16_t *)test_ram_ptr(addr,2); }
+static int32_t FASTCALL test_read_byte( sh4addr_t addr ) { return *(int8_t *)test_ram_ptr(addr,1); }
+static void FASTCALL test_write_long( sh4addr_t addr, uint32_t val )
+{
+    *(uint32_t *)test_ram_ptr(addr,4) = val;
+    sh4_pdi_invalidate_block( addr, 4 );
+}
+static void FASTCALL test_write_word( sh4addr_t addr, uint32_t val )
+{
+    *(uint16_t *)test_ram_ptr(addr,2) = val;
+    sh4_pdi_invalidate_block( addr, 2 );
+}
+static void FASTCALL test_write_byte( sh4addr_t addr, uint32_t val )
+{
+    *test_ram_ptr(addr,1) = val;
+    sh4_pdi_invalidate_block( addr, 1 );
+}
+static void FASTCALL test_prefetch( sh4addr_t addr ) { }
+
+static struct mem_region_fn test_region = {
+        test_read_long, test_write_long, test_read_word, test_write_word,
+        test_read_byte, test_write_byte, NULL, NULL, test_prefetch, test_read_byte };
+
+mem_region_fn_t FASTCALL mmu_get_region_for_vma_read( sh4vma_t *addr )
+{
+    *addr &= 0x1FFFFFFF;
+    return &test_region;
+}
+mem_region_fn_t FASTCALL mmu_get_region_for_vma_write( sh4vma_t *addr )
+{
+    *addr &= 0x1FFFFFFF;
+    return &test_region;
+}
+mem_region_fn_t FASTCALL mmu_get_region_for_vma_prefetch( sh4vma_t *addr )
+{
+    *addr &= 0x1FFFFFFF;
+    return &test_region;
+}
+
+gboolean FASTCALL mmu_update_icache( sh4vma_t addr )
+{
+    if( (addr & 0xFFFF0000) != RAM_VMA ) {
+        return FALSE;
+    }
+    sh4_icache.page_vma = RAM_VMA;
+    sh4_icache.page_ppa = RAM_PHYS;
+    sh4_icache.mask = 0xFFFF0000;
+    sh4_icache.page = test_ram;
+    return TRUE;
+}
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand( void )
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+static void test_reset( uint32_t iterations, gboolean smc )
+{
+    int i;
+    memset( test_ram, 0, sizeof(test_ram) );
+    memcpy( test_ram, test_program, sizeof(test_program) );
+    test_seed = 0x5EED;
+    for( i=0; i<64; i++ ) {
+        ((uint32_t *)(test_ram + DATA_OFFSET))[i] = test_rand();
+    }
+    memset( &sh4r, 0, sizeof(sh4r) );
+    memset( &sh4_icache, 0, sizeof(sh4_icache) );
+    sh4_icache.page_vma = -1;
+    sh4r.sr = SR_MD;
+    sh4r.pc = RAM_VMA;
+    sh4r.new_pc = RAM_VMA + 2;
+    sh4r.r[4] = RAM_VMA + DATA_OFFSET;
+    sh4r.r[5] = iterations;
+    sh4r.r[8] = RAM_VMA + (smc ? PATCH_OFFSET : SCRATCH_OFFSET);
+    sh4r.r[9] = RAM_VMA + OUTPUT_OFFSET;
+    sh4r.r[12] = 0x7F;
+    sh4r.r[13] = 0xEB00;
+    sh4r.sh4_state = SH4_STATE_RUNNING;
+    sh4r.event_pending = EVENT_PERIOD;
+    event_hash = 0;
+    event_count = 0;
+    sh4_pdi_flush_cache();
+}
+
+/**
+ * Run the program until it sleeps.
+ * @return the number of instructions executed
+ */
+static uint64_t test_run( void )
+{
+    uint64_t instructions = 0;
+    while( sh4r.sh4_state == SH4_STATE_RUNNING ) {
+        sh4r.slice_cycle = 0;
+        sh4_emulate_run_slice( SLICE_NS );
+        instructions += sh4r.slice_cycle / sh4_cpu_period;
+        sh4r.event_pending -= SLICE_NS;
+    }
+    return instructions + 1; /* The SLEEP */
+}
+
+static uint32_t elapsed_us( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000000 + (end.tv_usec - start->tv_usec);
+}
+
+/**
+ * Run the program with the single-step interpreter and the pre-decoded
+ * interpreter, and check both finish in exactly the same state.
+ */
+static gboolean test_compare( const char *name, uint32_t iterations, gboolean smc )
+{
+    struct sh4_registers step_regs;
+    static unsigned char step_ram[RAM_SIZE];
+    uint32_t step_hash;
+    uint64_t step_count, pdi_count;
+    struct timeval start;
+    uint32_t step_us, pdi_us;
+
+    sh4_pdi_set_enabled( FALSE );
+    test_reset( iterations, smc );
+    gettimeofday( &start, NULL );
+    step_count = test_run();
+    step_us = elapsed_us( &start );
+    step_regs = sh4r;
+    step_hash = event_hash;
+    memcpy( step_ram, test_ram, RAM_SIZE );
+
+    sh4_pdi_set_enabled( TRUE );
+    test_reset( iterations, smc );
+    gettimeofday( &start, NULL );
+    pdi_count = test_run();
+    pdi_us = elapsed_us( &start );
+
+    if( memcmp( &step_regs, &sh4r, sizeof(sh4r) ) != 0 || step_count != pdi_count ) {
+        int i;
+        fprintf( stderr, "%s: CPU state differs (%lld vs %lld instructions)\n", name,
+                 (long long)step_count, (long long)pdi_count );
+        fprintf( stderr, "  pc: %08X %08X\n", step_regs.pc, sh4r.pc );
+        for( i=0; i<16; i++ ) {
+            fprintf( stderr, "  r%d: %08X %08X\n", i, step_regs.r[i], sh4r.r[i] );
+        }
+        return FALSE;
+    }
+    if( memcmp( step_ram, test_ram, RAM_SIZE ) != 0 ) {
+        fprintf( stderr, "%s: memory differs\n", name );
+        return FALSE;
+    }
+    if( step_hash != event_hash || event_count == 0 ) {
+        fprintf( stderr, "%s: events were handled at different points\n", name );
+        return FALSE;
+    }
+    if( smc && sh4r.r[15] == iterations ) {
+        fprintf( stderr, "%s: patched instruction never executed\n", name );
+        return FALSE;
+    }
+
+    printf( "%-6s %10lld instructions: step %7.1f MIPS, pre-decoded %7.1f MIPS (%.2fx)\n", name,
+            (long long)pdi_count, step_count / (double)step_us, pdi_count / (double)pdi_us,
+            step_us / (double)pdi_us );
+    return TRUE;
+}
+
+/**
+ * Decode overlapping blocks (the outer loop from the top, and the inner loop
+ * from its branch target, in both orders) and check that a write only
+ * invalidates the blocks covering the written address.
+ */
+static gboolean test_invalidate( void )
+{
+    static const struct { uint32_t first, write; gboolean outer, inner, after; } cases[] = {
+        { 0x00, 0x06, TRUE, TRUE, FALSE },   /* Both loops cover 0x06 */
+        { 0x00, 0x02, TRUE, FALSE, FALSE },  /* Only the outer loop covers 0x02 */
+        { 0x04, 0x0E, TRUE, TRUE, FALSE },   /* Decoded inner first, both cover the branch */
+        { 0x04, 0x00, TRUE, FALSE, FALSE },
+        { 0x00, 0x10, FALSE, FALSE, TRUE },  /* Only the following block */
+    };
+    gboolean result = TRUE;
+    int i;
+
+    for( i=0; i<sizeof(cases)/sizeof(cases[0]); i++ ) {
+        sh4_pdi_block_t outer, inner, after;
+        test_reset( 1, FALSE );
+        mmu_update_icache( RAM_VMA );
+        if( cases[i].first == 0 ) {
+            outer = sh4_pdi_get_block( RAM_VMA );
+            inner = sh4_pdi_get_block( RAM_VMA + 0x04 );
+        } else {
+            inner = sh4_pdi_get_block( RAM_VMA + 0x04 );
+            outer = sh4_pdi_get_block( RAM_VMA );
+        }
+        after = sh4_pdi_get_block( RAM_VMA + 0x10 );
+        sh4_pdi_invalidate_block( RAM_PHYS + cases[i].write, 2 );
+        if( outer->active == cases[i].outer || inner->active == cases[i].inner ||
+                after->active == cases[i].after ) {
+            fprintf( stderr, "Write to %02X: outer %s, inner %s, following block %s\n", cases[i].write,
+                     outer->active ? "active" : "invalidated", inner->active ? "active" : "invalidated",
+                     after->active ? "active" : "invalidated" );
+            result = FALSE;
+        }
+        if( (inner->active && sh4_pdi_get_block( RAM_VMA + 0x04 ) != inner) ||
+                !sh4_pdi_get_block( RAM_VMA )->active || !sh4_pdi_get_block( RAM_VMA + 0x04 )->active ) {
+            fprintf( stderr, "Write to %02X: blocks not found again afterwards\n", cases[i].write );
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+    mmio_region_CPG.mem = cpg_mem;
+    sh4_pdi_init();
+    if( !sh4_pdi_is_enabled() ) {
+        printf( "Pre-decoded interpreter not supported by this compiler\n" );
+        return 0;
+    }
+    result = test_invalidate() && result;
+    result = test_compare( "smc", 20000, TRUE ) && result;
+    result = test_compare( "loop", 200000, FALSE ) && result;
+    return result ? 0 : 1;
+}
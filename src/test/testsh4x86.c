@@ -29,6 +29,7 @@
 #include "sh4/sh4core.h"
 #include "sh4/sh4mmio.h"
 #include "sh4/mmu.h"
+#include "sh4/sh4pdi.h"
 
 struct dreamcast_module sh4_module;
 struct mmio_region mmio_region_MMU;
@@ -122,6 +123,10 @@ struct sh4_icache_struct sh4_icache;
 struct mem_region_fn mem_region_unmapped;
 const struct cpu_desc_struct sh4_cpu_desc;
 sh4addr_t FASTCALL mmu_vma_to_phys_disasm( sh4vma_t vma ) { return vma; }
+void FASTCALL sh4_pdi_invalidate_block( sh4addr_t address, size_t bytes ) { }
+void FASTCALL sh4_pdi_flush_page( sh4addr_t address ) { }
+void sh4_pdi_flush_cache( void ) { }
+gboolean sh4_translate_is_enabled() { return TRUE; }
 
 void usage()
 {
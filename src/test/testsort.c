@@ -0,0 +1,278 @@
+/**
+ * $Id$
+ *
+ * Translucent triangle sort test and benchmark. Checks that the arena-based
+ * sort produces exactly the same order as the original recursive merge sort
+ * over the tile lists in testsort.data, and reports the time taken by each
+ * (serial and parallel).
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/scene.h"
+#include "pvr2/rendsort.h"
+#include "workpool.h"
+
+#define MAX_TILES 256
+#define MAX_TRIANGLES 65536
+#define ITERATIONS 200
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+
+unsigned char pvr2_main_ram[8*1024*1024];
+struct pvr2_scene_struct pvr2_scene;
+
+static struct vertex_struct vertexes[MAX_TRIANGLES*3];
+static struct polygon_struct polys[MAX_TRIANGLES];
+static struct polygon_struct *poly_map[MAX_TRIANGLES];
+static struct tile_segment segments[MAX_TILES];
+static int tile_count = 0, triangle_count = 0;
+
+/**
+ * The original recursive merge sort, used as the reference result.
+ */
+static void reference_sort( struct sort_triangle **triangles, int num_triangles, struct sort_triangle **out )
+{
+    if( num_triangles > 2 ) {
+        int l = num_triangles>>1, r=num_triangles-l, i=0,j=0;
+        struct sort_triangle *left[l];
+        struct sort_triangle *right[r];
+        reference_sort( triangles, l, left );
+        reference_sort( triangles+l, r, right );
+
+        while(1) {
+            if( sort_triangle_compare(left[i], right[j]) <= 0 ) {
+                *out++ = left[i++];
+                if( i == l ) {
+                    memcpy( out, &right[j], (r-j)*sizeof(struct sort_triangle *) );
+                    break;
+                }
+            } else {
+                *out++ = right[j++];
+                if( j == r ) {
+                    memcpy( out, &left[i], (l-i)*sizeof(struct sort_triangle *) );
+                    break;
+                }
+            }
+        }
+    } else if( num_triangles == 2 ) {
+        if( sort_triangle_compare(triangles[0], triangles[1]) <= 0 ) {
+            out[0] = triangles[0];
+            out[1] = triangles[1];
+        } else {
+            struct sort_triangle *tmp = triangles[0];
+            out[0] = triangles[1];
+            out[1] = tmp;
+        }
+    } else {
+        out[0] = triangles[0];
+    }
+}
+
+/**
+ * Load the tile lists into the fake scene. Each tile becomes a segment
+ * whose translucent list contains one polygon entry per triangle.
+ */
+static gboolean load_scene( const char *filename )
+{
+    char line[512];
+    uint32_t *list = (uint32_t *)pvr2_main_ram;
+    FILE *f = fopen( filename, "r" );
+    if( f == NULL ) {
+        fprintf( stderr, "Unable to open %s\n", filename );
+        return FALSE;
+    }
+
+    while( fgets( line, sizeof(line), f ) != NULL ) {
+        int tx, ty;
+        float v[9];
+        if( line[0] == '#' ) {
+            continue;
+        } else if( sscanf( line, "tile %d %d", &tx, &ty ) == 2 ) {
+            if( tile_count != 0 ) {
+                *list++ = 0xF0000000;
+            }
+            if( tile_count == MAX_TILES ) {
+                break;
+            }
+            segments[tile_count].control = ((ty>>5) << 8) | ((tx>>5) << 2);
+            segments[tile_count].trans_ptr = ((unsigned char *)list) - pvr2_main_ram;
+            segments[tile_count].opaque_ptr = segments[tile_count].opaquemod_ptr =
+                segments[tile_count].transmod_ptr = segments[tile_count].punchout_ptr = NO_POINTER;
+            tile_count++;
+        } else if( tile_count != 0 && triangle_count < MAX_TRIANGLES &&
+                sscanf( line, "%f %f %f %f %f %f %f %f %f", &v[0], &v[1], &v[2],
+                        &v[3], &v[4], &v[5], &v[6], &v[7], &v[8] ) == 9 ) {
+            struct polygon_struct *poly = &polys[triangle_count];
+            int i;
+            for( i=0; i<3; i++ ) {
+                vertexes[triangle_count*3+i].x = v[i*3];
+                vertexes[triangle_count*3+i].y = v[i*3+1];
+                vertexes[triangle_count*3+i].z = v[i*3+2];
+            }
+            poly->vertex_count = 3;
+            poly->vertex_index = triangle_count*3;
+            poly->mod_vertex_index = -1;
+            poly->next = poly->sub_next = NULL;
+            poly_map[triangle_count] = poly;
+            *list++ = 0x20000000 | triangle_count;
+            triangle_count++;
+        }
+    }
+    fclose(f);
+    if( tile_count == 0 ) {
+        fprintf( stderr, "No tiles found in %s\n", filename );
+        return FALSE;
+    }
+    *list++ = 0xF0000000;
+    segments[tile_count-1].control |= SEGMENT_END;
+
+    pvr2_scene.vertex_array = vertexes;
+    pvr2_scene.poly_array = polys;
+    pvr2_scene.poly_count = triangle_count;
+    pvr2_scene.buf_to_poly_map = poly_map;
+    pvr2_scene.segment_list = segments;
+    pvr2_scene.vram = pvr2_main_ram;
+    pvr2_scene.sort_mode = SORT_ALWAYS;
+    return TRUE;
+}
+
+struct check_state {
+    struct sort_triangle **expected;
+    int count;
+    int pos;
+    gboolean ok;
+};
+
+static void check_triangle( struct polygon_struct *poly, int index, void *data )
+{
+    struct check_state *state = data;
+    if( state->pos >= state->count || state->expected[state->pos]->poly != poly ||
+            state->expected[state->pos]->triangle_num != index ) {
+        state->ok = FALSE;
+    }
+    state->pos++;
+}
+
+static gboolean test_sort_order()
+{
+    struct sort_triangle *triangles = g_malloc( (triangle_count+1) * sizeof(struct sort_triangle) );
+    struct sort_triangle **in = g_malloc( (triangle_count+1) * sizeof(struct sort_triangle *) );
+    struct sort_triangle **out = g_malloc( (triangle_count+1) * sizeof(struct sort_triangle *) );
+    gboolean result = TRUE;
+    int i, j;
+
+    render_sort_scene();
+    for( i=0; i<tile_count; i++ ) {
+        struct check_state state;
+        int count = sort_extract_triangles( segments[i].trans_ptr, triangles );
+        for( j=0; j<count; j++ ) {
+            in[j] = &triangles[j];
+        }
+        reference_sort( in, count, out );
+        state.expected = out;
+        state.count = count;
+        state.pos = 0;
+        state.ok = TRUE;
+        if( render_sort_tile( &segments[i], check_triangle, &state ) ) {
+            if( !state.ok || state.pos != count ) {
+                fprintf( stderr, "Sort order mismatch in tile %d (%d triangles)\n", i, count );
+                result = FALSE;
+            }
+        } else if( count > 1 ) {
+            fprintf( stderr, "Tile %d (%d triangles) was not sorted\n", i, count );
+            result = FALSE;
+        }
+    }
+    g_free( triangles );
+    g_free( in );
+    g_free( out );
+    return result;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+static void benchmark_reference()
+{
+    struct sort_triangle *triangles = g_malloc( (triangle_count+1) * sizeof(struct sort_triangle) );
+    struct sort_triangle **order = g_malloc( (triangle_count+1) * sizeof(struct sort_triangle *) );
+    struct timeval start;
+    int i, j, n;
+
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        for( i=0; i<tile_count; i++ ) {
+            int count = sort_extract_triangles( segments[i].trans_ptr, triangles );
+            for( j=0; j<count; j++ ) {
+                order[j] = &triangles[j];
+            }
+            reference_sort( order, count, order );
+        }
+    }
+    printf( "Recursive sort:            %5dms\n", elapsed_ms(&start) );
+    g_free( triangles );
+    g_free( order );
+}
+
+static void benchmark_arena( int threads )
+{
+    struct timeval start;
+    int n;
+
+    workpool_shutdown();
+    workpool_init( threads );
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        render_sort_scene();
+    }
+    printf( "Arena sort (%2d threads):   %5dms\n", workpool_get_thread_count(), elapsed_ms(&start) );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result;
+    const char *srcdir = getenv("srcdir");
+    gchar *filename;
+
+    if( argc > 1 ) {
+        filename = g_strdup( argv[1] );
+    } else {
+        filename = g_strdup_printf( "%s/test/testsort.data", srcdir == NULL ? "." : srcdir );
+    }
+    if( !load_scene( filename ) ) {
+        g_free( filename );
+        return 1;
+    }
+    g_free( filename );
+
+    printf( "Loaded %d triangles in %d tiles\n", triangle_count, tile_count );
+    result = test_sort_order();
+    benchmark_reference();
+    benchmark_arena( 1 );
+    benchmark_arena( 0 );
+    workpool_shutdown();
+
+    return result ? 0 : 1;
+}
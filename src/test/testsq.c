@@ -0,0 +1,290 @@
+/**
+ * $Id$
+ *
+ * Store-queue coalescing test. Interleaves store-queue bursts to the TA, YUV
+ * and VRAM DMA areas with PVR2 register and VRAM accesses, and checks that
+ * everything reaches the PVR2 side in program order. The register and VRAM
+ * handlers flush the same way as the ones in pvr2/pvr2.c and pvr2/pvr2mem.c.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "mem.h"
+#include "mmio.h"
+#include "clock.h"
+#include "sh4/sh4.h"
+#include "sh4/sh4mmio.h"
+#include "sh4/mmu.h"
+
+#define TA_BASE      0x10000000
+#define YUV_BASE     0x10800000
+#define VDMA_BASE    0x11000000
+#define VRAM_BASE    0x05000000
+#define VRAM_SIZE    (8*1024*1024)
+#define SQ_AREA(addr) (0xE0000000 | ((addr) & 0x03FFFFE0))
+
+struct sh4_registers sh4r;
+uint32_t sh4_bus_period = 10;
+struct mem_region_fn **sh4_address_space = NULL;
+mem_region_fn_t *ext_address_space = NULL;
+struct mmio_region mmio_region_MMU;
+static char mmu_regs[LXDREAM_PAGE_SIZE];
+static unsigned char vram[VRAM_SIZE];
+
+void FASTCALL mmio_region_MMU_write( uint32_t reg, uint32_t val ) { }
+int32_t FASTCALL unmapped_read_long( sh4addr_t addr ) { return 0; }
+void FASTCALL unmapped_write_long( sh4addr_t addr, uint32_t val ) { }
+void FASTCALL unmapped_read_burst( unsigned char *dest, sh4addr_t addr ) { }
+void FASTCALL unmapped_write_burst( sh4addr_t addr, unsigned char *src ) { }
+void FASTCALL unmapped_prefetch( sh4addr_t addr ) { }
+struct mem_region_fn mem_region_unmapped = {
+        unmapped_read_long, unmapped_write_long,
+        unmapped_read_long, unmapped_write_long,
+        unmapped_read_long, unmapped_write_long,
+        unmapped_read_burst, unmapped_write_burst,
+        unmapped_prefetch, unmapped_read_long };
+
+/******************************* Delivery log *******************************/
+
+#define LOG_FIFO 'F'  /* Bulk write from the CCN to the TA/YUV FIFO */
+#define LOG_VDMA 'D'  /* Bulk write from the CCN to a VRAM DMA window */
+#define LOG_VRAM 'V'  /* Direct VRAM access */
+#define LOG_MMIO 'M'  /* Register access */
+#define MAX_LOG 64
+
+static struct log_entry {
+    char kind;
+    uint32_t addr;
+    uint32_t length;
+    uint32_t first;   /* Sequence number of the first burst delivered */
+} delivery_log[MAX_LOG];
+static int log_count = 0;
+static gboolean log_ok = TRUE;
+
+static void log_delivery( char kind, uint32_t addr, uint32_t length, uint32_t first )
+{
+    if( log_count < MAX_LOG ) {
+        struct log_entry *ent = &delivery_log[log_count++];
+        ent->kind = kind;
+        ent->addr = addr;
+        ent->length = length;
+        ent->first = first;
+    }
+}
+
+/**
+ * Data must arrive as whole bursts, in the order they were issued, so check
+ * that the sequence numbers carried in each burst follow on from the
+ * previous delivery.
+ */
+static uint32_t next_sequence = 0;
+
+void pvr2_dma_write( sh4addr_t destaddr, unsigned char *src, uint32_t count )
+{
+    uint32_t i;
+    ccn_storequeue_flush();
+    for( i=0; i<count; i+= 32 ) {
+        if( *((uint32_t *)(src+i)) != next_sequence++ ) {
+            fprintf( stderr, "Burst out of order at %08X+%d\n", destaddr, i );
+            log_ok = FALSE;
+        }
+    }
+    if( destaddr & 0x01000000 ) {
+        memcpy( vram + (destaddr & 0x007FFFE0), src, count );
+        log_delivery( LOG_VDMA, destaddr, count, *((uint32_t *)src) );
+    } else {
+        log_delivery( LOG_FIFO, destaddr, count, *((uint32_t *)src) );
+    }
+}
+
+static int32_t FASTCALL vram_read_long( sh4addr_t addr )
+{
+    ccn_storequeue_flush();
+    log_delivery( LOG_VRAM, addr, 4, 0 );
+    return *((int32_t *)(vram + (addr & 0x007FFFFC)));
+}
+
+static void FASTCALL vram_write_long( sh4addr_t addr, uint32_t val )
+{
+    ccn_storequeue_flush();
+    log_delivery( LOG_VRAM, addr, 4, 0 );
+    *((uint32_t *)(vram + (addr & 0x007FFFFC))) = val;
+}
+
+static struct mem_region_fn vram_region = {
+        vram_read_long, vram_write_long,
+        vram_read_long, vram_write_long,
+        vram_read_long, vram_write_long,
+        unmapped_read_burst, unmapped_write_burst,
+        unmapped_prefetch, vram_read_long };
+
+/* A register block built with the same macros as the real MMIO regions */
+MMIO_REGION_READ_FN( TEST, reg )
+{
+    ccn_storequeue_flush();
+    log_delivery( LOG_MMIO, reg, 4, 0 );
+    return 0;
+}
+
+MMIO_REGION_READ_DEFSUBFNS( TEST )
+
+MMIO_REGION_WRITE_FN( TEST, reg, val )
+{
+    ccn_storequeue_flush();
+    log_delivery( LOG_MMIO, reg, 4, 0 );
+}
+
+/*********************************** Tests **********************************/
+
+static uint32_t sequence = 0;
+
+/**
+ * Fill a store queue with the next sequence number and flush it to target,
+ * exactly as a guest STORE.L x8 + PREF sequence would.
+ */
+static void sq_burst( sh4addr_t target )
+{
+    sh4addr_t addr = SQ_AREA(target);
+    int queue = (addr & 0x20) >> 2;
+    int i;
+
+    sh4r.store_queue[queue] = sequence++;
+    for( i=1; i<8; i++ ) {
+        sh4r.store_queue[queue+i] = target + i;
+    }
+    MMIO_WRITE( MMU, QACR0 + (queue>>1), (target >> 24) & 0x1C );
+    ccn_storequeue_prefetch( addr );
+}
+
+static gboolean check_log( const char *what, const struct log_entry *expect, int count )
+{
+    int i;
+    gboolean result = log_ok;
+
+    if( log_count != count ) {
+        fprintf( stderr, "%s: expected %d deliveries, got %d\n", what, count, log_count );
+        result = FALSE;
+    } else {
+        for( i=0; i<count; i++ ) {
+            if( delivery_log[i].kind != expect[i].kind || delivery_log[i].addr != expect[i].addr ||
+                    delivery_log[i].length != expect[i].length || delivery_log[i].first != expect[i].first ) {
+                fprintf( stderr, "%s: delivery %d was %c %08X+%d (#%d), expected %c %08X+%d (#%d)\n",
+                         what, i, delivery_log[i].kind, delivery_log[i].addr, delivery_log[i].length,
+                         delivery_log[i].first, expect[i].kind, expect[i].addr, expect[i].length,
+                         expect[i].first );
+                result = FALSE;
+            }
+        }
+    }
+    log_count = 0;
+    log_ok = TRUE;
+    return result;
+}
+
+/**
+ * Register accesses must see every burst issued before them, whether they
+ * are reads or writes.
+ */
+static gboolean test_mmio_order( void )
+{
+    static const struct log_entry expect[] = {
+            { LOG_FIFO, TA_BASE, 96, 0 }, { LOG_MMIO, 0x10, 4, 0 },
+            { LOG_FIFO, TA_BASE + 0x60, 32, 3 }, { LOG_MMIO, 0x14, 4, 0 },
+            { LOG_MMIO, 0x18, 4, 0 } };
+
+    sq_burst( TA_BASE );
+    sq_burst( TA_BASE + 0x20 );
+    sq_burst( TA_BASE + 0x40 );
+    mmio_region_TEST_write( 0x10, 0 );
+    sq_burst( TA_BASE + 0x60 );
+    mmio_region_TEST_read( 0x14 );
+    mmio_region_TEST_read_byte( 0x18 );
+    return check_log( "MMIO order", expect, sizeof(expect)/sizeof(expect[0]) );
+}
+
+/**
+ * Bursts to the VRAM windows are only coalesced while they're sequential,
+ * and must be visible to direct VRAM accesses straight away.
+ */
+static gboolean test_vram_order( void )
+{
+    static const struct log_entry expect[] = {
+            { LOG_FIFO, TA_BASE, 64, 4 }, { LOG_VDMA, VDMA_BASE + 0x1000, 64, 6 },
+            { LOG_VRAM, VRAM_BASE + 0x1000, 4, 0 }, { LOG_VDMA, VDMA_BASE + 0x1060, 32, 8 },
+            { LOG_VDMA, VDMA_BASE + 0x1040, 32, 9 }, { LOG_VRAM, VRAM_BASE + 0x1040, 4, 0 } };
+    gboolean result = TRUE;
+
+    sq_burst( TA_BASE );
+    sq_burst( TA_BASE );
+    sq_burst( VDMA_BASE + 0x1000 );
+    sq_burst( VDMA_BASE + 0x1020 );
+    if( ext_address_space[VRAM_BASE>>12]->read_long( VRAM_BASE + 0x1000 ) != 6 ) {
+        fprintf( stderr, "VRAM read didn't see the preceding window burst\n" );
+        result = FALSE;
+    }
+    sq_burst( VDMA_BASE + 0x1060 );
+    sq_burst( VDMA_BASE + 0x1040 );
+    ext_address_space[VRAM_BASE>>12]->write_long( VRAM_BASE + 0x1040, 0 );
+    if( *((uint32_t *)(vram + 0x1040)) != 0 ) {
+        fprintf( stderr, "VRAM window burst landed after a later VRAM write\n" );
+        result = FALSE;
+    }
+    return check_log( "VRAM order", expect, sizeof(expect)/sizeof(expect[0]) ) && result;
+}
+
+/**
+ * Changing FIFO, filling the buffer and leaving the core all deliver the
+ * pending data.
+ */
+static gboolean test_flush_points( void )
+{
+    static const struct log_entry expect[] = {
+            { LOG_FIFO, TA_BASE, 64, 10 }, { LOG_FIFO, YUV_BASE, 32, 12 },
+            { LOG_FIFO, TA_BASE, 4096, 13 }, { LOG_FIFO, TA_BASE, 64, 141 } };
+    int i;
+
+    sq_burst( TA_BASE );
+    sq_burst( TA_BASE );
+    sq_burst( YUV_BASE );
+    for( i=0; i<130; i++ ) {
+        sq_burst( TA_BASE );
+    }
+    ccn_storequeue_flush();
+    ccn_storequeue_flush();
+    return check_log( "Flush points", expect, sizeof(expect)/sizeof(expect[0]) );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+    int i;
+
+    ext_address_space = malloc( sizeof(mem_region_fn_t) * LXDREAM_PAGE_TABLE_ENTRIES );
+    for( i=0; i<LXDREAM_PAGE_TABLE_ENTRIES; i++ ) {
+        ext_address_space[i] = &mem_region_unmapped;
+    }
+    for( i=0; i<VRAM_SIZE>>12; i++ ) {
+        ext_address_space[(VRAM_BASE>>12) + i] = &vram_region;
+    }
+    mmio_region_MMU.mem = mmu_regs;
+
+    result = test_mmio_order() && result;
+    result = test_vram_order() && result;
+    result = test_flush_points() && result;
+    free( ext_address_space );
+    return result ? 0 : 1;
+}
@@ -0,0 +1,399 @@
+/**
+ * $Id$
+ *
+ * Software renderer golden image test. Renders a fixed hand-built scene
+ * (gouraud background, opaque polygons with a mix of depth modes, a
+ * textured quad and auto-sorted translucent triangles) with
+ * pvr2_scene_render_sw, and compares the result against testswrender.ppm.
+ * Also checks that decoded textures are reused between scenes until the
+ * texture cache reports them modified.
+ * Run with an output filename to write a new golden image instead.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "workpool.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/pvr2mmio.h"
+#include "pvr2/scene.h"
+#include "pvr2/swrender.h"
+
+#define WIDTH  128
+#define HEIGHT 64
+#define TILES_X (WIDTH/32)
+#define TILES_Y (HEIGHT/32)
+#define SCENE_POLYS 16
+#define SCENE_VERTEXES 64
+#define TOLERANCE 2
+
+/* Polygon context words */
+#define DEPTH(mode)      ((mode)<<29)
+#define DEPTH_GREATER    4
+#define DEPTH_GEQUAL     6
+#define DEPTH_ALWAYS     7
+#define NO_DEPTH_WRITE   0x04000000
+#define TEXTURED         0x02000000
+#define GOURAUD          0x00800000
+#define BLEND(src,dst)   (((src)<<29)|((dst)<<26))
+#define BLEND_ZERO       0
+#define BLEND_ONE        1
+#define BLEND_SRC_ALPHA  4
+#define BLEND_INV_SRC_ALPHA 5
+#define FOG_DISABLED     0x00800000
+#define TEX_16X16        0x09
+
+#define OPAQUE_POLY2     (BLEND(BLEND_ONE,BLEND_ZERO)|FOG_DISABLED)
+#define TRANS_POLY2      (BLEND(BLEND_SRC_ALPHA,BLEND_INV_SRC_ALPHA)|FOG_DISABLED)
+
+unsigned char pvr2_main_ram[8 MB];
+struct pvr2_scene_struct pvr2_scene;
+struct mmio_region mmio_region_PVR2;
+static char pvr2_regs[LXDREAM_PAGE_SIZE];
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+void pvr2_check_palette_changed( void ) { }
+void pvr2_scene_finished( void ) { }
+void texcache_begin_scene( uint32_t palette_mode, uint32_t stride_width ) { }
+
+static uint32_t texture_serial = 1;
+static uint32_t texture_modified_serial = 0;
+static int texture_decodes = 0;
+
+uint32_t texcache_get_serial( void )
+{
+    return texture_serial++;
+}
+
+gboolean texcache_is_modified( uint32_t texture_word, int width, int height, uint32_t serial )
+{
+    return texture_modified_serial > serial;
+}
+
+/**
+ * Every texture in the scene is a 16x16 checkerboard of 4x4 red and blue
+ * squares (the texture word is ignored).
+ */
+int texcache_decode_texture_argb32( uint32_t *out, uint32_t texture_word, int width, int height )
+{
+    int x, y;
+    texture_decodes++;
+    for( y=0; y<height; y++ ) {
+        for( x=0; x<width; x++ ) {
+            out[y*width+x] = ((x>>2)^(y>>2))&1 ? 0xFFFF2020 : 0xFF2020FF;
+        }
+    }
+    return 1;
+}
+
+/******************************* Test scene *********************************/
+
+static struct vertex_struct vertexes[SCENE_VERTEXES];
+static struct polygon_struct polys[SCENE_POLYS];
+static struct polygon_struct *poly_map[SCENE_POLYS];
+static uint32_t contexts[SCENE_POLYS][3];
+static struct tile_segment segments[TILES_X*TILES_Y];
+static int vertex_count = 0, poly_count = 0;
+
+static struct polygon_struct *add_poly( uint32_t poly1, uint32_t poly2 )
+{
+    struct polygon_struct *poly = &polys[poly_count];
+    contexts[poly_count][0] = poly1;
+    contexts[poly_count][1] = poly2;
+    contexts[poly_count][2] = 0;
+    poly->context = contexts[poly_count];
+    poly->vertex_count = 0;
+    poly->vertex_index = vertex_count;
+    poly->tex_id = poly->mod_tex_id = 0;
+    poly->mod_vertex_index = -1;
+    poly->next = poly->sub_next = NULL;
+    poly_map[poly_count] = poly;
+    poly_count++;
+    return poly;
+}
+
+static void add_vertex( struct polygon_struct *poly, float x, float y, float z,
+                        uint32_t argb, float u, float v )
+{
+    struct vertex_struct *vert = &vertexes[vertex_count++];
+    memset( vert, 0, sizeof(struct vertex_struct) );
+    vert->x = x;
+    vert->y = y;
+    vert->z = z;
+    vert->u = u;
+    vert->v = v;
+    vert->tex_mode = POLY1_TEXTURED(poly->context[0]) ? 0 : 2;
+    vert->rgba[0] = ((argb >> 16) & 0xFF) / 255.0;
+    vert->rgba[1] = ((argb >> 8) & 0xFF) / 255.0;
+    vert->rgba[2] = (argb & 0xFF) / 255.0;
+    vert->rgba[3] = (argb >> 24) / 255.0;
+    poly->vertex_count++;
+}
+
+/**
+ * Write a tile list containing the polygons first..last-1 (all polygons
+ * cover every tile, and are left to the renderer to clip).
+ * @return the list's address
+ */
+static uint32_t add_tile_list( uint32_t **list, int first, int last )
+{
+    uint32_t addr = ((unsigned char *)*list) - pvr2_main_ram;
+    int i;
+    for( i=first; i<last; i++ ) {
+        *(*list)++ = 0x20000000 | i;
+    }
+    *(*list)++ = 0xF0000000;
+    return addr;
+}
+
+static void build_scene( void )
+{
+    struct polygon_struct *poly;
+    uint32_t *list = (uint32_t *)pvr2_main_ram;
+    int opaque_start, trans_start, trans_end;
+    int i;
+
+    /* Opaque polygons */
+    opaque_start = poly_count;
+    poly = add_poly( DEPTH(DEPTH_GEQUAL)|GOURAUD, OPAQUE_POLY2 );
+    add_vertex( poly, 4.0, 4.0, 2.0, 0xFFFF0000, 0, 0 );
+    add_vertex( poly, 120.0, 10.0, 2.0, 0xFF00FF00, 0, 0 );
+    add_vertex( poly, 30.0, 60.0, 2.0, 0xFF0000FF, 0, 0 );
+    /* Nearer, flat shaded (so the last vertex colour is used) */
+    poly = add_poly( DEPTH(DEPTH_GEQUAL), OPAQUE_POLY2 );
+    add_vertex( poly, 20.0, 30.0, 1.0, 0xFFFF0000, 0, 0 );
+    add_vertex( poly, 90.0, 2.0, 1.0, 0xFF00FF00, 0, 0 );
+    add_vertex( poly, 70.0, 50.0, 1.0, 0xFFFFFF00, 0, 0 );
+    /* Same depth as the first triangle, which strict GREATER must lose to */
+    poly = add_poly( DEPTH(DEPTH_GREATER)|GOURAUD, OPAQUE_POLY2 );
+    add_vertex( poly, 2.0, 40.0, 2.0, 0xFF00FFFF, 0, 0 );
+    add_vertex( poly, 60.0, 20.0, 2.0, 0xFF00FFFF, 0, 0 );
+    add_vertex( poly, 50.0, 62.0, 2.0, 0xFFFF00FF, 0, 0 );
+    /* Textured strip, repeating the texture twice across */
+    poly = add_poly( DEPTH(DEPTH_GEQUAL)|TEXTURED|GOURAUD, OPAQUE_POLY2|TEX_16X16 );
+    add_vertex( poly, 70.0, 24.0, 1.5, 0xFFFFFFFF, 0.0, 0.0 );
+    add_vertex( poly, 124.0, 24.0, 1.5, 0xFFFFFFFF, 2.0, 0.0 );
+    add_vertex( poly, 70.0, 60.0, 1.5, 0xFF808080, 0.0, 1.0 );
+    add_vertex( poly, 124.0, 60.0, 1.5, 0xFF808080, 2.0, 1.0 );
+    /* Far away, but drawn regardless and without updating the depth buffer */
+    poly = add_poly( DEPTH(DEPTH_ALWAYS)|NO_DEPTH_WRITE, OPAQUE_POLY2 );
+    add_vertex( poly, 100.0, 0.0, 8.0, 0xFF000000, 0, 0 );
+    add_vertex( poly, 127.0, 0.0, 8.0, 0xFF000000, 0, 0 );
+    add_vertex( poly, 127.0, 20.0, 8.0, 0xFFFFFFFF, 0, 0 );
+
+    /* Translucent triangles, listed front to back so that the sort matters */
+    trans_start = poly_count;
+    poly = add_poly( DEPTH(DEPTH_GEQUAL)|GOURAUD, TRANS_POLY2 );
+    add_vertex( poly, 10.0, 10.0, 0.5, 0x80FFFFFF, 0, 0 );
+    add_vertex( poly, 110.0, 30.0, 0.5, 0x80FFFFFF, 0, 0 );
+    add_vertex( poly, 40.0, 56.0, 0.5, 0x80FFFFFF, 0, 0 );
+    poly = add_poly( DEPTH(DEPTH_GEQUAL)|GOURAUD, TRANS_POLY2 );
+    add_vertex( poly, 30.0, 4.0, 0.7, 0xC0FF0000, 0, 0 );
+    add_vertex( poly, 100.0, 50.0, 0.7, 0xC0FF0000, 0, 0 );
+    add_vertex( poly, 0.0, 50.0, 0.7, 0x400000FF, 0, 0 );
+    poly = add_poly( DEPTH(DEPTH_GEQUAL)|GOURAUD, TRANS_POLY2 );
+    add_vertex( poly, 60.0, 0.0, 0.9, 0xA000FF00, 0, 0 );
+    add_vertex( poly, 126.0, 62.0, 0.9, 0xA000FF00, 0, 0 );
+    add_vertex( poly, 20.0, 62.0, 0.9, 0xA000FF00, 0, 0 );
+    trans_end = poly_count;
+
+    /* Background */
+    poly = add_poly( DEPTH(DEPTH_ALWAYS)|GOURAUD, OPAQUE_POLY2 );
+    add_vertex( poly, 0.0, 0.0, 0.1, 0xFF202040, 0, 0 );
+    add_vertex( poly, WIDTH, 0.0, 0.1, 0xFF402020, 0, 0 );
+    add_vertex( poly, 0.0, HEIGHT, 0.1, 0xFF204020, 0, 0 );
+    add_vertex( poly, WIDTH, HEIGHT, 0.1, 0xFF404040, 0, 0 );
+
+    for( i=0; i<TILES_X*TILES_Y; i++ ) {
+        segments[i].control = ((i/TILES_X) << 8) | ((i%TILES_X) << 2);
+        segments[i].opaque_ptr = add_tile_list( &list, opaque_start, trans_start );
+        segments[i].trans_ptr = add_tile_list( &list, trans_start, trans_end );
+        segments[i].opaquemod_ptr = segments[i].transmod_ptr = segments[i].punchout_ptr = NO_POINTER;
+    }
+    segments[TILES_X*TILES_Y-1].control |= SEGMENT_END;
+
+    pvr2_scene.vertex_array = vertexes;
+    pvr2_scene.poly_array = polys;
+    pvr2_scene.poly_count = poly_count;
+    pvr2_scene.bkgnd_poly = poly;
+    pvr2_scene.buf_to_poly_map = poly_map;
+    pvr2_scene.segment_list = segments;
+    pvr2_scene.vram = pvr2_main_ram;
+    pvr2_scene.sort_mode = SORT_ALWAYS;
+    pvr2_scene.shadow_mode = SHADOW_NONE;
+    pvr2_scene.bounds[0] = 0;
+    pvr2_scene.bounds[1] = WIDTH;
+    pvr2_scene.bounds[2] = 0;
+    pvr2_scene.bounds[3] = HEIGHT;
+}
+
+/*********************************** Tests **********************************/
+
+static uint32_t pixels[WIDTH*HEIGHT];
+
+static void render_scene( void )
+{
+    struct sw_render_buffer buffer;
+    memset( &buffer, 0, sizeof(buffer) );
+    buffer.buffer.width = WIDTH;
+    buffer.buffer.height = HEIGHT;
+    buffer.pixels = pixels;
+    memset( pixels, 0, sizeof(pixels) );
+    pvr2_scene_render_sw( &buffer.buffer );
+}
+
+/**
+ * Render the scene, and check that it decoded the expected number of textures
+ */
+static gboolean render_scene_decodes( const char *what, int expect )
+{
+    texture_decodes = 0;
+    render_scene();
+    if( texture_decodes != expect ) {
+        fprintf( stderr, "%s: decoded %d textures, expected %d\n", what, texture_decodes, expect );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @return the RGB value of pixel x,y (counting from the top, as the image
+ * files do) of the render buffer.
+ */
+static uint32_t get_pixel( int x, int y )
+{
+    return pixels[(HEIGHT-1-y)*WIDTH + x] & 0x00FFFFFF;
+}
+
+static gboolean write_image( const char *filename )
+{
+    FILE *f = fopen( filename, "wb" );
+    int x, y;
+    if( f == NULL ) {
+        fprintf( stderr, "Unable to write %s\n", filename );
+        return FALSE;
+    }
+    fprintf( f, "P6\n%d %d\n255\n", WIDTH, HEIGHT );
+    for( y=0; y<HEIGHT; y++ ) {
+        for( x=0; x<WIDTH; x++ ) {
+            uint32_t pixel = get_pixel( x, y );
+            fputc( pixel >> 16, f );
+            fputc( (pixel >> 8) & 0xFF, f );
+            fputc( pixel & 0xFF, f );
+        }
+    }
+    fclose( f );
+    return TRUE;
+}
+
+/**
+ * Compare the render buffer against the golden image, allowing each channel
+ * to be off by a couple of steps (the scalar and SSE paths round slightly
+ * differently).
+ */
+static gboolean compare_image( const char *what, const unsigned char *golden )
+{
+    int x, y, i, bad = 0;
+    for( y=0; y<HEIGHT; y++ ) {
+        for( x=0; x<WIDTH; x++ ) {
+            uint32_t pixel = get_pixel( x, y );
+            const unsigned char *expect = &golden[(y*WIDTH + x)*3];
+            for( i=0; i<3; i++ ) {
+                if( abs( (int)((pixel >> (16-i*8)) & 0xFF) - expect[i] ) > TOLERANCE ) {
+                    if( bad++ == 0 ) {
+                        fprintf( stderr, "%s: pixel %d,%d is %06X, expected %02X%02X%02X\n",
+                                 what, x, y, pixel, expect[0], expect[1], expect[2] );
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    if( bad != 0 ) {
+        fprintf( stderr, "%s: %d pixels differ from the golden image\n", what, bad );
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static unsigned char *load_image( const char *filename )
+{
+    unsigned char *image;
+    int width, height, max;
+    FILE *f = fopen( filename, "rb" );
+    if( f == NULL ) {
+        fprintf( stderr, "Unable to open %s\n", filename );
+        return NULL;
+    }
+    if( fscanf( f, "P6 %d %d %d", &width, &height, &max ) != 3 || fgetc(f) == EOF ||
+            width != WIDTH || height != HEIGHT || max != 255 ) {
+        fprintf( stderr, "%s is not a %dx%d PPM image\n", filename, WIDTH, HEIGHT );
+        fclose( f );
+        return NULL;
+    }
+    image = g_malloc( WIDTH*HEIGHT*3 );
+    if( fread( image, WIDTH*HEIGHT*3, 1, f ) != 1 ) {
+        fprintf( stderr, "%s is truncated\n", filename );
+        g_free( image );
+        image = NULL;
+    }
+    fclose( f );
+    return image;
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *srcdir = getenv("srcdir");
+    gboolean result = TRUE;
+    unsigned char *golden;
+    gchar *filename;
+
+    mmio_region_PVR2.mem = pvr2_regs;
+    build_scene();
+
+    if( argc > 1 ) {
+        render_scene();
+        return write_image( argv[1] ) ? 0 : 1;
+    }
+
+    filename = g_strdup_printf( "%s/test/testswrender.ppm", srcdir == NULL ? "." : srcdir );
+    golden = load_image( filename );
+    g_free( filename );
+    if( golden == NULL ) {
+        return 1;
+    }
+
+    /* Render with several worker threads, and again on a single thread
+     * (reusing the textures decoded by the first render) */
+    workpool_init( 4 );
+    result = render_scene_decodes( "Worker threads", 1 ) && result;
+    result = compare_image( "Worker threads", golden ) && result;
+    workpool_shutdown();
+    workpool_init( 1 );
+    result = render_scene_decodes( "Single thread", 0 ) && result;
+    result = compare_image( "Single thread", golden ) && result;
+
+    /* Once the texture is modified, it must be decoded again */
+    texture_modified_serial = texture_serial;
+    result = render_scene_decodes( "Modified texture", 1 ) && result;
+    result = compare_image( "Modified texture", golden ) && result;
+    result = render_scene_decodes( "Unmodified texture", 0 ) && result;
+    workpool_shutdown();
+
+    g_free( golden );
+    return result ? 0 : 1;
+}
@@ -0,0 +1,310 @@
+/**
+ * $Id$
+ *
+ * Tile accelerator bulk write test. Feeds the same TA stream through
+ * pvr2_ta_write and pvr2_ta_write_bulk (in chunks of various sizes, so that
+ * two-block vertexes and contexts get split across transfers) and checks
+ * that the polygon buffer, tile lists, TA registers, TA state and raised
+ * events all come out identical.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "lxdream.h"
+#include "mem.h"
+#include "pvr2/pvr2.h"
+#include "pvr2/pvr2mmio.h"
+
+#define MAX_BLOCKS 1024
+#define MAX_EVENTS 256
+
+#define TILE_BASE   0x00100000
+#define LIST_BASE   0x00110000
+#define LIST_END    0x00180000
+#define POLY_BASE   0x00200000
+#define POLY_END    0x00300000
+
+#define CMD_END_LIST   0x00000000
+#define CMD_CLIP       0x20000000
+#define CMD_POLYGON    0x80000000
+#define CMD_SPRITE     0xA0000000
+#define CMD_VERTEX     0xE0000000
+#define END_OF_STRIP   0x10000000
+#define LIST(n)        ((n)<<24)
+
+unsigned char pvr2_main_ram[8 MB];
+struct mmio_region mmio_region_PVR2;
+static char pvr2_regs[LXDREAM_PAGE_SIZE];
+
+static int events[MAX_EVENTS];
+static int event_count = 0;
+
+void asic_event( int event )
+{
+    if( event_count < MAX_EVENTS ) {
+        events[event_count++] = event;
+    }
+}
+
+void fwrite_dump32( unsigned int *buf, unsigned int length, FILE *f ) { }
+
+/******************************* Test stream ********************************/
+
+static uint32_t stream[MAX_BLOCKS][8];
+static int stream_blocks = 0;
+static unsigned int seed = 1;
+
+static unsigned int test_rand( void )
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7FFF;
+}
+
+static uint32_t random_float( float max )
+{
+    union { float f; uint32_t i; } u;
+    u.f = (test_rand() * max) / 32768.0;
+    return u.i;
+}
+
+/**
+ * Add a block whose first word is cmd and whose remaining words are random
+ * on-screen coordinates (which also serve as colours, UVs and so on).
+ */
+static uint32_t *add_block( uint32_t cmd )
+{
+    uint32_t *block = stream[stream_blocks++];
+    int i;
+    block[0] = cmd;
+    for( i=1; i<8; i++ ) {
+        block[i] = random_float( 480.0 );
+    }
+    return block;
+}
+
+/**
+ * Add a strip (or sprite/modifier volume sequence) of count vertexes of
+ * blocks blocks each, flagging the last one as the end of the strip.
+ */
+static void add_strip( int count, int blocks )
+{
+    int i;
+    for( i=0; i<count; i++ ) {
+        add_block( CMD_VERTEX | (i == count-1 ? END_OF_STRIP : 0) );
+        if( blocks == 2 ) {
+            add_block( random_float( 480.0 ) );
+        }
+    }
+}
+
+static void build_stream( void )
+{
+    uint32_t *clip;
+
+    /* Opaque list, changing polygon type between strips */
+    add_block( CMD_POLYGON | LIST(0) | 0x00 );       /* Packed colour */
+    add_strip( 6, 1 );
+    add_block( CMD_POLYGON | LIST(0) | 0x10 );       /* Float colour */
+    add_strip( 5, 1 );
+    add_block( CMD_POLYGON | LIST(0) | 0x18 );       /* Textured, float colour */
+    add_strip( 5, 2 );
+    add_block( CMD_POLYGON | LIST(0) | 0x2C );       /* Textured specular intensity */
+    add_block( random_float( 1.0 ) );                /* + face colours */
+    add_strip( 4, 1 );
+    add_block( CMD_POLYGON | LIST(0) | 0xC9 );       /* Textured UV16, two volume */
+    add_strip( 7, 2 );
+    add_block( CMD_POLYGON | LIST(0) | 0xE8 );       /* Textured intensity, two volume */
+    add_block( random_float( 1.0 ) );
+    add_strip( 3, 2 );
+    add_block( CMD_POLYGON | LIST(0) | 0x88 );       /* Textured, cheap shadow */
+    add_strip( 4, 1 );
+    add_block( CMD_SPRITE | LIST(0) | 0x08 );        /* Textured sprites */
+    add_strip( 1, 2 );
+    add_strip( 1, 2 );
+    add_strip( 1, 2 );
+    add_block( CMD_SPRITE | LIST(0) );               /* Untextured sprites */
+    add_strip( 2, 2 );
+    add_block( CMD_END_LIST );
+
+    /* Opaque modifier list */
+    add_block( CMD_POLYGON | LIST(1) );
+    add_strip( 6, 2 );
+    add_block( CMD_END_LIST );
+
+    /* Translucent list, with a tile clip and a fixed strip length */
+    clip = add_block( CMD_CLIP );
+    clip[4] = 1; clip[5] = 1; clip[6] = 12; clip[7] = 9;
+    add_block( CMD_POLYGON | LIST(2) | 0x00800000 | (1<<18) | (2<<16) );
+    add_strip( 9, 1 );
+    add_block( CMD_POLYGON | LIST(2) | 0x20 );       /* Intensity */
+    add_strip( 4, 1 );
+    add_block( CMD_POLYGON | LIST(2) | 0x1D );       /* Textured UV16 specular, float colour */
+    add_strip( 6, 2 );
+    add_block( CMD_END_LIST );
+
+    /* Punch-through list */
+    add_block( CMD_POLYGON | LIST(4) | 0x0C );       /* Textured specular, packed colour */
+    add_strip( 8, 1 );
+    add_block( CMD_END_LIST );
+}
+
+/*********************************** Tests **********************************/
+
+static FILE *initial_state;
+
+static void reset_ta( void )
+{
+    memset( pvr2_main_ram, 0, sizeof(pvr2_main_ram) );
+    memset( pvr2_regs, 0, sizeof(pvr2_regs) );
+    MMIO_WRITE( PVR2, TA_TILEBASE, TILE_BASE );
+    MMIO_WRITE( PVR2, TA_POLYBASE, POLY_BASE );
+    MMIO_WRITE( PVR2, TA_LISTEND, LIST_END );
+    MMIO_WRITE( PVR2, TA_POLYEND, POLY_END );
+    MMIO_WRITE( PVR2, TA_TILESIZE, (14 << 16) | 19 );
+    MMIO_WRITE( PVR2, TA_TILECFG, 0x00010111 );
+    MMIO_WRITE( PVR2, TA_LISTBASE, LIST_BASE );
+    rewind( initial_state );
+    pvr2_ta_load_state( initial_state );
+    pvr2_ta_init();
+    event_count = 0;
+}
+
+static struct {
+    unsigned char *ram;
+    char regs[LXDREAM_PAGE_SIZE];
+    FILE *state;
+    int events[MAX_EVENTS];
+    int event_count;
+} reference;
+
+static void save_reference( void )
+{
+    memcpy( reference.ram, pvr2_main_ram, sizeof(pvr2_main_ram) );
+    memcpy( reference.regs, pvr2_regs, sizeof(pvr2_regs) );
+    rewind( reference.state );
+    pvr2_ta_save_state( reference.state );
+    memcpy( reference.events, events, sizeof(events) );
+    reference.event_count = event_count;
+}
+
+static gboolean matches_reference( const char *what )
+{
+    gboolean result = TRUE;
+    FILE *f = tmpfile();
+    long size;
+
+    if( memcmp( reference.ram, pvr2_main_ram, sizeof(pvr2_main_ram) ) != 0 ) {
+        fprintf( stderr, "%s: polygon buffer/tile lists differ\n", what );
+        result = FALSE;
+    }
+    if( memcmp( reference.regs, pvr2_regs, sizeof(pvr2_regs) ) != 0 ) {
+        fprintf( stderr, "%s: TA registers differ (POLYPOS %08X/%08X, LISTPOS %08X/%08X)\n",
+                 what, MMIO_READ( PVR2, TA_POLYPOS ), *((uint32_t *)(reference.regs + TA_POLYPOS)),
+                 MMIO_READ( PVR2, TA_LISTPOS ), *((uint32_t *)(reference.regs + TA_LISTPOS)) );
+        result = FALSE;
+    }
+    if( event_count != reference.event_count ||
+            memcmp( reference.events, events, event_count * sizeof(int) ) != 0 ) {
+        fprintf( stderr, "%s: raised %d events, expected %d\n", what, event_count, reference.event_count );
+        result = FALSE;
+    }
+
+    pvr2_ta_save_state( f );
+    size = ftell( f );
+    if( size != ftell( reference.state ) ) {
+        fprintf( stderr, "%s: TA state size differs\n", what );
+        result = FALSE;
+    } else {
+        char state[size], ref_state[size];
+        rewind( f );
+        rewind( reference.state );
+        if( fread( state, size, 1, f ) != 1 || fread( ref_state, size, 1, reference.state ) != 1 ||
+                memcmp( state, ref_state, size ) != 0 ) {
+            fprintf( stderr, "%s: TA state differs\n", what );
+            result = FALSE;
+        }
+        fseek( reference.state, size, SEEK_SET );
+    }
+    fclose( f );
+    return result;
+}
+
+/**
+ * Write the stream with pvr2_ta_write_bulk in chunks of the given number of
+ * blocks (cycling through the list), and compare with the reference.
+ */
+static gboolean test_bulk( const char *what, const int *chunks, int num_chunks )
+{
+    int posn = 0, i = 0;
+
+    reset_ta();
+    while( posn < stream_blocks ) {
+        int length = chunks[i++ % num_chunks];
+        if( posn + length > stream_blocks ) {
+            length = stream_blocks - posn;
+        }
+        pvr2_ta_write_bulk( (unsigned char *)stream[posn], length * 32 );
+        posn += length;
+    }
+    return matches_reference( what );
+}
+
+int main( int argc, char *argv[] )
+{
+    static const int whole[] = { MAX_BLOCKS };
+    static const int single[] = { 1 };
+    static const int odd[] = { 3 };
+    static const int mixed[] = { 5, 1, 2, 7, 4, 1, 1, 9, 6, 3 };
+    int random[64];
+    gboolean result = TRUE;
+    int i;
+
+    reference.ram = malloc( sizeof(pvr2_main_ram) );
+    reference.state = tmpfile();
+    initial_state = tmpfile();
+    mmio_region_PVR2.mem = pvr2_regs;
+    pvr2_ta_reset();
+    pvr2_ta_save_state( initial_state );
+
+    build_stream();
+
+    /* Reference result, one block at a time */
+    reset_ta();
+    for( i=0; i<stream_blocks; i++ ) {
+        pvr2_ta_write( (unsigned char *)stream[i], 32 );
+    }
+    if( MMIO_READ( PVR2, TA_POLYPOS ) == POLY_BASE || MMIO_READ( PVR2, TA_LISTPOS ) == LIST_BASE>>2 ||
+            event_count != 4 ) {
+        fprintf( stderr, "Reference stream didn't produce the expected polygons/tile lists\n" );
+        result = FALSE;
+    }
+    save_reference();
+
+    for( i=0; i<64; i++ ) {
+        random[i] = (test_rand() % 12) + 1;
+    }
+    result = test_bulk( "Whole stream", whole, 1 ) && result;
+    result = test_bulk( "Single blocks", single, 1 ) && result;
+    result = test_bulk( "3 block chunks", odd, 1 ) && result;
+    result = test_bulk( "Mixed chunks", mixed, sizeof(mixed)/sizeof(mixed[0]) ) && result;
+    result = test_bulk( "Random chunks", random, 64 ) && result;
+
+    fclose( initial_state );
+    fclose( reference.state );
+    free( reference.ram );
+    return result ? 0 : 1;
+}
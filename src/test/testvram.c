@@ -0,0 +1,248 @@
+/**
+ * $Id$
+ *
+ * 64-bit VRAM interleave test and benchmark. Checks that the batched
+ * read/write kernels produce exactly the same bank layout as the original
+ * word-at-a-time loops for all alignments and lengths, and compares their
+ * bandwidth on 640x480 framebuffers at 16 and 32bpp.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "mmio.h"
+#include "pvr2/pvr2.h"
+
+#define ITERATIONS 200
+#define FRAME_WIDTH 640
+#define FRAME_HEIGHT 480
+
+void log_message( void *ptr, int level, const gchar *source, const char *msg, ... ) { }
+void fwrite_dump( unsigned char *buf, unsigned int length, FILE *f ) { }
+void ccn_storequeue_flush( void ) { }
+void pvr2_render_thread_sync( void ) { }
+void texcache_invalidate_page( uint32_t texture_addr ) { }
+gboolean pvr2_render_buffer_invalidate( sh4addr_t addr, gboolean isWrite ) { return FALSE; }
+void pvr2_ta_write_bulk( unsigned char *buf, uint32_t length ) { }
+void FASTCALL pvr2_ta_write_burst( sh4addr_t addr, unsigned char *buf ) { }
+void pvr2_yuv_write( unsigned char *buf, uint32_t length ) { }
+int32_t FASTCALL unmapped_read_long( sh4addr_t addr ) { return 0; }
+void FASTCALL unmapped_write_long( sh4addr_t addr, uint32_t val ) { }
+void FASTCALL unmapped_read_burst( unsigned char *dest, sh4addr_t addr ) { }
+
+struct mmio_region mmio_region_ASIC;
+struct colour_format colour_formats[1];
+display_driver_t display_driver;
+
+static unsigned char ref_ram[8 MB];
+
+/**
+ * The original word-at-a-time loops, used as the reference result
+ */
+static void ref_vram64_write( sh4addr_t destaddr, unsigned char *src, uint32_t length )
+{
+    int bank_flag = (destaddr & 0x04) >> 2;
+    uint32_t *banks[2];
+    uint32_t *dwsrc = (uint32_t *)src;
+
+    destaddr = destaddr & 0x7FFFFF;
+    banks[0] = ((uint32_t *)(ref_ram + ((destaddr & 0x007FFFF8) >>1)));
+    banks[1] = banks[0] + 0x100000;
+    if( bank_flag )
+        banks[0]++;
+    while( length >= 4 ) {
+        *banks[bank_flag]++ = *dwsrc++;
+        bank_flag = !bank_flag;
+        length -= 4;
+    }
+}
+
+static void ref_vram64_read( unsigned char *dest, sh4addr_t srcaddr, uint32_t length )
+{
+    int bank_flag = (srcaddr & 0x04) >> 2;
+    uint32_t *banks[2];
+    uint32_t *dwdest = (uint32_t *)dest;
+
+    srcaddr = srcaddr & 0x7FFFFF;
+    banks[0] = ((uint32_t *)(ref_ram + ((srcaddr&0x007FFFF8)>>1)));
+    banks[1] = banks[0] + 0x100000;
+    if( bank_flag )
+        banks[0]++;
+    while( length >= 4 ) {
+        *dwdest++ = *banks[bank_flag]++;
+        bank_flag = !bank_flag;
+        length -= 4;
+    }
+}
+
+static void ref_vram64_read_stride( unsigned char *dest, uint32_t dest_line_bytes, sh4addr_t srcaddr,
+                                    uint32_t src_line_bytes, uint32_t line_count )
+{
+    int bank_flag = (srcaddr & 0x04) >> 2;
+    uint32_t *banks[2];
+    uint32_t *dwdest = (uint32_t *)dest;
+    uint32_t dest_line_gap = 0, src_line_gap = 0, line_bytes;
+    int src_line_gap_flag;
+    int i,j;
+
+    srcaddr = srcaddr & 0x7FFFF8;
+    if( src_line_bytes <= dest_line_bytes ) {
+        dest_line_gap = (dest_line_bytes - src_line_bytes) >> 2;
+        src_line_gap_flag = 0;
+        line_bytes = src_line_bytes >> 2;
+    } else {
+        i = (src_line_bytes - dest_line_bytes);
+        src_line_gap_flag = i & 0x04;
+        src_line_gap = i >> 3;
+        line_bytes = dest_line_bytes >> 2;
+    }
+    banks[0] = (uint32_t *)(ref_ram + (srcaddr>>1));
+    banks[1] = banks[0] + 0x100000;
+    if( bank_flag )
+        banks[0]++;
+    for( i=0; i<line_count; i++ ) {
+        for( j=0; j<line_bytes; j++ ) {
+            *dwdest++ = *banks[bank_flag]++;
+            bank_flag = !bank_flag;
+        }
+        dwdest += dest_line_gap;
+        banks[0] += src_line_gap;
+        banks[1] += src_line_gap;
+        if( src_line_gap_flag ) {
+            banks[bank_flag]++;
+            bank_flag = !bank_flag;
+        }
+    }
+}
+
+static uint32_t test_seed = 0x5EED;
+static uint32_t test_rand()
+{
+    test_seed = test_seed * 1103515245 + 12345;
+    return test_seed >> 8;
+}
+
+static void fill_random( unsigned char *buf, uint32_t length )
+{
+    uint32_t i;
+    for( i=0; i<length; i++ ) {
+        buf[i] = test_rand();
+    }
+}
+
+static gboolean test_write_read()
+{
+    static unsigned char src[65536], out[65536], ref_out[65536];
+    gboolean result = TRUE;
+    int n;
+
+    fill_random( pvr2_main_ram, 8 MB );
+    memcpy( ref_ram, pvr2_main_ram, 8 MB );
+    for( n=0; n<2000 && result; n++ ) {
+        uint32_t addr = (test_rand() % (8 MB - sizeof(src))) & ~3;
+        uint32_t length = (test_rand() % (n < 100 ? 64 : sizeof(src))) & ~3;
+        fill_random( src, length );
+        pvr2_vram64_write( addr, src, length );
+        ref_vram64_write( addr, src, length );
+        if( memcmp( pvr2_main_ram, ref_ram, 8 MB ) != 0 ) {
+            fprintf( stderr, "Write mismatch at %08X+%d\n", addr, length );
+            result = FALSE;
+        }
+        pvr2_vram64_read( out, addr, length );
+        ref_vram64_read( ref_out, addr, length );
+        if( memcmp( out, ref_out, length ) != 0 ) {
+            fprintf( stderr, "Read mismatch at %08X+%d\n", addr, length );
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+static gboolean test_read_stride()
+{
+    static unsigned char out[65536], ref_out[65536];
+    gboolean result = TRUE;
+    int n;
+
+    for( n=0; n<2000 && result; n++ ) {
+        uint32_t addr = (test_rand() % (4 MB)) & ~3;
+        uint32_t src_line = ((test_rand() % 256) + 1) << 2;
+        uint32_t dest_line = ((test_rand() % 256) + 1) << 2;
+        uint32_t lines = (test_rand() % 32) + 1;
+        memset( out, 0, sizeof(out) );
+        memset( ref_out, 0, sizeof(ref_out) );
+        pvr2_vram64_read_stride( out, dest_line, addr, src_line, lines );
+        ref_vram64_read_stride( ref_out, dest_line, addr, src_line, lines );
+        if( memcmp( out, ref_out, sizeof(out) ) != 0 ) {
+            fprintf( stderr, "Stride read mismatch at %08X (%d => %d x %d)\n", addr,
+                     src_line, dest_line, lines );
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+static uint32_t elapsed_ms( struct timeval *start )
+{
+    struct timeval end;
+    gettimeofday( &end, NULL );
+    return (end.tv_sec - start->tv_sec) * 1000 + (end.tv_usec - start->tv_usec)/1000;
+}
+
+static void benchmark( int bpp )
+{
+    uint32_t size = FRAME_WIDTH * FRAME_HEIGHT * bpp;
+    unsigned char *frame = g_malloc( size );
+    struct timeval start;
+    int n;
+
+    fill_random( frame, size );
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        ref_vram64_write( 0x200000, frame, size );
+    }
+    printf( "%dbpp write, word loop:   %5dms\n", bpp*8, elapsed_ms(&start) );
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        pvr2_vram64_write( 0x200000, frame, size );
+    }
+    printf( "%dbpp write, batched:     %5dms\n", bpp*8, elapsed_ms(&start) );
+
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        ref_vram64_read( frame, 0x200000, size );
+    }
+    printf( "%dbpp read,  word loop:   %5dms\n", bpp*8, elapsed_ms(&start) );
+    gettimeofday( &start, NULL );
+    for( n=0; n<ITERATIONS; n++ ) {
+        pvr2_vram64_read( frame, 0x200000, size );
+    }
+    printf( "%dbpp read,  batched:     %5dms\n", bpp*8, elapsed_ms(&start) );
+    g_free( frame );
+}
+
+int main( int argc, char *argv[] )
+{
+    gboolean result = TRUE;
+
+    result = test_write_read() && result;
+    result = test_read_stride() && result;
+    benchmark( 2 );
+    benchmark( 4 );
+    return result ? 0 : 1;
+}
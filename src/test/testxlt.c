@@ -19,6 +19,7 @@
 #include <assert.h>
 #include "xlat/xltcache.h"
 #include "dreamcast.h"
+#include "sh4/sh4pdi.h"
 
 extern xlat_cache_block_t xlat_new_cache;
 extern xlat_cache_block_t xlat_new_cache_ptr;
@@ -27,6 +28,11 @@ void sh4_translate_unlink_block( void *use_list )
 {
 }
 
+void FASTCALL sh4_pdi_invalidate_block( sh4addr_t address, size_t bytes ) { }
+void FASTCALL sh4_pdi_flush_page( sh4addr_t address ) { }
+void sh4_pdi_flush_cache( void ) { }
+gboolean sh4_translate_is_enabled() { return TRUE; }
+
 /**
  * Test initial allocations from the new cache
  */
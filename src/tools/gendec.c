@@ -35,10 +35,11 @@ const char *out_filename = NULL;
 
 #define GEN_SOURCE 1
 #define GEN_TEMPLATE 2
+#define GEN_THREADED 3
 
 FILE *ins_file, *act_file, *out_file;
 
-char *option_list = "tmho:w";
+char *option_list = "tTmho:w";
 int gen_mode = GEN_SOURCE;
 int emit_warnings = 0;
 
@@ -46,6 +47,7 @@ struct option longopts[] = {
     { "help", no_argument, NULL, 'h' },
     { "output", required_argument, NULL, 'o' },
     { "template", no_argument, NULL, 't' },
+    { "threaded", no_argument, NULL, 'T' },
     { "warnings", no_argument, NULL, 'w' },
     { NULL, 0, 0, 0 } };
 
@@ -55,6 +57,8 @@ static void usage() {
     printf( "  -h, --help         Print this help message\n" );
     printf( "  -o, --output=FILE  Generate output to the given file\n" );
     printf( "  -t, --template     Generate a template skeleton instead of an instruction matcher\n" );
+    printf( "  -T, --threaded     Generate a decoder and labelled handlers for a threaded\n" );
+    printf( "                     interpreter from the last action block\n" );
     printf( "  -w, --warnings     Emit warnings when unmatched instructions are found\n" );
 }
 
@@ -212,13 +216,20 @@ static void fprint_action( struct rule *rule, const struct action *action, int d
 static void split_and_generate( struct ruleset *rules, const struct action *actions, 
                          int ruleidx[], int rule_count, int input_mask, 
                          int depth, FILE *f ) {
+    const char *undefined_action = gen_mode == GEN_THREADED ?
+            "THREADED_DECODED(THREADED_RULE_COUNT)" : "UNDEF(ir)";
     uint32_t mask;
     int i,j;
 
     if( rule_count == 0 ) {
-        fprintf( f, "%*cUNDEF(ir);\n", depth*8, ' ' );
+        fprintf( f, "%*c%s;\n", depth*8, ' ', undefined_action );
     } else if( rule_count == 1 ) {
-        fprint_action( rules->rules[ruleidx[0]], &actions[ruleidx[0]], depth, f );
+        if( gen_mode == GEN_THREADED ) {
+            fprintf( f, "%*cTHREADED_DECODED(%d); /* %s */\n", depth*8, ' ', ruleidx[0],
+                     rules->rules[ruleidx[0]]->format );
+        } else {
+            fprint_action( rules->rules[ruleidx[0]], &actions[ruleidx[0]], depth, f );
+        }
     } else {
 
         mask = find_mask(rules, ruleidx, rule_count, input_mask);
@@ -264,8 +275,8 @@ static void split_and_generate( struct ruleset *rules, const struct action *acti
             }
         }
         if( has_empty_options ) {
-            fprintf( f, "%*cdefault:\n%*cUNDEF(ir);\n%*cbreak;\n",
-                    depth*8+4, ' ', depth*8+8, ' ', depth*8 + 8, ' ' );
+            fprintf( f, "%*cdefault:\n%*c%s;\n%*cbreak;\n",
+                    depth*8+4, ' ', depth*8+8, ' ', undefined_action, depth*8 + 8, ' ' );
         }
         fprintf( f, "%*c}\n", depth*8, ' ' );
     }
@@ -301,6 +312,70 @@ static int generate_decoder( struct ruleset *rules, actionfile_t af, FILE *out )
     return 0;
 }
 
+/**
+ * Generate a threaded-dispatch interpreter from the last action block. The
+ * output is a fragment with two halves, selected by THREADED_DECODER:
+ *   - the decoder, which is the usual decode switch with each rule replaced
+ *     by THREADED_DECODED(rule-index) (or THREADED_RULE_COUNT for opcodes
+ *     that don't match any rule);
+ *   - the handlers - one label per rule (threaded_rule_N, plus
+ *     threaded_undefined) containing the action and ending in
+ *     THREADED_NEXT(), and a table of the label addresses in rule order.
+ * Text blocks are ignored. Both halves are intended to be #included inside a
+ * function body, which supplies ir and any macros the actions use.
+ */
+static int generate_threaded( struct ruleset *rules, actionfile_t af, FILE *out )
+{
+    struct action actions[MAX_RULES];
+    int ruleidx[rules->rule_count];
+    int found = 0;
+    int i;
+
+    actiontoken_t token = action_file_next(af);
+    while( token->symbol != END ) {
+        if( token->symbol == ERROR ) {
+            fprintf( stderr, "Error parsing action file" );
+            return -1;
+        } else if( token->symbol == ACTIONS ) {
+            if( emit_warnings ) {
+                check_actions( rules, token );
+            }
+            memcpy( actions, token->actions, sizeof(actions) );
+            found = 1;
+        }
+        token = action_file_next(af);
+    }
+    if( !found ) {
+        fprintf( stderr, "Error: no action block found in %s\n", act_filename );
+        return -1;
+    }
+    for( i=0; i<rules->rule_count; i++ ) {
+        ruleidx[i] = i;
+    }
+
+    fprintf( out, "/* Generated by gendec --threaded from %s and %s - do not edit */\n",
+             ins_filename, act_filename );
+    fprintf( out, "#define THREADED_RULE_COUNT %d\n", rules->rule_count );
+    fprintf( out, "#ifdef THREADED_DECODER\n" );
+    split_and_generate( rules, actions, ruleidx, rules->rule_count, 0, 1, out );
+    fprintf( out, "#else\n" );
+
+    fprintf( out, "static void * const threaded_handlers[THREADED_RULE_COUNT+1] = {" );
+    for( i=0; i<rules->rule_count; i++ ) {
+        fprintf( out, "%s&&threaded_rule_%d,", (i%6) == 0 ? "\n    " : " ", i );
+    }
+    fprintf( out, "\n    &&threaded_undefined };\n" );
+    fprintf( out, "#pragma clang diagnostic push\n#pragma clang diagnostic ignored \"-Wunused-variable\"\n" );
+    for( i=0; i<rules->rule_count; i++ ) {
+        fprintf( out, "threaded_rule_%d:\n", i );
+        fprint_action( rules->rules[i], &actions[i], 1, out );
+        fprintf( out, "        THREADED_NEXT();\n" );
+    }
+    fprintf( out, "threaded_undefined:\n        UNDEF(ir);\n        THREADED_NEXT();\n" );
+    fprintf( out, "#pragma clang diagnostic pop\n#endif\n" );
+    return 0;
+}
+
 static int generate_template( struct ruleset *rules, actionfile_t af, FILE *out )
 {
     int i;
@@ -337,6 +412,9 @@ int main( int argc, char *argv[] )
         case 't':
             gen_mode = GEN_TEMPLATE;
             break;
+        case 'T':
+            gen_mode = GEN_THREADED;
+            break;
         case 'o':
             out_filename = optarg;
             break;
@@ -413,6 +491,11 @@ int main( int argc, char *argv[] )
             exit(7);
         }
         break;
+    case GEN_THREADED:
+        if( generate_threaded( rules, af, out_file ) != 0 ) {
+            exit(7);
+        }
+        break;
     }
     
     action_file_close(af);
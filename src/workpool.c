@@ -0,0 +1,176 @@
+/**
+ * $Id$
+ *
+ * Simple fixed-size pool of worker threads for data-parallel jobs.
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include "lxdream.h"
+#include "workpool.h"
+
+#define WORKPOOL_MAX_THREADS 32
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_wait;   /* workers wait here for a new job */
+    pthread_cond_t done_wait;   /* caller waits here for job completion */
+    gboolean started;
+    gboolean shutdown;
+    gboolean busy;
+    int nthreads;               /* number of worker threads (excluding caller) */
+    unsigned int generation;    /* incremented for each job */
+    int active;                 /* workers still running the current job */
+
+    /* Current job */
+    workpool_fn_t fn;
+    void *data;
+    int count;
+    volatile int next;          /* next index to be claimed */
+
+    pthread_t threads[WORKPOOL_MAX_THREADS];
+} workpool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+               FALSE, FALSE, FALSE, 0, 0, 0 };
+
+static void workpool_do_work( workpool_fn_t fn, void *data, int count )
+{
+    int i;
+    while( (i = __sync_fetch_and_add( &workpool.next, 1 )) < count ) {
+        fn( data, i );
+    }
+}
+
+static void *workpool_thread_main( void *arg )
+{
+    unsigned int seen = 0;
+    pthread_mutex_lock(&workpool.mutex);
+    for(;;) {
+        while( !workpool.shutdown && workpool.generation == seen ) {
+            pthread_cond_wait(&workpool.work_wait, &workpool.mutex);
+        }
+        if( workpool.shutdown ) {
+            break;
+        }
+        seen = workpool.generation;
+        workpool_fn_t fn = workpool.fn;
+        void *data = workpool.data;
+        int count = workpool.count;
+        pthread_mutex_unlock(&workpool.mutex);
+
+        workpool_do_work( fn, data, count );
+
+        pthread_mutex_lock(&workpool.mutex);
+        if( --workpool.active == 0 ) {
+            pthread_cond_signal(&workpool.done_wait);
+        }
+    }
+    pthread_mutex_unlock(&workpool.mutex);
+    return NULL;
+}
+
+void workpool_init( int threads )
+{
+    int i;
+    pthread_mutex_lock(&workpool.mutex);
+    if( workpool.started ) {
+        pthread_mutex_unlock(&workpool.mutex);
+        return;
+    }
+    if( threads <= 0 ) {
+        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = ncpus > 0 ? (int)ncpus : 1;
+    }
+    if( threads > WORKPOOL_MAX_THREADS+1 ) {
+        threads = WORKPOOL_MAX_THREADS+1;
+    }
+    workpool.started = TRUE;
+    workpool.shutdown = FALSE;
+    workpool.nthreads = 0;
+    for( i=0; i<threads-1; i++ ) {
+        if( pthread_create( &workpool.threads[i], NULL, workpool_thread_main, NULL ) != 0 ) {
+            WARN( "Unable to create worker thread, continuing with %d threads", i+1 );
+            break;
+        }
+        workpool.nthreads++;
+    }
+    pthread_mutex_unlock(&workpool.mutex);
+}
+
+void workpool_shutdown( void )
+{
+    int i, n;
+    pthread_mutex_lock(&workpool.mutex);
+    if( !workpool.started ) {
+        pthread_mutex_unlock(&workpool.mutex);
+        return;
+    }
+    workpool.shutdown = TRUE;
+    n = workpool.nthreads;
+    pthread_cond_broadcast(&workpool.work_wait);
+    pthread_mutex_unlock(&workpool.mutex);
+
+    for( i=0; i<n; i++ ) {
+        pthread_join( workpool.threads[i], NULL );
+    }
+
+    pthread_mutex_lock(&workpool.mutex);
+    workpool.nthreads = 0;
+    workpool.started = FALSE;
+    pthread_mutex_unlock(&workpool.mutex);
+}
+
+int workpool_get_thread_count( void )
+{
+    if( !workpool.started ) {
+        workpool_init(0);
+    }
+    return workpool.nthreads + 1;
+}
+
+void workpool_run( workpool_fn_t fn, void *data, int count )
+{
+    int i;
+
+    if( !workpool.started ) {
+        workpool_init(0);
+    }
+
+    pthread_mutex_lock(&workpool.mutex);
+    if( count <= 1 || workpool.nthreads == 0 || workpool.busy ) {
+        pthread_mutex_unlock(&workpool.mutex);
+        for( i=0; i<count; i++ ) {
+            fn( data, i );
+        }
+        return;
+    }
+    workpool.busy = TRUE;
+    workpool.fn = fn;
+    workpool.data = data;
+    workpool.count = count;
+    workpool.next = 0;
+    workpool.active = workpool.nthreads;
+    workpool.generation++;
+    pthread_cond_broadcast(&workpool.work_wait);
+    pthread_mutex_unlock(&workpool.mutex);
+
+    workpool_do_work( fn, data, count );
+
+    pthread_mutex_lock(&workpool.mutex);
+    while( workpool.active > 0 ) {
+        pthread_cond_wait(&workpool.done_wait, &workpool.mutex);
+    }
+    workpool.busy = FALSE;
+    pthread_mutex_unlock(&workpool.mutex);
+}
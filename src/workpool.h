@@ -0,0 +1,65 @@
+/**
+ * $Id$
+ *
+ * Simple fixed-size pool of worker threads for data-parallel jobs. A job is
+ * a function applied to every index in [0,count); the caller blocks until
+ * all indexes have been processed (and takes part in the work itself).
+ *
+ * Copyright (c) 2012 Nathan Keynes.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef lxdream_workpool_H
+#define lxdream_workpool_H 1
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Job function, invoked once for each index in the job. Calls for different
+ * indexes may run concurrently and in any order.
+ */
+typedef void (*workpool_fn_t)( void *data, int index );
+
+/**
+ * Start the worker threads. This is optional - the pool will be started
+ * on demand by the first call to workpool_run().
+ * @param threads Total number of threads to use for jobs (including the
+ * calling thread), or 0 to use one per online CPU. 1 disables threading.
+ */
+void workpool_init( int threads );
+
+/**
+ * Stop and join all worker threads.
+ */
+void workpool_shutdown( void );
+
+/**
+ * @return the number of threads that will run a job (including the caller).
+ */
+int workpool_get_thread_count( void );
+
+/**
+ * Run fn(data, i) for all 0 <= i < count and wait for them to complete.
+ * If the pool is already busy (ie this is a nested call from inside another
+ * job), the job is simply run inline in the calling thread.
+ */
+void workpool_run( workpool_fn_t fn, void *data, int count );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* !lxdream_workpool_H */
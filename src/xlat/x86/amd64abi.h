@@ -36,6 +36,18 @@ static inline void decode_address( uintptr_t base, int addr_reg, int target_reg
     MOVP_sib_rptr( 3, target_reg, REG_RDI, 0, target_reg );
 }
 
+/**
+ * As decode_address, but loading the table from the pointer at baseptr.
+ */
+static inline void decode_address_indirect( uintptr_t baseptr, int addr_reg, int target_reg )
+{
+    MOVL_r32_r32( addr_reg, target_reg );
+    SHRL_imm_r32( 12, target_reg );
+    MOVP_immptr_rptr( baseptr, REG_RDI );
+    MOVP_rptrdisp_rptr( REG_RDI, 0, REG_RDI );
+    MOVP_sib_rptr( 3, target_reg, REG_RDI, 0, target_reg );
+}
+
 /**
  * Note: clobbers ECX to make the indirect call - this isn't usually
  * a problem since the callee will generally clobber it anyway.
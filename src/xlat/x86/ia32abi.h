@@ -37,6 +37,18 @@ static inline void decode_address( uintptr_t base, int addr_reg, int target_reg
     MOVP_sib_rptr( 2, target_reg, -1, base, target_reg );
 }
 
+/**
+ * As decode_address, but loading the table from the pointer at baseptr.
+ */
+static inline void decode_address_indirect( uintptr_t baseptr, int addr_reg, int target_reg )
+{
+    MOVL_r32_r32( addr_reg, target_reg );
+    SHRL_imm_r32( 12, target_reg );
+    SHLL_imm_r32( 2, target_reg );
+    ADDL_r32disp_r32( -1, baseptr, target_reg );
+    MOVL_r32disp_r32( target_reg, 0, target_reg );
+}
+
 /**
  * Note: clobbers ECX to make the indirect call - this isn't usually
  * a problem since the callee will generally clobber it anyway.
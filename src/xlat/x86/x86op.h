@@ -373,6 +373,7 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define ADDL_r32_r32(r1,r2)          x86_encode_r32_rm32(0x01, r1, r2)
 #define ADDL_r32_rbpdisp(r1,disp)    x86_encode_r32_rbpdisp32(0x01, r1, disp)
 #define ADDL_r32_r32disp(r1,r2,dsp)  x86_encode_r32_mem32disp32(0x01, r1, r2, dsp)
+#define ADDL_r32disp_r32(r1,dsp,r2)  x86_encode_r32_mem32disp32(0x03, r2, r1, dsp)
 #define ADDL_rbpdisp_r32(disp,r1)    x86_encode_r32_rbpdisp32(0x03, r1, disp)
 #define ADDQ_imms_r64(imm,r1)        x86_encode_imms_rm64(0x83, 0x81, 0, imm, r1)
 #define ADDQ_r64_r64(r1,r2)          x86_encode_r64_rm64(0x01, r1, r2)
@@ -464,6 +465,8 @@ static inline void x86_encode_modrm_rip(int rexw, uint32_t opcode, int rr, int32
 #define MOVSXL_r16_r32(r1,r2)        x86_encode_r32_rm32(0x0FBF, r2, r1)
 #define MOVSXL_rbpdisp8_r32(disp,r1) x86_encode_r32_rbpdisp32(0x0FBE, r1, disp) 
 #define MOVSXL_rbpdisp16_r32(dsp,r1) x86_encode_r32_rbpdisp32(0x0FBF, r1, dsp) 
+#define MOVSXL_sib8_r32(ss,ii,bb,d,r1)  x86_encode_r32_mem32(0x0FBE, r1, bb, ii, ss, d)
+#define MOVSXL_sib16_r32(ss,ii,bb,d,r1) x86_encode_r32_mem32(0x0FBF, r1, bb, ii, ss, d)
 #define MOVSXQ_imm32_r64(i32,r1)     x86_encode_r64_rm64(0xC7, 0, r1); OP32(i32) /* Technically a MOV */
 #define MOVSXQ_r8_r64(r1,r2)         x86_encode_r64_rm64(0x0FBE, r2, r1)
 #define MOVSXQ_r16_r64(r1,r2)        x86_encode_r64_rm64(0x0FBF, r2, r1)
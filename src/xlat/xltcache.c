@@ -23,6 +23,7 @@
 #include "dreamcast.h"
 #include "sh4/sh4core.h"
 #include "sh4/sh4trans.h"
+#include "sh4/sh4pdi.h"
 #include "xlat/xltcache.h"
 
 #define XLAT_LUT_PAGE_BITS 12
@@ -105,6 +106,9 @@ void xlat_flush_cache()
 {
     xlat_cache_block_t tmp;
     int i;
+    if( !sh4_translate_is_enabled() ) {
+        sh4_pdi_flush_cache();
+    }
     xlat_new_cache_ptr = xlat_new_cache;
     xlat_new_cache_ptr->active = 0;
     xlat_new_cache_ptr->size = XLAT_NEW_CACHE_SIZE - 2*sizeof(struct xlat_cache_block);
@@ -158,6 +162,9 @@ static void xlat_flush_page_by_lut( void **page )
 
 void FASTCALL xlat_invalidate_word( sh4addr_t addr )
 {
+    if( !sh4_translate_is_enabled() ) {
+        sh4_pdi_invalidate_block( addr, 2 );
+    }
     void **page = xlat_lut[XLAT_LUT_PAGE(addr)];
     if( page != NULL ) {
         int entry = XLAT_LUT_ENTRY(addr);
@@ -173,6 +180,9 @@ void FASTCALL xlat_invalidate_word( sh4addr_t addr )
 
 void FASTCALL xlat_invalidate_long( sh4addr_t addr )
 {
+    if( !sh4_translate_is_enabled() ) {
+        sh4_pdi_invalidate_block( addr, 4 );
+    }
     void **page = xlat_lut[XLAT_LUT_PAGE(addr)];
     if( page != NULL ) {
         int entry = XLAT_LUT_ENTRY(addr);
@@ -193,6 +203,9 @@ void FASTCALL xlat_invalidate_block( sh4addr_t address, size_t size )
     uint32_t page_no = XLAT_LUT_PAGE(address);
     int entry = XLAT_LUT_ENTRY(address);
 
+    if( !sh4_translate_is_enabled() ) {
+        sh4_pdi_invalidate_block( address, size );
+    }
     if( entry == 0 && xlat_lut[page_no] != NULL && IS_ENTRY_CONTINUATION(xlat_lut[page_no][entry])) {
         /* First entry may be a delay-slot for the previous page */
         xlat_flush_page_by_lut(xlat_lut[XLAT_LUT_PAGE(address-2)]);
@@ -225,6 +238,9 @@ void FASTCALL xlat_invalidate_block( sh4addr_t address, size_t size )
 
 void FASTCALL xlat_flush_page( sh4addr_t address )
 {
+    if( !sh4_translate_is_enabled() ) {
+        sh4_pdi_flush_page( address );
+    }
     void **page = xlat_lut[XLAT_LUT_PAGE(address)];
     if( page != NULL ) {
         xlat_flush_page_by_lut(page);